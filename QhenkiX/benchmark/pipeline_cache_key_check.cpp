@@ -0,0 +1,78 @@
+#include <cstdio>
+#include <cstring>
+
+#include <d3dcompiler.h>
+
+#include "graphics/d3d12/d3d12_context.h"
+
+// Checks that pipeline cache keys tell apart descs that create different pipelines.
+// Usage: QhenkiXPipelineCacheKeyCheck
+int main()
+{
+	using namespace qhenki;
+	using namespace qhenki::gfx;
+
+	// Keys only hash the bytecode, so any bytes will do
+	auto make_shader = [](const ShaderType type, const char* bytes, const size_t size, Shader* shader)
+	{
+		const auto output = mkS<D3D11ShaderOutput>();
+		if (FAILED(D3DCreateBlob(size, output->shader_blob.ReleaseAndGetAddressOf())))
+		{
+			return false;
+		}
+		memcpy(output->shader_blob->GetBufferPointer(), bytes, size);
+		*shader = { .type = type, .shader_model = ShaderModel::SM_5_0, .internal_state = output, .reflection = nullptr };
+		return true;
+	};
+	Shader vertex_shader, pixel_shader;
+	if (!make_shader(VERTEX_SHADER, "vs", 2, &vertex_shader) || !make_shader(PIXEL_SHADER, "ps", 2, &pixel_shader))
+	{
+		fprintf(stderr, "Failed to create shader blobs\n");
+		return 1;
+	}
+
+	int failures = 0;
+	auto expect_distinct = [&](const char* name, const GraphicsPipelineDesc& a, const GraphicsPipelineDesc& b)
+	{
+		util::Hash128 library_a, library_b;
+		const auto key_a = D3D12Context::make_pipeline_cache_key(a, vertex_shader, pixel_shader, nullptr, &library_a);
+		const auto key_b = D3D12Context::make_pipeline_cache_key(b, vertex_shader, pixel_shader, nullptr, &library_b);
+		if (key_a == key_b || library_a == library_b)
+		{
+			fprintf(stderr, "%s: descs share a key\n", name);
+			failures++;
+		}
+	};
+
+	// Deferred pipelines with independent blend, differing only in the second target
+	D3D12_BLEND_DESC blend{};
+	blend.IndependentBlendEnable = TRUE;
+	for (auto& target : blend.RenderTarget)
+	{
+		target.RenderTargetWriteMask = D3D12_COLOR_WRITE_ENABLE_ALL;
+	}
+	GraphicsPipelineDesc deferred;
+	deferred.blend_desc = blend;
+	deferred.num_render_targets = -1;
+	GraphicsPipelineDesc deferred_blend = deferred;
+	auto& target = deferred_blend.blend_desc->RenderTarget[1];
+	target.BlendEnable = TRUE;
+	target.SrcBlend = D3D12_BLEND_SRC_ALPHA;
+	target.DestBlend = D3D12_BLEND_INV_SRC_ALPHA;
+	target.BlendOp = D3D12_BLEND_OP_ADD;
+	target.SrcBlendAlpha = D3D12_BLEND_ONE;
+	target.DestBlendAlpha = D3D12_BLEND_ZERO;
+	target.BlendOpAlpha = D3D12_BLEND_OP_ADD;
+	expect_distinct("deferred independent blend", deferred, deferred_blend);
+
+	GraphicsPipelineDesc deferred_mask = deferred;
+	deferred_mask.blend_desc->RenderTarget[7].RenderTargetWriteMask = D3D12_COLOR_WRITE_ENABLE_RED;
+	expect_distinct("deferred last target write mask", deferred, deferred_mask);
+
+	if (failures)
+	{
+		return 1;
+	}
+	printf("Pipeline cache keys OK\n");
+	return 0;
+}
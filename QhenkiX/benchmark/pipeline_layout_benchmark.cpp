@@ -0,0 +1,136 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <random>
+#include <vector>
+
+#include <qhenkiX/utility/pipeline_layout_cache.h>
+
+// Canonicalizes, hashes and looks up generated pipeline layouts, then round-trips the cache through a file.
+// Usage: QhenkiXPipelineLayoutBenchmark [layout_count] [iterations]
+int main(int argc, char* argv[])
+{
+	using namespace qhenki::util;
+	namespace fs = std::filesystem;
+	using Binding = CanonicalPipelineLayout::Binding;
+
+	const size_t layout_count = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1'000;
+	const int iterations = argc > 2 ? std::atoi(argv[2]) : 100;
+
+	// Layouts as a renderer declares them: a few push ranges and up to 6 spaces of unsorted bindings
+	struct GeneratedLayout
+	{
+		std::vector<std::pair<uint32_t, uint32_t>> push_ranges; // Size in bytes, binding
+		std::vector<std::vector<Binding>> spaces;
+	};
+	std::mt19937 rng(1234);
+	std::vector<GeneratedLayout> layouts(layout_count);
+	for (size_t i = 0; i < layout_count; i++)
+	{
+		auto& layout = layouts[i];
+		const auto push_count = rng() % 3;
+		for (uint32_t r = 0; r < push_count; r++)
+		{
+			layout.push_ranges.emplace_back(static_cast<uint32_t>(4 + rng() % 128), r);
+		}
+		layout.spaces.resize(6);
+		for (auto& space : layout.spaces)
+		{
+			const auto binding_count = rng() % 6;
+			for (uint32_t b = 0; b < binding_count; b++)
+			{
+				space.push_back({ b, static_cast<uint32_t>(rng() % 4), static_cast<uint32_t>(1 + rng() % 8) });
+			}
+			std::ranges::shuffle(space, rng);
+		}
+		layout.spaces[i % 6].push_back({ 16, 0, static_cast<uint32_t>(i + 1) }); // Keeps layouts distinct
+	}
+	auto canonicalize = [](const GeneratedLayout& layout)
+	{
+		CanonicalPipelineLayout canonical;
+		for (const auto& [size, binding] : layout.push_ranges)
+		{
+			canonical.add_push_range(size, binding);
+		}
+		for (uint32_t s = 0; s < layout.spaces.size(); s++)
+		{
+			canonical.add_space(s, layout.spaces[s]);
+		}
+		return canonical;
+	};
+
+	// Stand-in for the serialized root signature, sized like a real one
+	PipelineLayoutCache cache;
+	for (const auto& layout : layouts)
+	{
+		const auto canonical = canonicalize(layout);
+		const auto words = canonical.serialize();
+		std::vector<uint8_t> blob(64 + words.size() * 8, static_cast<uint8_t>(words.size()));
+		cache.store(canonical, blob);
+	}
+	if (cache.size() != layout_count)
+	{
+		fprintf(stderr, "%zu layouts share a key\n", layout_count - cache.size());
+		return 1;
+	}
+
+	double best_hash_ms = 1e30, best_find_ms = 1e30;
+	size_t misses = 0;
+	std::vector<uint8_t> blob;
+	for (int it = 0; it < iterations; it++)
+	{
+		// Bindings are listed in another order each time, which must not change the key
+		for (auto& layout : layouts)
+		{
+			std::ranges::shuffle(layout.spaces[it % 6], rng);
+		}
+
+		auto start = std::chrono::steady_clock::now();
+		uint64_t checksum = 0;
+		for (const auto& layout : layouts)
+		{
+			checksum ^= canonicalize(layout).hash().low;
+		}
+		best_hash_ms = std::min(best_hash_ms, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+
+		start = std::chrono::steady_clock::now();
+		for (const auto& layout : layouts)
+		{
+			misses += !cache.find(canonicalize(layout), &blob);
+		}
+		best_find_ms = std::min(best_find_ms, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+		if (checksum == 0)
+		{
+			printf("checksum 0\n"); // Keeps the hashing from being optimized out
+		}
+	}
+
+	const auto path = fs::temp_directory_path() / "qhenkix_layout_benchmark.layouts";
+	auto start = std::chrono::steady_clock::now();
+	const bool saved = cache.save(path);
+	const double save_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	PipelineLayoutCache loaded;
+	start = std::chrono::steady_clock::now();
+	const bool was_loaded = loaded.load(path);
+	const double load_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	for (const auto& layout : layouts)
+	{
+		misses += !loaded.find(canonicalize(layout), &blob);
+	}
+	std::error_code ec;
+	const auto file_size = fs::file_size(path, ec);
+	fs::remove(path, ec);
+
+	printf("%zu layouts, %d iterations\n", layout_count, iterations);
+	printf("canonicalize + hash: best %.3f ms, %.1f ns per layout\n", best_hash_ms, best_hash_ms * 1e6 / layout_count);
+	printf("canonicalize + find: best %.3f ms, %.1f ns per layout\n", best_find_ms, best_find_ms * 1e6 / layout_count);
+	printf("save %.2f ms, load %.2f ms, %llu bytes\n", save_ms, load_ms, static_cast<unsigned long long>(file_size));
+	if (!saved || !was_loaded || misses)
+	{
+		fprintf(stderr, "%zu lookups missed%s\n", misses, saved && was_loaded ? "" : ", round trip failed");
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,119 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#include <d3d12.h>
+#include <wrl/client.h>
+
+#include "graphics/d3d12/d3d12_root_hasher.h"
+
+using Microsoft::WRL::ComPtr;
+
+// Looks up embedded root signatures from many threads, as parallel pipeline creation does.
+// Usage: QhenkiXRootHasherBenchmark [root_signature_count] [lookups_per_thread] [max_threads]
+int main(int argc, char* argv[])
+{
+	using namespace qhenki::gfx;
+
+	const uint32_t root_count = argc > 1 ? std::atoi(argv[1]) : 64;
+	const uint32_t lookups = argc > 2 ? std::atoi(argv[2]) : 1'000'000;
+	const uint32_t max_threads = argc > 3 ? std::atoi(argv[3]) : std::max(1u, std::thread::hardware_concurrency());
+
+	ComPtr<ID3D12Device> device;
+	if (FAILED(D3D12CreateDevice(nullptr, D3D_FEATURE_LEVEL_11_0, IID_PPV_ARGS(&device))))
+	{
+		fprintf(stderr, "Failed to create D3D12 device\n");
+		return 1;
+	}
+
+	// Distinct blobs of realistic size: a few root constants and a descriptor table each
+	std::vector<ComPtr<ID3DBlob>> blobs(root_count);
+	for (uint32_t i = 0; i < root_count; i++)
+	{
+		D3D12_DESCRIPTOR_RANGE range
+		{
+			.RangeType = D3D12_DESCRIPTOR_RANGE_TYPE_SRV,
+			.NumDescriptors = 1 + i % 8,
+			.BaseShaderRegister = 0,
+			.RegisterSpace = i / 8,
+			.OffsetInDescriptorsFromTableStart = D3D12_DESCRIPTOR_RANGE_OFFSET_APPEND,
+		};
+		D3D12_ROOT_PARAMETER parameters[2]{};
+		parameters[0].ParameterType = D3D12_ROOT_PARAMETER_TYPE_32BIT_CONSTANTS;
+		parameters[0].Constants = { .ShaderRegister = 0, .RegisterSpace = 0, .Num32BitValues = 4 };
+		parameters[0].ShaderVisibility = D3D12_SHADER_VISIBILITY_ALL;
+		parameters[1].ParameterType = D3D12_ROOT_PARAMETER_TYPE_DESCRIPTOR_TABLE;
+		parameters[1].DescriptorTable = { .NumDescriptorRanges = 1, .pDescriptorRanges = &range };
+		parameters[1].ShaderVisibility = D3D12_SHADER_VISIBILITY_PIXEL;
+		const D3D12_ROOT_SIGNATURE_DESC desc
+		{
+			.NumParameters = 2,
+			.pParameters = parameters,
+			.Flags = D3D12_ROOT_SIGNATURE_FLAG_ALLOW_INPUT_ASSEMBLER_INPUT_LAYOUT,
+		};
+		ComPtr<ID3DBlob> error;
+		if (FAILED(D3D12SerializeRootSignature(&desc, D3D_ROOT_SIGNATURE_VERSION_1, &blobs[i], &error)))
+		{
+			fprintf(stderr, "Failed to serialize root signature %u\n", i);
+			return 1;
+		}
+	}
+
+	D3D12RootHasher hasher;
+	for (const auto& blob : blobs)
+	{
+		if (!hasher.add_root_signature(device.Get(), blob->GetBufferPointer(), blob->GetBufferSize()))
+		{
+			fprintf(stderr, "Failed to create root signature\n");
+			return 1;
+		}
+	}
+	printf("%u root signatures, %zu byte blobs, %u lookups per thread\n", root_count, blobs[0]->GetBufferSize(), lookups);
+
+	// Powers of two up to max_threads, then max_threads itself
+	std::vector<uint32_t> thread_counts;
+	for (uint32_t count = 1; count < max_threads; count *= 2)
+	{
+		thread_counts.push_back(count);
+	}
+	thread_counts.push_back(max_threads);
+
+	for (const uint32_t thread_count : thread_counts)
+	{
+		std::atomic<uint64_t> misses = 0;
+		std::atomic<bool> go = false;
+		std::vector<std::thread> threads;
+		threads.reserve(thread_count);
+		for (uint32_t t = 0; t < thread_count; t++)
+		{
+			threads.emplace_back([&, t]
+			{
+				while (!go.load(std::memory_order_acquire)) {}
+				uint64_t thread_misses = 0;
+				for (uint32_t i = 0; i < lookups; i++)
+				{
+					const auto& blob = blobs[(i + t) % root_count];
+					thread_misses += hasher.find_root_signature(blob->GetBufferPointer(), blob->GetBufferSize()) == nullptr;
+				}
+				misses.fetch_add(thread_misses, std::memory_order_relaxed);
+			});
+		}
+
+		const auto start = std::chrono::steady_clock::now();
+		go.store(true, std::memory_order_release);
+		for (auto& thread : threads)
+		{
+			thread.join();
+		}
+		const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+		const double total = static_cast<double>(lookups) * thread_count;
+		printf("%2u threads: %.2f ms, %.2f M lookups/s, %.1f ns per lookup per thread%s\n", thread_count, ms,
+			total / ms / 1000.0, ms * 1e6 / lookups, misses ? " (MISSES)" : "");
+	}
+	return 0;
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+#include <smartpointer.h>
+
+#include "pipeline.h"
+#include "shader.h"
+
+namespace qhenki::gfx
+{
+	class Context;
+
+	enum class AsyncStatus : uint8_t
+	{
+		PENDING,
+		SUCCEEDED,
+		FAILED,
+	};
+
+	/**
+	 * @brief Result of a Context::create_*_async call. Copies refer to the same job.
+	 *
+	 * Poll with get_status, which never blocks, or block with wait. get_or returns a fallback until the job
+	 * succeeded, so rendering can continue with e.g. a default pipeline while the real one is created.
+	 */
+	template <typename T>
+	class AsyncHandle
+	{
+		struct State
+		{
+			T value{};
+			std::atomic<AsyncStatus> status{ AsyncStatus::PENDING };
+			std::mutex mutex;
+			std::condition_variable finished;
+		};
+		sPtr<State> m_state;
+
+		static AsyncHandle make_pending()
+		{
+			AsyncHandle handle;
+			handle.m_state = mkS<State>();
+			return handle;
+		}
+
+		T* get_target() const { return &m_state->value; }
+
+		// Publishes the value written through get_target
+		void finish(const bool succeeded) const
+		{
+			{
+				std::scoped_lock lock(m_state->mutex);
+				m_state->status.store(succeeded ? AsyncStatus::SUCCEEDED : AsyncStatus::FAILED, std::memory_order_release);
+			}
+			m_state->finished.notify_all();
+		}
+
+		friend class Context;
+
+	public:
+		AsyncHandle() = default; // Empty, see is_valid
+
+		// Already succeeded, e.g. for passing a shader created synchronously to create_pipeline_async
+		explicit AsyncHandle(T value) : m_state(mkS<State>())
+		{
+			m_state->value = std::move(value);
+			m_state->status.store(AsyncStatus::SUCCEEDED, std::memory_order_release);
+		}
+
+		bool is_valid() const { return m_state != nullptr; }
+
+		AsyncStatus get_status() const
+		{
+			assert(m_state);
+			return m_state->status.load(std::memory_order_acquire);
+		}
+
+		bool is_ready() const { return get_status() != AsyncStatus::PENDING; }
+
+		// Blocks until the job finished. Returns whether it succeeded
+		bool wait() const
+		{
+			if (!is_ready())
+			{
+				std::unique_lock lock(m_state->mutex);
+				m_state->finished.wait(lock, [this] { return is_ready(); });
+			}
+			return get_status() == AsyncStatus::SUCCEEDED;
+		}
+
+		// Only valid once the job succeeded
+		const T& get() const
+		{
+			assert(get_status() == AsyncStatus::SUCCEEDED);
+			return m_state->value;
+		}
+
+		// The result if the job succeeded, otherwise fallback. Never blocks
+		const T& get_or(const T& fallback) const
+		{
+			return m_state && get_status() == AsyncStatus::SUCCEEDED ? m_state->value : fallback;
+		}
+	};
+
+	using ShaderHandle = AsyncHandle<Shader>;
+	using PipelineHandle = AsyncHandle<GraphicsPipeline>;
+}
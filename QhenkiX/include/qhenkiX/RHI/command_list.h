@@ -1,4 +1,6 @@
 ﻿#pragma once
+#include <array>
+#include <dxgiformat.h>
 
 namespace qhenki::gfx
 {
@@ -8,6 +10,14 @@ namespace qhenki::gfx
 	private:
 		std::array<const DescriptorHeap*, 2> m_current_bound_heaps{};
 
+		// Targets of the current render pass, deferred pipelines are specialized for them
+		std::array<DXGI_FORMAT, 8> m_rtv_formats{};
+		uint32_t m_rtv_count = 0;
+		DXGI_FORMAT m_dsv_format = DXGI_FORMAT_UNKNOWN;
+		bool m_has_depth_stencil = false;
+		sPtr<void> m_deferred_pipeline; // Bound deferred pipeline, its variant is set by the next draw
+		bool m_deferred_pipeline_set = false; // Whether the variant for the current targets is set
+
 		friend class D3D12Context;
 	};
 }
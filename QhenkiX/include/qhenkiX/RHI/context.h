@@ -1,6 +1,16 @@
 #pragma once
+#include <filesystem>
+#include <mutex>
+#include <span>
 #include <stdexcept>
+#include <string>
+#include <vector>
 
+#undef min
+#undef max
+#include <tsl/robin_map.h>
+
+#include "async_handle.h"
 #include "shader.h"
 #include "swapchain.h"
 #include <qhenkiX/display_window.h>
@@ -18,21 +28,64 @@
 #include "sampler.h"
 #include "submission.h"
 #include "texture.h"
+#include <qhenkiX/utility/job_pool.h>
 
 namespace qhenki::gfx
 {
+	class ShaderCache;
+	class ShaderHotReload;
+
 	// TODO: replace all D3D types with qhenki::gfx types
 	class Context
 	{
 		virtual bool is_debug_layer_enabled() const = 0;
 
+		// Created on first use by the *_async functions
+		std::mutex m_async_mutex;
+		uPtr<util::JobPool> m_async_jobs;
+		std::vector<uPtr<ShaderCompiler>> m_async_compilers; // One per worker, compilers are not thread safe
+
+		// Archives are shared by the shaders created from them and unmapped with the last one
+		struct MappedShaderArchive;
+		std::mutex m_archive_mutex;
+		tsl::robin_map<std::string, std::weak_ptr<const MappedShaderArchive>> m_archives;
+
+		sPtr<const MappedShaderArchive> get_shader_archive(const char* path);
+
 	protected:
+		// Bytecode compiled ahead of time, see create_shader_from_blob
+		struct PrecompiledShader
+		{
+			const char* path;
+			std::span<const uint8_t> bytecode;
+			sPtr<const void> owner; // Keeps bytecode alive, a mapped file or a decompressed copy
+			sPtr<const util::ShaderReflectionData> reflection; // From the .refl sidecar, nullptr if there is none
+		};
+		// Wraps the bytecode without copying it
+		virtual bool create_precompiled_shader(const PrecompiledShader& precompiled, ShaderType shader_type,
+		                                       ShaderModel shader_model, Shader* shader) = 0;
+
 		uPtr<ShaderCompiler> m_shader_compiler;
+		ShaderCache* m_shader_cache = nullptr; // Not owned, optional
+		ShaderHotReload* m_hot_reload = nullptr; // Not owned, optional
+
+		// Workers of the *_async functions, also used by backends for background work
+		util::JobPool* get_async_jobs();
+		// Runs the queued async jobs and stops the workers. Backends call this before releasing the device
+		void finish_async_jobs();
 
 	public:
 		virtual void create(bool enable_debug_layer) = 0; // TODO: return error string for potential dialog box
 		virtual bool is_compatibility() const = 0;
 
+		// create_shader_dynamic reuses shaders compiled by earlier runs from this cache and stores new ones. nullptr to disable
+		void set_shader_cache(ShaderCache* cache) { m_shader_cache = cache; }
+		// Shaders from create_shader_dynamic and pipelines made from them are reported to hot_reload. nullptr to disable
+		void set_hot_reload(ShaderHotReload* hot_reload) { m_hot_reload = hot_reload; }
+
+		// Compiler for use on another thread, m_shader_compiler is not thread safe. nullptr if the compiler is unavailable
+		virtual uPtr<ShaderCompiler> make_shader_compiler() = 0;
+
 		// Creates swapchain based off specified description
 		virtual bool create_swapchain(const DisplayWindow& window, const SwapchainDesc& swapchain_desc, Swapchain* swapchain,
 		                              Queue* direct_queue, unsigned* frame_index) = 0;
@@ -41,14 +94,94 @@ namespace qhenki::gfx
 		virtual bool present(Swapchain* swapchain, UINT fence_count, Fence* wait_fences, UINT swapchain_index) = 0;
 
         virtual bool create_shader_dynamic(ShaderCompiler* compiler, Shader* shader, const CompilerInput& input) = 0;
+
+		/**
+		 * @brief Creates a shader from a .dxil or .dxbc output of SXC, without involving a shader compiler.
+		 * @param path Output file. It is mapped into memory and used in place. Its .refl sidecar (if present) is loaded as
+		 * the reflection, so pipeline creation does not reflect the shader either.
+		 * @param shader_type Type the output was compiled as.
+		 * @param shader_model Shader model the output was compiled with.
+		 * @param shader (out) Created shader.
+		 */
+		bool create_shader_from_blob(const char* path, ShaderType shader_type, ShaderModel shader_model, Shader* shader);
+
+		/**
+		 * @brief Creates a shader from one permutation of an SXC archive (.dxilp or .dxbcp), see create_shader_from_blob.
+		 * @param path Archive file. It stays mapped while shaders created from it exist, compressed permutations are
+		 * decompressed, others are used in place.
+		 * @param defines Define set of the permutation in any order, e.g. {"A=1", "B=0"}.
+		 * @param shader_type Type the archive was compiled as.
+		 * @param shader_model Shader model the archive was compiled with.
+		 * @param shader (out) Created shader.
+		 */
+		bool create_shader_from_archive(const char* path, std::span<const std::string> defines, ShaderType shader_type,
+		                                ShaderModel shader_model, Shader* shader);
+
 		virtual bool create_pipeline(const GraphicsPipelineDesc& desc, GraphicsPipeline* pipeline, const Shader& vertex_shader, const Shader& pixel_shader,
 		                             PipelineLayout* in_layout, const char* debug_name = nullptr) = 0;
 		virtual bool bind_pipeline(CommandList* cmd_list, const GraphicsPipeline& pipeline) = 0;
 
+		/**
+		 * @brief Creates many pipelines in parallel on the async workers and the calling thread, see create_pipeline.
+		 * Blocks until all are created, so do not call it from an async job.
+		 * @param infos Pipelines to create. succeeded of each is set to the result of its create_pipeline.
+		 * @return Whether every pipeline was created.
+		 */
+		bool create_pipelines(std::span<PipelineCreateInfo> infos);
+		// Exchanges the backend objects of two pipelines, so every copy of a uses the pipeline created as b and vice versa
+		virtual void swap_pipelines(GraphicsPipeline* a, GraphicsPipeline* b) = 0;
+		// Whether a pipeline created without target formats failed to compile for targets it was drawn to. Its draws to
+		// those targets are skipped until it is replaced, e.g. by hot reload
+		virtual bool has_pipeline_failed(const GraphicsPipeline& pipeline) const = 0;
+
+		/**
+		 * @brief Loads the pipeline states stored by an earlier run, so create_pipeline skips compiling them in the driver.
+		 * Call once after create, before creating pipelines.
+		 * @param path File written by save_pipeline_cache. A missing or outdated file (e.g. after a driver update) starts
+		 * an empty cache. Serialized pipeline layouts are kept in a file next to it (path with the extension .layouts).
+		 * @return Whether the backend persists pipeline states. D3D11 does not have pipeline state objects.
+		 */
+		virtual bool load_pipeline_cache(const std::filesystem::path& path) = 0;
+		// Writes the pipeline states created so far if any were added since load_pipeline_cache. Call before destroying the context
+		virtual bool save_pipeline_cache(const std::filesystem::path& path) = 0;
+
+		/**
+		 * @brief Compiles a shader on a worker thread, see create_shader_dynamic.
+		 * @param input Copied, so it does not need to outlive the call.
+		 * @return Handle that succeeds once the shader is created.
+		 */
+		ShaderHandle create_shader_async(const CompilerInput& input);
+
+		/**
+		 * @brief Creates a pipeline on a worker thread once both shaders are compiled, see create_pipeline.
+		 * @param desc Copied. desc.input_layout (if set) and in_layout must stay alive until the handle is ready.
+		 * @param vertex_shader From create_shader_async, or ShaderHandle(shader) for an existing shader.
+		 * @param pixel_shader From create_shader_async, or ShaderHandle(shader) for an existing shader.
+		 * @param in_layout Optional premade layout.
+		 * @param debug_name Copied, optional.
+		 * @return Handle that fails if either shader failed. Bind handle.get_or(fallback) until it is ready.
+		 */
+		PipelineHandle create_pipeline_async(const GraphicsPipelineDesc& desc, const ShaderHandle& vertex_shader,
+		                                     const ShaderHandle& pixel_shader, PipelineLayout* in_layout, const char* debug_name = nullptr);
+
+		// Identical layouts share one backend object, the order of bindings within a space does not matter
 		virtual bool create_pipeline_layout(PipelineLayoutDesc* desc, PipelineLayout* layout) = 0;
+		/**
+		 * @brief Derives the smallest layout binding every resource the shaders use, see util::CanonicalPipelineLayout::from_reflection.
+		 *
+		 * This is the layout create_pipeline uses when given neither a layout nor shaders with an embedded root signature,
+		 * so binding either is equivalent.
+		 *
+		 * @param parameters (out) Optional, the root parameters in order, for set_pipeline_constant,
+		 * set_pipeline_constant_buffer and set_descriptor_table. Empty for backends without layouts.
+		 */
+		virtual bool create_pipeline_layout(const Shader& vertex_shader, const Shader& pixel_shader, PipelineLayout* layout,
+		                                    std::vector<PipelineLayoutParameter>* parameters = nullptr) = 0;
 		virtual void bind_pipeline_layout(CommandList* cmd_list, const PipelineLayout& layout) = 0;
 
 		virtual bool set_pipeline_constant(CommandList* cmd_list, UINT param, UINT32 offset, UINT size, void* data) = 0;
+		// Binds a constant buffer to a CONSTANT_BUFFER parameter. offset must be a multiple of 256 bytes
+		virtual void set_pipeline_constant_buffer(CommandList* cmd_list, UINT param, const Buffer& buffer, uint64_t offset = 0) = 0;
 
 		virtual bool create_descriptor_heap(const DescriptorHeapDesc& desc, DescriptorHeap* heap, const char* debug_name = nullptr) = 0;
 		virtual void set_descriptor_heap(CommandList* cmd_list, const DescriptorHeap& heap) = 0;
@@ -4,6 +4,7 @@
 #include <optional>
 
 #include "enums.h"
+#include "shader.h"
 
 namespace qhenki::gfx
 {
@@ -49,9 +50,11 @@ namespace qhenki::gfx
 		std::optional<InputLayoutDesc> input_layout;
 		std::optional<DXGI_SAMPLE_DESC> multisample_desc;
 		PrimitiveTopology topology = PrimitiveTopology::TRIANGLE_LIST;
-		int num_render_targets = -1; // If this is <= 0, pipeline is lazily created based off what render target is bound at draw time
+		// If this is <= 0, pipeline is lazily created based off what render target is bound at draw time. Draws are skipped
+		// while the pipeline for new targets is compiled in the background, or if it failed (see Context::has_pipeline_failed)
+		int num_render_targets = -1;
 		std::array<DXGI_FORMAT, 8> rtv_formats{};
-		DXGI_FORMAT dsv_format{};
+		DXGI_FORMAT dsv_format{}; // For deferred pipelines only used if the bound depth target has no format
 		bool increment_slot = false; // Whether to increment slot of input, used during reflection
 	};
 
@@ -88,4 +91,34 @@ constexpr size_t MAX_SPACES = 6; // 6 is arbitrary, defined based off Vulkan max
 	{
 		sPtr<void> internal_state;
 	};
+
+	enum class PipelineLayoutParameterType : uint8_t
+	{
+		CONSTANTS, // set_pipeline_constant
+		CONSTANT_BUFFER, // set_pipeline_constant_buffer
+		DESCRIPTOR_TABLE, // set_descriptor_table
+	};
+
+	// Root parameter of a layout derived from shader reflection, see Context::create_pipeline_layout
+	struct PipelineLayoutParameter
+	{
+		PipelineLayoutParameterType type;
+		D3D12_SHADER_VISIBILITY visibility;
+		uint32_t space;
+		uint32_t binding; // Register of constants or a constant buffer
+		uint32_t size; // Bytes of constants
+		std::vector<LayoutBinding> bindings; // Tables only, in the order of their descriptors in the table
+	};
+
+	// One pipeline of Context::create_pipelines, the arguments of create_pipeline
+	struct PipelineCreateInfo
+	{
+		const GraphicsPipelineDesc* desc;
+		GraphicsPipeline* pipeline; // (out)
+		const Shader* vertex_shader;
+		const Shader* pixel_shader;
+		PipelineLayout* layout = nullptr;
+		const char* debug_name = nullptr;
+		bool succeeded = false; // (out)
+	};
 }
@@ -1,6 +1,7 @@
 ﻿#pragma once
 
 #include <array>
+#include <dxgiformat.h>
 
 #include "descriptor_table.h"
 
@@ -25,5 +26,6 @@ namespace qhenki::gfx
 			Stencil = 1 << 3,
 		} clear_type; // Can be combined
 		Descriptor descriptor;
+		DXGI_FORMAT format = DXGI_FORMAT_UNKNOWN; // Format of the view, deferred pipelines are created for it
 	};
 }
@@ -2,6 +2,11 @@
 #include <cstdint>
 #include <smartpointer.h>
 
+namespace qhenki::util
+{
+	class ShaderReflectionData;
+}
+
 namespace qhenki::gfx
 {
 	enum ShaderType : uint8_t
@@ -27,5 +32,7 @@ namespace qhenki::gfx
 		ShaderType type;
 		ShaderModel shader_model; // SM shader was compiled with
 		sPtr<void> internal_state;
+		// Reflection precomputed by SXC (util::ShaderReflectionData::load). Pipeline creation skips reflecting the shader if set
+		sPtr<const util::ShaderReflectionData> reflection;
 	};
 }
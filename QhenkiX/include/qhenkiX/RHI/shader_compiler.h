@@ -56,6 +56,28 @@ struct CompilerInput
 	}
 };
 
+// Deep copy of a CompilerInput, for keeping one past the lifetime of the memory it points at
+struct OwnedCompilerInput
+{
+	CompilerInput input; // Points into the members below
+	std::vector<std::string> includes;
+	std::string pdb_path;
+
+	explicit OwnedCompilerInput(const CompilerInput& other)
+		: input(other), includes(other.includes.begin(), other.includes.end()), pdb_path(other.pdb_path)
+	{
+		input.path_and_defines = Owning
+		{
+			.path = std::string(other.get_path()),
+			.defines = std::vector<std::string>(other.get_defines().begin(), other.get_defines().end()),
+		};
+		input.includes = includes;
+		input.pdb_path = pdb_path;
+	}
+	OwnedCompilerInput(const OwnedCompilerInput&) = delete;
+	OwnedCompilerInput& operator=(const OwnedCompilerInput&) = delete;
+};
+
 struct CompilerOutput
 {
 	std::string error_message;
@@ -70,6 +92,10 @@ class ShaderCompiler
 public:
 	// Creates a source blob (DXIL or SPIR-V) from the input
 	virtual bool compile(const CompilerInput& input, CompilerOutput& output) = 0;
+	// Runs only the preprocessor. Output is the fully expanded source, errors are written to error_message
+	virtual bool preprocess(const CompilerInput& input, std::string& preprocessed, std::string& error_message) = 0;
+	// Identifies the compiler binary used for the given shader model (e.g. for invalidating cached output)
+	virtual std::string get_version(qhenki::gfx::ShaderModel shader_model) = 0;
 	virtual ~ShaderCompiler() = default;
 };
 
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <filesystem>
 #include <smartpointer.h>
 #include <thread>
 
@@ -8,6 +9,8 @@
 #include "input/input_manager.h"
 
 #include "RHI/context.h"
+#include "utility/shader_cache.h"
+#include "utility/shader_hot_reload.h"
 
 namespace qhenki
 {
@@ -47,6 +50,14 @@ namespace qhenki
 		gfx::Queue m_graphics_queue{}; // A graphics queue is given to the application by default
 		gfx::DescriptorHeap m_rtv_heap{}; // Default RTV heap that also contains swapchain descriptors
 
+		// Shaders compiled by create_shader_dynamic and pipeline states are reused from here on later runs. Opt-in, set
+		// before run() to a writable directory (e.g. under the user's local app data). Empty disables the cache
+		std::filesystem::path m_shader_cache_directory;
+		uPtr<gfx::ShaderCache> m_shader_cache = nullptr;
+		// Development mode, pipelines are rebuilt when their shader sources change on disk. Set before run()
+		bool m_shader_hot_reload = false;
+		uPtr<gfx::ShaderHotReload> m_hot_reload = nullptr;
+
 		gfx::Fence m_fence_frame_ready{};
 		std::array<uint64_t, m_frames_in_flight> m_fence_frame_ready_val{ 0, 0 };
 
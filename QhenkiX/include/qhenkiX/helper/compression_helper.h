@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+namespace qhenki::util
+{
+	/**
+	 * LZ4 block format (https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md), compatible with LZ4_decompress_safe_usingDict.
+	 * The optional dictionary acts as data preceding the block, so matches may reference it.
+	 */
+	struct CompressionHelper
+	{
+		static constexpr size_t LZ4_MAX_DICTIONARY_SIZE = 64 * 1024; // Largest match offset
+
+		// Worst case compressed size of incompressible input
+		static constexpr size_t lz4_compress_bound(const size_t size)
+		{
+			return size + size / 255 + 16;
+		}
+
+		/**
+		 * @brief Compresses one block.
+		 * @param src Input bytes.
+		 * @param size Input size.
+		 * @param dst (out) Compressed bytes.
+		 * @param capacity Size of dst, lz4_compress_bound(size) always suffices.
+		 * @param dictionary Optional, only the last LZ4_MAX_DICTIONARY_SIZE bytes are used.
+		 * @return Compressed size, 0 if dst is too small.
+		 */
+		static size_t lz4_compress(const void* src, size_t size, void* dst, size_t capacity, std::span<const uint8_t> dictionary = {});
+
+		/**
+		 * @brief Decompresses one block. Malformed input is rejected without reading or writing out of bounds.
+		 * @param src Compressed bytes.
+		 * @param size Compressed size.
+		 * @param dst (out) Decompressed bytes.
+		 * @param dst_size Exact decompressed size.
+		 * @param dictionary Same dictionary the block was compressed with.
+		 * @return Whether the block was valid and decompressed to exactly dst_size bytes.
+		 */
+		static bool lz4_decompress(const void* src, size_t size, void* dst, size_t dst_size, std::span<const uint8_t> dictionary = {});
+	};
+}
@@ -0,0 +1,167 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+namespace qhenki::util
+{
+	struct Hash128
+	{
+		uint64_t low = 0;
+		uint64_t high = 0;
+
+		bool operator==(const Hash128& other) const = default;
+		auto operator<=>(const Hash128& other) const = default;
+
+		// 32 hex characters, not null-terminated
+		std::array<char, 32> to_hex() const
+		{
+			constexpr char digits[] = "0123456789abcdef";
+			std::array<char, 32> out{};
+			for (int i = 0; i < 16; i++)
+			{
+				out[i] = digits[(high >> (60 - i * 4)) & 0xF];
+				out[16 + i] = digits[(low >> (60 - i * 4)) & 0xF];
+			}
+			return out;
+		}
+	};
+
+	// Portable XXH64 implementation so tools do not need an external hashing dependency
+	// Assumes a little endian target (x64/ARM64)
+	struct HashHelper
+	{
+		static constexpr uint64_t PRIME64_1 = 0x9E3779B185EBCA87ULL;
+		static constexpr uint64_t PRIME64_2 = 0xC2B2AE3D27D4EB4FULL;
+		static constexpr uint64_t PRIME64_3 = 0x165667B19E3779F9ULL;
+		static constexpr uint64_t PRIME64_4 = 0x85EBCA77C2B2AE63ULL;
+		static constexpr uint64_t PRIME64_5 = 0x27D4EB2F165667C5ULL;
+
+		static uint64_t rotl(const uint64_t x, const int r)
+		{
+			return (x << r) | (x >> (64 - r));
+		}
+
+		static uint64_t read64(const uint8_t* p)
+		{
+			uint64_t v;
+			memcpy(&v, p, sizeof(v));
+			return v;
+		}
+
+		static uint32_t read32(const uint8_t* p)
+		{
+			uint32_t v;
+			memcpy(&v, p, sizeof(v));
+			return v;
+		}
+
+		static uint64_t round(uint64_t acc, const uint64_t input)
+		{
+			acc += input * PRIME64_2;
+			acc = rotl(acc, 31);
+			acc *= PRIME64_1;
+			return acc;
+		}
+
+		static uint64_t merge_round(uint64_t acc, uint64_t val)
+		{
+			val = round(0, val);
+			acc ^= val;
+			acc = acc * PRIME64_1 + PRIME64_4;
+			return acc;
+		}
+
+		static uint64_t xxh64(const void* data, const size_t size, const uint64_t seed = 0)
+		{
+			const auto* p = static_cast<const uint8_t*>(data);
+			const uint8_t* const end = p + size;
+			uint64_t h;
+
+			if (size >= 32)
+			{
+				const uint8_t* const limit = end - 32;
+				uint64_t v1 = seed + PRIME64_1 + PRIME64_2;
+				uint64_t v2 = seed + PRIME64_2;
+				uint64_t v3 = seed;
+				uint64_t v4 = seed - PRIME64_1;
+				// Four independent lanes, the compiler can keep these in registers and pipeline the multiplies
+				do
+				{
+					v1 = round(v1, read64(p));
+					v2 = round(v2, read64(p + 8));
+					v3 = round(v3, read64(p + 16));
+					v4 = round(v4, read64(p + 24));
+					p += 32;
+				} while (p <= limit);
+
+				h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+				h = merge_round(h, v1);
+				h = merge_round(h, v2);
+				h = merge_round(h, v3);
+				h = merge_round(h, v4);
+			}
+			else
+			{
+				h = seed + PRIME64_5;
+			}
+
+			h += static_cast<uint64_t>(size);
+
+			while (p + 8 <= end)
+			{
+				h ^= round(0, read64(p));
+				h = rotl(h, 27) * PRIME64_1 + PRIME64_4;
+				p += 8;
+			}
+			if (p + 4 <= end)
+			{
+				h ^= static_cast<uint64_t>(read32(p)) * PRIME64_1;
+				h = rotl(h, 23) * PRIME64_2 + PRIME64_3;
+				p += 4;
+			}
+			while (p < end)
+			{
+				h ^= (*p) * PRIME64_5;
+				h = rotl(h, 11) * PRIME64_1;
+				p++;
+			}
+
+			h ^= h >> 33;
+			h *= PRIME64_2;
+			h ^= h >> 29;
+			h *= PRIME64_3;
+			h ^= h >> 32;
+			return h;
+		}
+
+		static uint64_t xxh64(const std::string_view str, const uint64_t seed = 0)
+		{
+			return xxh64(str.data(), str.size(), seed);
+		}
+
+		// Two differently seeded lanes, used where a 64-bit collision would silently produce wrong output (e.g. caches)
+		static Hash128 hash128(const void* data, const size_t size)
+		{
+			return
+			{
+				.low = xxh64(data, size, 0),
+				.high = xxh64(data, size, PRIME64_3),
+			};
+		}
+
+		static Hash128 hash128(const std::string_view str)
+		{
+			return hash128(str.data(), str.size());
+		}
+	};
+}
+
+// Hash128 is already uniformly distributed, e.g. for tsl::robin_map keys
+template <>
+struct std::hash<qhenki::util::Hash128>
+{
+	size_t operator()(const qhenki::util::Hash128& hash) const noexcept { return hash.low; }
+};
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+
+namespace qhenki::util
+{
+	// Read only memory mapping of a whole file. The view stays valid until close or destruction
+	class MappedFile
+	{
+		const void* m_data = nullptr;
+		size_t m_size = 0;
+		bool m_open = false;
+#ifdef _WIN32
+		void* m_file = nullptr; // HANDLE
+		void* m_mapping = nullptr; // HANDLE
+#endif
+
+	public:
+		MappedFile() = default;
+		~MappedFile();
+
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+		MappedFile(MappedFile&& other) noexcept;
+		MappedFile& operator=(MappedFile&& other) noexcept;
+
+		/**
+		 * Maps a file into memory.
+		 * @param path Path to the file. An empty file opens successfully with a null view.
+		 * @return Whether the file was opened and mapped.
+		 */
+		bool open(const char* path);
+#ifdef _WIN32
+		bool open(const wchar_t* path);
+#endif
+		void close();
+
+		bool is_open() const { return m_open; }
+		const void* data() const { return m_data; }
+		size_t size() const { return m_size; }
+	};
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <filesystem>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+
+#undef min
+#undef max
+#include <tsl/robin_map.h>
+
+#include <smartpointer.h>
+
+namespace qhenki::gfx
+{
+	/**
+	 * @brief Source files shared by all shader compilers of a build, keyed by normalized path.
+	 *
+	 * Each file is read from disk at most once. Paths that do not exist are remembered as well since
+	 * include resolution probes every include directory. Lookups only take a shared lock.
+	 * Returned contents stay valid until clear(), so the compilers can use them without copying.
+	 */
+	class IncludeCache
+	{
+		mutable std::shared_mutex m_mutex;
+		tsl::robin_map<std::string, uPtr<const std::string>> m_files; // nullptr for missing files
+
+	public:
+		IncludeCache() = default;
+		IncludeCache(const IncludeCache&) = delete;
+		IncludeCache& operator=(const IncludeCache&) = delete;
+
+		/**
+		 * @brief Returns the contents of a file, reading it on first access.
+		 * @param path File path, normalized before lookup.
+		 * @return File contents or nullptr if the file does not exist or could not be read.
+		 */
+		const std::string* load(const std::filesystem::path& path);
+
+		// Drops all files so changes on disk are seen. Must not be called while a compile is using the cache
+		void clear();
+
+		size_t size() const;
+	};
+}
@@ -1,23 +1,38 @@
 #pragma once
 
 #include <d3dcommon.h>
+#include <filesystem>
 #include <span>
 #include <vector>
 #include <string>
 
+#undef min
+#undef max
+#include <tsl/robin_map.h>
+
 namespace qhenki::gfx
 {
-	// Multi-include path include handler, mainly for FXC since you can't specify multiple paths in D3DCompileFromFile
+	class IncludeCache;
+
+	// Multi-include path include handler, mainly for FXC since you can't specify multiple paths in D3DCompileFromFile.
+	// Quoted includes are looked up next to the including file first, like the compilers' default handlers
 	class MultiIncludeHandler : public ID3DInclude
 	{
 		std::span<const std::string> m_include_paths;
+		IncludeCache* m_cache = nullptr; // Files are read from disk on every include if not set
+		std::filesystem::path m_source_directory; // Of the compiled file, the parent of top level includes
+		tsl::robin_map<LPCVOID, std::filesystem::path> m_directories; // Of every opened file, by the data given to the compiler
+
+		bool open_file(const std::filesystem::path& path, LPCVOID* ppData, UINT* pBytes);
 	public:
-		explicit MultiIncludeHandler(std::span<const std::string> include_paths)
-			: m_include_paths(include_paths) {
+		explicit MultiIncludeHandler(std::span<const std::string> include_paths, IncludeCache* cache = nullptr,
+			std::filesystem::path source_directory = {})
+			: m_include_paths(include_paths), m_cache(cache), m_source_directory(std::move(source_directory)) {
 		}
 
-		explicit MultiIncludeHandler(const std::vector<std::string>& include_paths)
-			: m_include_paths(include_paths) {
+		explicit MultiIncludeHandler(const std::vector<std::string>& include_paths, IncludeCache* cache = nullptr,
+			std::filesystem::path source_directory = {})
+			: m_include_paths(include_paths), m_cache(cache), m_source_directory(std::move(source_directory)) {
 		}
 
 		HRESULT STDMETHODCALLTYPE Open(D3D_INCLUDE_TYPE IncludeType, LPCSTR pFileName, LPCVOID pParentData, LPCVOID* ppData, UINT* pBytes) override;
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace qhenki::util
+{
+	/**
+	 * @brief Fixed set of long-lived worker threads running jobs in submission order.
+	 *
+	 * Jobs receive the index of the worker running them, so state that is not thread safe (e.g. a shader compiler)
+	 * can be kept once per worker. Jobs start in FIFO order, so a job may wait on jobs submitted before it without
+	 * deadlocking the pool.
+	 */
+	class JobPool
+	{
+		std::mutex m_mutex;
+		std::condition_variable m_job_added;
+		std::condition_variable m_idle;
+		std::deque<std::function<void(uint32_t)>> m_jobs;
+		uint32_t m_running = 0;
+		bool m_stop = false;
+		std::vector<std::thread> m_workers;
+
+		void worker_main(uint32_t worker);
+
+	public:
+		// 0 for one worker per hardware thread, leaving one for the submitting thread
+		explicit JobPool(uint32_t worker_count = 0);
+		JobPool(const JobPool&) = delete;
+		JobPool& operator=(const JobPool&) = delete;
+		// Runs the jobs still queued, then joins the workers
+		~JobPool();
+
+		uint32_t get_worker_count() const { return static_cast<uint32_t>(m_workers.size()); }
+
+		void submit(std::function<void(uint32_t worker)> job);
+
+		// Blocks until the queue is empty and no job is running
+		void wait_idle();
+	};
+}
@@ -0,0 +1,171 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <span>
+#include <vector>
+
+#include "qhenkiX/helper/hash_helper.h"
+#include "qhenkiX/utility/shader_reflection.h"
+
+#undef min
+#undef max
+#include <tsl/robin_map.h>
+
+namespace qhenki::util
+{
+	/*
+	 * Pipeline layout cache (pipelines.layouts next to the pipeline cache)
+	 *
+	 * [PipelineLayoutCacheHeader]
+	 * [entry_count * (PipelineLayoutCacheEntry, canonical layout words, root signature blob)]
+	 */
+	constexpr uint32_t PIPELINE_LAYOUT_CACHE_MAGIC = 0x434C5051; // "QPLC"
+	constexpr uint32_t PIPELINE_LAYOUT_CACHE_VERSION = 3;
+
+	struct PipelineLayoutCacheHeader
+	{
+		uint32_t magic;
+		uint32_t version;
+		uint32_t entry_count;
+		uint32_t reserved;
+		uint64_t content_hash; // Of everything after the header, detects truncated or corrupted files
+	};
+	static_assert(sizeof(PipelineLayoutCacheHeader) == 24);
+
+	struct PipelineLayoutCacheEntry
+	{
+		Hash128 key; // CanonicalPipelineLayout::hash
+		uint32_t word_count;
+		uint32_t blob_size;
+	};
+	static_assert(sizeof(PipelineLayoutCacheEntry) == 24);
+
+	/**
+	 * @brief Platform independent form of a pipeline layout, equal for every description that creates the same layout.
+	 *
+	 * Root parameters are push ranges, then root descriptors, then tables. Bindings of a table are sorted by register,
+	 * the order their descriptor ranges are laid out in. Enum values (descriptor range types, shader visibility) are
+	 * stored as their D3D values so the header does not depend on Windows headers.
+	 */
+	struct CanonicalPipelineLayout
+	{
+		static constexpr uint32_t VISIBILITY_ALL = 0; // D3D12_SHADER_VISIBILITY_ALL
+		static constexpr uint32_t VISIBILITY_VERTEX = 1; // Followed by hull, domain, geometry and pixel
+		static constexpr uint32_t VISIBILITY_PIXEL = 5;
+		// D3D12_ROOT_SIGNATURE_FLAG_DENY_VERTEX_SHADER_ROOT_ACCESS, the flags of the other stages follow in visibility order
+		static constexpr uint32_t DENY_VERTEX_ROOT_ACCESS = 0x2;
+		static constexpr uint32_t RANGE_SRV = 0; // D3D12_DESCRIPTOR_RANGE_TYPE_SRV
+		static constexpr uint32_t RANGE_UAV = 1;
+		static constexpr uint32_t RANGE_CBV = 2;
+		static constexpr uint32_t RANGE_SAMPLER = 3;
+		static constexpr uint32_t MAX_ROOT_SIZE = 64; // 32-bit values, a table costs 1, a root descriptor 2
+		static constexpr uint32_t UNBOUNDED = 0xFFFFFFFF; // Descriptor count of an unbounded array, gfx::INFINITE_DESCRIPTORS
+
+		struct PushRange
+		{
+			uint32_t num_values; // 32-bit values
+			uint32_t binding;
+			uint32_t space;
+			uint32_t visibility;
+		};
+
+		// Constant buffer bound by its address instead of a descriptor
+		struct RootDescriptor
+		{
+			uint32_t binding;
+			uint32_t space;
+			uint32_t visibility;
+		};
+
+		struct Binding
+		{
+			uint32_t binding;
+			uint32_t type;
+			uint32_t count;
+
+			auto operator<=>(const Binding& other) const = default;
+		};
+
+		struct Table
+		{
+			uint32_t space;
+			uint32_t visibility;
+			std::vector<Binding> bindings;
+		};
+
+		// Shader stage for from_reflection
+		struct Stage
+		{
+			const ShaderReflectionData* reflection;
+			uint32_t visibility; // D3D12_SHADER_VISIBILITY of the stage
+		};
+
+		std::vector<PushRange> push_ranges;
+		std::vector<RootDescriptor> root_descriptors;
+		std::vector<Table> tables;
+		uint32_t deny_flags = 0; // D3D12_ROOT_SIGNATURE_FLAG_DENY_*_ROOT_ACCESS of stages the layout is used without
+
+		// Size in bytes, rounded up to 32-bit values
+		void add_push_range(uint32_t size, uint32_t binding, uint32_t space = SHADER_REFLECTION_PUSH_CONSTANT_SPACE,
+		                    uint32_t visibility = VISIBILITY_ALL);
+		// Table of the bindings of a space, visible to all stages. An empty space is skipped
+		void add_space(uint32_t index, std::vector<Binding> bindings);
+
+		/**
+		 * @brief Smallest layout binding everything the stages use.
+		 *
+		 * Resources used by one stage are only visible to it. Push constants become root constants and single constant
+		 * buffers root descriptors while they fit in MAX_ROOT_SIZE, the rest goes into a table per space and visibility
+		 * (samplers in their own, since tables cannot mix them with views). Push constants that do not fit are bound as
+		 * constant buffers instead, largest first. Parameters that usually change per draw come first: root constants,
+		 * root descriptors, view tables, then sampler tables. Unbounded arrays get a table each. Stages that are not
+		 * passed are denied root access.
+		 */
+		static CanonicalPipelineLayout from_reflection(std::span<const Stage> stages);
+
+		uint32_t get_root_size() const;
+
+		// Flat form, compared on lookup since a matching hash alone may be a collision
+		std::vector<uint32_t> serialize() const;
+		Hash128 hash() const;
+	};
+
+	/**
+	 * @brief Serialized root signatures by pipeline layout, persisted across runs.
+	 *
+	 * Lets the backend skip building and serializing the root signature of a layout it has seen before. The blobs do
+	 * not depend on the adapter or driver, so a stored file stays valid until PIPELINE_LAYOUT_CACHE_VERSION changes.
+	 * All methods are thread safe.
+	 */
+	class PipelineLayoutCache
+	{
+		struct Entry
+		{
+			std::vector<uint32_t> layout; // CanonicalPipelineLayout::serialize
+			std::vector<uint8_t> blob;
+		};
+
+		mutable std::mutex m_mutex;
+		tsl::robin_map<Hash128, Entry> m_entries;
+		bool m_dirty = false;
+
+	public:
+		/**
+		 * @brief Finds the root signature blob stored for layout.
+		 * @param blob (out) Copy of the blob.
+		 * @return Whether an identical layout was stored.
+		 */
+		bool find(const CanonicalPipelineLayout& layout, std::vector<uint8_t>* blob) const;
+		// Stores the serialized root signature of layout, replacing the blob of a colliding layout
+		void store(const CanonicalPipelineLayout& layout, std::span<const uint8_t> blob);
+
+		size_t size() const;
+
+		// Replaces the entries with the ones in the file. A missing or corrupted file leaves the cache empty
+		bool load(const std::filesystem::path& path);
+		// Writes the entries if any were stored since load. Written to a temporary file and renamed into place
+		bool save(const std::filesystem::path& path);
+	};
+}
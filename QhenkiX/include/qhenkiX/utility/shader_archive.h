@@ -0,0 +1,222 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "qhenkiX/helper/compression_helper.h"
+#include "qhenkiX/helper/hash_helper.h"
+
+namespace qhenki::util
+{
+	/*
+	 * Permutation archive (.dxilp/.dxbcp) written by SXC
+	 *
+	 * [ShaderArchiveHeader]
+	 * [ShaderArchiveDictionary] only if SHADER_ARCHIVE_FLAG_LZ4 is set
+	 * [ShaderArchiveEntry * entry_count] sorted by key
+	 * [dictionary][pad to 16][blob 0][pad to 16][blob 1][pad to 16]...
+	 *
+	 * All offsets are from the start of the file, so a mapped file can be used in place.
+	 * Entries with identical bytecode may point at the same blob.
+	 * In compressed archives every blob is an LZ4 block using the shared dictionary, unless it did not compress,
+	 * and is only decompressed when read.
+	 */
+	constexpr uint32_t SHADER_ARCHIVE_MAGIC = 0x41435853; // "SXCA"
+	constexpr uint16_t SHADER_ARCHIVE_VERSION = 1;
+	constexpr uint32_t SHADER_ARCHIVE_ALIGNMENT = 16;
+	constexpr uint16_t SHADER_ARCHIVE_FLAG_LZ4 = 1 << 0;
+
+	struct ShaderArchiveHeader
+	{
+		uint32_t magic;
+		uint16_t version;
+		uint16_t flags; // SHADER_ARCHIVE_FLAG_*, other bits must be zero
+		uint32_t entry_count;
+		uint32_t entry_offset;
+		uint64_t file_size;
+	};
+	static_assert(sizeof(ShaderArchiveHeader) == 24);
+
+	struct ShaderArchiveDictionary
+	{
+		uint64_t offset;
+		uint32_t size; // 0 if the blobs are compressed without a dictionary
+		uint32_t reserved;
+	};
+	static_assert(sizeof(ShaderArchiveDictionary) == 16);
+
+	struct ShaderArchiveEntry
+	{
+		uint64_t key; // ShaderArchive::make_key of the permutation defines
+		uint64_t offset;
+		uint32_t size; // Stored size
+		uint32_t uncompressed_size; // 0 if the blob is stored uncompressed
+	};
+	static_assert(sizeof(ShaderArchiveEntry) == 24);
+
+	// Read only view over archive bytes. Does not copy or own the data
+	class ShaderArchive
+	{
+		const uint8_t* m_data = nullptr;
+		size_t m_size = 0;
+		const ShaderArchiveEntry* m_entries = nullptr;
+		uint32_t m_entry_count = 0;
+		std::span<const uint8_t> m_dictionary;
+
+	public:
+		// Order independent hash of a define set, e.g. {"A=1", "B=0"}
+		static uint64_t make_key(std::span<const std::string> defines)
+		{
+			std::vector<std::string_view> sorted(defines.begin(), defines.end());
+			std::ranges::sort(sorted);
+			uint64_t key = HashHelper::xxh64(nullptr, 0);
+			for (const auto& define : sorted)
+			{
+				// Chain hashes so that {"AB"} and {"A", "B"} differ
+				key = HashHelper::xxh64(define.data(), define.size(), key);
+			}
+			return key;
+		}
+
+		/**
+		 * @brief Validates the header and entry table of archive bytes.
+		 * @param data Pointer to the archive bytes, must outlive the view.
+		 * @param size Size of the archive in bytes.
+		 * @return Whether the data is a valid archive.
+		 */
+		bool open(const void* data, const size_t size)
+		{
+			m_data = nullptr;
+			m_size = 0;
+			m_entries = nullptr;
+			m_entry_count = 0;
+			m_dictionary = {};
+
+			if (!data || size < sizeof(ShaderArchiveHeader))
+			{
+				return false;
+			}
+			const auto bytes = static_cast<const uint8_t*>(data);
+			const auto header = reinterpret_cast<const ShaderArchiveHeader*>(bytes);
+			if (header->magic != SHADER_ARCHIVE_MAGIC || header->version != SHADER_ARCHIVE_VERSION
+				|| header->file_size != size || (header->flags & ~SHADER_ARCHIVE_FLAG_LZ4))
+			{
+				return false;
+			}
+			std::span<const uint8_t> dictionary;
+			if (header->flags & SHADER_ARCHIVE_FLAG_LZ4)
+			{
+				if (size < sizeof(ShaderArchiveHeader) + sizeof(ShaderArchiveDictionary))
+				{
+					return false;
+				}
+				const auto dictionary_desc = reinterpret_cast<const ShaderArchiveDictionary*>(bytes + sizeof(ShaderArchiveHeader));
+				if (dictionary_desc->offset > size || size - dictionary_desc->offset < dictionary_desc->size)
+				{
+					return false;
+				}
+				dictionary = { bytes + dictionary_desc->offset, dictionary_desc->size };
+			}
+			if (header->entry_offset % alignof(ShaderArchiveEntry) != 0
+				|| header->entry_offset > size
+				|| (size - header->entry_offset) / sizeof(ShaderArchiveEntry) < header->entry_count)
+			{
+				return false;
+			}
+			const auto entries = reinterpret_cast<const ShaderArchiveEntry*>(bytes + header->entry_offset);
+			for (uint32_t i = 0; i < header->entry_count; i++)
+			{
+				if (entries[i].offset > size || size - entries[i].offset < entries[i].size
+					|| (entries[i].uncompressed_size && !(header->flags & SHADER_ARCHIVE_FLAG_LZ4)))
+				{
+					return false;
+				}
+			}
+
+			m_data = bytes;
+			m_size = size;
+			m_entries = entries;
+			m_entry_count = header->entry_count;
+			m_dictionary = dictionary;
+			return true;
+		}
+
+		bool is_compressed() const
+		{
+			return get_header()->flags & SHADER_ARCHIVE_FLAG_LZ4;
+		}
+
+		// Size of the permutation bytecode, i.e. the buffer size read needs
+		static size_t get_size(const ShaderArchiveEntry& entry)
+		{
+			return entry.uncompressed_size ? entry.uncompressed_size : entry.size;
+		}
+
+		/**
+		 * @brief Copies or decompresses the bytecode of one permutation. Other permutations are not touched.
+		 * @param entry Entry of this archive.
+		 * @param out (out) Buffer of get_size(entry) bytes.
+		 * @return False if the compressed blob is corrupt.
+		 */
+		bool read(const ShaderArchiveEntry& entry, void* out) const
+		{
+			const auto blob = get_blob(entry);
+			if (!entry.uncompressed_size)
+			{
+				if (!blob.empty())
+				{
+					memcpy(out, blob.data(), blob.size());
+				}
+				return true;
+			}
+			return CompressionHelper::lz4_decompress(blob.data(), blob.size(), out, entry.uncompressed_size, m_dictionary);
+		}
+
+		bool read(const ShaderArchiveEntry& entry, std::vector<uint8_t>* out) const
+		{
+			out->resize(get_size(entry));
+			return read(entry, out->data());
+		}
+
+		const ShaderArchiveHeader* get_header() const
+		{
+			return reinterpret_cast<const ShaderArchiveHeader*>(m_data);
+		}
+
+		std::span<const ShaderArchiveEntry> get_entries() const
+		{
+			return { m_entries, m_entry_count };
+		}
+
+		// Stored bytes, compressed if entry.uncompressed_size is set. Use read for the bytecode
+		std::span<const uint8_t> get_blob(const ShaderArchiveEntry& entry) const
+		{
+			return { m_data + entry.offset, entry.size };
+		}
+
+		// Binary search on the sorted entry table. Returns nullptr if the permutation is not in the archive
+		const ShaderArchiveEntry* find(const uint64_t key) const
+		{
+			const auto end = m_entries + m_entry_count;
+			const auto it = std::lower_bound(m_entries, end, key,
+				[](const ShaderArchiveEntry& e, const uint64_t k) { return e.key < k; });
+			if (it == end || it->key != key)
+			{
+				return nullptr;
+			}
+			return it;
+		}
+
+		// Bytecode of a permutation in place. Empty if not found or compressed, use find + read for compressed archives
+		std::span<const uint8_t> find(std::span<const std::string> defines) const
+		{
+			const auto entry = find(make_key(defines));
+			return entry && !entry->uncompressed_size ? get_blob(*entry) : std::span<const uint8_t>{};
+		}
+	};
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <qhenkiX/RHI/shader_compiler.h>
+#include <qhenkiX/helper/hash_helper.h>
+
+namespace qhenki::gfx
+{
+	/**
+	 * @brief Persistent cache of shaders compiled at runtime, see Context::set_shader_cache.
+	 *
+	 * Entries are looked up by a key of the compile settings (absolute source path, defines, entry point, shader model,
+	 * optimization, flags, include directories and compiler version) and store the content hash of the source and
+	 * every file it includes. An entry is only used if all of them still hash the same, so no compiler or preprocessor
+	 * runs on a hit. Includes are found by scanning for #include without evaluating conditionals, which may record
+	 * more files than the compiler read but never fewer. Compiles that write a PDB bypass the cache.
+	 *
+	 * Entries are written to a temporary file and renamed into place, so the directory can be shared by concurrent
+	 * processes. All methods are thread safe.
+	 */
+	class ShaderCache
+	{
+		std::filesystem::path m_directory;
+
+		std::filesystem::path get_entry_path(const util::Hash128& key) const;
+
+	public:
+		struct Entry
+		{
+			std::vector<uint8_t> bytecode; // DXIL or DXBC
+			std::vector<uint8_t> reflection; // util::ShaderReflectionData record, empty if the backend does not need one
+			std::vector<uint8_t> root_signature; // Root signature declared in the shader, empty if none
+		};
+
+		// File an entry depends on, with its contents as of collect_dependencies
+		struct Dependency
+		{
+			std::string path;
+			uint64_t size;
+			uint64_t content_hash;
+		};
+
+		// Creates the directory if missing. A directory that cannot be created makes every load miss and every store fail
+		explicit ShaderCache(std::filesystem::path directory);
+		ShaderCache(const ShaderCache&) = delete;
+		ShaderCache& operator=(const ShaderCache&) = delete;
+
+		const std::filesystem::path& get_directory() const { return m_directory; }
+
+		static util::Hash128 make_key(const CompilerInput& input, std::string_view compiler_version);
+
+		// A hit does not write the PDB of the compile, so compiles that write one always run
+		static bool is_cacheable(const CompilerInput& input) { return input.pdb_path.empty(); }
+
+		/**
+		 * @brief Hashes the source of input and every file it includes, recursively, for store.
+		 * Call this before compiling, so a file saved during the compile makes the entry stale instead of storing the
+		 * old bytecode under the new contents. Include candidates searched before the one that resolved are recorded as
+		 * missing, since creating one of them changes which file the compiler reads.
+		 * @param dependencies (out) The source first.
+		 * @return Whether the source could be read.
+		 */
+		static bool collect_dependencies(const CompilerInput& input, std::vector<Dependency>* dependencies);
+
+		/**
+		 * @brief Files the compile of input depends on, found the same way as for cache entries.
+		 * @param files (out) Normalized paths of the source and every file it includes.
+		 * @param missing (out) Normalized paths of include candidates that do not exist. Creating one changes the compile.
+		 * @return Whether the source could be read.
+		 */
+		static bool get_dependencies(const CompilerInput& input, std::vector<std::string>* files, std::vector<std::string>* missing);
+
+		/**
+		 * @brief Loads the entry of key if the source and its includes are unchanged since it was stored.
+		 * @param key From make_key.
+		 * @param entry (out) Cached outputs.
+		 * @return Whether the entry exists, is intact and up-to-date.
+		 */
+		bool load(const util::Hash128& key, Entry* entry) const;
+
+		/**
+		 * @brief Stores the outputs of a successful compile, replacing any previous entry of key.
+		 * @param key From make_key.
+		 * @param dependencies From collect_dependencies, taken before compiling.
+		 * @param entry Outputs to store.
+		 * @return Whether the entry was written.
+		 */
+		bool store(const util::Hash128& key, std::span<const Dependency> dependencies, const Entry& entry) const;
+	};
+}
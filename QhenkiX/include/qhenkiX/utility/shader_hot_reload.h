@@ -0,0 +1,107 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <filesystem>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <qhenkiX/RHI/context.h>
+
+namespace qhenki::gfx
+{
+	/**
+	 * @brief Development mode that recompiles shaders when their source changes, see Context::set_hot_reload.
+	 *
+	 * The context reports every shader made by create_shader_dynamic and every pipeline made from two such shaders.
+	 * A background thread polls the modification times of the sources and their includes, recompiles changed shaders
+	 * with the same CompilerInput and rebuilds the pipelines using them. update swaps each rebuilt pipeline into the
+	 * existing one in place, so every copy of the GraphicsPipeline draws with the new shaders without the application
+	 * recreating anything. A failed compile keeps the previous shader and is retried on the next change.
+	 *
+	 * The caller's Shader objects keep their original code, pipelines created from them later are rebuilt right away.
+	 * desc.input_layout (if set) of a watched pipeline must stay alive while the pipeline does.
+	 */
+	class ShaderHotReload
+	{
+		struct WatchedFile
+		{
+			std::string path;
+			std::filesystem::file_time_type time; // file_time_type::min() if the file does not exist
+		};
+
+		struct ShaderEntry
+		{
+			uint64_t id;
+			std::weak_ptr<void> original; // Internal state of the caller's shader, identifies it in watch_pipeline
+			Shader current; // Latest successful compile
+			bool reloaded = false; // Whether current was recompiled, otherwise it is the caller's shader
+			sPtr<const OwnedCompilerInput> input;
+			std::vector<WatchedFile> files;
+		};
+
+		struct PipelineEntry
+		{
+			uint64_t id;
+			std::weak_ptr<void> state; // Internal state of the caller's pipeline, its contents are swapped
+			GraphicsPipelineDesc desc;
+			std::array<uint64_t, 2> shaders; // Vertex and pixel shader entry ids
+			std::optional<PipelineLayout> layout;
+			std::string debug_name;
+			bool stale = false; // Created from a shader that was already reloaded
+			std::optional<GraphicsPipeline> pending; // Rebuilt, swapped in by update
+		};
+
+		struct Retired
+		{
+			uint64_t fence_value; // Released once the frame fence reaches this
+			sPtr<void> state;
+		};
+
+		Context* m_context;
+		uPtr<ShaderCompiler> m_compiler; // Used by the reload thread only
+		std::chrono::milliseconds m_poll_interval;
+
+		std::mutex m_mutex;
+		std::condition_variable m_stop_requested;
+		bool m_stop = false;
+		uint64_t m_next_id = 0;
+		std::vector<ShaderEntry> m_shaders;
+		std::vector<PipelineEntry> m_pipelines;
+		std::vector<Retired> m_retired;
+
+		std::thread m_thread;
+
+		static std::vector<WatchedFile> get_watched_files(const CompilerInput& input);
+		void reload_main();
+		void poll();
+
+	public:
+		explicit ShaderHotReload(Context* context, std::chrono::milliseconds poll_interval = std::chrono::milliseconds(250));
+		ShaderHotReload(const ShaderHotReload&) = delete;
+		ShaderHotReload& operator=(const ShaderHotReload&) = delete;
+		// Stops the reload thread, waiting for a compile in progress
+		~ShaderHotReload();
+
+		// Whether the caller is the reload thread, e.g. for rebuilt pipelines that must not be shared with other pipelines
+		bool is_reload_thread() const { return std::this_thread::get_id() == m_thread.get_id(); }
+
+		// Called by the context after creating a shader or pipeline. Thread safe, ignored for the reload thread's own
+		void watch_shader(const Shader& shader, const CompilerInput& input);
+		void watch_pipeline(const GraphicsPipeline& pipeline, const GraphicsPipelineDesc& desc, const Shader& vertex_shader,
+		                    const Shader& pixel_shader, PipelineLayout* in_layout, const char* debug_name);
+
+		/**
+		 * @brief Swaps rebuilt pipelines in. Call on the main thread between frames, while no command list is recorded.
+		 * @param frame_fence Fence signaled by the submission of every frame.
+		 * @param submitted_value A value frame_fence reaches only once all frames submitted so far completed. The replaced
+		 * pipelines are kept alive until then, since in flight frames may still use them.
+		 * @return Number of pipelines swapped in.
+		 */
+		uint32_t update(const Fence& frame_fence, uint64_t submitted_value);
+	};
+}
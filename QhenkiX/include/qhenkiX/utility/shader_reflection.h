@@ -0,0 +1,194 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <smartpointer.h>
+
+namespace qhenki::util
+{
+	/*
+	 * Reflection record (.refl) written by SXC next to every output, so the runtime never reflects shaders
+	 *
+	 * [ShaderReflectionHeader]
+	 * [ShaderReflectionInput * input_count]
+	 * [ShaderReflectionResource * resource_count]
+	 * [ShaderReflectionPushConstant * push_constant_count]
+	 * [strings, null terminated]
+	 *
+	 * Names are offsets into the string table. Enum values are stored as their D3D values (DXGI_FORMAT, D3D_NAME,
+	 * D3D_SHADER_INPUT_TYPE) so the header does not depend on Windows headers.
+	 * The sidecar of a permutation archive is itself a ShaderArchive holding one record per permutation key.
+	 */
+	constexpr uint32_t SHADER_REFLECTION_MAGIC = 0x52435853; // "SXCR"
+	constexpr uint16_t SHADER_REFLECTION_VERSION = 1;
+	constexpr std::string_view SHADER_REFLECTION_EXTENSION = ".refl";
+	// Constant buffers in this space are root constants, see D3D12Context::create_pipeline_layout
+	constexpr uint32_t SHADER_REFLECTION_PUSH_CONSTANT_SPACE = 5;
+
+	struct ShaderReflectionHeader
+	{
+		uint32_t magic;
+		uint16_t version;
+		uint16_t flags; // Reserved
+		uint32_t input_count;
+		uint32_t resource_count;
+		uint32_t push_constant_count;
+		uint32_t string_size;
+	};
+	static_assert(sizeof(ShaderReflectionHeader) == 24);
+
+	struct ShaderReflectionInput
+	{
+		uint32_t semantic; // String offset
+		uint32_t semantic_index;
+		uint32_t format; // DXGI_FORMAT resolved from the component mask and type
+		uint32_t system_value; // D3D_NAME, e.g. D3D_NAME_VERTEX_ID
+	};
+	static_assert(sizeof(ShaderReflectionInput) == 16);
+
+	struct ShaderReflectionResource
+	{
+		uint32_t name; // String offset
+		uint32_t type; // D3D_SHADER_INPUT_TYPE
+		uint32_t bind_point; // Register
+		uint32_t space;
+		uint32_t count; // 0 for unbounded arrays
+		uint32_t size; // Constant buffer size in bytes, 0 for other resources
+	};
+	static_assert(sizeof(ShaderReflectionResource) == 24);
+
+	struct ShaderReflectionPushConstant
+	{
+		uint32_t binding; // Register in SHADER_REFLECTION_PUSH_CONSTANT_SPACE
+		uint32_t size; // Bytes
+	};
+	static_assert(sizeof(ShaderReflectionPushConstant) == 8);
+
+	// Reflection of one shader. Names point into the string table, so a loaded record is a single allocation
+	class ShaderReflectionData
+	{
+		std::vector<ShaderReflectionInput> m_inputs;
+		std::vector<ShaderReflectionResource> m_resources;
+		std::vector<ShaderReflectionPushConstant> m_push_constants;
+		std::string m_strings;
+
+		uint32_t add_string(const std::string_view str)
+		{
+			const auto offset = static_cast<uint32_t>(m_strings.size());
+			m_strings.append(str);
+			m_strings.push_back('\0');
+			return offset;
+		}
+
+	public:
+		void add_input(const std::string_view semantic, const uint32_t semantic_index, const uint32_t format, const uint32_t system_value)
+		{
+			m_inputs.push_back({ add_string(semantic), semantic_index, format, system_value });
+		}
+
+		void add_resource(const std::string_view name, const uint32_t type, const uint32_t bind_point, const uint32_t space,
+			const uint32_t count, const uint32_t size)
+		{
+			m_resources.push_back({ add_string(name), type, bind_point, space, count, size });
+		}
+
+		void add_push_constant(const uint32_t binding, const uint32_t size)
+		{
+			m_push_constants.push_back({ binding, size });
+		}
+
+		std::span<const ShaderReflectionInput> get_inputs() const { return m_inputs; }
+		std::span<const ShaderReflectionResource> get_resources() const { return m_resources; }
+		std::span<const ShaderReflectionPushConstant> get_push_constants() const { return m_push_constants; }
+
+		// Offsets are validated by load, the result stays valid as long as this object
+		const char* get_string(const uint32_t offset) const
+		{
+			return m_strings.data() + offset;
+		}
+
+		void serialize(std::vector<uint8_t>* out) const
+		{
+			const ShaderReflectionHeader header
+			{
+				.magic = SHADER_REFLECTION_MAGIC,
+				.version = SHADER_REFLECTION_VERSION,
+				.flags = 0,
+				.input_count = static_cast<uint32_t>(m_inputs.size()),
+				.resource_count = static_cast<uint32_t>(m_resources.size()),
+				.push_constant_count = static_cast<uint32_t>(m_push_constants.size()),
+				.string_size = static_cast<uint32_t>(m_strings.size()),
+			};
+			auto append = [out](const void* data, const size_t size)
+			{
+				out->insert(out->end(), static_cast<const uint8_t*>(data), static_cast<const uint8_t*>(data) + size);
+			};
+			out->clear();
+			out->reserve(sizeof(header) + m_inputs.size() * sizeof(ShaderReflectionInput)
+				+ m_resources.size() * sizeof(ShaderReflectionResource)
+				+ m_push_constants.size() * sizeof(ShaderReflectionPushConstant) + m_strings.size());
+			append(&header, sizeof(header));
+			append(m_inputs.data(), m_inputs.size() * sizeof(ShaderReflectionInput));
+			append(m_resources.data(), m_resources.size() * sizeof(ShaderReflectionResource));
+			append(m_push_constants.data(), m_push_constants.size() * sizeof(ShaderReflectionPushConstant));
+			append(m_strings.data(), m_strings.size());
+		}
+
+		/**
+		 * @brief Parses a reflection record, e.g. a .refl sidecar or an entry of an archive sidecar.
+		 * @param data Record bytes, copied.
+		 * @param size Size of the record in bytes.
+		 * @return The reflection or nullptr if the record is invalid.
+		 */
+		static sPtr<const ShaderReflectionData> load(const void* data, const size_t size)
+		{
+			ShaderReflectionHeader header;
+			if (!data || size < sizeof(header))
+			{
+				return nullptr;
+			}
+			memcpy(&header, data, sizeof(header));
+			const uint64_t expected = sizeof(header) + static_cast<uint64_t>(header.input_count) * sizeof(ShaderReflectionInput)
+				+ static_cast<uint64_t>(header.resource_count) * sizeof(ShaderReflectionResource)
+				+ static_cast<uint64_t>(header.push_constant_count) * sizeof(ShaderReflectionPushConstant) + header.string_size;
+			if (header.magic != SHADER_REFLECTION_MAGIC || header.version != SHADER_REFLECTION_VERSION || expected != size)
+			{
+				return nullptr;
+			}
+
+			auto reflection = mkS<ShaderReflectionData>();
+			auto p = static_cast<const uint8_t*>(data) + sizeof(header);
+			auto read = [&p]<typename T>(std::vector<T>* v, const uint32_t count)
+			{
+				v->resize(count);
+				memcpy(v->data(), p, count * sizeof(T));
+				p += count * sizeof(T);
+			};
+			read(&reflection->m_inputs, header.input_count);
+			read(&reflection->m_resources, header.resource_count);
+			read(&reflection->m_push_constants, header.push_constant_count);
+			reflection->m_strings.assign(reinterpret_cast<const char*>(p), header.string_size);
+
+			// Every name must start inside the table and the table must end with a terminator
+			const auto& strings = reflection->m_strings;
+			if (!strings.empty() && strings.back() != '\0')
+			{
+				return nullptr;
+			}
+			for (const auto& input : reflection->m_inputs)
+			{
+				if (input.semantic >= strings.size()) return nullptr;
+			}
+			for (const auto& resource : reflection->m_resources)
+			{
+				if (resource.name >= strings.size()) return nullptr;
+			}
+			return reflection;
+		}
+	};
+}
@@ -1,5 +1,6 @@
 #include "qhenkiX/application.h"
 
+#include <algorithm>
 #include <iostream>
 #include "graphics/d3d11/d3d11_context.h"
 #include "graphics/d3d12/d3d12_context.h"
@@ -11,6 +12,11 @@
 
 using namespace qhenki;
 
+namespace
+{
+	constexpr auto PIPELINE_CACHE_FILE = "pipelines.bin"; // In m_shader_cache_directory
+}
+
 /**
  * This could be overridden to set up the display window with custom settings.
  * For example opening a settings window first to allow the user to select some settings.
@@ -63,6 +69,17 @@ void Application::run(const gfx::API api, const bool enable_debug_layer)
 		throw std::runtime_error("API not implemented");
 	}
 	m_context->create(enable_debug_layer);
+	if (!m_shader_cache_directory.empty())
+	{
+		m_shader_cache = mkU<gfx::ShaderCache>(m_shader_cache_directory);
+		m_context->set_shader_cache(m_shader_cache.get());
+		m_context->load_pipeline_cache(m_shader_cache_directory / PIPELINE_CACHE_FILE);
+	}
+	if (m_shader_hot_reload)
+	{
+		m_hot_reload = mkU<gfx::ShaderHotReload>(m_context.get());
+		m_context->set_hot_reload(m_hot_reload.get());
+	}
 
 	THROW_IF_FALSE(m_context->create_queue(qhenki::gfx::QueueType::GRAPHICS, &m_graphics_queue));
 
@@ -114,10 +131,24 @@ void Application::run(const gfx::API api, const bool enable_debug_layer)
 				ImGui_ImplSDL3_ProcessEvent(&event);
         }
 		m_input_manager.update(m_window_.get_window()); // After all SDL events
+		if (m_hot_reload)
+		{
+			// The highest value is only reached once every frame in flight completed
+			m_hot_reload->update(m_fence_frame_ready, *std::ranges::max_element(m_fence_frame_ready_val));
+		}
         render();
     }
 	m_context->wait_idle(&m_graphics_queue);
 	destroy();
+	if (m_shader_cache)
+	{
+		m_context->save_pipeline_cache(m_shader_cache_directory / PIPELINE_CACHE_FILE);
+	}
+	if (m_hot_reload)
+	{
+		m_context->set_hot_reload(nullptr);
+		m_hot_reload = nullptr;
+	}
 }
 
 Application::~Application() = default;
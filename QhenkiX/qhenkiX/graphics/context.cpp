@@ -0,0 +1,248 @@
+#include "qhenkiX/RHI/context.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+
+#include <windows.h>
+
+#include "qhenkiX/helper/mapped_file.h"
+#include "qhenkiX/utility/shader_archive.h"
+#include "qhenkiX/utility/shader_reflection.h"
+
+using namespace qhenki::gfx;
+
+struct Context::MappedShaderArchive
+{
+	util::MappedFile file;
+	util::ShaderArchive archive;
+	util::MappedFile reflection_file;
+	util::ShaderArchive reflections; // Records under the same keys, only valid if has_reflections
+	bool has_reflections = false;
+};
+
+namespace
+{
+	void log_shader_error(const char* message, const char* path)
+	{
+		char buffer[512];
+		std::snprintf(buffer, sizeof(buffer), "Qhenki ERROR: %s: %s\n", message, path);
+		OutputDebugStringA(buffer);
+	}
+
+	std::string get_reflection_path(const char* path)
+	{
+		return std::string(path) + std::string(qhenki::util::SHADER_REFLECTION_EXTENSION);
+	}
+}
+
+qhenki::util::JobPool* Context::get_async_jobs()
+{
+	std::scoped_lock lock(m_async_mutex);
+	if (!m_async_jobs)
+	{
+		m_async_jobs = mkU<util::JobPool>();
+		// Created by the first compile on each worker, loading precompiled shaders does not need a compiler
+		m_async_compilers.resize(m_async_jobs->get_worker_count());
+	}
+	return m_async_jobs.get();
+}
+
+void Context::finish_async_jobs()
+{
+	std::scoped_lock lock(m_async_mutex);
+	m_async_jobs.reset();
+	m_async_compilers.clear();
+}
+
+ShaderHandle Context::create_shader_async(const CompilerInput& input)
+{
+	// The input may point at caller memory, the job keeps its own copy
+	auto job = mkS<const OwnedCompilerInput>(input);
+
+	auto handle = ShaderHandle::make_pending();
+	const auto jobs = get_async_jobs();
+	jobs->submit([this, job, handle](const uint32_t worker)
+	{
+		auto& compiler = m_async_compilers[worker];
+		if (!compiler)
+		{
+			compiler = make_shader_compiler();
+		}
+		// Without its own compiler the job must not fall back to m_shader_compiler, which is not thread safe
+		handle.finish(compiler && create_shader_dynamic(compiler.get(), handle.get_target(), job->input));
+	});
+	return handle;
+}
+
+PipelineHandle Context::create_pipeline_async(const GraphicsPipelineDesc& desc, const ShaderHandle& vertex_shader,
+	const ShaderHandle& pixel_shader, PipelineLayout* in_layout, const char* debug_name)
+{
+	assert(vertex_shader.is_valid() && pixel_shader.is_valid());
+	auto handle = PipelineHandle::make_pending();
+	get_async_jobs()->submit([this, desc, vertex_shader, pixel_shader, in_layout,
+		name = std::string(debug_name ? debug_name : ""), handle](uint32_t)
+	{
+		// Shader jobs were submitted first so they are already running, waiting here cannot stall the pool
+		if (!vertex_shader.wait() || !pixel_shader.wait())
+		{
+			handle.finish(false);
+			return;
+		}
+		handle.finish(create_pipeline(desc, handle.get_target(), vertex_shader.get(), pixel_shader.get(), in_layout,
+			name.empty() ? nullptr : name.c_str()));
+	});
+	return handle;
+}
+
+bool Context::create_pipelines(const std::span<PipelineCreateInfo> infos)
+{
+	struct Batch
+	{
+		std::span<PipelineCreateInfo> infos;
+		std::atomic<size_t> next = 0;
+		std::atomic<size_t> finished = 0;
+		std::atomic<bool> all_succeeded = true;
+	};
+	if (infos.empty())
+	{
+		return true;
+	}
+
+	// Items are claimed one at a time, so a slow pipeline does not hold back a whole chunk. Shared with the jobs, which
+	// may only start once every item is claimed and the call returned
+	const auto batch = mkS<Batch>();
+	batch->infos = infos;
+	auto run = [this, batch]
+	{
+		for (size_t i; (i = batch->next.fetch_add(1, std::memory_order_relaxed)) < batch->infos.size();)
+		{
+			auto& info = batch->infos[i];
+			assert(info.desc && info.pipeline && info.vertex_shader && info.pixel_shader);
+			info.succeeded = create_pipeline(*info.desc, info.pipeline, *info.vertex_shader, *info.pixel_shader,
+				info.layout, info.debug_name);
+			if (!info.succeeded)
+			{
+				batch->all_succeeded.store(false, std::memory_order_relaxed);
+			}
+			if (batch->finished.fetch_add(1, std::memory_order_acq_rel) + 1 == batch->infos.size())
+			{
+				batch->finished.notify_all();
+			}
+		}
+	};
+
+	const auto jobs = get_async_jobs();
+	const size_t job_count = std::min<size_t>(jobs->get_worker_count(), infos.size() - 1);
+	for (size_t i = 0; i < job_count; i++)
+	{
+		jobs->submit([run](uint32_t) { run(); });
+	}
+	run();
+
+	for (size_t finished; (finished = batch->finished.load(std::memory_order_acquire)) < infos.size();)
+	{
+		batch->finished.wait(finished, std::memory_order_acquire);
+	}
+	return batch->all_succeeded.load(std::memory_order_relaxed);
+}
+
+sPtr<const Context::MappedShaderArchive> Context::get_shader_archive(const char* path)
+{
+	std::scoped_lock lock(m_archive_mutex);
+	if (const auto it = m_archives.find(path); it != m_archives.end())
+	{
+		if (auto archive = it->second.lock())
+		{
+			return archive;
+		}
+	}
+
+	auto archive = mkS<MappedShaderArchive>();
+	if (!archive->file.open(path) || !archive->archive.open(archive->file.data(), archive->file.size()))
+	{
+		return nullptr;
+	}
+	const auto reflection_path = get_reflection_path(path);
+	archive->has_reflections = archive->reflection_file.open(reflection_path.c_str())
+		&& archive->reflections.open(archive->reflection_file.data(), archive->reflection_file.size());
+	m_archives.insert_or_assign(path, archive);
+	return archive;
+}
+
+bool Context::create_shader_from_blob(const char* path, const ShaderType shader_type, const ShaderModel shader_model, Shader* shader)
+{
+	assert(path && shader);
+	auto file = mkS<util::MappedFile>();
+	if (!file->open(path) || file->size() == 0)
+	{
+		log_shader_error("Failed to map shader", path);
+		return false;
+	}
+
+	PrecompiledShader precompiled
+	{
+		.path = path,
+		.bytecode = { static_cast<const uint8_t*>(file->data()), file->size() },
+		.owner = file,
+	};
+	const auto reflection_path = get_reflection_path(path);
+	if (util::MappedFile reflection_file; reflection_file.open(reflection_path.c_str()))
+	{
+		// Copied into its own record, the sidecar is small
+		precompiled.reflection = util::ShaderReflectionData::load(reflection_file.data(), reflection_file.size());
+	}
+	return create_precompiled_shader(precompiled, shader_type, shader_model, shader);
+}
+
+bool Context::create_shader_from_archive(const char* path, const std::span<const std::string> defines,
+	const ShaderType shader_type, const ShaderModel shader_model, Shader* shader)
+{
+	assert(path && shader);
+	const auto archive = get_shader_archive(path);
+	if (!archive)
+	{
+		log_shader_error("Failed to open shader archive", path);
+		return false;
+	}
+	const auto key = util::ShaderArchive::make_key(defines);
+	const auto entry = archive->archive.find(key);
+	if (!entry)
+	{
+		log_shader_error("Permutation not found in shader archive", path);
+		return false;
+	}
+
+	PrecompiledShader precompiled{ .path = path };
+	if (entry->uncompressed_size)
+	{
+		auto bytecode = mkS<std::vector<uint8_t>>();
+		if (!archive->archive.read(*entry, bytecode.get()))
+		{
+			log_shader_error("Failed to decompress permutation of shader archive", path);
+			return false;
+		}
+		precompiled.bytecode = *bytecode;
+		precompiled.owner = std::move(bytecode);
+	}
+	else
+	{
+		precompiled.bytecode = archive->archive.get_blob(*entry);
+		precompiled.owner = archive;
+	}
+
+	if (archive->has_reflections)
+	{
+		if (const auto record = archive->reflections.find(key))
+		{
+			std::vector<uint8_t> data;
+			if (record->uncompressed_size)
+			{
+				archive->reflections.read(*record, &data);
+			}
+			const auto bytes = record->uncompressed_size ? std::span<const uint8_t>(data) : archive->reflections.get_blob(*record);
+			precompiled.reflection = util::ShaderReflectionData::load(bytes.data(), bytes.size());
+		}
+	}
+	return create_precompiled_shader(precompiled, shader_type, shader_model, shader);
+}
@@ -13,7 +13,10 @@
 #include "d3d11_pipeline.h"
 #include "d3d11_shader_compiler.h"
 #include "d3d11_heap.h"
+#include "../mapped_blob.h"
 #include "qhenkiX/helper/d3d_helper.h"
+#include "qhenkiX/utility/shader_cache.h"
+#include "qhenkiX/utility/shader_hot_reload.h"
 
 using namespace qhenki::gfx;
 
@@ -204,6 +207,11 @@ bool D3D11Context::resize_swapchain(Swapchain* const swapchain, int width, int h
     return swap_d3d11->resize(m_device_.Get(), m_device_context_.Get(), width, height);
 }
 
+uPtr<ShaderCompiler> D3D11Context::make_shader_compiler()
+{
+	return mkU<D3D11ShaderCompiler>();
+}
+
 bool D3D11Context::create_shader_dynamic(ShaderCompiler* compiler, Shader* shader, const CompilerInput& input)
 {
 	if (compiler == nullptr)
@@ -212,22 +220,89 @@ bool D3D11Context::create_shader_dynamic(ShaderCompiler* compiler, Shader* shade
 	}
 
 	CompilerOutput output = {};
+	util::Hash128 cache_key;
+	std::vector<ShaderCache::Dependency> dependencies;
+	bool cached = false;
+	bool use_cache = m_shader_cache && ShaderCache::is_cacheable(input);
+	if (use_cache)
+	{
+		// DXBC is cheap to reflect when the pipeline is created, only the bytecode is cached
+		cache_key = ShaderCache::make_key(input, compiler->get_version(input.shader_model));
+		ShaderCache::Entry entry;
+		if (m_shader_cache->load(cache_key, &entry))
+		{
+			auto cached_output = mkS<D3D11ShaderOutput>();
+			if (SUCCEEDED(D3DCreateBlob(entry.bytecode.size(), cached_output->shader_blob.ReleaseAndGetAddressOf())))
+			{
+				memcpy(cached_output->shader_blob->GetBufferPointer(), entry.bytecode.data(), entry.bytecode.size());
+				output.shader_data = cached_output->shader_blob->GetBufferPointer();
+				output.shader_size = entry.bytecode.size();
+				output.internal_state = cached_output;
+				cached = true;
+			}
+		}
+		// Hashed before compiling, a file saved during the compile must not be stored as the source of the old bytecode
+		use_cache = cached || ShaderCache::collect_dependencies(input, &dependencies);
+	}
+
 	// ID3DBlob
-	if (!compiler->compile(input, output))
+	if (!cached && !compiler->compile(input, output))
 	{
 		OutputDebugStringA(output.error_message.c_str());
 		return false;
 	}
 
+	if (use_cache && !cached)
+	{
+		const auto bytecode = static_cast<const uint8_t*>(output.shader_data);
+		ShaderCache::Entry entry;
+		entry.bytecode.assign(bytecode, bytecode + output.shader_size);
+		if (!m_shader_cache->store(cache_key, dependencies, entry))
+		{
+			OutputDebugStringA("Qhenki D3D11 WARNING: Failed to write shader cache entry\n");
+		}
+	}
+
 	shader->type = input.shader_type;
 	shader->shader_model = input.shader_model;
 	bool result = true;
 	// Calls CreateXShader(). Thread safe since it only uses the device
 	shader->internal_state = mkS<D3D11Shader>(m_device_.Get(), input.shader_type, input.get_path().data(), output, &result);
 
+	if (result && m_hot_reload)
+	{
+		m_hot_reload->watch_shader(*shader, input);
+	}
     return result;
 }
 
+bool D3D11Context::create_precompiled_shader(const PrecompiledShader& precompiled, const ShaderType shader_type,
+	const ShaderModel shader_model, Shader* shader)
+{
+	if (shader_model >= ShaderModel::SM_6_0)
+	{
+		OutputDebugStringA("Qhenki D3D11 ERROR: DXIL shaders are not supported by D3D11, compile with SM 5.x\n");
+		return false;
+	}
+
+	// The blob references the mapped bytes, D3D11 copies the bytecode when creating the shader
+	auto blob_output = mkS<D3D11ShaderOutput>();
+	blob_output->shader_blob = MappedBlob<ID3DBlob>::create(precompiled.owner, precompiled.bytecode);
+	const CompilerOutput output
+	{
+		.shader_size = precompiled.bytecode.size(),
+		.shader_data = precompiled.bytecode.data(),
+		.internal_state = blob_output,
+	};
+
+	shader->type = shader_type;
+	shader->shader_model = shader_model;
+	shader->reflection = precompiled.reflection;
+	bool result = true;
+	shader->internal_state = mkS<D3D11Shader>(m_device_.Get(), shader_type, precompiled.path, output, &result);
+	return result;
+}
+
 bool D3D11Context::create_pipeline(const GraphicsPipelineDesc& desc, GraphicsPipeline* pipeline,
                                    const Shader& vertex_shader, const Shader& pixel_shader,
                                    PipelineLayout* in_layout, const char* debug_name)
@@ -239,14 +314,14 @@ bool D3D11Context::create_pipeline(const GraphicsPipelineDesc& desc, GraphicsPip
 
 	assert(d3d11_pipeline);
 
-	d3d11_pipeline->vertex_shader = vertex_shader.internal_state.get();
-	d3d11_pipeline->pixel_shader = pixel_shader.internal_state.get();
+	d3d11_pipeline->vertex_shader = vertex_shader.internal_state;
+	d3d11_pipeline->pixel_shader = pixel_shader.internal_state;
 
 	const auto true_vs = std::get_if<D3D11VertexShader>(&d3d11_vertex_shader->m_shader);
 	assert(true_vs);
 
 	ID3D11InputLayout* input_layout_ = m_layout_assembler_.create_input_layout_reflection(m_device_.Get(),
-		true_vs->vertex_shader_blob.Get(), desc.increment_slot);
+		true_vs->vertex_shader_blob.Get(), desc.increment_slot, vertex_shader.reflection.get());
 	d3d11_pipeline->input_layout = input_layout_;
 
 	bool succeeded = input_layout_ != nullptr;
@@ -337,6 +412,10 @@ bool D3D11Context::create_pipeline(const GraphicsPipelineDesc& desc, GraphicsPip
 		}
 	}
 
+	if (succeeded && m_hot_reload)
+	{
+		m_hot_reload->watch_pipeline(*pipeline, desc, vertex_shader, pixel_shader, in_layout, debug_name);
+	}
     return succeeded;
 }
 
@@ -348,6 +427,12 @@ bool D3D11Context::bind_pipeline(CommandList* cmd_list, const GraphicsPipeline&
 	return true;
 }
 
+void D3D11Context::swap_pipelines(GraphicsPipeline* a, GraphicsPipeline* b)
+{
+	assert(a && b);
+	std::swap(*to_internal(*a), *to_internal(*b));
+}
+
 bool D3D11Context::create_descriptor_heap(const DescriptorHeapDesc& desc, DescriptorHeap* const heap, const char* debug_name)
 {
 	switch (desc.type)
@@ -1129,6 +1214,7 @@ bool D3D11Context::present(Swapchain* const swapchain, const UINT fence_count, F
 
 D3D11Context::~D3D11Context()
 {
+	finish_async_jobs(); // Jobs use the device
     m_device_context_->ClearState();
     m_device_context_->Flush();
     m_device_context_.Reset();
@@ -48,19 +48,37 @@ namespace qhenki::gfx
 		bool create_swapchain_descriptors(const Swapchain& swapchain, DescriptorHeap* rtv_heap) override { return true; }
 		bool present(Swapchain* swapchain, UINT fence_count, Fence* wait_fences, UINT swapchain_index) override;
 
+		uPtr<ShaderCompiler> make_shader_compiler() override;
 		// thread safe
 		bool create_shader_dynamic(ShaderCompiler* compiler, Shader* shader, const CompilerInput& input) override;
 		// thread safe
+		bool create_precompiled_shader(const PrecompiledShader& precompiled, ShaderType shader_type, ShaderModel shader_model,
+		                               Shader* shader) override;
+		// thread safe
 		bool create_pipeline(const GraphicsPipelineDesc& desc, GraphicsPipeline* pipeline,
 		                     const Shader& vertex_shader, const Shader& pixel_shader,
 		                     PipelineLayout* in_layout, const char* debug_name) override;
 		bool bind_pipeline(CommandList* cmd_list, const GraphicsPipeline& pipeline) override;
+		void swap_pipelines(GraphicsPipeline* a, GraphicsPipeline* b) override;
+		// Pipelines are created immediately
+		bool has_pipeline_failed(const GraphicsPipeline& pipeline) const override { return false; }
+		// D3D11 has no pipeline state objects, the runtime already shares identical state objects
+		bool load_pipeline_cache(const std::filesystem::path& path) override { return false; }
+		bool save_pipeline_cache(const std::filesystem::path& path) override { return false; }
 
 		// D3D11 does not have root signatures
 		bool create_pipeline_layout(PipelineLayoutDesc* const desc, PipelineLayout* layout) override { return true; }
+		bool create_pipeline_layout(const Shader& vertex_shader, const Shader& pixel_shader, PipelineLayout* layout,
+		                            std::vector<PipelineLayoutParameter>* parameters) override
+		{
+			if (parameters) parameters->clear();
+			return true;
+		}
 		void bind_pipeline_layout(CommandList* cmd_list, const PipelineLayout& layout) override {}
 
 		bool set_pipeline_constant(CommandList* cmd_list, UINT param, UINT32 offset, UINT size, void* data) override { return !is_compatibility(); }
+		// Constant buffers are bound with compatibility_set_constant_buffers
+		void set_pipeline_constant_buffer(CommandList* cmd_list, UINT param, const Buffer& buffer, uint64_t offset) override {}
 
 		bool create_descriptor_heap(const DescriptorHeapDesc& desc, DescriptorHeap* heap, const char* debug_name) override;
 		// Heaps only store views in D3D11
@@ -4,6 +4,8 @@
 #include <d3dcompiler.h>
 #include <string>
 
+#include "qhenkiX/utility/shader_reflection.h"
+
 using namespace qhenki::gfx;
 
 template <typename T>
@@ -173,24 +175,58 @@ std::vector<D3D11_INPUT_ELEMENT_DESC> D3D11LayoutAssembler::create_input_layout_
 	return input_layout_desc;
 }
 
-ID3D11InputLayout* D3D11LayoutAssembler::create_input_layout_reflection(
-	ID3D11Device* const device,
-	ID3DBlob* const vertex_shader_blob, bool increment_slot)
+std::vector<D3D11_INPUT_ELEMENT_DESC> D3D11LayoutAssembler::create_input_layout_desc(const util::ShaderReflectionData& vs_reflection, const bool increment_slot)
 {
-    ComPtr<ID3D11ShaderReflection> pVertexShaderReflection;
-    if (FAILED(D3DReflect(vertex_shader_blob->GetBufferPointer(), 
-        vertex_shader_blob->GetBufferSize(), 
-        IID_ID3D11ShaderReflection, 
-        &pVertexShaderReflection)))
+    UINT slot = 0;
+    std::vector<D3D11_INPUT_ELEMENT_DESC> input_layout_desc;
+    input_layout_desc.reserve(vs_reflection.get_inputs().size());
+    for (const auto& input : vs_reflection.get_inputs())
     {
-		OutputDebugStringA("Qhenki D3D11 ERROR: Input layout reflection failed\n");
-		return nullptr;
-    }
+        // Ignore system attributes
+        if (input.system_value == D3D_NAME_VERTEX_ID
+            || input.system_value == D3D_NAME_PRIMITIVE_ID
+            || input.system_value == D3D_NAME_INSTANCE_ID) continue;
 
-    D3D11_SHADER_DESC shader_desc;
-    pVertexShaderReflection->GetDesc(&shader_desc);
+        input_layout_desc.push_back(
+        {
+            .SemanticName = vs_reflection.get_string(input.semantic),
+            .SemanticIndex = input.semantic_index,
+            .Format = static_cast<DXGI_FORMAT>(input.format), // Resolved by SXC
+            .InputSlot = slot,
+            .AlignedByteOffset = D3D11_APPEND_ALIGNED_ELEMENT,
+            // TODO: INSTANCING
+            .InputSlotClass = D3D11_INPUT_PER_VERTEX_DATA,
+            .InstanceDataStepRate = 0,
+        });
 
-	std::vector<D3D11_INPUT_ELEMENT_DESC> input_layout_desc = create_input_layout_desc(pVertexShaderReflection.Get(), increment_slot);
+        if (increment_slot) slot++;
+    }
+    return input_layout_desc;
+}
+
+ID3D11InputLayout* D3D11LayoutAssembler::create_input_layout_reflection(
+	ID3D11Device* const device,
+	ID3DBlob* const vertex_shader_blob, bool increment_slot, const util::ShaderReflectionData* const vs_reflection)
+{
+	std::vector<D3D11_INPUT_ELEMENT_DESC> input_layout_desc;
+	if (vs_reflection)
+	{
+		input_layout_desc = create_input_layout_desc(*vs_reflection, increment_slot);
+	}
+	else
+	{
+	    ComPtr<ID3D11ShaderReflection> pVertexShaderReflection;
+	    if (FAILED(D3DReflect(vertex_shader_blob->GetBufferPointer(), 
+	        vertex_shader_blob->GetBufferSize(), 
+	        IID_ID3D11ShaderReflection, 
+	        &pVertexShaderReflection)))
+	    {
+			OutputDebugStringA("Qhenki D3D11 ERROR: Input layout reflection failed\n");
+			return nullptr;
+	    }
+
+		input_layout_desc = create_input_layout_desc(pVertexShaderReflection.Get(), increment_slot);
+	}
 
     if (input_layout_desc.empty())
     {
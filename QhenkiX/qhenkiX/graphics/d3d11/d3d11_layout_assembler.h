@@ -9,6 +9,11 @@
 
 using Microsoft::WRL::ComPtr;
 
+namespace qhenki::util
+{
+	class ShaderReflectionData;
+}
+
 namespace qhenki::gfx
 {
 	struct D3D11Layout
@@ -33,6 +38,7 @@ namespace qhenki::gfx
 		std::optional<ComPtr<ID3D11InputLayout>> create_input_layout_manual(ID3D11Device* device, ID3DBlob* vertex_shader_blob);
 
 		static std::vector<D3D11_INPUT_ELEMENT_DESC> create_input_layout_desc(ID3D11ShaderReflection* vs_reflection, bool increment_slot);
+		static std::vector<D3D11_INPUT_ELEMENT_DESC> create_input_layout_desc(const util::ShaderReflectionData& vs_reflection, bool increment_slot);
 
 		/**
 		 * @brief Creates an input layout using shader reflection.
@@ -42,9 +48,11 @@ namespace qhenki::gfx
 		 * @param device D3D11 device
 		 * @param vertex_shader_blob Compiled vertex shader blob
 		 * @param increment_slot If true, slots will be incremented by 1 for each vertex attribute
+		 * @param vs_reflection Reflection precomputed by SXC, optional. The shader is reflected if nullptr
 		 * @return Pointer to the created ID3D11InputLayout
 		 */
-		ID3D11InputLayout* create_input_layout_reflection(ID3D11Device* device, ID3DBlob* vertex_shader_blob, bool increment_slot);
+		ID3D11InputLayout* create_input_layout_reflection(ID3D11Device* device, ID3DBlob* vertex_shader_blob, bool increment_slot,
+			const util::ShaderReflectionData* vs_reflection = nullptr);
 
 		void clear_maps();
 	};
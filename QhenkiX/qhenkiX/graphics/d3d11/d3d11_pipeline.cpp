@@ -7,13 +7,13 @@ using namespace qhenki::gfx;
 
 void D3D11GraphicsPipeline::bind(ID3D11DeviceContext* const context)
 {
-	if (const auto shader = static_cast<D3D11Shader*>(vertex_shader))
+	if (const auto shader = static_cast<D3D11Shader*>(vertex_shader.get()))
 	{
 		const auto vs = std::get_if<D3D11VertexShader>(&shader->m_shader);  
 		assert(vs);
 		context->VSSetShader(vs->vertex_shader.Get(), nullptr, 0);
 	}
-	if (const auto shader = static_cast<D3D11Shader*>(pixel_shader))
+	if (const auto shader = static_cast<D3D11Shader*>(pixel_shader.get()))
 	{
 		const auto ps = std::get_if<ComPtr<ID3D11PixelShader>>(&shader->m_shader);
 		assert(ps);
@@ -1,13 +1,16 @@
 ﻿#pragma once
 
+#include <smartpointer.h>
+
 #include "d3d11_layout_assembler.h"
 
 namespace qhenki::gfx
 {
 	struct D3D11GraphicsPipeline
 	{
-		void* vertex_shader = nullptr; // D3D11Shader*
-		void* pixel_shader = nullptr; // D3D11Shader*
+		// D3D11Shader, owned so it stays valid after the Shader objects are released or reloaded
+		sPtr<void> vertex_shader;
+		sPtr<void> pixel_shader;
 		ID3D11InputLayout* input_layout = nullptr;
 		D3D11_PRIMITIVE_TOPOLOGY topology = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
 		ComPtr<ID3D11RasterizerState> rasterizer_state = nullptr;
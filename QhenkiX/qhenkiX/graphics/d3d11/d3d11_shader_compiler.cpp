@@ -5,9 +5,11 @@
 #include <d3dcompiler.h>
 #include <wrl/client.h>
 #include <array>
+#include <vector>
 
 #include "qhenkiX/helper/d3d_helper.h"
 #include <qhenkiX/helper/file_helper.h>
+#include <qhenkiX/utility/include_cache.h>
 #include <qhenkiX/utility/include_handlers.h>
 
 #include "qhenkiX/helper/string_helper.h"
@@ -30,6 +32,37 @@ void D3D11ShaderCompiler::get_shader_dll_path(char* buffer, size_t buffer_length
 	}
 }
 
+// Converts the defines into D3D_SHADER_MACRO. defines owns the split strings and must outlive macros
+static void build_macros(const CompilerInput& input, std::vector<D3D_SHADER_MACRO>& macros, std::vector<std::string>& defines)
+{
+	macros.clear();
+	macros.reserve(input.get_defines().size() + 1);
+
+	defines.clear();
+	defines.reserve(input.get_defines().size() * 2);
+
+    for (const auto& define : input.get_defines())
+    {
+        // Split the string at the first '='
+        size_t pos = define.find('=');
+        if (pos != std::string::npos)
+        {
+			defines.push_back(define.substr(0, pos));
+			auto& substr1 = defines.back();
+			defines.push_back(define.substr(pos + 1));
+			auto& substr2 = defines.back();
+            macros.push_back({ .Name= substr1.c_str(), .Definition= substr2.c_str() });
+        }
+        else
+        {
+			defines.push_back(define);
+			auto& substr1 = defines.back();
+            macros.push_back({ .Name= substr1.c_str(), .Definition= nullptr});
+        }
+    }
+    macros.push_back({ .Name= nullptr, .Definition= nullptr});
+}
+
 bool D3D11ShaderCompiler::compile(const CompilerInput& input, CompilerOutput& output)
 {
 	UINT flags = D3DCOMPILE_ENABLE_STRICTNESS | D3DCOMPILE_WARNINGS_ARE_ERRORS;
@@ -63,56 +96,57 @@ bool D3D11ShaderCompiler::compile(const CompilerInput& input, CompilerOutput& ou
 	}
 
 	thread_local std::vector<D3D_SHADER_MACRO> macros; // TODO: replace with stack allocator and share with below temp alloc.
-	macros.clear();
-	macros.reserve(input.get_defines().size() + 1);
-
 	// Need to keep in scope for substrings until shader is compiled
 	thread_local std::vector<std::string> defines;
-	defines.clear();
-	defines.reserve(input.get_defines().size() * 2);
-
-    for (const auto& define : input.get_defines())
-    {
-        // Convert the defines into D3D_SHADER_MACRO
-        // Split the string at the first '='
-        size_t pos = define.find('=');
-        if (pos != std::string::npos)
-        {
-			defines.push_back(define.substr(0, pos));
-			auto& substr1 = defines.back();
-			defines.push_back(define.substr(pos + 1));
-			auto& substr2 = defines.back();
-            macros.push_back({ .Name= substr1.c_str(), .Definition= substr2.c_str() });
-        }
-        else
-        {
-			defines.push_back(define);
-			auto& substr1 = defines.back();
-            macros.push_back({ .Name= substr1.c_str(), .Definition= nullptr});
-        }
-    }
-    macros.push_back({ .Name= nullptr, .Definition= nullptr});
+	build_macros(input, macros, defines);
 
 	const auto target = D3DHelper::get_shader_model_char(input.shader_type, input.shader_model);
 
-	MultiIncludeHandler handler(input.includes);
+	MultiIncludeHandler handler(input.includes, m_include_cache, std::filesystem::path(input.get_path()).parent_path());
 
 	ComPtr<ID3DBlob> shader_blob = nullptr;
 	// TODO: d3dcompiler_47.dll should be linked with the application
-	// TODO: custom include handler
 
 	ComPtr<ID3DBlob> error_blob;
-	Utf8To16Scoped path_buffer(input.get_path());
-	const HRESULT hr = D3DCompileFromFile(
-		path_buffer.c_str(),
-		macros.data(),
-		&handler,
-		input.entry_point.c_str(),
-		target.c_str(),
-		flags,
-		0,
-		shader_blob.ReleaseAndGetAddressOf(),
-		error_blob.ReleaseAndGetAddressOf());
+	HRESULT hr;
+	if (m_include_cache)
+	{
+		// Source comes from the shared cache, every permutation of a shader reuses the same copy
+		const auto& input_path = input.get_path();
+		const auto source = m_include_cache->load(input_path);
+		if (!source)
+		{
+			output.error_message = "D3D11ShaderCompiler: Failed to read/open file :: " + std::string(input_path.begin(), input_path.end());
+			return false;
+		}
+		const std::string source_name(input_path.begin(), input_path.end());
+		hr = D3DCompile(
+			source->data(),
+			source->size(),
+			source_name.c_str(),
+			macros.data(),
+			&handler,
+			input.entry_point.c_str(),
+			target.c_str(),
+			flags,
+			0,
+			shader_blob.ReleaseAndGetAddressOf(),
+			error_blob.ReleaseAndGetAddressOf());
+	}
+	else
+	{
+		Utf8To16Scoped path_buffer(input.get_path());
+		hr = D3DCompileFromFile(
+			path_buffer.c_str(),
+			macros.data(),
+			&handler,
+			input.entry_point.c_str(),
+			target.c_str(),
+			flags,
+			0,
+			shader_blob.ReleaseAndGetAddressOf(),
+			error_blob.ReleaseAndGetAddressOf());
+	}
 	if (FAILED(hr))
 	{
 		if (error_blob && error_blob->GetBufferSize() > 0)
@@ -168,6 +202,81 @@ bool D3D11ShaderCompiler::compile(const CompilerInput& input, CompilerOutput& ou
 	return true;
 }
 
+bool D3D11ShaderCompiler::preprocess(const CompilerInput& input, std::string& preprocessed, std::string& error_message)
+{
+	void* data = nullptr;
+	size_t size;
+	const auto& input_path = input.get_path();
+	const std::string* source = m_include_cache ? m_include_cache->load(input_path) : nullptr;
+	if (source)
+	{
+		size = source->size();
+	}
+	else if (m_include_cache || !FileHelper::read_file(input_path.data(), &data, &size))
+	{
+		error_message = "D3D11ShaderCompiler: Failed to read/open file :: " + std::string(input_path.begin(), input_path.end());
+		return false;
+	}
+
+	thread_local std::vector<D3D_SHADER_MACRO> macros;
+	thread_local std::vector<std::string> defines;
+	build_macros(input, macros, defines);
+
+	MultiIncludeHandler handler(input.includes, m_include_cache, std::filesystem::path(input.get_path()).parent_path());
+
+	ComPtr<ID3DBlob> code_blob;
+	ComPtr<ID3DBlob> error_blob;
+	const std::string source_name(input_path.begin(), input_path.end());
+	const HRESULT hr = D3DPreprocess(source ? source->data() : data, size, source_name.c_str(), macros.data(), &handler,
+		code_blob.ReleaseAndGetAddressOf(), error_blob.ReleaseAndGetAddressOf());
+	free(data);
+	if (FAILED(hr))
+	{
+		if (error_blob && error_blob->GetBufferSize() > 0)
+		{
+			error_message = static_cast<char*>(error_blob->GetBufferPointer());
+		}
+		return false;
+	}
+
+	// Blob contains a null terminator
+	preprocessed.assign(static_cast<const char*>(code_blob->GetBufferPointer()), strnlen(
+		static_cast<const char*>(code_blob->GetBufferPointer()), code_blob->GetBufferSize()));
+	return true;
+}
+
+std::string D3D11ShaderCompiler::get_version(ShaderModel shader_model)
+{
+	// Every d3dcompiler_47.dll has the same name, the file version of the loaded one tells builds apart
+	static const std::string version = []
+	{
+		char buffer[128];
+		(void)snprintf(buffer, sizeof(buffer), "d3dcompiler_%d", D3D_COMPILER_VERSION);
+		std::string name = buffer;
+
+		char path[MAX_PATH];
+		if (!get_dll_path(path, sizeof(path)))
+		{
+			return name;
+		}
+		DWORD handle = 0;
+		const auto size = GetFileVersionInfoSizeA(path, &handle);
+		std::vector<uint8_t> info(size);
+		VS_FIXEDFILEINFO* file_info = nullptr;
+		UINT file_info_size = 0;
+		if (size == 0 || !GetFileVersionInfoA(path, 0, size, info.data())
+			|| !VerQueryValueA(info.data(), "\\", reinterpret_cast<void**>(&file_info), &file_info_size) || !file_info)
+		{
+			return name;
+		}
+		(void)snprintf(buffer, sizeof(buffer), "_%u.%u.%u.%u",
+			static_cast<unsigned>(HIWORD(file_info->dwFileVersionMS)), static_cast<unsigned>(LOWORD(file_info->dwFileVersionMS)),
+			static_cast<unsigned>(HIWORD(file_info->dwFileVersionLS)), static_cast<unsigned>(LOWORD(file_info->dwFileVersionLS)));
+		return name + buffer;
+	}();
+	return version;
+}
+
 bool D3D11ShaderCompiler::get_dll_path(char* buffer1, unsigned long buffer_length)
 {
 	assert(buffer1);
@@ -24,11 +24,21 @@ namespace qhenki::gfx
         ComPtr<ID3DBlob> root_signature_blob;
     };
 
+    class IncludeCache;
+
     class D3D11ShaderCompiler : public ShaderCompiler
     {
+    protected:
+        IncludeCache* m_include_cache = nullptr; // Not owned, optional
+
     public:
+        // Shares source and include files with other compilers instead of reading them on every compile. nullptr to disable
+        void set_include_cache(IncludeCache* cache) { m_include_cache = cache; }
+
         static void get_shader_dll_path(char* buffer, size_t buffer_length);
         bool compile(const CompilerInput& input, CompilerOutput& output) override;
+        bool preprocess(const CompilerInput& input, std::string& preprocessed, std::string& error_message) override;
+        std::string get_version(ShaderModel shader_model) override;
         static bool get_dll_path(char* buffer1, unsigned long buffer_length);
     };
 }
@@ -8,6 +8,7 @@
 
 #include <d3d12shader.h>
 #include <d3dcompiler.h>
+#include <fstream>
 
 #include "d3d12_pipeline.h"
 #include "d3d12_shader_compiler.h"
@@ -17,13 +18,44 @@
 #include "d3d12_descriptor_heap.h"
 #include "d3d12_fence.h"
 #include "d3d12_texture.h"
+#include "../mapped_blob.h"
 
 #include "qhenkiX/helper/d3d_helper.h"
 #include "qhenkiX/helper/math_helper.h"
 #include "qhenkiX/helper/string_helper.h"
+#include "qhenkiX/utility/shader_cache.h"
+#include "qhenkiX/utility/shader_hot_reload.h"
+#include "qhenkiX/utility/shader_reflection.h"
 
 using namespace qhenki::gfx;
 
+// Used if GraphicsPipelineDesc::blend_desc is not set
+static D3D12_BLEND_DESC get_default_blend_desc()
+{
+	constexpr D3D12_RENDER_TARGET_BLEND_DESC default_render_target_blend_desc =
+	{
+		FALSE,FALSE,
+		D3D12_BLEND_ONE, D3D12_BLEND_ZERO, D3D12_BLEND_OP_ADD,
+		D3D12_BLEND_ONE, D3D12_BLEND_ZERO, D3D12_BLEND_OP_ADD,
+		D3D12_LOGIC_OP_NOOP,
+		D3D12_COLOR_WRITE_ENABLE_ALL,
+	};
+	D3D12_BLEND_DESC blend_desc{};
+	blend_desc.AlphaToCoverageEnable = FALSE;
+	blend_desc.IndependentBlendEnable = FALSE;
+	for (auto& i : blend_desc.RenderTarget)
+		i = default_render_target_blend_desc;
+	return blend_desc;
+}
+
+// Pipeline layouts are persisted next to the pipeline cache, e.g. pipelines.layouts
+static std::filesystem::path get_layout_cache_path(const std::filesystem::path& pipeline_cache_path)
+{
+	auto path = pipeline_cache_path;
+	path.replace_extension(".layouts");
+	return path;
+}
+
 static D3D12DescriptorHeap* to_internal(const DescriptorHeap& ext)
 {
 	auto d3d12_heap = static_cast<D3D12DescriptorHeap*>(ext.internal_state.get());
@@ -203,8 +235,6 @@ void D3D12Context::create(const bool enable_debug_layer)
 		m_dxgi_debug->EnableLeakTrackingForThread();
 	}
 
-	m_shader_compiler = mkU<D3D12ShaderCompiler>();
-
 	if (FAILED(m_device->CheckFeatureSupport(D3D12_FEATURE_D3D12_OPTIONS, &m_options, sizeof(m_options))))
 	{
 		OutputDebugStringA("Qhenki D3D12 ERROR: Failed to query feature data\n");
@@ -384,13 +414,167 @@ bool D3D12Context::present(Swapchain* const swapchain, const UINT fence_count, F
 	return result == S_OK;
 }
 
+bool D3D12Context::create_shader_from_cache(ShaderCompiler* compiler, const CompilerInput& input, const ShaderCache::Entry& entry,
+	Shader* shader) const
+{
+	if (input.shader_model < ShaderModel::SM_6_0)
+	{
+		auto output = mkS<D3D11ShaderOutput>();
+		auto make_blob = [](const std::vector<uint8_t>& data, ComPtr<ID3DBlob>* blob)
+		{
+			if (FAILED(D3DCreateBlob(data.size(), blob->ReleaseAndGetAddressOf())))
+			{
+				return false;
+			}
+			memcpy((*blob)->GetBufferPointer(), data.data(), data.size());
+			return true;
+		};
+		if (!make_blob(entry.bytecode, &output->shader_blob)
+			|| (!entry.root_signature.empty() && !make_blob(entry.root_signature, &output->root_signature_blob)))
+		{
+			return false;
+		}
+		shader->internal_state = output;
+	}
+	else
+	{
+		const auto d3d12_shader_compiler = static_cast<D3D12ShaderCompiler*>(compiler);
+		auto output = mkS<D3D12ShaderOutput>();
+		auto make_blob = [d3d12_shader_compiler](const std::vector<uint8_t>& data, ComPtr<IDxcBlob>* blob)
+		{
+			ComPtr<IDxcBlobEncoding> encoding;
+			if (FAILED(d3d12_shader_compiler->m_library->CreateBlob(data.data(), static_cast<UINT32>(data.size()), DXC_CP_ACP, &encoding)))
+			{
+				return false;
+			}
+			*blob = encoding;
+			return true;
+		};
+		if (!make_blob(entry.bytecode, &output->shader_blob)
+			|| (!entry.root_signature.empty() && !make_blob(entry.root_signature, &output->root_signature_blob)))
+		{
+			return false;
+		}
+		// Reflection is not stripped from the container, used if the cached record is missing
+		output->reflection_blob = output->shader_blob;
+		shader->internal_state = output;
+	}
+
+	shader->type = input.shader_type;
+	shader->shader_model = input.shader_model;
+	shader->reflection = entry.reflection.empty() ? nullptr
+		: util::ShaderReflectionData::load(entry.reflection.data(), entry.reflection.size());
+	return true;
+}
+
+void D3D12Context::store_shader_in_cache(ShaderCompiler* compiler, const util::Hash128& key, const CompilerInput& input,
+	const std::span<const ShaderCache::Dependency> dependencies, const CompilerOutput& output, Shader* shader) const
+{
+	ShaderCache::Entry entry;
+	const auto bytecode = static_cast<const uint8_t*>(output.shader_data);
+	entry.bytecode.assign(bytecode, bytecode + output.shader_size);
+
+	const auto d3d12_shader_compiler = static_cast<D3D12ShaderCompiler*>(compiler);
+	auto reflection = mkS<util::ShaderReflectionData>();
+	std::string error_message;
+	if (d3d12_shader_compiler->reflect(output.shader_data, output.shader_size, input.shader_model, reflection.get(), error_message))
+	{
+		reflection->serialize(&entry.reflection);
+		// Same reflection a cache hit would get, so pipeline creation does not depend on whether the shader was cached
+		shader->reflection = reflection;
+	}
+
+	// Root signature declared in the shader, see create_pipeline
+	const uint8_t* root_signature = nullptr;
+	size_t root_signature_size = 0;
+	if (input.shader_model < ShaderModel::SM_6_0)
+	{
+		if (const auto& blob = static_cast<D3D11ShaderOutput*>(output.internal_state.get())->root_signature_blob)
+		{
+			root_signature = static_cast<const uint8_t*>(blob->GetBufferPointer());
+			root_signature_size = blob->GetBufferSize();
+		}
+	}
+	else if (const auto& blob = static_cast<D3D12ShaderOutput*>(output.internal_state.get())->root_signature_blob)
+	{
+		root_signature = static_cast<const uint8_t*>(blob->GetBufferPointer());
+		root_signature_size = blob->GetBufferSize();
+	}
+	if (root_signature)
+	{
+		entry.root_signature.assign(root_signature, root_signature + root_signature_size);
+	}
+
+	if (!m_shader_cache->store(key, dependencies, entry))
+	{
+		OutputDebugStringA("Qhenki D3D12 WARNING: Failed to write shader cache entry\n");
+	}
+}
+
+uPtr<ShaderCompiler> D3D12Context::make_shader_compiler()
+{
+	try
+	{
+		return mkU<D3D12ShaderCompiler>();
+	}
+	catch (const std::runtime_error& e)
+	{
+		OutputDebugStringA(("Qhenki D3D12 ERROR: " + std::string(e.what()) + "\n").c_str());
+		return nullptr;
+	}
+}
+
+D3D12ShaderCompiler* D3D12Context::get_shader_compiler()
+{
+	std::scoped_lock lock(m_shader_compiler_mutex);
+	if (!m_shader_compiler)
+	{
+		m_shader_compiler = make_shader_compiler();
+	}
+	return static_cast<D3D12ShaderCompiler*>(m_shader_compiler.get());
+}
+
+D3D12ShaderCompiler* D3D12Context::get_reflector()
+{
+	if (!m_reflector)
+	{
+		m_reflector = make_shader_compiler();
+	}
+	return static_cast<D3D12ShaderCompiler*>(m_reflector.get());
+}
+
 bool D3D12Context::create_shader_dynamic(ShaderCompiler* compiler, Shader* shader, const CompilerInput& input)
 {
 	assert(shader); // Assert that shader pointer is not null
 	if (compiler == nullptr)
 	{
-		compiler = m_shader_compiler.get();
+		compiler = get_shader_compiler();
+		if (compiler == nullptr)
+		{
+			OutputDebugStringA("Qhenki D3D12 ERROR: No shader compiler to compile with\n");
+			return false;
+		}
+	}
+
+	util::Hash128 cache_key;
+	std::vector<ShaderCache::Dependency> dependencies;
+	bool use_cache = m_shader_cache && ShaderCache::is_cacheable(input);
+	if (use_cache)
+	{
+		cache_key = ShaderCache::make_key(input, compiler->get_version(input.shader_model));
+		ShaderCache::Entry entry;
+		if (m_shader_cache->load(cache_key, &entry) && create_shader_from_cache(compiler, input, entry, shader))
+		{
+			if (m_hot_reload)
+			{
+				m_hot_reload->watch_shader(*shader, input);
+			}
+			return true;
+		}
+		// Hashed before compiling, a file saved during the compile must not be stored as the source of the old bytecode
+		use_cache = ShaderCache::collect_dependencies(input, &dependencies);
 	}
+
 	CompilerOutput output = {};
 	if (!compiler->compile(input, output))
 	{
@@ -405,6 +589,221 @@ bool D3D12Context::create_shader_dynamic(ShaderCompiler* compiler, Shader* shade
 		.internal_state = output.internal_state, // IDxcBlob
 	};
 
+	if (use_cache)
+	{
+		store_shader_in_cache(compiler, cache_key, input, dependencies, output, shader);
+	}
+	if (m_hot_reload)
+	{
+		m_hot_reload->watch_shader(*shader, input);
+	}
+	return true;
+}
+
+qhenki::util::Hash128 D3D12Context::make_pipeline_cache_key(const GraphicsPipelineDesc& desc, const Shader& vertex_shader,
+	const Shader& pixel_shader, const PipelineLayout* in_layout, util::Hash128* library_key)
+{
+	assert(library_key);
+	std::string buffer;
+	buffer.reserve(512);
+	auto append = [&buffer]<typename T>(const T& value)
+	{
+		static_assert(std::has_unique_object_representations_v<T> || std::is_floating_point_v<T>);
+		buffer.append(reinterpret_cast<const char*>(&value), sizeof(value));
+	};
+	auto append_blob = [&append](const void* data, const size_t size)
+	{
+		const auto hash = util::HashHelper::hash128(data, size);
+		append(hash.low);
+		append(hash.high);
+	};
+
+	const void* root_signature = nullptr;
+	size_t root_signature_size = 0;
+	append(static_cast<uint32_t>(vertex_shader.shader_model));
+	if (vertex_shader.shader_model < ShaderModel::SM_6_0)
+	{
+		const auto vs11 = static_cast<D3D11ShaderOutput*>(vertex_shader.internal_state.get());
+		const auto ps11 = static_cast<D3D11ShaderOutput*>(pixel_shader.internal_state.get());
+		append_blob(vs11->shader_blob->GetBufferPointer(), vs11->shader_blob->GetBufferSize());
+		append_blob(ps11->shader_blob->GetBufferPointer(), ps11->shader_blob->GetBufferSize());
+		if (vs11->root_signature_blob)
+		{
+			root_signature = vs11->root_signature_blob->GetBufferPointer();
+			root_signature_size = vs11->root_signature_blob->GetBufferSize();
+		}
+	}
+	else
+	{
+		const auto vs12 = static_cast<D3D12ShaderOutput*>(vertex_shader.internal_state.get());
+		const auto ps12 = static_cast<D3D12ShaderOutput*>(pixel_shader.internal_state.get());
+		append_blob(vs12->shader_blob->GetBufferPointer(), vs12->shader_blob->GetBufferSize());
+		append_blob(ps12->shader_blob->GetBufferPointer(), ps12->shader_blob->GetBufferSize());
+		if (vs12->root_signature_blob)
+		{
+			root_signature = vs12->root_signature_blob->GetBufferPointer();
+			root_signature_size = vs12->root_signature_blob->GetBufferSize();
+		}
+	}
+	// The embedded root signature is part of the bytecode, a premade one is only known by its object (see below)
+	append(static_cast<uint8_t>(root_signature != nullptr));
+
+	// The input layout comes from reflecting the vertex shader, desc.input_layout and multisample_desc are not used yet
+	append(static_cast<uint8_t>(desc.increment_slot));
+	append(static_cast<uint32_t>(desc.topology));
+
+	const auto rasterizer = desc.rasterizer_state.value_or(RasterizerDesc{});
+	append(rasterizer.fill_mode);
+	append(rasterizer.cull_mode);
+	append(rasterizer.front_counter_clockwise);
+	append(rasterizer.depth_bias);
+	append(rasterizer.depth_bias_clamp);
+	append(rasterizer.slope_scaled_depth_bias);
+	append(rasterizer.depth_clip_enable);
+
+	const auto blend = desc.blend_desc.value_or(get_default_blend_desc());
+	append(blend.AlphaToCoverageEnable);
+	append(blend.IndependentBlendEnable);
+	// Without independent blend only the first target is used. Deferred pipelines do not know their target count, so
+	// every target is hashed
+	int blend_count = 1;
+	if (blend.IndependentBlendEnable)
+	{
+		blend_count = desc.num_render_targets > 0 ? desc.num_render_targets : D3D12_SIMULTANEOUS_RENDER_TARGET_COUNT;
+	}
+	for (int i = 0; i < blend_count; i++)
+	{
+		const auto& target = blend.RenderTarget[i];
+		append(target.BlendEnable);
+		append(target.LogicOpEnable);
+		if (target.BlendEnable)
+		{
+			append(target.SrcBlend);
+			append(target.DestBlend);
+			append(target.BlendOp);
+			append(target.SrcBlendAlpha);
+			append(target.DestBlendAlpha);
+			append(target.BlendOpAlpha);
+		}
+		if (target.LogicOpEnable)
+		{
+			append(target.LogicOp);
+		}
+		append(target.RenderTargetWriteMask);
+	}
+
+	const auto& depth_stencil = desc.depth_stencil_state;
+	const bool depth_enable = depth_stencil && depth_stencil->depth_enable;
+	const bool stencil_enable = depth_stencil && depth_stencil->stencil_enable;
+	append(static_cast<uint8_t>(depth_enable));
+	append(static_cast<uint8_t>(stencil_enable));
+	if (depth_enable)
+	{
+		append(depth_stencil->depth_write_mask);
+		append(depth_stencil->depth_func);
+	}
+	if (stencil_enable)
+	{
+		append(depth_stencil->stencil_read_mask);
+		append(depth_stencil->stencil_write_mask);
+		for (const auto& face : { depth_stencil->front_face, depth_stencil->back_face })
+		{
+			append(face.StencilFailOp);
+			append(face.StencilDepthFailOp);
+			append(face.StencilPassOp);
+			append(face.StencilFunc);
+		}
+	}
+
+	append(desc.num_render_targets);
+	for (int i = 0; i < desc.num_render_targets; i++)
+	{
+		append(desc.rtv_formats[i]);
+	}
+	append(desc.dsv_format);
+
+	if (root_signature)
+	{
+		append_blob(root_signature, root_signature_size);
+	}
+	*library_key = util::HashHelper::hash128(buffer);
+	if (in_layout)
+	{
+		// Layouts come from m_root_reflection, which shares them and keeps them alive for the context's lifetime,
+		// so the object pointer is a stable key. The library validates the root signature on load
+		append(reinterpret_cast<uintptr_t>(static_cast<ComPtr<ID3D12RootSignature>*>(in_layout->internal_state.get())->Get()));
+	}
+	return util::HashHelper::hash128(buffer);
+}
+
+bool D3D12Context::has_root_signature_part(const std::span<const uint8_t> container)
+{
+	// Header: "DXBC", 16 byte digest, version, total size, part count, followed by the part offsets
+	constexpr uint32_t DXBC_MAGIC = 0x43425844; // DXBC
+	constexpr uint32_t RTS0_FOURCC = 0x30535452; // RTS0
+	constexpr size_t PART_COUNT_OFFSET = 28;
+	auto read_u32 = [&container](const size_t offset, uint32_t* value)
+	{
+		if (offset + sizeof(uint32_t) > container.size())
+		{
+			return false;
+		}
+		memcpy(value, container.data() + offset, sizeof(uint32_t));
+		return true;
+	};
+
+	uint32_t magic, part_count;
+	if (!read_u32(0, &magic) || magic != DXBC_MAGIC || !read_u32(PART_COUNT_OFFSET, &part_count))
+	{
+		return false;
+	}
+	for (uint32_t i = 0; i < part_count; i++)
+	{
+		uint32_t part_offset, fourcc;
+		if (!read_u32(PART_COUNT_OFFSET + sizeof(uint32_t) * (1 + static_cast<size_t>(i)), &part_offset)
+			|| !read_u32(part_offset, &fourcc))
+		{
+			return false;
+		}
+		if (fourcc == RTS0_FOURCC)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+bool D3D12Context::create_precompiled_shader(const PrecompiledShader& precompiled, const ShaderType shader_type,
+	const ShaderModel shader_model, Shader* shader)
+{
+	// CreateRootSignature accepts a whole container with an RTS0 part, so the bytecode doubles as the root signature
+	const bool has_root_signature = has_root_signature_part(precompiled.bytecode);
+	if (shader_model < ShaderModel::SM_6_0)
+	{
+		auto output = mkS<D3D11ShaderOutput>();
+		output->shader_blob = MappedBlob<ID3DBlob>::create(precompiled.owner, precompiled.bytecode);
+		if (has_root_signature)
+		{
+			output->root_signature_blob = output->shader_blob;
+		}
+		shader->internal_state = output;
+	}
+	else
+	{
+		auto output = mkS<D3D12ShaderOutput>();
+		output->shader_blob = MappedBlob<IDxcBlob>::create(precompiled.owner, precompiled.bytecode);
+		// Reflection is not stripped from the container by SXC, used if there is no sidecar
+		output->reflection_blob = output->shader_blob;
+		if (has_root_signature)
+		{
+			output->root_signature_blob = output->shader_blob;
+		}
+		shader->internal_state = output;
+	}
+
+	shader->type = shader_type;
+	shader->shader_model = shader_model;
+	shader->reflection = precompiled.reflection;
 	return true;
 }
 
@@ -444,17 +843,88 @@ std::vector<D3D12_INPUT_ELEMENT_DESC> D3D12Context::shader_reflection(ID3D12Shad
 	return input_element_desc;
 }
 
-void D3D12Context::root_signature_reflection(ID3D12ShaderReflection* shader_reflection, const D3D12_SHADER_DESC& shader_desc)
+std::vector<D3D12_INPUT_ELEMENT_DESC> D3D12Context::input_layout_from_reflection(const util::ShaderReflectionData& reflection,
+	const bool increment_slot)
+{
+	const auto inputs = reflection.get_inputs();
+	std::vector<D3D12_INPUT_ELEMENT_DESC> input_element_desc;
+	input_element_desc.reserve(inputs.size());
+	UINT slot = 0;
+	for (const auto& input : inputs)
+	{
+		input_element_desc.emplace_back(D3D12_INPUT_ELEMENT_DESC
+			{
+				.SemanticName = reflection.get_string(input.semantic),
+				.SemanticIndex = input.semantic_index,
+				.Format = static_cast<DXGI_FORMAT>(input.format),
+				.InputSlot = slot,
+				.AlignedByteOffset = D3D12_APPEND_ALIGNED_ELEMENT,
+				.InputSlotClass = D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA,
+				.InstanceDataStepRate = 0u, // TODO: manual options for instancing
+			});
+		if (increment_slot) slot++;
+	}
+	return input_element_desc;
+}
+
+sPtr<const qhenki::util::ShaderReflectionData> D3D12Context::get_reflection(const Shader& shader)
+{
+	if (shader.reflection)
+	{
+		return shader.reflection;
+	}
+	const void* bytecode;
+	size_t size;
+	if (shader.shader_model < ShaderModel::SM_6_0)
+	{
+		const auto output = static_cast<D3D11ShaderOutput*>(shader.internal_state.get());
+		assert(output);
+		bytecode = output->shader_blob->GetBufferPointer();
+		size = output->shader_blob->GetBufferSize();
+	}
+	else
+	{
+		const auto output = static_cast<D3D12ShaderOutput*>(shader.internal_state.get());
+		assert(output && output->reflection_blob);
+		bytecode = output->reflection_blob->GetBufferPointer();
+		size = output->reflection_blob->GetBufferSize();
+	}
+
+	auto reflection = mkS<util::ShaderReflectionData>();
+	std::string error_message;
+	std::scoped_lock lock(m_reflector_mutex);
+	const auto reflector = get_reflector();
+	if (!reflector)
+	{
+		OutputDebugStringA("Qhenki D3D12 ERROR: Shader has no precomputed reflection and there is no shader compiler to reflect it\n");
+		return nullptr;
+	}
+	if (!reflector->reflect(bytecode, size, shader.shader_model, reflection.get(), error_message))
+	{
+		OutputDebugStringA(("Qhenki D3D12 ERROR: " + error_message + "\n").c_str());
+		return nullptr;
+	}
+	return reflection;
+}
+
+bool D3D12Context::root_signature_reflection(const Shader& vertex_shader, const Shader& pixel_shader,
+	util::CanonicalPipelineLayout* layout)
 {
-	// TODO: finish this
-	assert(false);
-	throw std::runtime_error("D3D12: Root signature reflection not implemented");
-	//D3D12_ROOT_SIGNATURE_DESC root_signature_desc = {};
-	//for (UINT i = 0; i < shader_desc.BoundResources; i++)
-	//{
-	//	D3D12_SHADER_INPUT_BIND_DESC bind_desc = {};
-	//	shader_reflection->GetResourceBindingDesc(i, &bind_desc);
-	//}
+	assert(layout);
+	const auto vs_reflection = get_reflection(vertex_shader);
+	const auto ps_reflection = get_reflection(pixel_shader);
+	if (!vs_reflection || !ps_reflection)
+	{
+		OutputDebugStringA("Qhenki D3D12 ERROR: Failed to reflect shaders for root signature\n");
+		return false;
+	}
+	const std::array<util::CanonicalPipelineLayout::Stage, 2> stages
+	{ {
+		{ vs_reflection.get(), D3D12_SHADER_VISIBILITY_VERTEX },
+		{ ps_reflection.get(), D3D12_SHADER_VISIBILITY_PIXEL },
+	} };
+	*layout = util::CanonicalPipelineLayout::from_reflection(stages);
+	return true;
 }
 
 UINT D3D12Context::GetMaxDescriptorsForHeapType(ID3D12Device* device, D3D12_DESCRIPTOR_HEAP_TYPE type) const
@@ -484,17 +954,34 @@ bool D3D12Context::create_pipeline(const GraphicsPipelineDesc& desc, GraphicsPip
                                    PipelineLayout* in_layout, const char* debug_name)
 {
 	assert(pipeline);
-	pipeline->internal_state = mkS<D3D12Pipeline>();
-
-	const auto d3d12_pipeline = to_internal(*pipeline);
+	assert(vertex_shader.shader_model == pixel_shader.shader_model);
 
-	D3D12_GRAPHICS_PIPELINE_STATE_DESC* pso_desc;
+	// Identical requests share one pipeline (deferred ones share their variants). Pipelines rebuilt by hot reload are
+	// swapped into another, so they are not shared
+	const bool cacheable = !(m_hot_reload && m_hot_reload->is_reload_thread());
+	util::Hash128 cache_key, library_key;
+	if (cacheable)
 	{
-		std::scoped_lock lock(m_pipeline_desc_mutex);
-		pso_desc = m_pipeline_desc_pool.construct();
+		cache_key = make_pipeline_cache_key(desc, vertex_shader, pixel_shader, in_layout, &library_key);
+		std::scoped_lock lock(m_pipeline_cache_mutex);
+		if (const auto it = m_pipeline_cache.find(cache_key); it != m_pipeline_cache.end())
+		{
+			if (auto cached = it->second.lock())
+			{
+				// Already watched by hot reload through the first request
+				pipeline->internal_state = std::move(cached);
+				return true;
+			}
+		}
 	}
 
-	assert(vertex_shader.shader_model == pixel_shader.shader_model);
+	pipeline->internal_state = mkS<D3D12Pipeline>();
+
+	const auto d3d12_pipeline = to_internal(*pipeline);
+
+	// Scratch of this call, so pipelines created on several threads do not contend on shared storage
+	D3D12_GRAPHICS_PIPELINE_STATE_DESC pso_desc_storage{};
+	const auto pso_desc = &pso_desc_storage;
 
 	D3D12ShaderOutput* vs12 = nullptr;
 	D3D11ShaderOutput* vs11 = nullptr;
@@ -507,19 +994,22 @@ bool D3D12Context::create_pipeline(const GraphicsPipelineDesc& desc, GraphicsPip
 		const auto ps11 = static_cast<D3D11ShaderOutput*>(pixel_shader.internal_state.get());
 		assert(vs11);
 		assert(ps11);
-		if (const auto hr = D3DReflect(
-			vs11->shader_blob->GetBufferPointer(),
-			vs11->shader_blob->GetBufferSize(),
-			IID_ID3D12ShaderReflection,
-			&shader_reflection); FAILED(hr))
+		if (!vertex_shader.reflection)
 		{
-			OutputDebugStringA("Qhenki D3D12 ERROR: Failed to reflect vertex shader\n");
-			return false;
+			if (const auto hr = D3DReflect(
+				vs11->shader_blob->GetBufferPointer(),
+				vs11->shader_blob->GetBufferSize(),
+				IID_ID3D12ShaderReflection,
+				&shader_reflection); FAILED(hr))
+			{
+				OutputDebugStringA("Qhenki D3D12 ERROR: Failed to reflect vertex shader\n");
+				return false;
+			}
+			const auto hr_d = shader_reflection->GetDesc(&shader_desc);
+			assert(SUCCEEDED(hr_d));
+			// Input reflection (VS)
+			d3d12_pipeline->input_layout_desc = this->shader_reflection(shader_reflection.Get(), shader_desc, desc.increment_slot);
 		}
-		const auto hr_d = shader_reflection->GetDesc(&shader_desc);
-		assert(SUCCEEDED(hr_d));
-		// Input reflection (VS)
-		d3d12_pipeline->input_layout_desc = this->shader_reflection(shader_reflection.Get(), shader_desc, desc.increment_slot);
 
 		pso_desc->VS =
 		{
@@ -538,27 +1028,36 @@ bool D3D12Context::create_pipeline(const GraphicsPipelineDesc& desc, GraphicsPip
 		const auto ps12 = static_cast<D3D12ShaderOutput*>(pixel_shader.internal_state.get());
 		assert(vs12);
 		assert(ps12);
-		const auto& vs_reflection_buffer_12 = vs12->reflection_blob;
-
-		const DxcBuffer vs_reflection_dxc_buffer =
+		if (!vertex_shader.reflection)
 		{
-			vs_reflection_buffer_12->GetBufferPointer(),
-			vs_reflection_buffer_12->GetBufferSize(),
-			0
-		};
-		const auto d3d12_shader_compiler = static_cast<D3D12ShaderCompiler*>(m_shader_compiler.get());
-		assert(d3d12_shader_compiler);
+			const auto& vs_reflection_buffer_12 = vs12->reflection_blob;
 
-		if (const auto hr = d3d12_shader_compiler->m_library->CreateReflection(&vs_reflection_dxc_buffer, 
-			IID_PPV_ARGS(&shader_reflection)); FAILED(hr))
-		{
-			OutputDebugStringA("Qhenki D3D12 ERROR: Failed to reflect vertex shader\n");
-			return false;
+			const DxcBuffer vs_reflection_dxc_buffer =
+			{
+				vs_reflection_buffer_12->GetBufferPointer(),
+				vs_reflection_buffer_12->GetBufferSize(),
+				0
+			};
+			{
+				std::scoped_lock lock(m_reflector_mutex);
+				const auto reflector = get_reflector();
+				if (!reflector)
+				{
+					OutputDebugStringA("Qhenki D3D12 ERROR: Vertex shader has no precomputed reflection and there is no shader compiler to reflect it\n");
+					return false;
+				}
+				if (const auto hr = reflector->m_library->CreateReflection(&vs_reflection_dxc_buffer,
+					IID_PPV_ARGS(&shader_reflection)); FAILED(hr))
+				{
+					OutputDebugStringA("Qhenki D3D12 ERROR: Failed to reflect vertex shader\n");
+					return false;
+				}
+			}
+			// Input reflection (VS)
+			const auto hr_d = shader_reflection->GetDesc(&shader_desc);
+			assert(SUCCEEDED(hr_d));
+			d3d12_pipeline->input_layout_desc = this->shader_reflection(shader_reflection.Get(), shader_desc, desc.increment_slot);
 		}
-		// Input reflection (VS)
-		const auto hr_d = shader_reflection->GetDesc(&shader_desc);
-		assert(SUCCEEDED(hr_d));
-		d3d12_pipeline->input_layout_desc = this->shader_reflection(shader_reflection.Get(), shader_desc, desc.increment_slot);
 
 		pso_desc->VS =
 		{
@@ -572,6 +1071,13 @@ bool D3D12Context::create_pipeline(const GraphicsPipelineDesc& desc, GraphicsPip
 		};
 	}
 
+	if (vertex_shader.reflection)
+	{
+		// Precomputed by SXC. The pipeline keeps the reflection alive since the elements point at its semantic names
+		d3d12_pipeline->reflection = vertex_shader.reflection;
+		d3d12_pipeline->input_layout_desc = input_layout_from_reflection(*vertex_shader.reflection, desc.increment_slot);
+	}
+
 	const auto& input_layout_desc = d3d12_pipeline->input_layout_desc;
 	pso_desc->InputLayout =
 	{
@@ -608,7 +1114,16 @@ bool D3D12Context::create_pipeline(const GraphicsPipelineDesc& desc, GraphicsPip
 	}
 	else // Create new root signature using reflection
 	{
-		root_signature_reflection(shader_reflection.Get(), shader_desc);
+		util::CanonicalPipelineLayout layout;
+		if (!root_signature_reflection(vertex_shader, pixel_shader, &layout))
+		{
+			return false;
+		}
+		pso_desc->pRootSignature = create_root_signature(layout);
+		if (!pso_desc->pRootSignature)
+		{
+			return false;
+		}
 	}
 
 	auto make_d3d12_rasterizer_desc = [](const RasterizerDesc& r)
@@ -631,25 +1146,7 @@ bool D3D12Context::create_pipeline(const GraphicsPipelineDesc& desc, GraphicsPip
 
 	pso_desc->RasterizerState = make_d3d12_rasterizer_desc(desc.rasterizer_state.value_or(RasterizerDesc{}));
 
-	if (desc.blend_desc.has_value())
-	{
-		pso_desc->BlendState = *desc.blend_desc;
-	}
-	else
-	{
-		pso_desc->BlendState.AlphaToCoverageEnable = FALSE;
-		pso_desc->BlendState.IndependentBlendEnable = FALSE;
-		constexpr D3D12_RENDER_TARGET_BLEND_DESC default_render_target_blend_desc =
-		{
-			FALSE,FALSE,
-			D3D12_BLEND_ONE, D3D12_BLEND_ZERO, D3D12_BLEND_OP_ADD,
-			D3D12_BLEND_ONE, D3D12_BLEND_ZERO, D3D12_BLEND_OP_ADD,
-			D3D12_LOGIC_OP_NOOP,
-			D3D12_COLOR_WRITE_ENABLE_ALL,
-		};
-		for (auto& i : pso_desc->BlendState.RenderTarget)
-			i = default_render_target_blend_desc;
-	}
+	pso_desc->BlendState = desc.blend_desc.value_or(get_default_blend_desc());
 
 	if (desc.depth_stencil_state.has_value())
 	{
@@ -703,8 +1200,19 @@ bool D3D12Context::create_pipeline(const GraphicsPipelineDesc& desc, GraphicsPip
 
 	if (desc.num_render_targets < 1)
 	{
-		OutputDebugStringA("Qhenki D3D12 WARNING: Pipeline creation deferred due to lack of targets\n");
-		d3d12_pipeline->deferred = true;
+		// Completed for the targets it is drawn to, the description keeps what it points at alive
+		auto deferred = mkS<D3D12DeferredPipeline>();
+		deferred->desc = *pso_desc;
+		deferred->input_layout_desc = std::move(d3d12_pipeline->input_layout_desc);
+		deferred->reflection = std::move(d3d12_pipeline->reflection);
+		deferred->desc.InputLayout.pInputElementDescs = deferred->input_layout_desc.data();
+		deferred->vertex_shader = vertex_shader.internal_state;
+		deferred->pixel_shader = pixel_shader.internal_state;
+		deferred->root_signature = pso_desc->pRootSignature;
+		deferred->default_dsv_format = desc.dsv_format;
+		deferred->debug_name = debug_name ? debug_name : "";
+		d3d12_pipeline->input_layout_desc.clear();
+		d3d12_pipeline->deferred = std::move(deferred);
 	}
 	else
 	{
@@ -713,19 +1221,54 @@ bool D3D12Context::create_pipeline(const GraphicsPipelineDesc& desc, GraphicsPip
 			pso_desc->RTVFormats[i] = desc.rtv_formats[i];
 		}
 		pso_desc->DSVFormat = desc.dsv_format;
-		if (const auto hr = m_device->CreateGraphicsPipelineState(pso_desc, 
-			IID_PPV_ARGS(&d3d12_pipeline->pipeline_state)); FAILED(hr))
+
+		const auto library_key_hex = library_key.to_hex();
+		const std::wstring library_name(library_key_hex.begin(), library_key_hex.end());
+		// Pipeline libraries are free threaded, only storing and serializing is serialized (see m_pipeline_cache_mutex).
+		// Loading fails if the state is not stored or was stored with another root signature
+		const bool loaded = cacheable && m_pipeline_library && SUCCEEDED(m_pipeline_library->LoadGraphicsPipeline(
+			library_name.c_str(), pso_desc, IID_PPV_ARGS(&d3d12_pipeline->pipeline_state)));
+		if (!loaded)
 		{
-			OutputDebugStringA("Qhenki D3D12 ERROR: Failed to create Graphics Pipeline State\n");
-			return false;
+			if (const auto hr = m_device->CreateGraphicsPipelineState(pso_desc,
+				IID_PPV_ARGS(&d3d12_pipeline->pipeline_state)); FAILED(hr))
+			{
+				OutputDebugStringA("Qhenki D3D12 ERROR: Failed to create Graphics Pipeline State\n");
+				return false;
+			}
+		}
+
+		if (cacheable)
+		{
+			std::scoped_lock lock(m_pipeline_cache_mutex);
+			// Storing fails if the name is taken by a state with another root signature, that one stays persisted
+			if (!loaded && m_pipeline_library && SUCCEEDED(m_pipeline_library->StorePipeline(library_name.c_str(),
+				d3d12_pipeline->pipeline_state.Get())))
+			{
+				m_pipeline_library_dirty = true;
+			}
 		}
 		d3d12_pipeline->input_layout_desc.clear();
-		// Free description
-		std::scoped_lock lock(m_pipeline_desc_mutex);
-		m_pipeline_desc_pool.destroy(pso_desc);
+		d3d12_pipeline->reflection.reset();
 	}
 
-	if (debug_name)
+	if (cacheable)
+	{
+		std::scoped_lock lock(m_pipeline_cache_mutex);
+		if (m_pipeline_cache.size() >= m_pipeline_cache_prune_size)
+		{
+			for (auto it = m_pipeline_cache.begin(); it != m_pipeline_cache.end();)
+			{
+				it = it->second.expired() ? m_pipeline_cache.erase(it) : std::next(it);
+			}
+			m_pipeline_cache_prune_size = std::max<size_t>(64, m_pipeline_cache.size() * 2);
+		}
+		d3d12_pipeline->cached = true;
+		d3d12_pipeline->cache_key = cache_key;
+		m_pipeline_cache.insert_or_assign(cache_key, std::static_pointer_cast<D3D12Pipeline>(pipeline->internal_state));
+	}
+
+	if (debug_name && d3d12_pipeline->pipeline_state) // Variants of deferred pipelines are named when compiled
 	{
 		util::Utf8To16Scoped debug_name_utf8(debug_name);
 		if (FAILED(d3d12_pipeline->pipeline_state->SetName(debug_name_utf8.c_str())))
@@ -734,6 +1277,10 @@ bool D3D12Context::create_pipeline(const GraphicsPipelineDesc& desc, GraphicsPip
 		}
 	}
 
+	if (m_hot_reload)
+	{
+		m_hot_reload->watch_pipeline(*pipeline, desc, vertex_shader, pixel_shader, in_layout, debug_name);
+	}
 	return true;
 }
 
@@ -741,85 +1288,377 @@ bool D3D12Context::bind_pipeline(CommandList* cmd_list, const GraphicsPipeline&
 {
 	assert(cmd_list);
 	const auto d3d12_pipeline = to_internal(pipeline);
-	if (d3d12_pipeline->deferred)
-	{
-		// Set current render target info and create the pipeline
-		assert(false);
-		// Issue a warning that the pipeline was deferred
-		OutputDebugStringA("Qhenki D3D12 WARNING: Deferred pipeline compilation\n");
-		assert(d3d12_pipeline->input_layout_desc.empty());
-	}
 
 	const auto cmd_list_d3d12 = to_internal(*cmd_list);
 	cmd_list_d3d12->Get()->IASetPrimitiveTopology(d3d12_pipeline->primitive_topology);
-	cmd_list_d3d12->Get()->SetPipelineState(d3d12_pipeline->pipeline_state.Get());
+	// The state of a deferred pipeline depends on the targets, so it is set by the next draw
+	cmd_list->m_deferred_pipeline = d3d12_pipeline->deferred;
+	cmd_list->m_deferred_pipeline_set = false;
+	if (!d3d12_pipeline->deferred)
+	{
+		cmd_list_d3d12->Get()->SetPipelineState(d3d12_pipeline->pipeline_state.Get());
+	}
+
+	return true;
+}
+
+bool D3D12Context::set_deferred_pipeline_state(CommandList* cmd_list)
+{
+	if (!cmd_list->m_deferred_pipeline || cmd_list->m_deferred_pipeline_set)
+	{
+		return true;
+	}
+	auto deferred = std::static_pointer_cast<D3D12DeferredPipeline>(cmd_list->m_deferred_pipeline);
+
+	D3D12TargetFormats formats{ .rtv_count = cmd_list->m_rtv_count };
+	std::copy_n(cmd_list->m_rtv_formats.begin(), formats.rtv_count, formats.rtv_formats.begin());
+	if (cmd_list->m_has_depth_stencil)
+	{
+		formats.dsv_format = cmd_list->m_dsv_format != DXGI_FORMAT_UNKNOWN ? cmd_list->m_dsv_format : deferred->default_dsv_format;
+	}
+
+	sPtr<D3D12PipelineVariant> variant;
+	bool compile = false;
+	{
+		std::scoped_lock lock(deferred->variant_mutex);
+		auto& entry = deferred->variants[formats];
+		if (!entry)
+		{
+			entry = mkS<D3D12PipelineVariant>();
+			compile = true;
+		}
+		variant = entry;
+	}
+	if (compile)
+	{
+		get_async_jobs()->submit([this, deferred, variant, formats](uint32_t)
+		{
+			auto pso_desc = deferred->desc;
+			pso_desc.NumRenderTargets = formats.rtv_count;
+			std::copy_n(formats.rtv_formats.begin(), formats.rtv_count, pso_desc.RTVFormats);
+			pso_desc.DSVFormat = formats.dsv_format;
+			if (FAILED(m_device->CreateGraphicsPipelineState(&pso_desc, IID_PPV_ARGS(&variant->pipeline_state))))
+			{
+				OutputDebugStringA("Qhenki D3D12 ERROR: Failed to create Graphics Pipeline State of deferred pipeline\n");
+				deferred->failed.store(true, std::memory_order_release);
+				variant->status.store(AsyncStatus::FAILED, std::memory_order_release);
+				return;
+			}
+			if (!deferred->debug_name.empty())
+			{
+				util::Utf8To16Scoped debug_name_utf8(deferred->debug_name.c_str());
+				if (FAILED(variant->pipeline_state->SetName(debug_name_utf8.c_str())))
+				{
+					OutputDebugStringA("Qhenki D3D12 ERROR: Failed to set pipeline debug name\n");
+				}
+			}
+			variant->status.store(AsyncStatus::SUCCEEDED, std::memory_order_release);
+		});
+	}
+
+	// Draws are skipped until the variant is compiled. Compiling the same desc again would fail again, so a failed
+	// variant is reported by the first draw and stays failed until the pipeline is replaced (see has_pipeline_failed)
+	const auto status = variant->status.load(std::memory_order_acquire);
+	if (status != AsyncStatus::SUCCEEDED)
+	{
+		if (status == AsyncStatus::FAILED && !variant->reported.exchange(true, std::memory_order_relaxed))
+		{
+			OutputDebugStringA(("Qhenki D3D12 ERROR: Deferred pipeline \"" + deferred->debug_name
+				+ "\" failed to compile for the bound targets, its draws are skipped\n").c_str());
+		}
+		return false;
+	}
+	to_internal(*cmd_list)->Get()->SetPipelineState(variant->pipeline_state.Get());
+	cmd_list->m_deferred_pipeline_set = true;
+	return true;
+}
+
+bool D3D12Context::has_pipeline_failed(const GraphicsPipeline& pipeline) const
+{
+	const auto d3d12_pipeline = to_internal(pipeline);
+	return d3d12_pipeline->deferred && d3d12_pipeline->deferred->failed.load(std::memory_order_acquire);
+}
+
+void D3D12Context::swap_pipelines(GraphicsPipeline* a, GraphicsPipeline* b)
+{
+	assert(a && b);
+	std::scoped_lock lock(m_pipeline_cache_mutex);
+	std::swap(*to_internal(*a), *to_internal(*b));
+	// The cache keys moved with the contents, so each key has to refer to the object now holding its pipeline state
+	for (const auto pipeline : { a, b })
+	{
+		if (const auto d3d12_pipeline = std::static_pointer_cast<D3D12Pipeline>(pipeline->internal_state); d3d12_pipeline->cached)
+		{
+			m_pipeline_cache.insert_or_assign(d3d12_pipeline->cache_key, d3d12_pipeline);
+		}
+	}
+}
+
+bool D3D12Context::load_pipeline_cache(const std::filesystem::path& path)
+{
+	// Root signature blobs do not depend on the adapter, so they are used even without pipeline libraries
+	m_layout_cache.load(get_layout_cache_path(path));
+
+	ComPtr<ID3D12Device1> device1;
+	if (FAILED(m_device.As(&device1)))
+	{
+		OutputDebugStringA("Qhenki D3D12 WARNING: Pipeline libraries are not supported, pipeline states are not cached on disk\n");
+		return false;
+	}
+
+	std::scoped_lock lock(m_pipeline_cache_mutex);
+	m_pipeline_library.Reset();
+	m_pipeline_library_data.clear();
+	m_pipeline_library_dirty = false;
+	if (std::ifstream file(path, std::ios::binary | std::ios::ate); file)
+	{
+		m_pipeline_library_data.resize(static_cast<size_t>(file.tellg()));
+		file.seekg(0);
+		if (!file.read(reinterpret_cast<char*>(m_pipeline_library_data.data()), static_cast<std::streamsize>(m_pipeline_library_data.size())))
+		{
+			m_pipeline_library_data.clear();
+		}
+	}
+	if (!m_pipeline_library_data.empty())
+	{
+		// Fails for another adapter or driver version, the states are compiled again then
+		if (FAILED(device1->CreatePipelineLibrary(m_pipeline_library_data.data(), m_pipeline_library_data.size(),
+			IID_PPV_ARGS(&m_pipeline_library))))
+		{
+			OutputDebugStringA("Qhenki D3D12 WARNING: Discarding outdated pipeline cache\n");
+			m_pipeline_library_data.clear();
+		}
+	}
+	if (!m_pipeline_library && FAILED(device1->CreatePipelineLibrary(nullptr, 0, IID_PPV_ARGS(&m_pipeline_library))))
+	{
+		OutputDebugStringA("Qhenki D3D12 ERROR: Failed to create pipeline library\n");
+		return false;
+	}
+	return true;
+}
+
+bool D3D12Context::save_pipeline_cache(const std::filesystem::path& path)
+{
+	if (!m_layout_cache.save(get_layout_cache_path(path)))
+	{
+		OutputDebugStringA("Qhenki D3D12 ERROR: Failed to write pipeline layout cache\n");
+	}
+
+	std::scoped_lock lock(m_pipeline_cache_mutex);
+	if (!m_pipeline_library)
+	{
+		return false;
+	}
+	if (!m_pipeline_library_dirty)
+	{
+		return true;
+	}
 
+	std::vector<uint8_t> data(m_pipeline_library->GetSerializedSize());
+	if (FAILED(m_pipeline_library->Serialize(data.data(), data.size())))
+	{
+		OutputDebugStringA("Qhenki D3D12 ERROR: Failed to serialize pipeline library\n");
+		return false;
+	}
+	// Written next to the file and renamed over it, so a crash while writing does not leave a truncated cache
+	auto temp_path = path;
+	temp_path += ".tmp";
+	{
+		std::ofstream file(temp_path, std::ios::binary | std::ios::trunc);
+		if (!file.write(reinterpret_cast<const char*>(data.data()), static_cast<std::streamsize>(data.size())))
+		{
+			OutputDebugStringA("Qhenki D3D12 ERROR: Failed to write pipeline cache\n");
+			return false;
+		}
+	}
+	std::error_code ec;
+	std::filesystem::rename(temp_path, path, ec);
+	if (ec)
+	{
+		OutputDebugStringA("Qhenki D3D12 ERROR: Failed to write pipeline cache\n");
+		return false;
+	}
+	m_pipeline_library_dirty = false;
 	return true;
 }
 
 bool D3D12Context::create_pipeline_layout(PipelineLayoutDesc* const desc, PipelineLayout* const layout)
+{
+	assert(desc && layout);
+	util::CanonicalPipelineLayout canonical;
+	for (const auto& range : desc->push_ranges)
+	{
+		canonical.add_push_range(range.size, range.binding);
+	}
+	for (unsigned i = 0; i < desc->spaces.size(); i++)
+	{
+		std::vector<util::CanonicalPipelineLayout::Binding> bindings;
+		bindings.reserve(desc->spaces[i].size());
+		for (const auto& binding : desc->spaces[i])
+		{
+			bindings.push_back({ binding.binding, static_cast<uint32_t>(binding.type), binding.count });
+		}
+		canonical.add_space(i, std::move(bindings));
+	}
+
+	const auto root_signature = create_root_signature(canonical);
+	if (!root_signature)
+	{
+		return false;
+	}
+	layout->internal_state = mkS<ComPtr<ID3D12RootSignature>>(root_signature);
+	return true;
+}
+
+bool D3D12Context::create_pipeline_layout(const Shader& vertex_shader, const Shader& pixel_shader, PipelineLayout* const layout,
+	std::vector<PipelineLayoutParameter>* const parameters)
 {
 	assert(layout);
-	auto count_non_empty = [](const std::array<std::vector<LayoutBinding>, MAX_SPACES>& spaces)
+	util::CanonicalPipelineLayout canonical;
+	if (!root_signature_reflection(vertex_shader, pixel_shader, &canonical))
+	{
+		return false;
+	}
+	const auto root_signature = create_root_signature(canonical);
+	if (!root_signature)
+	{
+		return false;
+	}
+	layout->internal_state = mkS<ComPtr<ID3D12RootSignature>>(root_signature);
+
+	if (parameters)
+	{
+		// Same order as the root parameters, see serialize_root_signature
+		parameters->clear();
+		for (const auto& range : canonical.push_ranges)
 		{
-		unsigned count = 0;
-		for (const auto& space : spaces)
+			parameters->push_back(
+			{
+				.type = PipelineLayoutParameterType::CONSTANTS,
+				.visibility = static_cast<D3D12_SHADER_VISIBILITY>(range.visibility),
+				.space = range.space,
+				.binding = range.binding,
+				.size = range.num_values * 4,
+			});
+		}
+		for (const auto& descriptor : canonical.root_descriptors)
 		{
-			if (!space.empty()) count++;
+			parameters->push_back(
+			{
+				.type = PipelineLayoutParameterType::CONSTANT_BUFFER,
+				.visibility = static_cast<D3D12_SHADER_VISIBILITY>(descriptor.visibility),
+				.space = descriptor.space,
+				.binding = descriptor.binding,
+				.size = 0,
+			});
 		}
-		return count;
-		};
-	const auto spaces = count_non_empty(desc->spaces);
+		for (const auto& table : canonical.tables)
+		{
+			PipelineLayoutParameter parameter
+			{
+				.type = PipelineLayoutParameterType::DESCRIPTOR_TABLE,
+				.visibility = static_cast<D3D12_SHADER_VISIBILITY>(table.visibility),
+				.space = table.space,
+				.binding = table.bindings.front().binding,
+				.size = 0,
+			};
+			parameter.bindings.reserve(table.bindings.size());
+			for (const auto& binding : table.bindings)
+			{
+				parameter.bindings.push_back({ binding.binding, binding.count, static_cast<D3D12_DESCRIPTOR_RANGE_TYPE>(binding.type) });
+			}
+			parameters->push_back(std::move(parameter));
+		}
+	}
+	return true;
+}
 
-	const UINT param_count = desc->push_ranges.size() + spaces;
-	
-	std::array<D3D12_ROOT_PARAMETER, 16> params; // TODO: replace with small vector
+ID3D12RootSignature* D3D12Context::create_root_signature(const util::CanonicalPipelineLayout& layout)
+{
+	// Identical layouts skip serialization and share one root signature through the root hasher
+	std::vector<uint8_t> root_sig_data;
+	if (!m_layout_cache.find(layout, &root_sig_data))
+	{
+		if (!serialize_root_signature(layout, &root_sig_data))
+		{
+			return nullptr;
+		}
+		m_layout_cache.store(layout, root_sig_data);
+	}
+
+	const auto root_signature = m_root_reflection.add_root_signature(m_device.Get(), root_sig_data.data(), root_sig_data.size());
+	if (!root_signature)
+	{
+		OutputDebugStringA("Qhenki D3D12 ERROR: Failed to create root signature\n");
+	}
+	return root_signature;
+}
+
+bool D3D12Context::serialize_root_signature(const util::CanonicalPipelineLayout& layout, std::vector<uint8_t>* blob)
+{
+	// Deny flags are stored as D3D values, one bit per stage in visibility order
+	static_assert(util::CanonicalPipelineLayout::DENY_VERTEX_ROOT_ACCESS == D3D12_ROOT_SIGNATURE_FLAG_DENY_VERTEX_SHADER_ROOT_ACCESS);
+	static_assert(util::CanonicalPipelineLayout::DENY_VERTEX_ROOT_ACCESS << (D3D12_SHADER_VISIBILITY_PIXEL - D3D12_SHADER_VISIBILITY_VERTEX)
+		== D3D12_ROOT_SIGNATURE_FLAG_DENY_PIXEL_SHADER_ROOT_ACCESS);
+	if (layout.get_root_size() > util::CanonicalPipelineLayout::MAX_ROOT_SIZE)
+	{
+		OutputDebugStringA("Qhenki D3D12 ERROR: Root signature exceeds 64 DWORDs\n");
+		return false;
+	}
+	const UINT param_count = static_cast<UINT>(layout.push_ranges.size() + layout.root_descriptors.size() + layout.tables.size());
+
+	std::array<D3D12_ROOT_PARAMETER, util::CanonicalPipelineLayout::MAX_ROOT_SIZE> params; // Every parameter costs at least one DWORD
 	assert(param_count <= params.size());
 
 	int param_index = 0;
-	for (unsigned i = 0; i < desc->push_ranges.size(); i++)
+	for (const auto& range : layout.push_ranges)
 	{
-		const auto& range = desc->push_ranges[i];
 		params[param_index++] =
 		{
 			.ParameterType = D3D12_ROOT_PARAMETER_TYPE_32BIT_CONSTANTS,
 			.Constants =
 			{
 				.ShaderRegister = range.binding,
-				.RegisterSpace = 5, // TODO: change this to not be hardcoded
-				.Num32BitValues = (range.size + 3) / 4, // Bytes to 32-bit words conversion rounded up
+				.RegisterSpace = range.space,
+				.Num32BitValues = range.num_values,
+			},
+			.ShaderVisibility = static_cast<D3D12_SHADER_VISIBILITY>(range.visibility),
+		};
+	}
+
+	for (const auto& descriptor : layout.root_descriptors)
+	{
+		params[param_index++] =
+		{
+			.ParameterType = D3D12_ROOT_PARAMETER_TYPE_CBV,
+			.Descriptor =
+			{
+				.ShaderRegister = descriptor.binding,
+				.RegisterSpace = descriptor.space,
 			},
-			.ShaderVisibility = D3D12_SHADER_VISIBILITY_ALL,
+			.ShaderVisibility = static_cast<D3D12_SHADER_VISIBILITY>(descriptor.visibility),
 		};
 	}
 
 	std::vector<std::vector<D3D12_DESCRIPTOR_RANGE>> ranges;
-	ranges.reserve(desc->spaces.size());
-	for (unsigned i = 0; i < desc->spaces.size(); i++)
+	ranges.reserve(layout.tables.size());
+	for (const auto& table : layout.tables)
 	{
-		auto& space = desc->spaces[i];
-		if (space.empty()) continue;
-		// Sort vector of LayoutBindings by binding register
-		std::ranges::sort(space,
-	      [](const LayoutBinding& a, const LayoutBinding& b)
-	      {
-	          return a.binding < b.binding;
-	      });
-		// Assemble ranges dynamically
+		// Bindings are sorted by register, assemble ranges dynamically
 		std::vector<D3D12_DESCRIPTOR_RANGE> l_ranges; // TODO: Replace with small vector
-		l_ranges.reserve(space.size());
+		l_ranges.reserve(table.bindings.size());
 		unsigned offset = 0;
-		for (unsigned j = 0; j < space.size(); j++)
+		for (unsigned j = 0; j < table.bindings.size(); j++)
 		{
-			const auto& binding = space[j];
+			const auto& binding = table.bindings[j];
 			// Check that this is not the last binding and not infinite register count
-			assert(j == space.size() - 1 || binding.count != INFINITE_DESCRIPTORS);
+			assert(j == table.bindings.size() - 1 || binding.count != INFINITE_DESCRIPTORS);
 			D3D12_DESCRIPTOR_RANGE range
 			{
-				.RangeType = binding.type,
+				.RangeType = static_cast<D3D12_DESCRIPTOR_RANGE_TYPE>(binding.type),
 				.NumDescriptors = binding.count,
 				.BaseShaderRegister = binding.binding,
-				.RegisterSpace = i,
+				.RegisterSpace = table.space,
 				.OffsetInDescriptorsFromTableStart = offset,
 			};
 			offset += binding.count;
@@ -833,7 +1672,7 @@ bool D3D12Context::create_pipeline_layout(PipelineLayoutDesc* const desc, Pipeli
 				.NumDescriptorRanges = static_cast<UINT>(l_ranges.size()),
 				.pDescriptorRanges = l_ranges.data(),
 			},
-			.ShaderVisibility = D3D12_SHADER_VISIBILITY_ALL,
+			.ShaderVisibility = static_cast<D3D12_SHADER_VISIBILITY>(table.visibility),
 		};
 		ranges.emplace_back(std::move(l_ranges));
 	}
@@ -843,7 +1682,8 @@ bool D3D12Context::create_pipeline_layout(PipelineLayoutDesc* const desc, Pipeli
 		// Default range flags
 		.NumParameters = param_count,
 		.pParameters = params.data(),
-		.Flags = D3D12_ROOT_SIGNATURE_FLAG_ALLOW_INPUT_ASSEMBLER_INPUT_LAYOUT,
+		.Flags = D3D12_ROOT_SIGNATURE_FLAG_ALLOW_INPUT_ASSEMBLER_INPUT_LAYOUT
+			| static_cast<D3D12_ROOT_SIGNATURE_FLAGS>(layout.deny_flags),
 	};
 
 	ComPtr<ID3DBlob> root_sig_blob, error_blob;
@@ -859,18 +1699,8 @@ bool D3D12Context::create_pipeline_layout(PipelineLayoutDesc* const desc, Pipeli
 		}
 		return false;
 	}
-	const void* root_sig_data = root_sig_blob->GetBufferPointer();
-	size_t root_sig_data_size = root_sig_blob->GetBufferSize();
-
-	layout->internal_state = mkS<ComPtr<ID3D12RootSignature>>();
-	auto& root_signature = *static_cast<ComPtr<ID3D12RootSignature>*>(layout->internal_state.get());
-	if(FAILED(m_device->CreateRootSignature(0, root_sig_data, root_sig_data_size,
-		IID_PPV_ARGS(root_signature.ReleaseAndGetAddressOf()))))
-	{
-		OutputDebugStringA("Qhenki D3D12 ERROR: Failed to create root signature\n");
-		return false;
-	}
-
+	const auto data = static_cast<const uint8_t*>(root_sig_blob->GetBufferPointer());
+	blob->assign(data, data + root_sig_blob->GetBufferSize());
 	return true;
 }
 
@@ -901,6 +1731,15 @@ bool D3D12Context::set_pipeline_constant(CommandList* cmd_list, UINT param, UINT
 	return true;
 }
 
+void D3D12Context::set_pipeline_constant_buffer(CommandList* cmd_list, const UINT param, const Buffer& buffer, const uint64_t offset)
+{
+	assert(cmd_list);
+	assert(offset % D3D12_CONSTANT_BUFFER_DATA_PLACEMENT_ALIGNMENT == 0);
+	const auto cmd_list_d3d12 = to_internal(*cmd_list);
+	const auto buffer_d3d12 = to_internal(buffer);
+	cmd_list_d3d12->Get()->SetGraphicsRootConstantBufferView(param, buffer_d3d12->Get()->GetResource()->GetGPUVirtualAddress() + offset);
+}
+
 bool D3D12Context::create_descriptor_heap(const DescriptorHeapDesc& desc, DescriptorHeap* const heap, const char* debug_name)
 {
 	assert(heap);
@@ -1777,28 +2616,73 @@ void D3D12Context::start_render_pass(CommandList* cmd_list, Swapchain* const swa
 	command_list->ClearRenderTargetView(rtv_handle, clear_color_values, 0, nullptr);
 	if (depth_stencil)
 	{
-		if (depth_stencil->clear_type != RenderTarget::None)
-		{
-			D3D12_CLEAR_FLAGS clear_flags = static_cast<D3D12_CLEAR_FLAGS>(0);
-			if (depth_stencil->clear_type & RenderTarget::Depth)
-			{
-				clear_flags |= D3D12_CLEAR_FLAG_DEPTH;
-			}
-			if (depth_stencil->clear_type & RenderTarget::Stencil)
-			{
-				clear_flags |= D3D12_CLEAR_FLAG_STENCIL;
-			}
-			assert(clear_flags);
-			auto [clear_depth_value, clear_stencil_value] = depth_stencil->clear_params.dsv_clear_params;
-			command_list->ClearDepthStencilView(cpu_handle, clear_flags, clear_depth_value, clear_stencil_value, 0, nullptr);
-		}
+		clear_depth_stencil(command_list, *depth_stencil, cpu_handle);
 	}
+
+	const DXGI_FORMAT rtv_format = swapchain->desc.format;
+	set_render_pass_formats(cmd_list, 1, &rtv_format, depth_stencil);
 }
 
 void D3D12Context::start_render_pass(CommandList* cmd_list, unsigned rt_count,
                                      const RenderTarget* const* rts, const RenderTarget* const depth_stencil)
 {
-	assert(false);
+	assert(cmd_list);
+	assert(rt_count <= D3D12_SIMULTANEOUS_RENDER_TARGET_COUNT);
+	const auto command_list = to_internal(*cmd_list)->Get();
+
+	std::array<D3D12_CPU_DESCRIPTOR_HANDLE, D3D12_SIMULTANEOUS_RENDER_TARGET_COUNT> rtv_handles{};
+	std::array<DXGI_FORMAT, D3D12_SIMULTANEOUS_RENDER_TARGET_COUNT> rtv_formats{};
+	for (unsigned i = 0; i < rt_count; i++)
+	{
+		assert(rts[i] && rts[i]->descriptor.heap);
+		to_internal(*rts[i]->descriptor.heap)->get_CPU_descriptor(&rtv_handles[i], rts[i]->descriptor.offset, 0);
+		if (rts[i]->clear_type & RenderTarget::Color)
+		{
+			command_list->ClearRenderTargetView(rtv_handles[i], rts[i]->clear_params.clear_color_value.data(), 0, nullptr);
+		}
+		rtv_formats[i] = rts[i]->format;
+	}
+
+	D3D12_CPU_DESCRIPTOR_HANDLE dsv_handle{};
+	if (depth_stencil)
+	{
+		assert(depth_stencil->descriptor.heap);
+		to_internal(*depth_stencil->descriptor.heap)->get_CPU_descriptor(&dsv_handle, depth_stencil->descriptor.offset, 0);
+		clear_depth_stencil(command_list, *depth_stencil, dsv_handle);
+	}
+	command_list->OMSetRenderTargets(rt_count, rtv_handles.data(), FALSE, depth_stencil ? &dsv_handle : nullptr);
+
+	set_render_pass_formats(cmd_list, rt_count, rtv_formats.data(), depth_stencil);
+}
+
+void D3D12Context::clear_depth_stencil(ID3D12GraphicsCommandList* command_list, const RenderTarget& depth_stencil,
+	const D3D12_CPU_DESCRIPTOR_HANDLE handle)
+{
+	if (depth_stencil.clear_type != RenderTarget::None)
+	{
+		D3D12_CLEAR_FLAGS clear_flags = static_cast<D3D12_CLEAR_FLAGS>(0);
+		if (depth_stencil.clear_type & RenderTarget::Depth)
+		{
+			clear_flags |= D3D12_CLEAR_FLAG_DEPTH;
+		}
+		if (depth_stencil.clear_type & RenderTarget::Stencil)
+		{
+			clear_flags |= D3D12_CLEAR_FLAG_STENCIL;
+		}
+		assert(clear_flags);
+		auto [clear_depth_value, clear_stencil_value] = depth_stencil.clear_params.dsv_clear_params;
+		command_list->ClearDepthStencilView(handle, clear_flags, clear_depth_value, clear_stencil_value, 0, nullptr);
+	}
+}
+
+void D3D12Context::set_render_pass_formats(CommandList* cmd_list, const unsigned rt_count, const DXGI_FORMAT* rtv_formats,
+	const RenderTarget* depth_stencil)
+{
+	cmd_list->m_rtv_count = rt_count;
+	std::copy_n(rtv_formats, rt_count, cmd_list->m_rtv_formats.begin());
+	cmd_list->m_has_depth_stencil = depth_stencil != nullptr;
+	cmd_list->m_dsv_format = depth_stencil ? depth_stencil->format : DXGI_FORMAT_UNKNOWN;
+	cmd_list->m_deferred_pipeline_set = false; // A bound deferred pipeline may need another variant
 }
 
 void D3D12Context::set_viewports(CommandList* list, unsigned count, const D3D12_VIEWPORT* viewport)
@@ -1817,6 +2701,10 @@ void D3D12Context::set_scissor_rects(CommandList* list, unsigned count, const D3
 
 void D3D12Context::draw(CommandList* cmd_list, uint32_t vertex_count, uint32_t start_vertex_offset)
 {
+	if (!set_deferred_pipeline_state(cmd_list))
+	{
+		return;
+	}
 	const auto cmd_list_d3d12 = to_internal(*cmd_list);
 	const auto command_list = cmd_list_d3d12->Get();
 	command_list->DrawInstanced(vertex_count, 1, start_vertex_offset, 0);
@@ -1825,6 +2713,10 @@ void D3D12Context::draw(CommandList* cmd_list, uint32_t vertex_count, uint32_t s
 void D3D12Context::draw_indexed(CommandList* cmd_list, uint32_t index_count, uint32_t start_index_offset,
                                 int32_t base_vertex_offset)
 {
+	if (!set_deferred_pipeline_state(cmd_list))
+	{
+		return;
+	}
 	const auto cmd_list_d3d12 = to_internal(*cmd_list);
 	const auto command_list = cmd_list_d3d12->Get();
 	command_list->DrawIndexedInstanced(index_count, 1, 
@@ -2065,9 +2957,11 @@ void D3D12Context::wait_idle(Queue* const queue)
 
 D3D12Context::~D3D12Context()
 {
+	finish_async_jobs(); // Jobs use the device
     m_allocator.Reset();
     m_swapchain.Reset();
 	m_dxgi_factory.Reset();
+	m_pipeline_library.Reset();
 	if (D3D12Context::is_debug_layer_enabled())
 	{
 		m_dxgi_debug->ReportLiveObjects(DXGI_DEBUG_ALL, DXGI_DEBUG_RLO_IGNORE_INTERNAL);
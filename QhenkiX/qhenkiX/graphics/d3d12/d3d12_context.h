@@ -3,7 +3,6 @@
 #include <dxgi1_6.h>
 #include <wrl/client.h>
 #include <dxgidebug.h>
-#include <boost/pool/object_pool.hpp>
 
 #include <D3D12MemAlloc.h>
 #include "d3d12_descriptor_heap.h"
@@ -12,11 +11,15 @@
 #include "../d3d11/d3d11_shader_compiler.h"
 #include "qhenkiX/RHI/context.h"
 #include "qhenkiX/RHI/descriptor_table.h"
+#include "qhenkiX/utility/pipeline_layout_cache.h"
+#include "qhenkiX/utility/shader_cache.h"
 
 using Microsoft::WRL::ComPtr;
 
 namespace qhenki::gfx
 {
+	class D3D12ShaderCompiler;
+
 	class D3D12Context : public Context
 	{
 		D3D12_FEATURE_DATA_D3D12_OPTIONS12 m_options12 = {}; // Enhanced barriers
@@ -42,26 +45,85 @@ namespace qhenki::gfx
 
 		Queue* m_swapchain_queue = nullptr;
 
-		std::mutex m_pipeline_desc_mutex;
-		boost::object_pool<D3D12_GRAPHICS_PIPELINE_STATE_DESC> m_pipeline_desc_pool;
+		// Identical create_pipeline requests share one pipeline, persisted across runs by the pipeline library.
+		// Guards the cache and storing to or serializing the library
+		std::mutex m_pipeline_cache_mutex;
+		tsl::robin_map<util::Hash128, std::weak_ptr<D3D12Pipeline>> m_pipeline_cache;
+		size_t m_pipeline_cache_prune_size = 64; // Expired entries are erased once the cache grows to this
+		std::vector<uint8_t> m_pipeline_library_data; // Read by m_pipeline_library, must outlive it
+		ComPtr<ID3D12PipelineLibrary> m_pipeline_library; // nullptr until load_pipeline_cache
+		bool m_pipeline_library_dirty = false;
 
 		D3D11ShaderCompiler m_d3d11_shader_compiler; // Needed for SM < 6.0
 
+		// Guards creating m_shader_compiler. It is created on first use, so shipped builds that only load precompiled
+		// shaders with .refl sidecars start without dxcompiler.dll
+		std::mutex m_shader_compiler_mutex;
+		// m_shader_compiler, nullptr if DXC could not be loaded
+		D3D12ShaderCompiler* get_shader_compiler();
+
+		// Reflects shaders without precomputed reflection. create_pipeline runs on pool workers and the hot reload thread,
+		// so it does not share m_shader_compiler. Guards m_reflector and every call into it
+		std::mutex m_reflector_mutex;
+		uPtr<ShaderCompiler> m_reflector; // Created on first use like m_shader_compiler
+		// Call with m_reflector_mutex held. nullptr if DXC could not be loaded
+		D3D12ShaderCompiler* get_reflector();
+
 		D3D12RootHasher m_root_reflection;
+		util::PipelineLayoutCache m_layout_cache; // Serialized root signatures of create_pipeline_layout
 
 		Fence m_fence_wait_all{}; // For stalling queues
 
 		std::vector<D3D12_INPUT_ELEMENT_DESC> shader_reflection(ID3D12ShaderReflection* shader_reflection, const D3D12_SHADER_DESC& shader_desc, bool increment_slot) const;
-		void root_signature_reflection(ID3D12ShaderReflection* shader_reflection, const D3D12_SHADER_DESC& shader_desc);
+		static std::vector<D3D12_INPUT_ELEMENT_DESC> input_layout_from_reflection(const util::ShaderReflectionData& reflection, bool increment_slot);
+		// Reflection of a shader, precomputed or reflected from its bytecode. Thread-safe
+		sPtr<const util::ShaderReflectionData> get_reflection(const Shader& shader);
+		bool root_signature_reflection(const Shader& vertex_shader, const Shader& pixel_shader, util::CanonicalPipelineLayout* layout);
 
 		UINT GetMaxDescriptorsForHeapType(ID3D12Device* device, D3D12_DESCRIPTOR_HEAP_TYPE type) const;
 
+		// compiler is the one of the calling thread, see create_shader_dynamic
+		bool create_shader_from_cache(ShaderCompiler* compiler, const CompilerInput& input, const ShaderCache::Entry& entry,
+		                              Shader* shader) const;
+		// Also sets the reflection of shader so cached and freshly compiled shaders create the same pipelines
+		void store_shader_in_cache(ShaderCompiler* compiler, const util::Hash128& key, const CompilerInput& input,
+		                           std::span<const ShaderCache::Dependency> dependencies, const CompilerOutput& output,
+		                           Shader* shader) const;
+		// Whether a DXBC/DXIL container has an embedded root signature (RTS0 part)
+		static bool has_root_signature_part(std::span<const uint8_t> container);
+		bool create_precompiled_shader(const PrecompiledShader& precompiled, ShaderType shader_type, ShaderModel shader_model,
+		                               Shader* shader) override;
+
+		// Sets the variant of a bound deferred pipeline for the current targets. false if it is not compiled yet
+		bool set_deferred_pipeline_state(CommandList* cmd_list);
+		static void set_render_pass_formats(CommandList* cmd_list, unsigned rt_count, const DXGI_FORMAT* rtv_formats,
+		                                    const RenderTarget* depth_stencil);
+		static void clear_depth_stencil(ID3D12GraphicsCommandList* command_list, const RenderTarget& depth_stencil,
+		                                D3D12_CPU_DESCRIPTOR_HANDLE handle);
+
+		// Builds and serializes the root signature of a pipeline layout
+		static bool serialize_root_signature(const util::CanonicalPipelineLayout& layout, std::vector<uint8_t>* blob);
+		// Shared by every identical layout, valid while the context is. nullptr on failure
+		ID3D12RootSignature* create_root_signature(const util::CanonicalPipelineLayout& layout);
+
 		bool is_debug_layer_enabled() const override
 		{
 			return m_debug != nullptr;
 		}
 
 	public:
+		/**
+		 * @brief Key of a create_pipeline request in the pipeline cache.
+		 *
+		 * Unset optional states are hashed as the defaults create_pipeline uses and states disabled by another field (e.g.
+		 * stencil ops without stencil) are ignored, so equivalent descs share a key. Shaders are identified by their bytecode.
+		 *
+		 * @param library_key (out) Same without the identity of in_layout, which is not stable across runs.
+		 */
+		static util::Hash128 make_pipeline_cache_key(const GraphicsPipelineDesc& desc, const Shader& vertex_shader,
+		                                             const Shader& pixel_shader, const PipelineLayout* in_layout,
+		                                             util::Hash128* library_key);
+
 		void create(bool enable_debug_layer) override;
 		bool is_compatibility() const override { return false; }
 		bool create_swapchain(const DisplayWindow& window, const SwapchainDesc& swapchain_desc, Swapchain* swapchain,
@@ -70,6 +132,7 @@ namespace qhenki::gfx
 		bool create_swapchain_descriptors(const Swapchain& swapchain, DescriptorHeap* rtv_heap) override;
 		bool present(Swapchain* swapchain, UINT fence_count, Fence* wait_fences, UINT swapchain_index) override;
 
+		uPtr<ShaderCompiler> make_shader_compiler() override;
 		bool create_shader_dynamic(ShaderCompiler* compiler, Shader* shader, const CompilerInput& input) override;
 
 		bool create_pipeline(const GraphicsPipelineDesc& desc, GraphicsPipeline* pipeline,
@@ -77,11 +140,19 @@ namespace qhenki::gfx
 		                     PipelineLayout* in_layout, const char* debug_name) override;
 
 		bool bind_pipeline(CommandList* cmd_list, const GraphicsPipeline& pipeline) override;
+		void swap_pipelines(GraphicsPipeline* a, GraphicsPipeline* b) override;
+		bool has_pipeline_failed(const GraphicsPipeline& pipeline) const override;
+
+		bool load_pipeline_cache(const std::filesystem::path& path) override;
+		bool save_pipeline_cache(const std::filesystem::path& path) override;
 
 		bool create_pipeline_layout(PipelineLayoutDesc* desc, PipelineLayout* layout) override;
+		bool create_pipeline_layout(const Shader& vertex_shader, const Shader& pixel_shader, PipelineLayout* layout,
+		                            std::vector<PipelineLayoutParameter>* parameters) override;
 		void bind_pipeline_layout(CommandList* cmd_list, const PipelineLayout& layout) override;
 
 		bool set_pipeline_constant(CommandList* cmd_list, UINT param, UINT32 offset, UINT size, void* data) override;
+		void set_pipeline_constant_buffer(CommandList* cmd_list, UINT param, const Buffer& buffer, uint64_t offset) override;
 
 		bool create_descriptor_heap(const DescriptorHeapDesc& desc, DescriptorHeap* heap, const char* debug_name = nullptr) override;
 		void set_descriptor_heap(CommandList* cmd_list, const DescriptorHeap& heap) override;
@@ -1,17 +1,80 @@
 ﻿#pragma once
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+
 #include <d3d12.h>
 #include <wrl/client.h>
 
+#undef min
+#undef max
+#include <tsl/robin_map.h>
+
+#include <smartpointer.h>
+#include "qhenkiX/helper/hash_helper.h"
+#include "qhenkiX/RHI/async_handle.h"
+
 using Microsoft::WRL::ComPtr;
 
+namespace qhenki::util
+{
+	class ShaderReflectionData;
+}
+
 namespace qhenki::gfx
 {
+	// Targets bound by start_render_pass, a deferred pipeline has one variant per distinct set
+	struct D3D12TargetFormats
+	{
+		std::array<DXGI_FORMAT, D3D12_SIMULTANEOUS_RENDER_TARGET_COUNT> rtv_formats{};
+		uint32_t rtv_count = 0;
+		DXGI_FORMAT dsv_format = DXGI_FORMAT_UNKNOWN;
+
+		bool operator==(const D3D12TargetFormats& other) const = default;
+	};
+
+	struct D3D12TargetFormatsHasher
+	{
+		size_t operator()(const D3D12TargetFormats& formats) const
+		{
+			return util::HashHelper::xxh64(&formats, sizeof(formats));
+		}
+	};
+
+	struct D3D12PipelineVariant
+	{
+		ComPtr<ID3D12PipelineState> pipeline_state; // Valid once status is SUCCEEDED
+		std::atomic<AsyncStatus> status{ AsyncStatus::PENDING };
+		std::atomic<bool> reported = false; // Failure was logged by a draw
+	};
+
+	// Pipeline created without target formats. Its variants are compiled on a worker when first drawn to new targets
+	struct D3D12DeferredPipeline
+	{
+		D3D12_GRAPHICS_PIPELINE_STATE_DESC desc{}; // Everything but the target formats, points into the members below
+		std::vector<D3D12_INPUT_ELEMENT_DESC> input_layout_desc;
+		sPtr<const util::ShaderReflectionData> reflection; // Owns the semantic names of input_layout_desc if precomputed
+		sPtr<void> vertex_shader; // Keep the bytecode alive
+		sPtr<void> pixel_shader;
+		ComPtr<ID3D12RootSignature> root_signature;
+		DXGI_FORMAT default_dsv_format = DXGI_FORMAT_UNKNOWN; // Used if the bound depth target does not specify its format
+		std::string debug_name;
+		std::atomic<bool> failed = false; // Some variant failed to compile
+
+		std::mutex variant_mutex;
+		tsl::robin_map<D3D12TargetFormats, sPtr<D3D12PipelineVariant>, D3D12TargetFormatsHasher> variants;
+	};
+
 	struct D3D12Pipeline
 	{
 		std::vector<D3D12_INPUT_ELEMENT_DESC> input_layout_desc; // Clear this after creation!
-		D3D12_GRAPHICS_PIPELINE_STATE_DESC* desc = nullptr; // Temp for deferred compilation
+		sPtr<const util::ShaderReflectionData> reflection; // Owns the semantic names of input_layout_desc if precomputed
 		D3D12_PRIMITIVE_TOPOLOGY primitive_topology = D3D_PRIMITIVE_TOPOLOGY_UNDEFINED; // Needed for command list
-		ComPtr<ID3D12PipelineState> pipeline_state = nullptr;
-		bool deferred = false;
+		ComPtr<ID3D12PipelineState> pipeline_state = nullptr; // nullptr if deferred
+		sPtr<D3D12DeferredPipeline> deferred; // Set if created without target formats
+		bool cached = false; // Shared through the pipeline cache of the context under cache_key
+		util::Hash128 cache_key;
 	};
-}
\ No newline at end of file
+}
@@ -1,41 +1,95 @@
 ﻿#include "d3d12_root_hasher.h"
 
+#include <cstring>
+
+#include "qhenkiX/helper/hash_helper.h"
+
 using namespace qhenki::gfx;
 
-uint64_t D3D12RootHasher::fnv1a_hash(const void* data, size_t size)
+uint64_t D3D12RootHasher::hash(const void* data, const size_t size)
 {
-    constexpr uint64_t FNV_OFFSET_BASIS = 14695981039346656037ULL;
-	constexpr uint64_t FNV_PRIME = 1099511628211ULL;
-    const auto* bytes = static_cast<const uint8_t*>(data);
-    uint64_t hash = FNV_OFFSET_BASIS;
+	// Root signature blobs are a few hundred bytes, XXH64 hashes them 32 bytes per iteration
+	return util::HashHelper::xxh64(data, size);
+}
 
-    for (size_t i = 0; i < size; ++i) {
-        hash ^= bytes[i];
-        hash *= FNV_PRIME;
-    }
+ID3D12RootSignature* D3D12RootHasher::find(const Table* table, const uint64_t hash, const void* root_data, const size_t root_size)
+{
+	if (!table)
+	{
+		return nullptr;
+	}
+	const size_t mask = table->slots.size() - 1;
+	for (size_t i = hash & mask;; i = (i + 1) & mask)
+	{
+		const auto entry = table->slots[i].load(std::memory_order_acquire);
+		if (!entry)
+		{
+			return nullptr;
+		}
+		if (entry->hash == hash && entry->blob.size() == root_size && std::memcmp(entry->blob.data(), root_data, root_size) == 0)
+		{
+			return entry->root_signature.Get();
+		}
+	}
+}
 
-    return hash;
+void D3D12RootHasher::insert(Table* table, const Entry* entry)
+{
+	const size_t mask = table->slots.size() - 1;
+	size_t i = entry->hash & mask;
+	// Only writers fill slots, so relaxed is enough under the lock
+	while (table->slots[i].load(std::memory_order_relaxed))
+	{
+		i = (i + 1) & mask;
+	}
+	table->slots[i].store(entry, std::memory_order_release);
 }
 
-ID3D12RootSignature* D3D12RootHasher::find_root_signature(const size_t hash)
+ID3D12RootSignature* D3D12RootHasher::find_root_signature(const void* root_data, const size_t root_size) const
 {
-	std::lock_guard lock(m_root_mutex);
-	if (m_root_map.contains(hash)) return m_root_map[hash].Get();
-	return nullptr;
+	return find(m_table.load(std::memory_order_acquire), hash(root_data, root_size), root_data, root_size);
 }
 
 ID3D12RootSignature* D3D12RootHasher::add_root_signature(ID3D12Device* device, const void* root_data, size_t root_size)
 {
 	// Hash root signature blob
-	std::lock_guard lock(m_root_mutex);
-	const auto hash = fnv1a_hash(root_data, root_size);
-	if (m_root_map.contains(hash))
-		return nullptr;
-	ComPtr<ID3D12RootSignature> root_signature;
-	if (FAILED(device->CreateRootSignature(0, root_data, root_size, IID_PPV_ARGS(root_signature.ReleaseAndGetAddressOf()))))
+	const auto root_hash = hash(root_data, root_size);
+	if (const auto root_signature = find(m_table.load(std::memory_order_acquire), root_hash, root_data, root_size))
+	{
+		return root_signature;
+	}
+
+	std::scoped_lock lock(m_root_mutex);
+	// Another thread may have added it since the lookup above
+	const auto current = m_tables.empty() ? nullptr : m_tables.back().get();
+	if (const auto root_signature = find(current, root_hash, root_data, root_size))
+	{
+		return root_signature;
+	}
+
+	auto entry = mkU<Entry>();
+	if (FAILED(device->CreateRootSignature(0, root_data, root_size, IID_PPV_ARGS(entry->root_signature.ReleaseAndGetAddressOf()))))
 	{
 		return nullptr;
 	}
-	m_root_map[hash] = root_signature;
-	return root_signature.Get();
+	entry->hash = root_hash;
+	const auto bytes = static_cast<const uint8_t*>(root_data);
+	entry->blob.assign(bytes, bytes + root_size);
+	const auto root_signature = entry->root_signature.Get();
+	m_entries.push_back(std::move(entry));
+
+	if (current && m_entries.size() * 2 <= current->slots.size())
+	{
+		insert(current, m_entries.back().get());
+		return root_signature;
+	}
+	// Full, readers keep probing the old table until they see the new one. Doubling keeps adds amortized O(1)
+	auto table = mkU<Table>(current ? current->slots.size() * 2 : 64);
+	for (const auto& e : m_entries)
+	{
+		insert(table.get(), e.get());
+	}
+	m_table.store(table.get(), std::memory_order_release);
+	m_tables.push_back(std::move(table));
+	return root_signature;
 }
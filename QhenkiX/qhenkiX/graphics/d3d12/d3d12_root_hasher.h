@@ -3,35 +3,66 @@
 #include <d3d12.h>
 #include <wrl/client.h>
 
+#include <atomic>
+#include <cstdint>
 #include <mutex>
+#include <vector>
 
-#undef min
-#undef max
-#include <tsl/robin_map.h>
+#include <smartpointer.h>
 
 using Microsoft::WRL::ComPtr;
 
 namespace qhenki::gfx
 {
+	/**
+	 * @brief Shares root signature objects between pipelines whose shaders embed the same serialized root signature.
+	 *
+	 * Lookups are wait-free: entries are published into an open addressing table of atomic slots, so pipelines created
+	 * on many threads do not contend. Adds are serialized by a lock. A full table is replaced by one of twice the size,
+	 * replaced tables are kept for readers still probing them and take less memory than the current one in total.
+	 */
 	class D3D12RootHasher
 	{
+		struct Entry
+		{
+			uint64_t hash;
+			std::vector<uint8_t> blob; // Compared on lookup, a matching hash alone may be a collision
+			ComPtr<ID3D12RootSignature> root_signature;
+		};
+		struct Table
+		{
+			explicit Table(const size_t capacity) : slots(capacity) {}
+			std::vector<std::atomic<const Entry*>> slots; // Power of two, at most half full so probing ends at a null slot
+		};
+
+		std::atomic<const Table*> m_table = nullptr;
+
+		// Writers only
 		std::mutex m_root_mutex;
-		tsl::robin_map<size_t, ComPtr<ID3D12RootSignature>> m_root_map;
+		std::vector<uPtr<const Entry>> m_entries;
+		std::vector<uPtr<Table>> m_tables;
 
-		uint64_t fnv1a_hash(const void* data, size_t size);
+		static uint64_t hash(const void* data, size_t size);
+		static ID3D12RootSignature* find(const Table* table, uint64_t hash, const void* root_data, size_t root_size);
+		static void insert(Table* table, const Entry* entry);
 
 	public:
-		ID3D12RootSignature* find_root_signature(const size_t hash);
+		/**
+		 * @brief Finds the root signature created from an identical blob. Wait-free, safe to call from any thread.
+		 * @return The root signature, nullptr if none was added for this blob.
+		 */
+		ID3D12RootSignature* find_root_signature(const void* root_data, size_t root_size) const;
 
 		/**
 		 * @brief Adds a root signature to the hasher.
 		 *
 		 * Hashes the binary data of a root signature, creates the root signature object and stores it in a map with hash object pairing.
+		 * If an identical blob was added before, its root signature is returned instead of creating another.
 		 *
 		 * @param device A pointer to the ID3D12Device interface.
 		 * @param root_data A pointer to serialized root signature blob.
 		 * @param root_size The size of the serialized root signature blob.
-		 * @return A pointer to the created ID3D12RootSignature object. nullptr if the root signature already exists (might be hash collision) or creation failed.
+		 * @return A pointer to the ID3D12RootSignature object, valid while the hasher is. nullptr if creation failed.
 		 */
 		ID3D12RootSignature* add_root_signature(ID3D12Device* device, const void* root_data, size_t root_size);
 	};
@@ -9,10 +9,55 @@
 #include <filesystem>
 
 #include "qhenkiX/helper/string_helper.h"
+#include "qhenkiX/utility/include_cache.h"
+#include "qhenkiX/utility/shader_reflection.h"
 
 using namespace qhenki::gfx;
 using namespace qhenki::util;
 
+namespace
+{
+	// Serves includes from the shared IncludeCache. Lives on the stack for one compile, so reference counting is a no-op
+	class CachedIncludeHandler final : public IDxcIncludeHandler
+	{
+		IDxcUtils* m_utils;
+		IncludeCache* m_cache;
+
+	public:
+		CachedIncludeHandler(IDxcUtils* utils, IncludeCache* cache) : m_utils(utils), m_cache(cache) {}
+
+		HRESULT STDMETHODCALLTYPE LoadSource(LPCWSTR pFilename, IDxcBlob** ppIncludeSource) override
+		{
+			*ppIncludeSource = nullptr;
+			// DXC probes every include directory, missing candidates are cached as well
+			const auto contents = m_cache->load(std::filesystem::path(pFilename));
+			if (!contents)
+			{
+				return HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND);
+			}
+			// Pinned blob points into the cache, which outlives the compile
+			IDxcBlobEncoding* blob = nullptr;
+			const auto hr = m_utils->CreateBlobFromPinned(contents->data(), static_cast<UINT32>(contents->size()), DXC_CP_ACP, &blob);
+			*ppIncludeSource = blob;
+			return hr;
+		}
+
+		HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void** ppvObject) override
+		{
+			if (riid == __uuidof(IDxcIncludeHandler) || riid == __uuidof(IUnknown))
+			{
+				*ppvObject = this;
+				return S_OK;
+			}
+			*ppvObject = nullptr;
+			return E_NOINTERFACE;
+		}
+
+		ULONG STDMETHODCALLTYPE AddRef() override { return 1; }
+		ULONG STDMETHODCALLTYPE Release() override { return 1; }
+	};
+}
+
 DXGI_FORMAT D3D12ShaderCompiler::mask_to_format(const uint32_t mask, const D3D_REGISTER_COMPONENT_TYPE type)
 {
 	switch (type)
@@ -121,6 +166,11 @@ DXGI_FORMAT D3D12ShaderCompiler::mask_to_format(const uint32_t mask, const D3D_R
 
 D3D12ShaderCompiler::D3D12ShaderCompiler()
 {
+	// dxcompiler.dll is delay loaded, calling into it when it is missing would raise a structured exception
+	if (!LoadLibraryA("dxcompiler.dll"))
+	{
+		throw std::runtime_error("D3D12ShaderCompiler: dxcompiler.dll not found");
+	}
 	if (FAILED(DxcCreateInstance(CLSID_DxcLibrary, IID_PPV_ARGS(m_library.ReleaseAndGetAddressOf()))))
 	{
 		throw std::runtime_error("D3D12ShaderCompiler: Failed to create DxcLibrary");
@@ -140,26 +190,36 @@ bool D3D12ShaderCompiler::compile(const CompilerInput& input, CompilerOutput& ou
 	}
 
 	DxcBuffer source_buffer;
-	void* data;
+	void* data = nullptr;
 	size_t size;
 	const auto& input_path = input.get_path();
-	const auto succeed = FileHelper::read_file(input_path.data(), &data, &size);
-	if (!succeed)
+	const std::string* source = m_include_cache ? m_include_cache->load(input_path) : nullptr;
+	if (source)
+	{
+		size = source->size();
+	}
+	else if (m_include_cache || !FileHelper::read_file(input_path.data(), &data, &size))
 	{
 		output.error_message = "D3D12ShaderCompiler: Failed to read/open file :: " + std::string(input_path.begin(), input_path.end());
 		return false;
 	}
-	source_buffer.Ptr = data;
+	source_buffer.Ptr = source ? source->data() : data;
 	source_buffer.Size = size;
 	source_buffer.Encoding = DXC_CP_ACP;
 
-	// Create default file include handler
-	// TODO: custom include handlers
-	ComPtr<IDxcIncludeHandler> include_handler;
-	if (FAILED(m_library->CreateDefaultIncludeHandler(&include_handler)))
+	// Includes come from the shared cache if set, otherwise from disk through the default handler
+	CachedIncludeHandler cached_handler(m_library.Get(), m_include_cache);
+	ComPtr<IDxcIncludeHandler> default_handler;
+	IDxcIncludeHandler* include_handler = &cached_handler;
+	if (!m_include_cache)
 	{
-		output.error_message = "D3D12ShaderCompiler: Failed to create include handler";
-		return false;
+		if (FAILED(m_library->CreateDefaultIncludeHandler(&default_handler)))
+		{
+			free(data);
+			output.error_message = "D3D12ShaderCompiler: Failed to create include handler";
+			return false;
+		}
+		include_handler = default_handler.Get();
 	}
 
 	thread_local std::vector<const wchar_t*> args; // TODO: stack allocator and share with args_ptrs
@@ -247,7 +307,7 @@ bool D3D12ShaderCompiler::compile(const CompilerInput& input, CompilerOutput& ou
 		&source_buffer,
 		args.data(),
 		static_cast<UINT32>(args.size()),
-		include_handler.Get(),
+		include_handler,
 		IID_PPV_ARGS(&result)))
 	{
 		output_error();
@@ -351,6 +411,225 @@ bool D3D12ShaderCompiler::compile(const CompilerInput& input, CompilerOutput& ou
 	return true;
 }
 
+bool D3D12ShaderCompiler::preprocess(const CompilerInput& input, std::string& preprocessed, std::string& error_message)
+{
+	if (input.shader_model < ShaderModel::SM_6_0)
+	{
+		return D3D11ShaderCompiler::preprocess(input, preprocessed, error_message);
+	}
+
+	void* data = nullptr;
+	size_t size;
+	const auto& input_path = input.get_path();
+	const std::string* source = m_include_cache ? m_include_cache->load(input_path) : nullptr;
+	if (source)
+	{
+		size = source->size();
+	}
+	else if (m_include_cache || !FileHelper::read_file(input_path.data(), &data, &size))
+	{
+		error_message = "D3D12ShaderCompiler: Failed to read/open file :: " + std::string(input_path.begin(), input_path.end());
+		return false;
+	}
+	const DxcBuffer source_buffer
+	{
+		.Ptr = source ? source->data() : data,
+		.Size = size,
+		.Encoding = DXC_CP_ACP,
+	};
+
+	CachedIncludeHandler cached_handler(m_library.Get(), m_include_cache);
+	ComPtr<IDxcIncludeHandler> default_handler;
+	IDxcIncludeHandler* include_handler = &cached_handler;
+	if (!m_include_cache)
+	{
+		if (FAILED(m_library->CreateDefaultIncludeHandler(&default_handler)))
+		{
+			free(data);
+			error_message = "D3D12ShaderCompiler: Failed to create include handler";
+			return false;
+		}
+		include_handler = default_handler.Get();
+	}
+
+	// Preprocessing is not on the hot path so plain wstrings are fine here
+	std::vector<std::wstring> storage;
+	storage.reserve((input.get_defines().size() + input.includes.size()) * 2);
+	std::vector<const wchar_t*> args;
+	args.reserve((input.get_defines().size() + input.includes.size()) * 2 + 3);
+
+	auto widen_and_push = [&](const std::string& str, const wchar_t* flag)
+	{
+		args.emplace_back(flag);
+		storage.emplace_back();
+		utf8::utf8to16(str.begin(), str.end(), std::back_inserter(storage.back()));
+		args.push_back(storage.back().c_str());
+	};
+
+	args.emplace_back(L"-P");
+	for (const auto& define : input.get_defines())
+	{
+		widen_and_push(define, L"-D");
+	}
+	for (const auto& include : input.includes)
+	{
+		widen_and_push(include, L"-I");
+	}
+	// Target affects predefined macros such as __SHADER_TARGET_MAJOR
+	args.emplace_back(L"-T");
+	const auto sm = D3DHelper::get_shader_model_wchar(input.shader_type, input.shader_model);
+	args.emplace_back(sm.c_str());
+
+	ComPtr<IDxcResult> result;
+	const auto hr = m_compiler->Compile(&source_buffer, args.data(), static_cast<UINT32>(args.size()),
+		include_handler, IID_PPV_ARGS(&result));
+	free(data);
+
+	HRESULT status = E_FAIL;
+	if (SUCCEEDED(hr))
+	{
+		result->GetStatus(&status);
+	}
+	if (FAILED(hr) || FAILED(status))
+	{
+		ComPtr<IDxcBlobUtf8> errors;
+		if (result && SUCCEEDED(result->GetOutput(DXC_OUT_ERRORS, IID_PPV_ARGS(errors.ReleaseAndGetAddressOf()), nullptr))
+			&& errors && errors->GetStringLength())
+		{
+			error_message = errors->GetStringPointer();
+		}
+		return false;
+	}
+
+	ComPtr<IDxcBlobUtf8> hlsl;
+	if (FAILED(result->GetOutput(DXC_OUT_HLSL, IID_PPV_ARGS(hlsl.ReleaseAndGetAddressOf()), nullptr)) || !hlsl)
+	{
+		error_message = "D3D12ShaderCompiler: Failed to get preprocessed output";
+		return false;
+	}
+	preprocessed.assign(hlsl->GetStringPointer(), hlsl->GetStringLength());
+	return true;
+}
+
+bool D3D12ShaderCompiler::reflect(const void* bytecode, const size_t size, const ShaderModel shader_model,
+	ShaderReflectionData* reflection, std::string& error_message)
+{
+	assert(reflection);
+	ComPtr<ID3D12ShaderReflection> shader_reflection;
+	if (shader_model < ShaderModel::SM_6_0)
+	{
+		if (FAILED(D3DReflect(bytecode, size, IID_ID3D12ShaderReflection, &shader_reflection)))
+		{
+			error_message = "D3D12ShaderCompiler: Failed to reflect DXBC";
+			return false;
+		}
+	}
+	else
+	{
+		const DxcBuffer buffer
+		{
+			.Ptr = bytecode,
+			.Size = size,
+			.Encoding = 0,
+		};
+		if (FAILED(m_library->CreateReflection(&buffer, IID_PPV_ARGS(&shader_reflection))))
+		{
+			error_message = "D3D12ShaderCompiler: Failed to reflect DXIL";
+			return false;
+		}
+	}
+
+	D3D12_SHADER_DESC shader_desc{};
+	if (FAILED(shader_reflection->GetDesc(&shader_desc)))
+	{
+		error_message = "D3D12ShaderCompiler: Failed to get shader description";
+		return false;
+	}
+
+	// Only vertex inputs feed the input assembler
+	if (D3D12_SHVER_GET_TYPE(shader_desc.Version) == D3D12_SHVER_VERTEX_SHADER)
+	{
+		for (UINT i = 0; i < shader_desc.InputParameters; i++)
+		{
+			D3D12_SIGNATURE_PARAMETER_DESC parameter_desc{};
+			if (FAILED(shader_reflection->GetInputParameterDesc(i, &parameter_desc)))
+			{
+				error_message = "D3D12ShaderCompiler: Failed to get input parameter";
+				return false;
+			}
+			DXGI_FORMAT format;
+			try
+			{
+				format = mask_to_format(parameter_desc.Mask, parameter_desc.ComponentType);
+			}
+			catch (const std::runtime_error& e)
+			{
+				error_message = std::string(e.what()) + " :: " + parameter_desc.SemanticName;
+				return false;
+			}
+			reflection->add_input(parameter_desc.SemanticName, parameter_desc.SemanticIndex, format, parameter_desc.SystemValueType);
+		}
+	}
+
+	for (UINT i = 0; i < shader_desc.BoundResources; i++)
+	{
+		D3D12_SHADER_INPUT_BIND_DESC bind_desc{};
+		if (FAILED(shader_reflection->GetResourceBindingDesc(i, &bind_desc)))
+		{
+			error_message = "D3D12ShaderCompiler: Failed to get resource binding";
+			return false;
+		}
+		UINT buffer_size = 0;
+		if (bind_desc.Type == D3D_SIT_CBUFFER)
+		{
+			D3D12_SHADER_BUFFER_DESC buffer_desc{};
+			if (const auto cb = shader_reflection->GetConstantBufferByName(bind_desc.Name); cb && SUCCEEDED(cb->GetDesc(&buffer_desc)))
+			{
+				buffer_size = buffer_desc.Size;
+			}
+			if (bind_desc.Space == SHADER_REFLECTION_PUSH_CONSTANT_SPACE)
+			{
+				reflection->add_push_constant(bind_desc.BindPoint, buffer_size);
+				continue;
+			}
+		}
+		reflection->add_resource(bind_desc.Name, bind_desc.Type, bind_desc.BindPoint, bind_desc.Space, bind_desc.BindCount, buffer_size);
+	}
+	return true;
+}
+
+std::string D3D12ShaderCompiler::get_version(ShaderModel shader_model)
+{
+	if (shader_model < ShaderModel::SM_6_0)
+	{
+		return D3D11ShaderCompiler::get_version(shader_model);
+	}
+
+	UINT32 major = 0, minor = 0;
+	ComPtr<IDxcVersionInfo> version_info;
+	if (SUCCEEDED(m_compiler.As(&version_info)))
+	{
+		version_info->GetVersion(&major, &minor);
+	}
+
+	// Commit hash distinguishes builds that share a version number
+	UINT32 commit_count = 0;
+	char* commit_hash = nullptr;
+	ComPtr<IDxcVersionInfo2> version_info2;
+	if (SUCCEEDED(m_compiler.As(&version_info2)))
+	{
+		version_info2->GetCommitInfo(&commit_count, &commit_hash);
+	}
+
+	char buffer[128];
+	(void)snprintf(buffer, sizeof(buffer), "dxcompiler_%u.%u.%u_%s", major, minor, commit_count, commit_hash ? commit_hash : "");
+	if (commit_hash)
+	{
+		CoTaskMemFree(commit_hash);
+	}
+	return buffer;
+}
+
 bool D3D12ShaderCompiler::get_dll_path(char* buffer1, char* buffer2, unsigned long buffer_length)
 {
 	assert(buffer1);
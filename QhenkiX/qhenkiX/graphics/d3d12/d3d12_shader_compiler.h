@@ -9,6 +9,11 @@
 
 using Microsoft::WRL::ComPtr;
 
+namespace qhenki::util
+{
+	class ShaderReflectionData;
+}
+
 namespace qhenki::gfx
 {
 	struct D3D12ShaderOutput
@@ -27,7 +32,21 @@ namespace qhenki::gfx
 
 	public:
 		D3D12ShaderCompiler();
+		explicit D3D12ShaderCompiler(IncludeCache* include_cache) : D3D12ShaderCompiler() { set_include_cache(include_cache); }
 		bool compile(const CompilerInput& input, CompilerOutput& output) override;
+		bool preprocess(const CompilerInput& input, std::string& preprocessed, std::string& error_message) override;
+		std::string get_version(ShaderModel shader_model) override;
+
+		/**
+		 * @brief Extracts the reflection the runtime needs for pipeline creation from compiled bytecode.
+		 * @param bytecode DXBC or DXIL container. DXIL must not have its reflection stripped.
+		 * @param size Size of the bytecode in bytes.
+		 * @param shader_model Shader model the bytecode was compiled with.
+		 * @param reflection (out) Input elements (vertex shaders only), bound resources and push constants.
+		 * @param error_message (out) Reason on failure.
+		 */
+		bool reflect(const void* bytecode, size_t size, ShaderModel shader_model, util::ShaderReflectionData* reflection,
+			std::string& error_message);
 		static bool get_dll_path(char* buffer1, char* buffer2, unsigned long buffer_length);
 		~D3D12ShaderCompiler() override;
 
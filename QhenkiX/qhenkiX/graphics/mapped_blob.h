@@ -0,0 +1,72 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <span>
+
+#include <wrl/client.h>
+#include <smartpointer.h>
+
+using Microsoft::WRL::ComPtr;
+
+namespace qhenki::gfx
+{
+	/**
+	 * @brief Blob interface (ID3DBlob or IDxcBlob) over memory it does not own, e.g. a mapped shader file.
+	 *
+	 * Holds a reference to the owner of the bytes, so the memory stays valid while the runtime or a compiler holds the blob.
+	 */
+	template <typename Interface>
+	class MappedBlob final : public Interface
+	{
+		std::atomic<ULONG> m_ref_count = 1;
+		sPtr<const void> m_owner;
+		std::span<const uint8_t> m_bytes;
+
+		MappedBlob(sPtr<const void> owner, const std::span<const uint8_t> bytes)
+			: m_owner(std::move(owner)), m_bytes(bytes) {}
+		~MappedBlob() = default;
+
+	public:
+		static ComPtr<Interface> create(sPtr<const void> owner, const std::span<const uint8_t> bytes)
+		{
+			ComPtr<Interface> blob;
+			blob.Attach(new MappedBlob(std::move(owner), bytes));
+			return blob;
+		}
+
+		HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void** object) override
+		{
+			if (!object)
+			{
+				return E_POINTER;
+			}
+			if (riid == __uuidof(IUnknown) || riid == __uuidof(Interface))
+			{
+				AddRef();
+				*object = static_cast<Interface*>(this);
+				return S_OK;
+			}
+			*object = nullptr;
+			return E_NOINTERFACE;
+		}
+
+		ULONG STDMETHODCALLTYPE AddRef() override
+		{
+			return m_ref_count.fetch_add(1, std::memory_order_relaxed) + 1;
+		}
+
+		ULONG STDMETHODCALLTYPE Release() override
+		{
+			const ULONG count = m_ref_count.fetch_sub(1, std::memory_order_acq_rel) - 1;
+			if (count == 0)
+			{
+				delete this;
+			}
+			return count;
+		}
+
+		// Read only, the bytes may be a read only mapping. Neither D3D nor DXC write through it
+		LPVOID STDMETHODCALLTYPE GetBufferPointer() override { return const_cast<uint8_t*>(m_bytes.data()); }
+		SIZE_T STDMETHODCALLTYPE GetBufferSize() override { return m_bytes.size(); }
+	};
+}
@@ -0,0 +1,277 @@
+#include "qhenkiX/helper/compression_helper.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <vector>
+
+using namespace qhenki::util;
+
+namespace
+{
+	constexpr size_t MIN_MATCH = 4;
+	constexpr size_t LAST_LITERALS = 5; // The last 5 bytes are always literals
+	constexpr size_t MF_LIMIT = 12; // The last match must start at least 12 bytes before the end
+	constexpr size_t MAX_OFFSET = 65535;
+	constexpr uint32_t HASH_LOG = 16;
+	constexpr uint32_t NO_POSITION = UINT32_MAX;
+
+	uint32_t read32(const uint8_t* p)
+	{
+		uint32_t value;
+		memcpy(&value, p, sizeof(value));
+		return value;
+	}
+
+	uint32_t hash_sequence(const uint32_t sequence)
+	{
+		return (sequence * 2654435761u) >> (32 - HASH_LOG);
+	}
+
+	// Writes the 255 continuation bytes of a length field that did not fit in its token nibble
+	uint8_t* write_length(uint8_t* op, size_t length)
+	{
+		while (length >= 255)
+		{
+			*op++ = 255;
+			length -= 255;
+		}
+		*op++ = static_cast<uint8_t>(length);
+		return op;
+	}
+
+	bool read_length(const uint8_t** ip, const uint8_t* iend, size_t* length)
+	{
+		uint8_t b;
+		do
+		{
+			if (*ip >= iend)
+			{
+				return false;
+			}
+			b = *(*ip)++;
+			*length += b;
+		} while (b == 255);
+		return true;
+	}
+}
+
+size_t CompressionHelper::lz4_compress(const void* src, const size_t size, void* dst, const size_t capacity,
+	std::span<const uint8_t> dictionary)
+{
+	if (dictionary.size() > LZ4_MAX_DICTIONARY_SIZE)
+	{
+		dictionary = dictionary.last(LZ4_MAX_DICTIONARY_SIZE);
+	}
+
+	// Dictionary and input are matched as one buffer, offsets into the dictionary are then plain back references
+	thread_local std::vector<uint8_t> buffer;
+	thread_local std::vector<uint32_t> table;
+	buffer.resize(dictionary.size() + size);
+	if (!dictionary.empty())
+	{
+		memcpy(buffer.data(), dictionary.data(), dictionary.size());
+	}
+	if (size > 0)
+	{
+		memcpy(buffer.data() + dictionary.size(), src, size);
+	}
+	table.assign(size_t{ 1 } << HASH_LOG, NO_POSITION);
+
+	const uint8_t* const base = buffer.data();
+	const uint8_t* const iend = base + buffer.size();
+	const uint8_t* ip = base + dictionary.size();
+	const uint8_t* anchor = ip;
+	auto op = static_cast<uint8_t*>(dst);
+	uint8_t* const oend = op + capacity;
+
+	if (dictionary.size() >= MIN_MATCH)
+	{
+		for (const uint8_t* p = base; p + MIN_MATCH <= ip; p++)
+		{
+			table[hash_sequence(read32(p))] = static_cast<uint32_t>(p - base);
+		}
+	}
+
+	if (size > MF_LIMIT)
+	{
+		const uint8_t* const mf_limit = iend - MF_LIMIT;
+		const uint8_t* const match_limit = iend - LAST_LITERALS;
+		while (ip < mf_limit)
+		{
+			const uint32_t sequence = read32(ip);
+			auto& slot = table[hash_sequence(sequence)];
+			const uint32_t candidate = slot;
+			slot = static_cast<uint32_t>(ip - base);
+			const uint8_t* ref = base + candidate;
+			if (candidate == NO_POSITION || static_cast<size_t>(ip - ref) > MAX_OFFSET || read32(ref) != sequence)
+			{
+				ip++;
+				continue;
+			}
+
+			// Extend backwards into pending literals, then forwards
+			while (ip > anchor && ref > base && ip[-1] == ref[-1])
+			{
+				ip--;
+				ref--;
+			}
+			size_t match_length = MIN_MATCH;
+			while (ip + match_length < match_limit && ip[match_length] == ref[match_length])
+			{
+				match_length++;
+			}
+
+			const size_t literal_length = ip - anchor;
+			if (static_cast<size_t>(oend - op) < 1 + literal_length + literal_length / 255 + 1 + 2 + match_length / 255 + 1)
+			{
+				return 0;
+			}
+			uint8_t* const token = op++;
+			if (literal_length >= 15)
+			{
+				*token = 15 << 4;
+				op = write_length(op, literal_length - 15);
+			}
+			else
+			{
+				*token = static_cast<uint8_t>(literal_length << 4);
+			}
+			memcpy(op, anchor, literal_length);
+			op += literal_length;
+
+			const auto offset = static_cast<uint16_t>(ip - ref);
+			*op++ = static_cast<uint8_t>(offset);
+			*op++ = static_cast<uint8_t>(offset >> 8);
+
+			if (match_length - MIN_MATCH >= 15)
+			{
+				*token |= 15;
+				op = write_length(op, match_length - MIN_MATCH - 15);
+			}
+			else
+			{
+				*token |= static_cast<uint8_t>(match_length - MIN_MATCH);
+			}
+
+			ip += match_length;
+			anchor = ip;
+			// Positions inside the match are skipped, re-seed the one right before the end for the next search
+			if (ip - 2 >= base)
+			{
+				table[hash_sequence(read32(ip - 2))] = static_cast<uint32_t>(ip - 2 - base);
+			}
+		}
+	}
+
+	// Last sequence is literals only
+	const size_t literal_length = iend - anchor;
+	if (static_cast<size_t>(oend - op) < 1 + literal_length + literal_length / 255 + 1)
+	{
+		return 0;
+	}
+	uint8_t* const token = op++;
+	if (literal_length >= 15)
+	{
+		*token = 15 << 4;
+		op = write_length(op, literal_length - 15);
+	}
+	else
+	{
+		*token = static_cast<uint8_t>(literal_length << 4);
+	}
+	if (literal_length > 0)
+	{
+		memcpy(op, anchor, literal_length);
+		op += literal_length;
+	}
+	return op - static_cast<uint8_t*>(dst);
+}
+
+bool CompressionHelper::lz4_decompress(const void* src, const size_t size, void* dst, const size_t dst_size,
+	const std::span<const uint8_t> dictionary)
+{
+	auto ip = static_cast<const uint8_t*>(src);
+	const uint8_t* const iend = ip + size;
+	const auto dst_begin = static_cast<uint8_t*>(dst);
+	uint8_t* op = dst_begin;
+	uint8_t* const oend = dst_begin + dst_size;
+
+	while (true)
+	{
+		if (ip >= iend)
+		{
+			return false;
+		}
+		const uint8_t token = *ip++;
+
+		size_t literal_length = token >> 4;
+		if (literal_length == 15 && !read_length(&ip, iend, &literal_length))
+		{
+			return false;
+		}
+		if (literal_length > static_cast<size_t>(iend - ip) || literal_length > static_cast<size_t>(oend - op))
+		{
+			return false;
+		}
+		if (literal_length > 0)
+		{
+			memcpy(op, ip, literal_length);
+			ip += literal_length;
+			op += literal_length;
+		}
+		if (ip == iend)
+		{
+			return op == oend; // Last sequence has no match
+		}
+
+		if (iend - ip < 2)
+		{
+			return false;
+		}
+		const size_t offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		size_t match_length = token & 15;
+		if (match_length == 15 && !read_length(&ip, iend, &match_length))
+		{
+			return false;
+		}
+		match_length += MIN_MATCH;
+
+		const size_t produced = op - dst_begin;
+		if (offset == 0 || offset > produced + dictionary.size() || match_length > static_cast<size_t>(oend - op))
+		{
+			return false;
+		}
+
+		const uint8_t* match;
+		if (offset > produced)
+		{
+			// Starts in the dictionary and may continue into the output
+			const size_t back = offset - produced;
+			const size_t from_dictionary = std::min(back, match_length);
+			memcpy(op, dictionary.data() + dictionary.size() - back, from_dictionary);
+			op += from_dictionary;
+			match_length -= from_dictionary;
+			match = dst_begin;
+		}
+		else
+		{
+			match = op - offset;
+		}
+
+		if (match + match_length <= op)
+		{
+			memcpy(op, match, match_length);
+			op += match_length;
+		}
+		else
+		{
+			// Overlapping copy repeats the last offset bytes, byte by byte
+			for (size_t i = 0; i < match_length; i++)
+			{
+				*op++ = *match++;
+			}
+		}
+	}
+}
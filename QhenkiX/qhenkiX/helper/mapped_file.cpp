@@ -0,0 +1,167 @@
+#include "qhenkiX/helper/mapped_file.h"
+
+#include <utility>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace qhenki::util;
+
+MappedFile::~MappedFile()
+{
+	close();
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept
+{
+	*this = std::move(other);
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept
+{
+	if (this != &other)
+	{
+		close();
+		m_data = std::exchange(other.m_data, nullptr);
+		m_size = std::exchange(other.m_size, 0);
+		m_open = std::exchange(other.m_open, false);
+#ifdef _WIN32
+		m_file = std::exchange(other.m_file, nullptr);
+		m_mapping = std::exchange(other.m_mapping, nullptr);
+#endif
+	}
+	return *this;
+}
+
+#ifdef _WIN32
+static bool map_handle(HANDLE file, void** file_out, void** mapping_out, const void** data, size_t* size)
+{
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(file, &file_size))
+	{
+		CloseHandle(file);
+		return false;
+	}
+
+	*file_out = file;
+	*size = static_cast<size_t>(file_size.QuadPart);
+	if (*size == 0)
+	{
+		// Zero length files cannot be mapped
+		return true;
+	}
+
+	const HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!mapping)
+	{
+		return false;
+	}
+	*mapping_out = mapping;
+
+	*data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	return *data != nullptr;
+}
+
+bool MappedFile::open(const char* path)
+{
+	close();
+	const HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	m_open = map_handle(file, &m_file, &m_mapping, &m_data, &m_size);
+	if (!m_open)
+	{
+		close();
+	}
+	return m_open;
+}
+
+bool MappedFile::open(const wchar_t* path)
+{
+	close();
+	const HANDLE file = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	m_open = map_handle(file, &m_file, &m_mapping, &m_data, &m_size);
+	if (!m_open)
+	{
+		close();
+	}
+	return m_open;
+}
+
+void MappedFile::close()
+{
+	if (m_data)
+	{
+		UnmapViewOfFile(m_data);
+	}
+	if (m_mapping)
+	{
+		CloseHandle(m_mapping);
+	}
+	if (m_file)
+	{
+		CloseHandle(m_file);
+	}
+	m_data = nullptr;
+	m_size = 0;
+	m_open = false;
+	m_file = nullptr;
+	m_mapping = nullptr;
+}
+#else
+bool MappedFile::open(const char* path)
+{
+	close();
+	const int fd = ::open(path, O_RDONLY);
+	if (fd < 0)
+	{
+		return false;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0)
+	{
+		::close(fd);
+		return false;
+	}
+
+	m_size = static_cast<size_t>(st.st_size);
+	if (m_size > 0)
+	{
+		void* data = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data == MAP_FAILED)
+		{
+			::close(fd);
+			m_size = 0;
+			return false;
+		}
+		m_data = data;
+	}
+	// The mapping keeps its own reference to the file
+	::close(fd);
+	m_open = true;
+	return true;
+}
+
+void MappedFile::close()
+{
+	if (m_data)
+	{
+		munmap(const_cast<void*>(m_data), m_size);
+	}
+	m_data = nullptr;
+	m_size = 0;
+	m_open = false;
+}
+#endif
@@ -0,0 +1,65 @@
+#include "qhenkiX/utility/include_cache.h"
+
+#include <fstream>
+#include <mutex>
+
+using namespace qhenki::gfx;
+
+namespace
+{
+	std::string make_key(const std::filesystem::path& path)
+	{
+		const auto normalized = path.lexically_normal().generic_u8string();
+		return { reinterpret_cast<const char*>(normalized.data()), normalized.size() };
+	}
+
+	uPtr<const std::string> read_file(const std::filesystem::path& path)
+	{
+		std::ifstream file(path, std::ios::binary | std::ios::ate);
+		if (!file)
+		{
+			return nullptr;
+		}
+		const std::streamsize size = file.tellg();
+		if (size < 0)
+		{
+			return nullptr;
+		}
+		auto contents = mkU<std::string>(static_cast<size_t>(size), '\0');
+		file.seekg(0, std::ios::beg);
+		if (!file.read(contents->data(), size))
+		{
+			return nullptr;
+		}
+		return contents;
+	}
+}
+
+const std::string* IncludeCache::load(const std::filesystem::path& path)
+{
+	auto key = make_key(path);
+	{
+		std::shared_lock lock(m_mutex);
+		if (const auto it = m_files.find(key); it != m_files.end())
+		{
+			return it->second.get();
+		}
+	}
+
+	// Read outside the lock. If another thread loaded the same file meanwhile its copy is kept
+	auto contents = read_file(path);
+	std::unique_lock lock(m_mutex);
+	return m_files.try_emplace(std::move(key), std::move(contents)).first->second.get();
+}
+
+void IncludeCache::clear()
+{
+	std::unique_lock lock(m_mutex);
+	m_files.clear();
+}
+
+size_t IncludeCache::size() const
+{
+	std::shared_lock lock(m_mutex);
+	return m_files.size();
+}
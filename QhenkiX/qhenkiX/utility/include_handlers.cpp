@@ -1,51 +1,73 @@
 #include "qhenkiX/utility/include_handlers.h"
+#include "qhenkiX/utility/include_cache.h"
 
 #include <cassert>
-#include <filesystem>
 #include <fstream>
 
-HRESULT __stdcall qhenki::gfx::MultiIncludeHandler::Open(D3D_INCLUDE_TYPE IncludeType, LPCSTR pFileName, LPCVOID pParentData, LPCVOID* ppData, UINT* pBytes)
+bool qhenki::gfx::MultiIncludeHandler::open_file(const std::filesystem::path& path, LPCVOID* ppData, UINT* pBytes)
 {
-    for (const auto& dir : m_include_paths)
-    {
-        if (!std::filesystem::is_directory(dir))
-        {
-            continue; // Skip if not valid directory
-        }
-
-        std::ifstream file;
-
-        char fullPath[1024];
-        if (dir.size() + strlen(pFileName) + 1 < sizeof(fullPath))
-        {
-            std::snprintf(fullPath, sizeof(fullPath), "%s/%s", dir.c_str(), pFileName);
-			file.open(fullPath, std::ios::binary | std::ios::ate);
-        }
-        else
-        {
-            std::string fullPath = dir + "/" + pFileName;
-			file.open(fullPath, std::ios::binary | std::ios::ate);
-        }
+	if (m_cache)
+	{
+		// Missing candidates are cached too, so probing the include paths does not touch the disk after the first time
+		const auto contents = m_cache->load(path);
+		if (!contents)
+		{
+			return false;
+		}
+		*ppData = contents->data();
+		*pBytes = static_cast<UINT>(contents->size());
+	}
+	else
+	{
+		std::ifstream file(path, std::ios::binary | std::ios::ate);
+		if (!file)
+		{
+			return false;
+		}
+		const std::streamsize size = file.tellg();
+		file.seekg(0, std::ios::beg);
+		char* buffer = new char[size];
+		if (!file.read(buffer, size))
+		{
+			delete[] buffer;
+			return false;
+		}
+		*ppData = buffer;
+		*pBytes = static_cast<UINT>(size);
+	}
+	// Cached contents are shared by every include of a file, which all have the same directory
+	m_directories.insert_or_assign(*ppData, path.parent_path());
+	return true;
+}
 
-        if (file)
-        {
-            std::streamsize size = file.tellg();
-            file.seekg(0, std::ios::beg);
-            char* buffer = new char[size];
-            if (file.read(buffer, size))
-            {
-                *ppData = buffer;
-                *pBytes = static_cast<UINT>(size);
-                return S_OK;
-            }
-            delete[] buffer;
-        }
-    }
-    return E_FAIL;
+HRESULT __stdcall qhenki::gfx::MultiIncludeHandler::Open(D3D_INCLUDE_TYPE IncludeType, LPCSTR pFileName, LPCVOID pParentData, LPCVOID* ppData, UINT* pBytes)
+{
+	if (IncludeType == D3D_INCLUDE_LOCAL)
+	{
+		const auto it = pParentData ? m_directories.find(pParentData) : m_directories.end();
+		const auto& parent_directory = it != m_directories.end() ? it->second : m_source_directory;
+		if (open_file(parent_directory / pFileName, ppData, pBytes))
+		{
+			return S_OK;
+		}
+	}
+	for (const auto& dir : m_include_paths)
+	{
+		if (open_file(std::filesystem::path(dir) / pFileName, ppData, pBytes))
+		{
+			return S_OK;
+		}
+	}
+	return E_FAIL;
 }
 
 HRESULT __stdcall qhenki::gfx::MultiIncludeHandler::Close(LPCVOID pData)
 {
-	delete[] reinterpret_cast<const char*>(pData); // Open allocates memory with new char[]
-    return S_OK;
+	if (!m_cache)
+	{
+		// Open allocates memory with new char[], the address may be reused by the next file
+		m_directories.erase(pData);
+		delete[] reinterpret_cast<const char*>(pData);
+	}
+	return S_OK;
 }
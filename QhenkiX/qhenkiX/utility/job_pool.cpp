@@ -0,0 +1,74 @@
+#include "qhenkiX/utility/job_pool.h"
+
+#include <algorithm>
+
+using namespace qhenki::util;
+
+JobPool::JobPool(uint32_t worker_count)
+{
+	if (worker_count == 0)
+	{
+		// hardware_concurrency may return 0 if unknown
+		worker_count = std::max(2u, std::thread::hardware_concurrency()) - 1;
+	}
+	m_workers.reserve(worker_count);
+	for (uint32_t i = 0; i < worker_count; i++)
+	{
+		m_workers.emplace_back(&JobPool::worker_main, this, i);
+	}
+}
+
+JobPool::~JobPool()
+{
+	{
+		std::scoped_lock lock(m_mutex);
+		m_stop = true;
+	}
+	m_job_added.notify_all();
+	for (auto& worker : m_workers)
+	{
+		worker.join();
+	}
+}
+
+void JobPool::worker_main(const uint32_t worker)
+{
+	std::unique_lock lock(m_mutex);
+	while (true)
+	{
+		m_job_added.wait(lock, [this] { return m_stop || !m_jobs.empty(); });
+		if (m_jobs.empty())
+		{
+			return; // Stopping and drained
+		}
+		auto job = std::move(m_jobs.front());
+		m_jobs.pop_front();
+		m_running++;
+
+		lock.unlock();
+		job(worker);
+		job = nullptr; // Captures are released outside the lock
+		lock.lock();
+
+		m_running--;
+		if (m_running == 0 && m_jobs.empty())
+		{
+			m_idle.notify_all();
+		}
+	}
+}
+
+void JobPool::submit(std::function<void(uint32_t worker)> job)
+{
+	{
+		std::scoped_lock lock(m_mutex);
+		m_jobs.push_back(std::move(job));
+	}
+	m_job_added.notify_one();
+}
+
+void JobPool::wait_idle()
+{
+	std::unique_lock lock(m_mutex);
+	m_idle.wait(lock, [this] { return m_running == 0 && m_jobs.empty(); });
+}
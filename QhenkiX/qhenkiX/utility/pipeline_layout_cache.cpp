@@ -0,0 +1,391 @@
+#include "qhenkiX/utility/pipeline_layout_cache.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <fstream>
+#include <tuple>
+
+using namespace qhenki::util;
+namespace fs = std::filesystem;
+
+namespace
+{
+	// D3D_SHADER_INPUT_TYPE values
+	constexpr uint32_t INPUT_CBUFFER = 0;
+	constexpr uint32_t INPUT_TBUFFER = 1;
+	constexpr uint32_t INPUT_TEXTURE = 2;
+	constexpr uint32_t INPUT_SAMPLER = 3;
+	constexpr uint32_t INPUT_STRUCTURED = 5;
+	constexpr uint32_t INPUT_BYTEADDRESS = 7;
+	constexpr uint32_t INPUT_RTACCELERATIONSTRUCTURE = 12;
+
+	uint32_t get_range_type(const uint32_t input_type)
+	{
+		switch (input_type)
+		{
+		case INPUT_CBUFFER:
+			return CanonicalPipelineLayout::RANGE_CBV;
+		case INPUT_SAMPLER:
+			return CanonicalPipelineLayout::RANGE_SAMPLER;
+		case INPUT_TBUFFER:
+		case INPUT_TEXTURE:
+		case INPUT_STRUCTURED:
+		case INPUT_BYTEADDRESS:
+		case INPUT_RTACCELERATIONSTRUCTURE:
+			return CanonicalPipelineLayout::RANGE_SRV;
+		default: // Every other type is a UAV
+			return CanonicalPipelineLayout::RANGE_UAV;
+		}
+	}
+
+	// A resource used by more than one stage is visible to all
+	uint32_t merge_visibility(const uint32_t a, const uint32_t b)
+	{
+		return a == b ? a : CanonicalPipelineLayout::VISIBILITY_ALL;
+	}
+
+	struct Resource
+	{
+		uint32_t space;
+		uint32_t type; // Descriptor range type
+		uint32_t binding;
+		uint32_t count;
+		uint32_t visibility;
+	};
+
+	std::vector<CanonicalPipelineLayout::Table> make_tables(std::vector<Resource> resources)
+	{
+		using Layout = CanonicalPipelineLayout;
+		// Grouped by table, unbounded arrays after the bounded bindings of their group
+		auto table_key = [](const Resource& r)
+		{
+			return std::tuple(r.type == Layout::RANGE_SAMPLER, r.space, r.visibility, r.count == Layout::UNBOUNDED);
+		};
+		std::ranges::sort(resources, [&table_key](const Resource& a, const Resource& b)
+		{
+			return std::tuple_cat(table_key(a), std::tuple(a.binding, a.type)) < std::tuple_cat(table_key(b), std::tuple(b.binding, b.type));
+		});
+
+		std::vector<Layout::Table> tables;
+		for (size_t i = 0; i < resources.size(); i++)
+		{
+			const auto& resource = resources[i];
+			// An unbounded array must be the last range of its table
+			if (i == 0 || table_key(resource) != table_key(resources[i - 1]) || resource.count == Layout::UNBOUNDED)
+			{
+				tables.push_back({ resource.space, resource.visibility, {} });
+			}
+			tables.back().bindings.push_back({ resource.binding, resource.type, resource.count });
+		}
+		return tables;
+	}
+}
+
+void CanonicalPipelineLayout::add_push_range(const uint32_t size, const uint32_t binding, const uint32_t space, const uint32_t visibility)
+{
+	push_ranges.push_back({ (size + 3) / 4, binding, space, visibility }); // Bytes to 32-bit words conversion rounded up
+}
+
+void CanonicalPipelineLayout::add_space(const uint32_t index, std::vector<Binding> bindings)
+{
+	assert(tables.empty() || tables.back().space < index);
+	if (bindings.empty())
+	{
+		return;
+	}
+	// Register first, type and count only order bindings sharing a register (e.g. t0 and b0) deterministically
+	std::ranges::sort(bindings);
+	tables.push_back({ index, VISIBILITY_ALL, std::move(bindings) });
+}
+
+CanonicalPipelineLayout CanonicalPipelineLayout::from_reflection(const std::span<const Stage> stages)
+{
+	// Merge the usage of all stages
+	std::vector<Resource> resources;
+	std::vector<PushRange> push_ranges;
+	for (const auto& stage : stages)
+	{
+		if (!stage.reflection)
+		{
+			continue;
+		}
+		for (const auto& r : stage.reflection->get_resources())
+		{
+			const auto type = get_range_type(r.type);
+			const auto count = r.count ? r.count : UNBOUNDED;
+			const auto it = std::ranges::find_if(resources, [&](const Resource& other)
+			{
+				return other.space == r.space && other.type == type && other.binding == r.bind_point;
+			});
+			if (it == resources.end())
+			{
+				resources.push_back({ r.space, type, r.bind_point, count, stage.visibility });
+				continue;
+			}
+			it->count = std::max(it->count, count);
+			it->visibility = merge_visibility(it->visibility, stage.visibility);
+		}
+		for (const auto& push_constant : stage.reflection->get_push_constants())
+		{
+			const uint32_t num_values = (push_constant.size + 3) / 4;
+			const auto it = std::ranges::find(push_ranges, push_constant.binding, &PushRange::binding);
+			if (it == push_ranges.end())
+			{
+				push_ranges.push_back({ num_values, push_constant.binding, SHADER_REFLECTION_PUSH_CONSTANT_SPACE, stage.visibility });
+				continue;
+			}
+			it->num_values = std::max(it->num_values, num_values);
+			it->visibility = merge_visibility(it->visibility, stage.visibility);
+		}
+	}
+
+	CanonicalPipelineLayout layout;
+	// Stages without a shader get no root access, so the driver can skip them when root arguments change
+	for (uint32_t visibility = VISIBILITY_VERTEX; visibility <= VISIBILITY_PIXEL; visibility++)
+	{
+		if (std::ranges::find(stages, visibility, &Stage::visibility) == stages.end())
+		{
+			layout.deny_flags |= DENY_VERTEX_ROOT_ACCESS << (visibility - VISIBILITY_VERTEX);
+		}
+	}
+
+	// Single constant buffers are bound by address, saving the descriptor and the table indirection
+	std::vector<Resource> table_resources;
+	std::vector<Resource> root_resources;
+	for (const auto& resource : resources)
+	{
+		(resource.type == RANGE_CBV && resource.count == 1 ? root_resources : table_resources).push_back(resource);
+	}
+	layout.tables = make_tables(table_resources);
+
+	// Push constants are constant buffers to the shader, so ones that do not fit can be bound by address instead
+	uint32_t push_size = 0;
+	for (const auto& range : push_ranges)
+	{
+		push_size += range.num_values;
+	}
+	while (!push_ranges.empty() && push_size + layout.tables.size() > MAX_ROOT_SIZE)
+	{
+		const auto largest = std::ranges::max_element(push_ranges, {}, &PushRange::num_values);
+		root_resources.push_back({ largest->space, RANGE_CBV, largest->binding, 1, largest->visibility });
+		push_size -= largest->num_values;
+		push_ranges.erase(largest);
+	}
+	layout.push_ranges = std::move(push_ranges);
+	std::ranges::sort(layout.push_ranges, {}, &PushRange::binding);
+	std::ranges::sort(root_resources, {}, [](const Resource& r) { return std::pair(r.space, r.binding); });
+
+	// A root descriptor costs two values, move the last ones back into tables until the layout fits
+	while (!root_resources.empty() && layout.get_root_size() + root_resources.size() * 2 > MAX_ROOT_SIZE)
+	{
+		table_resources.push_back(root_resources.back());
+		root_resources.pop_back();
+		layout.tables = make_tables(table_resources);
+	}
+	for (const auto& resource : root_resources)
+	{
+		layout.root_descriptors.push_back({ resource.binding, resource.space, resource.visibility });
+	}
+	return layout;
+}
+
+uint32_t CanonicalPipelineLayout::get_root_size() const
+{
+	uint32_t size = static_cast<uint32_t>(root_descriptors.size() * 2 + tables.size());
+	for (const auto& range : push_ranges)
+	{
+		size += range.num_values;
+	}
+	return size;
+}
+
+std::vector<uint32_t> CanonicalPipelineLayout::serialize() const
+{
+	// Counts before each list, so a value cannot be mistaken for the start of the next list
+	size_t size = 4 + push_ranges.size() * 4 + root_descriptors.size() * 3;
+	for (const auto& table : tables)
+	{
+		size += 3 + table.bindings.size() * 3;
+	}
+	std::vector<uint32_t> words;
+	words.reserve(size);
+	words.push_back(deny_flags);
+	words.push_back(static_cast<uint32_t>(push_ranges.size()));
+	for (const auto& range : push_ranges)
+	{
+		words.insert(words.end(), { range.num_values, range.binding, range.space, range.visibility });
+	}
+	words.push_back(static_cast<uint32_t>(root_descriptors.size()));
+	for (const auto& descriptor : root_descriptors)
+	{
+		words.insert(words.end(), { descriptor.binding, descriptor.space, descriptor.visibility });
+	}
+	words.push_back(static_cast<uint32_t>(tables.size()));
+	for (const auto& table : tables)
+	{
+		words.insert(words.end(), { table.space, table.visibility, static_cast<uint32_t>(table.bindings.size()) });
+		for (const auto& binding : table.bindings)
+		{
+			words.insert(words.end(), { binding.binding, binding.type, binding.count });
+		}
+	}
+	assert(words.size() == size);
+	return words;
+}
+
+Hash128 CanonicalPipelineLayout::hash() const
+{
+	const auto words = serialize();
+	return HashHelper::hash128(words.data(), words.size() * sizeof(uint32_t));
+}
+
+bool PipelineLayoutCache::find(const CanonicalPipelineLayout& layout, std::vector<uint8_t>* blob) const
+{
+	assert(blob);
+	const auto words = layout.serialize();
+	const auto key = HashHelper::hash128(words.data(), words.size() * sizeof(uint32_t));
+
+	std::scoped_lock lock(m_mutex);
+	const auto it = m_entries.find(key);
+	if (it == m_entries.end() || it->second.layout != words)
+	{
+		return false;
+	}
+	*blob = it->second.blob;
+	return true;
+}
+
+void PipelineLayoutCache::store(const CanonicalPipelineLayout& layout, const std::span<const uint8_t> blob)
+{
+	auto words = layout.serialize();
+	const auto key = HashHelper::hash128(words.data(), words.size() * sizeof(uint32_t));
+
+	std::scoped_lock lock(m_mutex);
+	if (const auto it = m_entries.find(key); it != m_entries.end() && it->second.layout == words)
+	{
+		return; // Stored by another thread
+	}
+	m_entries.insert_or_assign(key, Entry{ std::move(words), { blob.begin(), blob.end() } });
+	m_dirty = true;
+}
+
+size_t PipelineLayoutCache::size() const
+{
+	std::scoped_lock lock(m_mutex);
+	return m_entries.size();
+}
+
+bool PipelineLayoutCache::load(const fs::path& path)
+{
+	std::vector<uint8_t> data;
+	if (std::ifstream file(path, std::ios::binary | std::ios::ate); file)
+	{
+		data.resize(static_cast<size_t>(file.tellg()));
+		file.seekg(0);
+		if (!file.read(reinterpret_cast<char*>(data.data()), static_cast<std::streamsize>(data.size())))
+		{
+			data.clear();
+		}
+	}
+
+	std::scoped_lock lock(m_mutex);
+	m_entries.clear();
+	m_dirty = false;
+
+	PipelineLayoutCacheHeader header;
+	if (data.size() < sizeof(header))
+	{
+		return false;
+	}
+	memcpy(&header, data.data(), sizeof(header));
+	if (header.magic != PIPELINE_LAYOUT_CACHE_MAGIC || header.version != PIPELINE_LAYOUT_CACHE_VERSION
+		|| HashHelper::xxh64(data.data() + sizeof(header), data.size() - sizeof(header)) != header.content_hash)
+	{
+		return false;
+	}
+
+	size_t offset = sizeof(header);
+	m_entries.reserve(header.entry_count);
+	for (uint32_t i = 0; i < header.entry_count; i++)
+	{
+		PipelineLayoutCacheEntry record;
+		if (data.size() - offset < sizeof(record))
+		{
+			m_entries.clear();
+			return false;
+		}
+		memcpy(&record, data.data() + offset, sizeof(record));
+		offset += sizeof(record);
+		const size_t layout_size = static_cast<size_t>(record.word_count) * sizeof(uint32_t);
+		if (data.size() - offset < layout_size + record.blob_size)
+		{
+			m_entries.clear();
+			return false;
+		}
+		Entry entry;
+		entry.layout.resize(record.word_count);
+		memcpy(entry.layout.data(), data.data() + offset, layout_size);
+		offset += layout_size;
+		entry.blob.assign(data.data() + offset, data.data() + offset + record.blob_size);
+		offset += record.blob_size;
+		m_entries.insert_or_assign(record.key, std::move(entry));
+	}
+	return offset == data.size();
+}
+
+bool PipelineLayoutCache::save(const fs::path& path)
+{
+	std::scoped_lock lock(m_mutex);
+	if (!m_dirty)
+	{
+		return true;
+	}
+
+	std::vector<uint8_t> data(sizeof(PipelineLayoutCacheHeader));
+	auto append = [&data](const void* p, const size_t size)
+	{
+		data.insert(data.end(), static_cast<const uint8_t*>(p), static_cast<const uint8_t*>(p) + size);
+	};
+	for (const auto& [key, entry] : m_entries)
+	{
+		const PipelineLayoutCacheEntry record
+		{
+			.key = key,
+			.word_count = static_cast<uint32_t>(entry.layout.size()),
+			.blob_size = static_cast<uint32_t>(entry.blob.size()),
+		};
+		append(&record, sizeof(record));
+		append(entry.layout.data(), entry.layout.size() * sizeof(uint32_t));
+		append(entry.blob.data(), entry.blob.size());
+	}
+	const PipelineLayoutCacheHeader header
+	{
+		.magic = PIPELINE_LAYOUT_CACHE_MAGIC,
+		.version = PIPELINE_LAYOUT_CACHE_VERSION,
+		.entry_count = static_cast<uint32_t>(m_entries.size()),
+		.reserved = 0,
+		.content_hash = HashHelper::xxh64(data.data() + sizeof(PipelineLayoutCacheHeader), data.size() - sizeof(PipelineLayoutCacheHeader)),
+	};
+	memcpy(data.data(), &header, sizeof(header));
+
+	// Written next to the file and renamed over it, so a crash while writing does not leave a truncated cache
+	auto temp_path = path;
+	temp_path += ".tmp";
+	{
+		std::ofstream file(temp_path, std::ios::binary | std::ios::trunc);
+		if (!file.write(reinterpret_cast<const char*>(data.data()), static_cast<std::streamsize>(data.size())))
+		{
+			return false;
+		}
+	}
+	std::error_code ec;
+	fs::rename(temp_path, path, ec);
+	if (ec)
+	{
+		fs::remove(temp_path, ec);
+		return false;
+	}
+	m_dirty = false;
+	return true;
+}
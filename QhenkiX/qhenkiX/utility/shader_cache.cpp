@@ -0,0 +1,394 @@
+#include "qhenkiX/utility/shader_cache.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstring>
+#include <fstream>
+#include <thread>
+
+using namespace qhenki::gfx;
+namespace fs = std::filesystem;
+
+namespace
+{
+	/*
+	 * [ShaderCacheHeader]
+	 * [dependency_count * (ShaderCacheDependency, path)]
+	 * [bytecode][reflection][root signature]
+	 */
+	constexpr uint32_t SHADER_CACHE_MAGIC = 0x43435351; // "QSCC"
+	constexpr uint32_t SHADER_CACHE_VERSION = 1;
+	constexpr uint64_t MISSING = UINT64_MAX; // Size of an include candidate that did not exist
+
+	struct ShaderCacheHeader
+	{
+		uint32_t magic;
+		uint32_t version;
+		uint32_t dependency_count;
+		uint32_t reserved;
+		uint64_t bytecode_size;
+		uint64_t reflection_size;
+		uint64_t root_signature_size;
+		uint64_t content_hash; // Of everything after the header, detects truncated or corrupted entries
+	};
+	static_assert(sizeof(ShaderCacheHeader) == 48);
+
+	struct ShaderCacheDependency
+	{
+		uint64_t size; // MISSING if the file must not exist
+		uint64_t content_hash;
+		uint32_t path_size;
+		uint32_t reserved;
+	};
+	static_assert(sizeof(ShaderCacheDependency) == 24);
+
+	std::string normalize(const fs::path& path)
+	{
+		std::error_code ec;
+		auto absolute = fs::absolute(path, ec);
+		if (ec)
+		{
+			absolute = path;
+		}
+		const auto normalized = absolute.lexically_normal().generic_u8string();
+		return { reinterpret_cast<const char*>(normalized.data()), normalized.size() };
+	}
+
+	bool read_file(const std::string& path, std::string* contents)
+	{
+		std::ifstream file(path, std::ios::binary | std::ios::ate);
+		if (!file)
+		{
+			return false;
+		}
+		const std::streamsize size = file.tellg();
+		if (size < 0)
+		{
+			return false;
+		}
+		contents->resize(static_cast<size_t>(size));
+		file.seekg(0, std::ios::beg);
+		return static_cast<bool>(file.read(contents->data(), size));
+	}
+
+	bool is_space(const char c)
+	{
+		return c == ' ' || c == '\t' || c == '\r';
+	}
+
+	// Calls callback(name, angled) for every #include directive, same rules as SXC's dependency scan
+	template <typename Callback>
+	void find_includes(const std::string& contents, Callback&& callback)
+	{
+		const char* p = contents.data();
+		const char* const end = p + contents.size();
+		while (p < end)
+		{
+			auto line_end = static_cast<const char*>(memchr(p, '\n', end - p));
+			if (!line_end)
+			{
+				line_end = end;
+			}
+
+			const char* c = p;
+			while (c < line_end && is_space(*c)) c++;
+			if (c < line_end && *c == '#')
+			{
+				c++;
+				while (c < line_end && is_space(*c)) c++;
+				constexpr std::string_view directive = "include";
+				if (static_cast<size_t>(line_end - c) > directive.size() && memcmp(c, directive.data(), directive.size()) == 0)
+				{
+					c += directive.size();
+					while (c < line_end && is_space(*c)) c++;
+					if (c < line_end && (*c == '"' || *c == '<'))
+					{
+						const bool angled = *c == '<';
+						const char close = angled ? '>' : '"';
+						const char* name_start = ++c;
+						while (c < line_end && *c != close) c++;
+						if (c < line_end && c > name_start)
+						{
+							callback(std::string_view(name_start, c - name_start), angled);
+						}
+					}
+				}
+			}
+			p = line_end + 1;
+		}
+	}
+
+	bool is_up_to_date(const ShaderCache::Dependency& dependency, std::string* contents)
+	{
+		std::error_code ec;
+		if (dependency.size == MISSING)
+		{
+			return !fs::is_regular_file(dependency.path, ec);
+		}
+		const auto size = fs::file_size(dependency.path, ec);
+		// Size check first so most edits are found without reading the file
+		return !ec && size == dependency.size && read_file(dependency.path, contents)
+			&& qhenki::util::HashHelper::xxh64(*contents) == dependency.content_hash;
+	}
+
+	void append_field(std::string& buffer, const std::string_view field)
+	{
+		// Length prefix so that ("ab", "c") and ("a", "bc") do not produce the same key
+		const uint64_t length = field.size();
+		buffer.append(reinterpret_cast<const char*>(&length), sizeof(length));
+		buffer.append(field);
+	}
+
+	bool write_file_atomic(const fs::path& path, const void* data, const size_t size)
+	{
+		static std::atomic_uint64_t counter{ 0 };
+		const auto unique = std::hash<std::thread::id>{}(std::this_thread::get_id()) ^ (counter++ << 32);
+
+		auto temp_path = path;
+		temp_path += ".tmp" + std::to_string(unique);
+		std::ofstream file(temp_path, std::ios::binary);
+		if (!file)
+		{
+			return false;
+		}
+		file.write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+		file.close();
+		std::error_code ec;
+		if (file.fail())
+		{
+			fs::remove(temp_path, ec);
+			return false;
+		}
+		fs::rename(temp_path, path, ec);
+		if (ec)
+		{
+			fs::remove(temp_path, ec);
+			return false;
+		}
+		return true;
+	}
+}
+
+ShaderCache::ShaderCache(fs::path directory) : m_directory(std::move(directory))
+{
+	std::error_code ec;
+	fs::create_directories(m_directory, ec);
+}
+
+fs::path ShaderCache::get_entry_path(const util::Hash128& key) const
+{
+	const auto hex = key.to_hex();
+	const std::string_view name(hex.data(), hex.size());
+	// Two character fan out keeps directories small
+	return m_directory / name.substr(0, 2) / name;
+}
+
+qhenki::util::Hash128 ShaderCache::make_key(const CompilerInput& input, const std::string_view compiler_version)
+{
+	std::string buffer;
+	buffer.reserve(256);
+	append_field(buffer, compiler_version);
+	// Absolute, the same relative path is a different shader in another working directory
+	append_field(buffer, normalize(input.get_path()));
+	append_field(buffer, input.entry_point);
+	buffer.push_back(static_cast<char>(input.shader_model));
+	buffer.push_back(static_cast<char>(input.shader_type));
+	buffer.push_back(static_cast<char>(input.optimization));
+	buffer.push_back(static_cast<char>(input.flags));
+	// Order is kept, a later define with the same name overrides an earlier one
+	const auto defines = input.get_defines();
+	const uint64_t define_count = defines.size();
+	buffer.append(reinterpret_cast<const char*>(&define_count), sizeof(define_count));
+	for (const auto& define : defines)
+	{
+		append_field(buffer, define);
+	}
+	const uint64_t include_count = input.includes.size();
+	buffer.append(reinterpret_cast<const char*>(&include_count), sizeof(include_count));
+	for (const auto& include : input.includes)
+	{
+		append_field(buffer, normalize(include));
+	}
+	return util::HashHelper::hash128(buffer);
+}
+
+bool ShaderCache::collect_dependencies(const CompilerInput& input, std::vector<Dependency>* dependencies)
+{
+	assert(dependencies);
+	dependencies->clear();
+	std::vector<std::string> include_dirs;
+	include_dirs.reserve(input.includes.size());
+	for (const auto& include : input.includes)
+	{
+		include_dirs.push_back(normalize(include));
+	}
+
+	std::vector<std::string> stack{ normalize(input.get_path()) };
+	std::string contents;
+	auto recorded = [dependencies](const std::string& path)
+	{
+		return std::ranges::find(*dependencies, path, &Dependency::path) != dependencies->end();
+	};
+	while (!stack.empty())
+	{
+		auto path = std::move(stack.back());
+		stack.pop_back();
+		if (recorded(path))
+		{
+			continue; // Diamond or circular include
+		}
+		if (!read_file(path, &contents))
+		{
+			if (dependencies->empty())
+			{
+				return false;
+			}
+			// Unreadable include, the compile failed or did not need it
+			dependencies->push_back({ std::move(path), MISSING, 0 });
+			continue;
+		}
+		dependencies->push_back({ path, contents.size(), qhenki::util::HashHelper::xxh64(contents) });
+
+		const auto parent_dir = fs::path(path).parent_path();
+		find_includes(contents, [&](const std::string_view name, const bool angled)
+		{
+			// Same search order as the compilers, quoted includes look next to the including file first
+			std::vector<std::string> candidates;
+			if (!angled) candidates.push_back(normalize(parent_dir / name));
+			for (const auto& dir : include_dirs) candidates.push_back(normalize(fs::path(dir) / name));
+			if (angled) candidates.push_back(normalize(parent_dir / name));
+			for (auto& candidate : candidates)
+			{
+				std::error_code ec;
+				if (fs::is_regular_file(candidate, ec))
+				{
+					stack.push_back(std::move(candidate));
+					break;
+				}
+				if (!recorded(candidate))
+				{
+					dependencies->push_back({ std::move(candidate), MISSING, 0 });
+				}
+			}
+		});
+	}
+	return true;
+}
+
+bool ShaderCache::get_dependencies(const CompilerInput& input, std::vector<std::string>* files, std::vector<std::string>* missing)
+{
+	assert(files && missing);
+	std::vector<Dependency> dependencies;
+	if (!collect_dependencies(input, &dependencies))
+	{
+		return false;
+	}
+	for (auto& dependency : dependencies)
+	{
+		(dependency.size == MISSING ? missing : files)->push_back(std::move(dependency.path));
+	}
+	return true;
+}
+
+bool ShaderCache::load(const util::Hash128& key, Entry* entry) const
+{
+	assert(entry);
+	std::string data;
+	if (!read_file(get_entry_path(key).string(), &data))
+	{
+		return false;
+	}
+
+	ShaderCacheHeader header;
+	if (data.size() < sizeof(header))
+	{
+		return false;
+	}
+	memcpy(&header, data.data(), sizeof(header));
+	if (header.magic != SHADER_CACHE_MAGIC || header.version != SHADER_CACHE_VERSION
+		|| util::HashHelper::xxh64(data.data() + sizeof(header), data.size() - sizeof(header)) != header.content_hash)
+	{
+		return false;
+	}
+
+	size_t offset = sizeof(header);
+	std::string contents;
+	for (uint32_t i = 0; i < header.dependency_count; i++)
+	{
+		ShaderCacheDependency record;
+		if (data.size() - offset < sizeof(record))
+		{
+			return false;
+		}
+		memcpy(&record, data.data() + offset, sizeof(record));
+		offset += sizeof(record);
+		if (data.size() - offset < record.path_size)
+		{
+			return false;
+		}
+		const Dependency dependency{ data.substr(offset, record.path_size), record.size, record.content_hash };
+		offset += record.path_size;
+		if (!is_up_to_date(dependency, &contents))
+		{
+			return false;
+		}
+	}
+
+	if (data.size() - offset != header.bytecode_size + header.reflection_size + header.root_signature_size)
+	{
+		return false;
+	}
+	auto read = [&data, &offset](std::vector<uint8_t>* out, const uint64_t size)
+	{
+		const auto begin = reinterpret_cast<const uint8_t*>(data.data()) + offset;
+		out->assign(begin, begin + size);
+		offset += size;
+	};
+	read(&entry->bytecode, header.bytecode_size);
+	read(&entry->reflection, header.reflection_size);
+	read(&entry->root_signature, header.root_signature_size);
+	return !entry->bytecode.empty();
+}
+
+bool ShaderCache::store(const util::Hash128& key, const std::span<const Dependency> dependencies, const Entry& entry) const
+{
+	std::vector<uint8_t> data(sizeof(ShaderCacheHeader));
+	auto append = [&data](const void* p, const size_t size)
+	{
+		data.insert(data.end(), static_cast<const uint8_t*>(p), static_cast<const uint8_t*>(p) + size);
+	};
+	for (const auto& dependency : dependencies)
+	{
+		const ShaderCacheDependency record
+		{
+			.size = dependency.size,
+			.content_hash = dependency.content_hash,
+			.path_size = static_cast<uint32_t>(dependency.path.size()),
+			.reserved = 0,
+		};
+		append(&record, sizeof(record));
+		append(dependency.path.data(), dependency.path.size());
+	}
+	append(entry.bytecode.data(), entry.bytecode.size());
+	append(entry.reflection.data(), entry.reflection.size());
+	append(entry.root_signature.data(), entry.root_signature.size());
+
+	const ShaderCacheHeader header
+	{
+		.magic = SHADER_CACHE_MAGIC,
+		.version = SHADER_CACHE_VERSION,
+		.dependency_count = static_cast<uint32_t>(dependencies.size()),
+		.reserved = 0,
+		.bytecode_size = entry.bytecode.size(),
+		.reflection_size = entry.reflection.size(),
+		.root_signature_size = entry.root_signature.size(),
+		.content_hash = util::HashHelper::xxh64(data.data() + sizeof(ShaderCacheHeader), data.size() - sizeof(ShaderCacheHeader)),
+	};
+	memcpy(data.data(), &header, sizeof(header));
+
+	const auto path = get_entry_path(key);
+	std::error_code ec;
+	fs::create_directories(path.parent_path(), ec);
+	return write_file_atomic(path, data.data(), data.size());
+}
@@ -0,0 +1,285 @@
+#include "qhenkiX/utility/shader_hot_reload.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+
+#include <windows.h>
+
+#undef min
+#undef max
+#include <tsl/robin_map.h>
+
+#include "qhenkiX/utility/shader_cache.h"
+
+using namespace qhenki::gfx;
+namespace fs = std::filesystem;
+
+namespace
+{
+	void log_reload(const char* message, const std::string_view path)
+	{
+		char buffer[512];
+		std::snprintf(buffer, sizeof(buffer), "Qhenki HOT RELOAD: %s %.*s\n", message, static_cast<int>(path.size()), path.data());
+		OutputDebugStringA(buffer);
+	}
+}
+
+ShaderHotReload::ShaderHotReload(Context* context, const std::chrono::milliseconds poll_interval)
+	: m_context(context), m_compiler(context->make_shader_compiler()), m_poll_interval(poll_interval)
+{
+	assert(m_context);
+	std::scoped_lock lock(m_mutex); // reload_main waits for m_thread to be set, see is_reload_thread
+	m_thread = std::thread(&ShaderHotReload::reload_main, this);
+}
+
+ShaderHotReload::~ShaderHotReload()
+{
+	{
+		std::scoped_lock lock(m_mutex);
+		m_stop = true;
+	}
+	m_stop_requested.notify_all();
+	m_thread.join();
+}
+
+std::vector<ShaderHotReload::WatchedFile> ShaderHotReload::get_watched_files(const CompilerInput& input)
+{
+	std::vector<std::string> files;
+	std::vector<std::string> missing;
+	if (!ShaderCache::get_dependencies(input, &files, &missing))
+	{
+		// Unreadable source, e.g. saved in the middle of a write. Watch it so the next write is seen
+		files.emplace_back(input.get_path());
+	}
+
+	std::vector<WatchedFile> watched;
+	watched.reserve(files.size() + missing.size());
+	for (auto& path : files)
+	{
+		std::error_code ec;
+		auto time = fs::last_write_time(path, ec);
+		watched.push_back({ std::move(path), ec ? fs::file_time_type::min() : time });
+	}
+	for (auto& path : missing)
+	{
+		watched.push_back({ std::move(path), fs::file_time_type::min() });
+	}
+	return watched;
+}
+
+void ShaderHotReload::watch_shader(const Shader& shader, const CompilerInput& input)
+{
+	if (is_reload_thread())
+	{
+		return; // Recompiled shaders and rebuilt pipelines replace watched ones
+	}
+	auto owned_input = mkS<const OwnedCompilerInput>(input);
+	auto files = get_watched_files(owned_input->input); // Reads the files, so outside the lock
+
+	std::scoped_lock lock(m_mutex);
+	m_shaders.push_back(
+	{
+		.id = m_next_id++,
+		.original = shader.internal_state,
+		.current = shader,
+		.input = std::move(owned_input),
+		.files = std::move(files),
+	});
+}
+
+void ShaderHotReload::watch_pipeline(const GraphicsPipeline& pipeline, const GraphicsPipelineDesc& desc,
+	const Shader& vertex_shader, const Shader& pixel_shader, PipelineLayout* in_layout, const char* debug_name)
+{
+	if (is_reload_thread())
+	{
+		return; // Recompiled shaders and rebuilt pipelines replace watched ones
+	}
+
+	std::scoped_lock lock(m_mutex);
+	auto find_shader = [this](const Shader& shader)
+	{
+		return std::ranges::find_if(m_shaders, [&shader](const ShaderEntry& entry)
+		{
+			return entry.original.lock() == shader.internal_state;
+		});
+	};
+	const auto vs = find_shader(vertex_shader);
+	const auto ps = find_shader(pixel_shader);
+	if (vs == m_shaders.end() || ps == m_shaders.end())
+	{
+		return; // A shader was not made by create_shader_dynamic, nothing to recompile it from
+	}
+
+	m_pipelines.push_back(
+	{
+		.id = m_next_id++,
+		.state = pipeline.internal_state,
+		.desc = desc,
+		.shaders = { vs->id, ps->id },
+		.layout = in_layout ? std::optional(*in_layout) : std::nullopt,
+		.debug_name = debug_name ? debug_name : "",
+		.stale = vs->reloaded || ps->reloaded,
+	});
+}
+
+void ShaderHotReload::reload_main()
+{
+	std::unique_lock lock(m_mutex);
+	while (!m_stop_requested.wait_for(lock, m_poll_interval, [this] { return m_stop; }))
+	{
+		lock.unlock();
+		poll();
+		lock.lock();
+	}
+}
+
+void ShaderHotReload::poll()
+{
+	struct Check
+	{
+		uint64_t id;
+		std::vector<WatchedFile> files;
+		sPtr<const OwnedCompilerInput> input;
+	};
+	std::vector<Check> checks;
+	{
+		std::scoped_lock lock(m_mutex);
+		std::erase_if(m_pipelines, [](const PipelineEntry& entry) { return entry.state.expired(); });
+		// Kept while a pipeline uses the shader or the caller still holds it (the entry holds one reference until reloaded)
+		std::erase_if(m_shaders, [this](const ShaderEntry& entry)
+		{
+			const bool used = std::ranges::any_of(m_pipelines, [&entry](const PipelineEntry& pipeline)
+			{
+				return std::ranges::find(pipeline.shaders, entry.id) != pipeline.shaders.end();
+			});
+			return !used && entry.original.use_count() <= (entry.reloaded ? 0 : 1);
+		});
+		checks.reserve(m_shaders.size());
+		for (const auto& shader : m_shaders)
+		{
+			checks.push_back({ shader.id, shader.files, shader.input });
+		}
+	}
+
+	// Recompile changed shaders. Includes are shared by many shaders, so each file is only checked once per poll
+	tsl::robin_map<std::string, fs::file_time_type> times;
+	auto is_modified = [&times](const WatchedFile& file)
+	{
+		auto it = times.find(file.path);
+		if (it == times.end())
+		{
+			std::error_code ec;
+			const auto time = fs::last_write_time(file.path, ec);
+			it = times.emplace(file.path, ec ? fs::file_time_type::min() : time).first;
+		}
+		return it->second != file.time;
+	};
+	std::vector<uint64_t> reloaded;
+	for (const auto& check : checks)
+	{
+		const bool modified = std::ranges::any_of(check.files, is_modified);
+		if (!modified)
+		{
+			continue;
+		}
+
+		// Files are listed before compiling, so an edit made during the compile is seen by the next poll
+		auto files = get_watched_files(check.input->input);
+		Shader shader;
+		// nullptr would make the context compile with its own compiler, which is not thread safe
+		const bool compiled = m_compiler && m_context->create_shader_dynamic(m_compiler.get(), &shader, check.input->input);
+
+		std::scoped_lock lock(m_mutex);
+		const auto entry = std::ranges::find(m_shaders, check.id, &ShaderEntry::id);
+		if (entry == m_shaders.end())
+		{
+			continue;
+		}
+		entry->files = std::move(files); // Also on failure, so the compile is only retried once the source changes again
+		if (!compiled)
+		{
+			log_reload("Failed to recompile, keeping the previous shader for", check.input->input.get_path());
+			continue;
+		}
+		log_reload("Recompiled", check.input->input.get_path());
+		entry->current = std::move(shader);
+		entry->reloaded = true;
+		reloaded.push_back(check.id);
+	}
+
+	// Rebuild the pipelines using them
+	struct Rebuild
+	{
+		uint64_t id;
+		GraphicsPipelineDesc desc;
+		Shader vertex_shader;
+		Shader pixel_shader;
+		std::optional<PipelineLayout> layout;
+		std::string debug_name;
+	};
+	std::vector<Rebuild> rebuilds;
+	{
+		std::scoped_lock lock(m_mutex);
+		for (auto& pipeline : m_pipelines)
+		{
+			const bool changed = std::ranges::any_of(pipeline.shaders, [&reloaded](const uint64_t id)
+			{
+				return std::ranges::find(reloaded, id) != reloaded.end();
+			});
+			if (!changed && !pipeline.stale)
+			{
+				continue;
+			}
+			pipeline.stale = false;
+			const auto vs = std::ranges::find(m_shaders, pipeline.shaders[0], &ShaderEntry::id);
+			const auto ps = std::ranges::find(m_shaders, pipeline.shaders[1], &ShaderEntry::id);
+			assert(vs != m_shaders.end() && ps != m_shaders.end()); // Kept while the pipeline uses them
+			rebuilds.push_back({ pipeline.id, pipeline.desc, vs->current, ps->current, pipeline.layout, pipeline.debug_name });
+		}
+	}
+	for (auto& rebuild : rebuilds)
+	{
+		GraphicsPipeline pipeline;
+		const bool created = m_context->create_pipeline(rebuild.desc, &pipeline, rebuild.vertex_shader, rebuild.pixel_shader,
+			rebuild.layout ? &*rebuild.layout : nullptr, rebuild.debug_name.empty() ? nullptr : rebuild.debug_name.c_str());
+		if (!created)
+		{
+			log_reload("Failed to rebuild pipeline", rebuild.debug_name);
+			continue;
+		}
+		std::scoped_lock lock(m_mutex);
+		const auto entry = std::ranges::find(m_pipelines, rebuild.id, &PipelineEntry::id);
+		if (entry != m_pipelines.end())
+		{
+			entry->pending = std::move(pipeline);
+		}
+	}
+}
+
+uint32_t ShaderHotReload::update(const Fence& frame_fence, const uint64_t submitted_value)
+{
+	const auto completed_value = m_context->get_fence_value(frame_fence);
+
+	std::scoped_lock lock(m_mutex);
+	std::erase_if(m_retired, [completed_value](const Retired& retired) { return retired.fence_value <= completed_value; });
+
+	uint32_t swapped = 0;
+	for (auto& entry : m_pipelines)
+	{
+		if (!entry.pending)
+		{
+			continue;
+		}
+		if (auto state = entry.state.lock())
+		{
+			// The pipeline keeps its identity, its contents become the rebuilt ones
+			GraphicsPipeline pipeline{ std::move(state) };
+			m_context->swap_pipelines(&pipeline, &*entry.pending);
+			m_retired.push_back({ submitted_value, std::move(entry.pending->internal_state) });
+			swapped++;
+		}
+		entry.pending.reset();
+	}
+	return swapped;
+}
@@ -0,0 +1,88 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "config_parser.h"
+
+#include <qhenkiX/helper/mapped_file.h>
+
+// Parses a synthetic config of generated job lines. Usage: SXCConfigParserBenchmark [line_count] [iterations]
+int main(int argc, char* argv[])
+{
+	using namespace qhenki;
+	namespace fs = std::filesystem;
+
+	const size_t line_count = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 100'000;
+	const int iterations = argc > 2 ? std::atoi(argv[2]) : 10;
+
+	const auto config_path = fs::temp_directory_path() / "sxc_config_benchmark.config";
+	{
+		constexpr const char* types[] = { "vs", "ps", "cs" };
+		std::ofstream config(config_path, std::ios::binary);
+		for (size_t i = 0; i < line_count; i++)
+		{
+			config << "-p shaders/material_" << i << ".hlsl -e main -st " << types[i % 3];
+			if (i % 4 == 0) config << " -o O2";
+			if (i % 2 == 0) config << " -d USE_TEXTURE={0,1}";
+			if (i % 8 == 0) config << " --define=QUALITY={0,1,2}";
+			if (i % 100 == 0) config << "\n# comment\n";
+			config << '\n';
+		}
+	}
+
+	const std::vector<std::string> global_defines{ "PLATFORM_PC=1" };
+	const sxc::CLIInput input
+	{
+		.config_path = config_path.string(),
+		.output_dir = "out",
+		.pdb_dir = {},
+		.global_defines = global_defines,
+		.include_paths = {},
+		.shader_model = gfx::ShaderModel::SM_6_0,
+		.optimization = CompilerInput::O3,
+		.debug_flag = false,
+	};
+
+	double best_ms = 1e30, total_ms = 0.0;
+	size_t permutation_count = 0;
+	for (int it = 0; it < iterations; it++)
+	{
+		const auto start = std::chrono::steady_clock::now();
+
+		util::MappedFile file;
+		if (!file.open(input.config_path.c_str()))
+		{
+			fprintf(stderr, "Failed to map %s\n", input.config_path.c_str());
+			return 1;
+		}
+		tbb::concurrent_vector<sxc::CompilerInputVector> inputs;
+		std::vector<sxc::ConfigParser::Error> errors;
+		if (!sxc::ConfigParser::parse({ static_cast<const char*>(file.data()), file.size() }, input, &inputs, &errors))
+		{
+			fprintf(stderr, "line %zu: %s\n", errors.front().line, errors.front().message.c_str());
+			return 1;
+		}
+
+		const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		best_ms = std::min(best_ms, ms);
+		total_ms += ms;
+
+		permutation_count = 0;
+		for (const auto& line : inputs)
+		{
+			permutation_count += line.size();
+		}
+	}
+
+	printf("%zu lines, %zu permutations\n", line_count, permutation_count);
+	printf("best %.2f ms, average %.2f ms, %.2f M lines/s\n", best_ms, total_ms / iterations,
+		static_cast<double>(line_count) / best_ms / 1000.0);
+
+	fs::remove(config_path);
+	return 0;
+}
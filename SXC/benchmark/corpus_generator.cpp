@@ -0,0 +1,253 @@
+#include "corpus_generator.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <string_view>
+
+using namespace qhenki::sxc::benchmark;
+
+namespace
+{
+	// Deterministic constants so corpora generated with the same settings are byte identical
+	struct Random
+	{
+		uint32_t state;
+
+		uint32_t next()
+		{
+			state = state * 1664525u + 1013904223u;
+			return state >> 8;
+		}
+
+		std::string constant()
+		{
+			return std::to_string(next() % 1000) + "." + std::to_string(next() % 100);
+		}
+	};
+
+	bool write_text(const fs::path& path, const std::string& text, uint64_t* total_bytes)
+	{
+		std::ofstream file(path, std::ios::binary);
+		file.write(text.data(), static_cast<std::streamsize>(text.size()));
+		*total_bytes += text.size();
+		return file.good();
+	}
+
+	std::string header_name(const uint32_t chain, const uint32_t level)
+	{
+		return "common_" + std::to_string(chain) + "_" + std::to_string(level);
+	}
+
+	// Each header includes the next one of its chain and calls into it, so every level is really used
+	std::string make_header(const CorpusSettings& settings, const uint32_t chain, const uint32_t level, Random* random)
+	{
+		const auto name = header_name(chain, level);
+		const bool has_next = level + 1 < settings.include_depth;
+		std::string text = "#ifndef " + name + "_HLSLI\n#define " + name + "_HLSLI\n\n";
+		if (has_next)
+		{
+			text += "#include \"" + header_name(chain, level + 1) + ".hlsli\"\n\n";
+		}
+		for (uint32_t f = 0; f < settings.function_count; f++)
+		{
+			text += "float " + name + "_f" + std::to_string(f) + "(float x)\n{\n";
+			if (has_next)
+			{
+				text += "\treturn " + header_name(chain, level + 1) + "_f" + std::to_string(f) + "(x) * " + random->constant() + " + "
+					+ random->constant() + ";\n";
+			}
+			else
+			{
+				text += "\treturn sin(x * " + random->constant() + ") + " + random->constant() + ";\n";
+			}
+			text += "}\n\n";
+		}
+		text += "#endif\n";
+		return text;
+	}
+
+	std::string make_source(const CorpusSettings& settings, const uint32_t index, const char* shader_type, Random* random)
+	{
+		const auto prefix = "shader_" + std::to_string(index);
+		const auto common = header_name(settings.shared_header_count ? index % settings.shared_header_count : 0, 0);
+		std::string text;
+		if (settings.shared_header_count && settings.include_depth)
+		{
+			text += "#include <" + common + ".hlsli>\n\n";
+		}
+		for (uint32_t f = 0; f < settings.function_count; f++)
+		{
+			text += "float " + prefix + "_f" + std::to_string(f) + "(float x)\n{\n\treturn x * " + random->constant() + " - "
+				+ random->constant() + ";\n}\n\n";
+		}
+
+		// Every value of every define selects a different call, so all permutations differ
+		text += "float apply_features(float x)\n{\n";
+		for (uint32_t d = 0; d < settings.define_count; d++)
+		{
+			const auto define = "FEATURE_" + std::to_string(d);
+			for (uint32_t v = 1; v < settings.fan_out; v++)
+			{
+				text += (v == 1 ? "#if " : "#elif ") + define + " == " + std::to_string(v) + "\n";
+				const uint32_t f = (d * settings.fan_out + v) % std::max(1u, settings.function_count);
+				const bool use_common = settings.shared_header_count && settings.include_depth && v % 2 == 0;
+				if (settings.function_count == 0)
+				{
+					text += "\tx = x + " + std::to_string(v) + ".0;\n";
+				}
+				else
+				{
+					text += "\tx = " + (use_common ? common : prefix) + "_f" + std::to_string(f) + "(x);\n";
+				}
+			}
+			if (settings.fan_out > 1)
+			{
+				text += "#endif\n";
+			}
+		}
+		text += "\treturn x;\n}\n\n";
+
+		if (shader_type[0] == 'v')
+		{
+			text += "float4 main(float3 position : POSITION) : SV_Position\n{\n"
+				"\treturn float4(position * apply_features(position.x), 1.0);\n}\n";
+		}
+		else if (shader_type[0] == 'p')
+		{
+			text += "float4 main(float4 position : SV_Position) : SV_Target\n{\n"
+				"\treturn apply_features(position.x).xxxx;\n}\n";
+		}
+		else
+		{
+			text += "RWStructuredBuffer<float> output : register(u0);\n\n[numthreads(64, 1, 1)]\n"
+				"void main(uint3 id : SV_DispatchThreadID)\n{\n\toutput[id.x] = apply_features(id.x);\n}\n";
+		}
+		return text;
+	}
+}
+
+bool qhenki::sxc::benchmark::generate_corpus(const CorpusSettings& settings, const fs::path& directory, CorpusInfo* info)
+{
+	std::error_code ec;
+	fs::create_directories(directory / "shaders", ec);
+	fs::create_directories(directory / "include", ec);
+	if (ec)
+	{
+		return false;
+	}
+
+	*info = {};
+	info->config_path = directory / "shaders.config";
+	info->include_dir = directory / "include";
+	Random random{ settings.seed };
+	bool written = true;
+
+	for (uint32_t chain = 0; chain < settings.shared_header_count; chain++)
+	{
+		for (uint32_t level = 0; level < settings.include_depth; level++)
+		{
+			const auto path = info->include_dir / (header_name(chain, level) + ".hlsli");
+			written &= write_text(path, make_header(settings, chain, level, &random), &info->source_bytes);
+		}
+	}
+
+	constexpr const char* types[] = { "vs", "ps", "cs" };
+	std::string values = "{";
+	for (uint32_t v = 0; v < settings.fan_out; v++)
+	{
+		if (v)
+		{
+			values += ',';
+		}
+		values += std::to_string(v);
+	}
+	values += "}";
+
+	uint64_t per_source = 1;
+	for (uint32_t d = 0; d < settings.define_count; d++)
+	{
+		per_source *= settings.fan_out;
+	}
+
+	std::string config = "# Generated by SXCCorpusGenerator\n";
+	for (uint32_t i = 0; i < settings.file_count; i++)
+	{
+		const auto type = types[i % 3];
+		const auto relative = "shaders/shader_" + std::to_string(i) + ".hlsl";
+		written &= write_text(directory / relative, make_source(settings, i, type, &random), &info->source_bytes);
+
+		config += "-p " + relative + " -e main -st " + type;
+		uint64_t count = per_source;
+		for (uint32_t d = 0; d < settings.define_count; d++)
+		{
+			config += " -d FEATURE_" + std::to_string(d) + "=" + values;
+		}
+		if (settings.unused_define_every && i % settings.unused_define_every == 0)
+		{
+			// Never referenced, pruning compiles these permutations once
+			config += " -d UNUSED_" + std::to_string(i) + "={0,1}";
+			count *= 2;
+		}
+		config += '\n';
+		info->permutation_count += count;
+	}
+	uint64_t config_bytes = 0;
+	written &= write_text(info->config_path, config, &config_bytes);
+	return written;
+}
+
+int qhenki::sxc::benchmark::parse_corpus_option(const int argc, char* argv[], const int i, CorpusSettings* settings)
+{
+	const struct
+	{
+		std::string_view name;
+		uint32_t* value;
+		uint32_t min;
+	} options[] =
+	{
+		{ "--files", &settings->file_count, 1 },
+		{ "--shared-headers", &settings->shared_header_count, 0 },
+		{ "--include-depth", &settings->include_depth, 0 },
+		{ "--defines", &settings->define_count, 0 },
+		{ "--fan-out", &settings->fan_out, 1 },
+		{ "--unused-every", &settings->unused_define_every, 0 },
+		{ "--functions", &settings->function_count, 0 },
+		{ "--seed", &settings->seed, 0 },
+	};
+	for (const auto& option : options)
+	{
+		if (option.name == argv[i] && i + 1 < argc)
+		{
+			*option.value = std::max(option.min, static_cast<uint32_t>(std::strtoul(argv[i + 1], nullptr, 10)));
+			return 2;
+		}
+	}
+	return 0;
+}
+
+const char* qhenki::sxc::benchmark::corpus_options_help()
+{
+	return
+		"  --files N           shader sources, one config line each [200]\n"
+		"  --shared-headers N  shared header chains, source i includes chain i % N [8]\n"
+		"  --include-depth N   headers per chain, each including the next [4]\n"
+		"  --defines N         permutation defines per source [2]\n"
+		"  --fan-out N         values per define, {0,1,...} [3]\n"
+		"  --unused-every N    every N-th source gets an unreferenced define, 0 for none [4]\n"
+		"  --functions N       generated functions per file [16]\n"
+		"  --seed N            seed of the generated constants [1]\n";
+}
+
+std::string qhenki::sxc::benchmark::corpus_settings_json(const CorpusSettings& settings)
+{
+	return "{\"files\": " + std::to_string(settings.file_count)
+		+ ", \"shared_headers\": " + std::to_string(settings.shared_header_count)
+		+ ", \"include_depth\": " + std::to_string(settings.include_depth)
+		+ ", \"defines\": " + std::to_string(settings.define_count)
+		+ ", \"fan_out\": " + std::to_string(settings.fan_out)
+		+ ", \"unused_define_every\": " + std::to_string(settings.unused_define_every)
+		+ ", \"functions\": " + std::to_string(settings.function_count)
+		+ ", \"seed\": " + std::to_string(settings.seed) + "}";
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+
+namespace qhenki::sxc::benchmark
+{
+	namespace fs = std::filesystem;
+
+	struct CorpusSettings
+	{
+		uint32_t file_count = 200; // Shader sources, one config line each
+		uint32_t shared_header_count = 8; // Header chains included by the sources, source i uses chain i % count
+		uint32_t include_depth = 4; // Headers per chain, each includes the next
+		uint32_t define_count = 2; // Permutation defines per source
+		uint32_t fan_out = 3; // Values per define, e.g. {a,b,c}
+		uint32_t unused_define_every = 4; // Every n-th source also gets a define it never references, 0 for none
+		uint32_t function_count = 16; // Generated functions per file, scales the source size
+		uint32_t seed = 1;
+	};
+
+	struct CorpusInfo
+	{
+		fs::path config_path; // shaders.config in the corpus directory, paths relative to it
+		fs::path include_dir; // Pass as -i, sources include the shared headers with <>
+		uint64_t permutation_count = 0;
+		uint64_t source_bytes = 0;
+	};
+
+	/**
+	 * @brief Writes a deterministic synthetic HLSL corpus and its SXC config.
+	 * @param settings Corpus shape.
+	 * @param directory Output directory, created if missing. Existing corpus files are overwritten.
+	 * @param info (out) Paths and totals of the corpus.
+	 * @return Whether every file was written.
+	 */
+	bool generate_corpus(const CorpusSettings& settings, const fs::path& directory, CorpusInfo* info);
+
+	/**
+	 * @brief Applies a corpus option such as "--files 500" at argv[i], see CorpusSettings.
+	 * @return Number of arguments consumed, 0 if argv[i] is not a corpus option.
+	 */
+	int parse_corpus_option(int argc, char* argv[], int i, CorpusSettings* settings);
+
+	// Usage lines of the corpus options
+	const char* corpus_options_help();
+
+	// Corpus shape as a JSON object, e.g. for benchmark reports
+	std::string corpus_settings_json(const CorpusSettings& settings);
+}
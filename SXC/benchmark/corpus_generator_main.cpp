@@ -0,0 +1,39 @@
+#include <cstdio>
+#include <cstring>
+
+#include "corpus_generator.h"
+
+// Writes a synthetic corpus for manual SXC runs. Usage: SXCCorpusGenerator <directory> [corpus options]
+int main(int argc, char* argv[])
+{
+	using namespace qhenki::sxc::benchmark;
+
+	if (argc < 2 || argv[1][0] == '-')
+	{
+		printf("Usage: SXCCorpusGenerator <directory> [options]\n%s", corpus_options_help());
+		return 1;
+	}
+
+	CorpusSettings settings;
+	for (int i = 2; i < argc;)
+	{
+		const int consumed = parse_corpus_option(argc, argv, i, &settings);
+		if (!consumed)
+		{
+			fprintf(stderr, "Unknown option: %s\n", argv[i]);
+			return 1;
+		}
+		i += consumed;
+	}
+
+	CorpusInfo info;
+	if (!generate_corpus(settings, argv[1], &info))
+	{
+		fprintf(stderr, "Failed to write corpus to %s\n", argv[1]);
+		return 1;
+	}
+	printf("%u sources, %llu permutations, %.2f MB of HLSL\n", settings.file_count,
+		static_cast<unsigned long long>(info.permutation_count), info.source_bytes / 1e6);
+	printf("SXC -c %s -i %s -sm 6_0 -out <output>\n", info.config_path.string().c_str(), info.include_dir.string().c_str());
+	return 0;
+}
@@ -0,0 +1,71 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "dependency_graph.h"
+#include "file_watcher.h"
+
+// Checks that saving a source next to the config is reported under the path the include graph knows it by.
+// Watch mode adds the config directory by its absolute path and source directories as the config spells them.
+// Usage: SXCFileWatcherCheck
+int main()
+{
+	using namespace qhenki;
+	namespace fs = std::filesystem;
+
+	const auto directory = fs::temp_directory_path() / "sxc_file_watcher_check";
+	std::error_code ec;
+	fs::remove_all(directory, ec);
+	fs::create_directories(directory);
+	{
+		std::ofstream(directory / "shaders.config") << "-p a.hlsl -e main -st ps\n";
+		std::ofstream(directory / "a.hlsl") << "#include \"b.hlsli\"\n";
+		std::ofstream(directory / "b.hlsli") << "// b\n";
+	}
+	const auto previous_directory = fs::current_path();
+	fs::current_path(directory);
+
+	int failures = 0;
+	{
+		sxc::DependencyGraph dependencies({});
+		sxc::FileWatcher watcher;
+		std::vector<std::string> files;
+		dependencies.collect_dependencies("a.hlsl", &files);
+		bool watching = watcher.add_directory(fs::absolute("shaders.config").parent_path());
+		for (const auto& file : files)
+		{
+			watching &= watcher.add_directory(fs::path(file).parent_path());
+		}
+		if (!watching || files.size() != 2)
+		{
+			fprintf(stderr, "Failed to watch the sources\n");
+			failures++;
+		}
+
+		for (const auto& file : files)
+		{
+			// Give the watcher a moment so the write is not merged with the previous one
+			std::this_thread::sleep_for(std::chrono::milliseconds(50));
+			std::ofstream(file, std::ios::app) << "// edited\n";
+
+			std::vector<std::string> changed;
+			watcher.wait(std::chrono::milliseconds(100), &changed);
+			if (std::ranges::find(changed, file) == changed.end())
+			{
+				fprintf(stderr, "%s: change not reported under the dependency graph path\n", file.c_str());
+				failures++;
+			}
+		}
+		watcher.stop();
+	}
+
+	fs::current_path(previous_directory);
+	fs::remove_all(directory, ec);
+	printf("%s\n", failures ? "FAILED" : "OK");
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,78 @@
+#include "stub_shader_compiler.h"
+
+#include <cstring>
+#include <vector>
+
+#include "dependency_graph.h"
+
+#include <qhenkiX/helper/hash_helper.h>
+
+using namespace qhenki::sxc::benchmark;
+
+bool StubShaderCompiler::preprocess(const CompilerInput& input, std::string& preprocessed, std::string& error_message)
+{
+	preprocessed.clear();
+	for (const auto& define : input.get_defines())
+	{
+		preprocessed += "#define ";
+		preprocessed += define;
+		preprocessed += '\n';
+	}
+
+	std::vector<std::string> files;
+	m_dependencies->collect_dependencies(input.get_path(), &files);
+	if (files.empty())
+	{
+		error_message = "Failed to open " + std::string(input.get_path()) + "\n";
+		return false;
+	}
+	for (const auto& file : files)
+	{
+		const auto contents = m_includes->load(file);
+		if (!contents)
+		{
+			error_message = "Failed to open " + file + "\n";
+			return false;
+		}
+		preprocessed += *contents;
+	}
+	return true;
+}
+
+bool StubShaderCompiler::compile(const CompilerInput& input, CompilerOutput& output)
+{
+	std::string preprocessed;
+	if (!preprocess(input, preprocessed, output.error_message))
+	{
+		return false;
+	}
+
+	// About one instruction word per 8 source bytes, like unoptimized bytecode. A shared prologue
+	// stands in for the container header and root signature every real blob carries
+	const auto hash = util::HashHelper::hash128(preprocessed);
+	auto blob = mkS<std::vector<uint8_t>>(256 + preprocessed.size() / 2);
+	auto& bytes = *blob;
+	for (size_t i = 0; i < 128; i++)
+	{
+		bytes[i] = static_cast<uint8_t>(i * 7);
+	}
+	memcpy(bytes.data() + 128, &hash, sizeof(hash));
+	uint64_t state = hash.low ^ input.entry_point.size();
+	for (size_t i = 128 + sizeof(hash); i + 8 <= bytes.size(); i += 8)
+	{
+		// Mostly small opcodes with random operands, compresses about as well as DXIL
+		state = state * 6364136223846793005ull + 1442695040888963407ull;
+		const uint64_t word = (state >> 40) & 0x00FF00FF0000001Full;
+		memcpy(bytes.data() + i, &word, sizeof(word));
+	}
+
+	output.shader_data = bytes.data();
+	output.shader_size = bytes.size();
+	output.internal_state = std::move(blob);
+	return true;
+}
+
+std::string StubShaderCompiler::get_version(gfx::ShaderModel)
+{
+	return "stub";
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <string>
+
+#include <qhenkiX/RHI/shader_compiler.h>
+#include <qhenkiX/utility/include_cache.h>
+
+namespace qhenki::sxc
+{
+	class DependencyGraph;
+}
+
+namespace qhenki::sxc::benchmark
+{
+	/**
+	 * @brief Stands in for DXC/FXC where they are not available.
+	 *
+	 * Reads a source and its includes through the shared IncludeCache like the real compilers and emits a
+	 * deterministic blob of roughly the size of real bytecode, so scheduling, pruning, archive and output costs
+	 * can be measured on any platform. Does not evaluate the preprocessor.
+	 */
+	class StubShaderCompiler final : public ShaderCompiler
+	{
+		gfx::IncludeCache* m_includes;
+		DependencyGraph* m_dependencies;
+
+	public:
+		StubShaderCompiler(gfx::IncludeCache* includes, DependencyGraph* dependencies)
+			: m_includes(includes), m_dependencies(dependencies) {}
+
+		bool compile(const CompilerInput& input, CompilerOutput& output) override;
+		// Defines followed by the source and every include, in include order
+		bool preprocess(const CompilerInput& input, std::string& preprocessed, std::string& error_message) override;
+		std::string get_version(gfx::ShaderModel shader_model) override;
+	};
+}
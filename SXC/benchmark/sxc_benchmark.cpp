@@ -0,0 +1,455 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <tbb/enumerable_thread_specific.h>
+#include <tbb/parallel_for.h>
+
+#include "config_parser.h"
+#include "corpus_generator.h"
+#include "define_pruning.h"
+#include "dependency_graph.h"
+#include "output_writer.h"
+#include "permutation_archive.h"
+#include "stub_shader_compiler.h"
+
+#ifdef SXC_BENCHMARK_COMPILER
+#include "compiler_pool.h"
+#endif
+
+#include <qhenkiX/helper/mapped_file.h>
+
+/*
+ * Generates a synthetic corpus and times the SXC build stages on it, in isolation and end to end.
+ * Prints a JSON report to stdout, progress goes to stderr.
+ *
+ * Stages that only need the file system (config parse, include scan, up-to-date check, define pruning) run
+ * everywhere. Compile and write run with StubShaderCompiler everywhere, and additionally through
+ * execute_compilation_job with DXC/FXC when built with SXC_BENCHMARK_COMPILER (Windows).
+ *
+ * Usage: SXCBenchmark [--dir path] [--iterations N] [--json path] [--keep] [corpus options]
+ */
+
+using namespace qhenki;
+namespace fs = std::filesystem;
+
+namespace
+{
+	struct StageResult
+	{
+		std::string name;
+		uint64_t items; // Permutations, or lines for per-line stages
+		const char* unit;
+		std::vector<double> ms;
+	};
+
+	// Runs setup untimed and body timed for every iteration
+	StageResult run_stage(const char* name, const char* unit, const uint64_t items, const int iterations,
+		const std::function<void()>& setup, const std::function<void()>& body)
+	{
+		StageResult result{ name, items, unit, {} };
+		for (int it = 0; it < iterations; it++)
+		{
+			if (setup) setup();
+			const auto start = std::chrono::steady_clock::now();
+			body();
+			result.ms.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+		}
+		const double best = *std::ranges::min_element(result.ms);
+		fprintf(stderr, "%-28s best %9.2f ms  %12.0f %s/s\n", name, best, items / (best / 1000.0), unit);
+		return result;
+	}
+
+	std::string to_json(const StageResult& stage)
+	{
+		const double best = *std::ranges::min_element(stage.ms);
+		double sum = 0.0;
+		for (const double ms : stage.ms) sum += ms;
+		char buffer[512];
+		snprintf(buffer, sizeof(buffer),
+			"{\"name\": \"%s\", \"unit\": \"%s\", \"items\": %llu, \"best_ms\": %.3f, \"mean_ms\": %.3f, \"per_second\": %.1f}",
+			stage.name.c_str(), stage.unit, static_cast<unsigned long long>(stage.items), best, sum / stage.ms.size(),
+			stage.items / (best / 1000.0));
+		return buffer;
+	}
+
+	struct Line
+	{
+		const sxc::CompilerInputVector* inputs;
+		fs::path output_path;
+		std::vector<uint32_t> output_index; // Permutation whose output is used, see define pruning in compiler_job.cpp
+	};
+
+	// Mirrors SXCJob::parse_config without its error printing
+	bool parse(const sxc::CLIInput& input, util::MappedFile* file, tbb::concurrent_vector<sxc::CompilerInputVector>* inputs)
+	{
+		if (!file->open(input.config_path.c_str()))
+		{
+			return false;
+		}
+		std::vector<sxc::ConfigParser::Error> errors;
+		return sxc::ConfigParser::parse({ static_cast<const char*>(file->data()), file->size() }, input, inputs, &errors);
+	}
+
+	std::vector<Line> make_lines(const tbb::concurrent_vector<sxc::CompilerInputVector>& inputs, const fs::path& output_dir)
+	{
+		std::vector<Line> lines;
+		for (const auto& input : inputs)
+		{
+			if (input.empty()) continue;
+			auto name = fs::path(input.front().get_path()).stem();
+			name += "_" + input.front().entry_point + (input.size() > 1 ? ".binp" : ".bin");
+			lines.push_back({ &input, output_dir / name, {} });
+		}
+		return lines;
+	}
+
+	// Same rule as prune_permutations in compiler_job.cpp
+	void prune(sxc::DependencyGraph* dependencies, Line* line)
+	{
+		const auto& inputs = *line->inputs;
+		line->output_index.resize(inputs.size());
+		for (uint32_t i = 0; i < inputs.size(); i++) line->output_index[i] = i;
+		if (inputs.size() < 2)
+		{
+			return;
+		}
+
+		std::vector<std::string_view> names;
+		std::vector<std::string_view> values;
+		for (const auto& input : inputs)
+		{
+			for (const auto& define : input.get_defines())
+			{
+				const auto name = sxc::get_define_name(define);
+				if (std::ranges::find(names, name) == names.end()) names.push_back(name);
+				const auto value = sxc::get_define_value(define);
+				if (!value.empty() && std::ranges::find(values, value) == values.end()) values.push_back(value);
+			}
+		}
+		std::vector<std::string> files;
+		std::vector<uint8_t> referenced;
+		bool complete;
+		dependencies->collect_dependencies(inputs.front().get_path(), &files, &complete);
+		if (!complete || !sxc::find_referenced_defines(files, names, values, &referenced))
+		{
+			return;
+		}
+
+		std::vector<std::pair<uint64_t, uint32_t>> first_of_kind;
+		std::vector<std::string> effective;
+		for (uint32_t i = 0; i < inputs.size(); i++)
+		{
+			effective.clear();
+			for (const auto& define : inputs[i].get_defines())
+			{
+				if (referenced[std::ranges::find(names, sxc::get_define_name(define)) - names.begin()])
+				{
+					effective.push_back(define);
+				}
+			}
+			const auto key = util::ShaderArchive::make_key(effective);
+			const auto it = std::ranges::find(first_of_kind, key, &std::pair<uint64_t, uint32_t>::first);
+			if (it == first_of_kind.end())
+			{
+				first_of_kind.emplace_back(key, i);
+			}
+			else
+			{
+				line->output_index[i] = it->second;
+			}
+		}
+	}
+
+	struct Task
+	{
+		uint32_t line;
+		uint32_t index;
+	};
+
+	std::vector<Task> make_tasks(const std::vector<Line>& lines)
+	{
+		std::vector<Task> tasks;
+		for (uint32_t l = 0; l < lines.size(); l++)
+		{
+			for (uint32_t i = 0; i < lines[l].output_index.size(); i++)
+			{
+				if (lines[l].output_index[i] == i) tasks.push_back({ l, i });
+			}
+		}
+		return tasks;
+	}
+
+	void compile(const std::vector<Line>& lines, const std::vector<Task>& tasks,
+		tbb::enumerable_thread_specific<sxc::benchmark::StubShaderCompiler>* compilers, std::vector<std::vector<CompilerOutput>>* outputs)
+	{
+		outputs->assign(lines.size(), {});
+		for (size_t l = 0; l < lines.size(); l++)
+		{
+			(*outputs)[l].resize(lines[l].inputs->size());
+		}
+		tbb::parallel_for(static_cast<size_t>(0), tasks.size(), [&](const size_t t)
+		{
+			const auto& task = tasks[t];
+			auto& out = (*outputs)[task.line][task.index];
+			if (!compilers->local().compile((*lines[task.line].inputs)[task.index], out))
+			{
+				fprintf(stderr, "%s", out.error_message.c_str());
+			}
+		});
+	}
+
+	void write(const std::vector<Line>& lines, const std::vector<std::vector<CompilerOutput>>& outputs)
+	{
+		sxc::OutputWriter writer(256ull << 20);
+		tbb::parallel_for(static_cast<size_t>(0), lines.size(), [&](const size_t l)
+		{
+			const auto& line = lines[l];
+			const auto& line_outputs = outputs[l];
+			std::vector<sxc::OutputFile> files;
+			if (line_outputs.size() == 1)
+			{
+				const auto data = static_cast<const uint8_t*>(line_outputs.front().shader_data);
+				files.push_back({ line.output_path, std::vector<uint8_t>(data, data + line_outputs.front().shader_size) });
+			}
+			else
+			{
+				sxc::PermutationArchiveWriter archive;
+				archive.reserve(line_outputs.size());
+				for (size_t i = 0; i < line_outputs.size(); i++)
+				{
+					const auto& out = line_outputs[line.output_index[i]];
+					archive.add((*line.inputs)[i].get_defines(), out.shader_data, out.shader_size);
+				}
+				std::vector<uint8_t> data;
+				std::string error;
+				if (!archive.finalize(&data, &error))
+				{
+					fprintf(stderr, "%s: %s\n", line.output_path.string().c_str(), error.c_str());
+					return;
+				}
+				files.push_back({ line.output_path, std::move(data) });
+			}
+			writer.submit(std::move(files));
+		});
+		writer.flush();
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	sxc::benchmark::CorpusSettings corpus;
+	fs::path directory = fs::temp_directory_path() / "sxc_benchmark_corpus";
+	std::optional<fs::path> json_path;
+	int iterations = 5;
+	bool keep = false;
+	for (int i = 1; i < argc;)
+	{
+		if (const int consumed = sxc::benchmark::parse_corpus_option(argc, argv, i, &corpus))
+		{
+			i += consumed;
+		}
+		else if (strcmp(argv[i], "--dir") == 0 && i + 1 < argc)
+		{
+			directory = argv[i + 1];
+			i += 2;
+		}
+		else if (strcmp(argv[i], "--iterations") == 0 && i + 1 < argc)
+		{
+			iterations = std::max(1, atoi(argv[i + 1]));
+			i += 2;
+		}
+		else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc)
+		{
+			json_path = argv[i + 1];
+			i += 2;
+		}
+		else if (strcmp(argv[i], "--keep") == 0)
+		{
+			keep = true;
+			i++;
+		}
+		else
+		{
+			fprintf(stderr, "Usage: SXCBenchmark [--dir path] [--iterations N] [--json path] [--keep] [options]\n%s",
+				sxc::benchmark::corpus_options_help());
+			return 1;
+		}
+	}
+
+	sxc::benchmark::CorpusInfo info;
+	if (!sxc::benchmark::generate_corpus(corpus, directory, &info))
+	{
+		fprintf(stderr, "Failed to write corpus to %s\n", directory.string().c_str());
+		return 1;
+	}
+	// SXC resolves config paths relative to the config directory
+	directory = fs::absolute(directory);
+	fs::current_path(directory);
+	fprintf(stderr, "Corpus: %u sources, %llu permutations, %.2f MB in %s\n", corpus.file_count,
+		static_cast<unsigned long long>(info.permutation_count), info.source_bytes / 1e6, directory.string().c_str());
+
+	const std::vector<std::string> include_paths{ "include" };
+	const fs::path output_dir = "out";
+	const sxc::CLIInput input
+	{
+		.config_path = "shaders.config",
+		.output_dir = output_dir.string(),
+		.pdb_dir = {},
+		.global_defines = {},
+		.include_paths = include_paths,
+		.shader_model = gfx::ShaderModel::SM_6_0,
+		.optimization = CompilerInput::O3,
+		.debug_flag = false,
+	};
+	const uint64_t permutations = info.permutation_count;
+	std::vector<StageResult> stages;
+
+	// State of the last iteration of a stage feeds the next stage
+	util::MappedFile config_file;
+	tbb::concurrent_vector<sxc::CompilerInputVector> inputs;
+	std::optional<sxc::DependencyGraph> dependencies;
+	std::vector<Line> lines;
+	std::vector<Task> tasks;
+	gfx::IncludeCache includes;
+	std::vector<std::vector<CompilerOutput>> outputs;
+
+	stages.push_back(run_stage("config_parse", "permutations", permutations, iterations,
+		[&] { config_file.close(); inputs.clear(); },
+		[&]
+		{
+			if (!parse(input, &config_file, &inputs)) fprintf(stderr, "Failed to parse %s\n", input.config_path.c_str());
+		}));
+	lines = make_lines(inputs, output_dir);
+
+	stages.push_back(run_stage("include_scan_cold", "sources", lines.size(), iterations,
+		[&] { dependencies.emplace(include_paths); },
+		[&]
+		{
+			tbb::parallel_for(static_cast<size_t>(0), lines.size(), [&](const size_t l)
+			{
+				dependencies->get_most_recent_time(lines[l].inputs->front().get_path());
+			});
+		}));
+
+	stages.push_back(run_stage("define_pruning", "permutations", permutations, iterations, {},
+		[&]
+		{
+			tbb::parallel_for(static_cast<size_t>(0), lines.size(), [&](const size_t l) { prune(&*dependencies, &lines[l]); });
+		}));
+	tasks = make_tasks(lines);
+
+	tbb::enumerable_thread_specific<sxc::benchmark::StubShaderCompiler> compilers(&includes, &*dependencies);
+	stages.push_back(run_stage("compile_stub", "permutations", tasks.size(), iterations,
+		[&] { includes.clear(); },
+		[&] { compile(lines, tasks, &compilers, &outputs); }));
+
+	std::error_code ec;
+	fs::create_directories(output_dir, ec);
+	stages.push_back(run_stage("write", "permutations", permutations, iterations, {},
+		[&] { write(lines, outputs); }));
+
+	// Everything written above is up-to-date now, this is the cost of a no-op build
+	stages.push_back(run_stage("up_to_date_check", "permutations", permutations, iterations,
+		[&] { dependencies->invalidate(); },
+		[&]
+		{
+			std::atomic_size_t stale{ 0 };
+			tbb::parallel_for(static_cast<size_t>(0), lines.size(), [&](const size_t l)
+			{
+				std::error_code error;
+				const auto output_time = fs::last_write_time(lines[l].output_path, error);
+				if (error || dependencies->get_most_recent_time(lines[l].inputs->front().get_path()) > output_time)
+				{
+					++stale;
+				}
+			});
+			if (stale) fprintf(stderr, "%zu outputs unexpectedly out of date\n", stale.load());
+		}));
+	outputs.clear();
+
+	stages.push_back(run_stage("end_to_end_stub", "permutations", permutations, iterations,
+		[&]
+		{
+			fs::remove_all(output_dir, ec);
+			fs::create_directories(output_dir, ec);
+			config_file.close();
+			inputs.clear();
+			includes.clear();
+		},
+		[&]
+		{
+			parse(input, &config_file, &inputs);
+			auto e2e_lines = make_lines(inputs, output_dir);
+			sxc::DependencyGraph graph(include_paths);
+			tbb::parallel_for(static_cast<size_t>(0), e2e_lines.size(), [&](const size_t l) { prune(&graph, &e2e_lines[l]); });
+			tbb::enumerable_thread_specific<sxc::benchmark::StubShaderCompiler> e2e_compilers(&includes, &graph);
+			std::vector<std::vector<CompilerOutput>> e2e_outputs;
+			compile(e2e_lines, make_tasks(e2e_lines), &e2e_compilers, &e2e_outputs);
+			write(e2e_lines, e2e_outputs);
+		}));
+
+#ifdef SXC_BENCHMARK_COMPILER
+	{
+		sxc::CompilerPool pool;
+		auto run_job = [&]
+		{
+			config_file.close();
+			inputs.clear();
+			if (sxc::SXCJob::parse_config(input, &inputs) < 0) return;
+			sxc::DependencyGraph graph(include_paths);
+			const sxc::JobSettings settings
+			{
+				.output_dir = input.output_dir,
+				.dependencies = &graph,
+				.compilers = &pool,
+			};
+			sxc::execute_compilation_job(&inputs, settings);
+		};
+		stages.push_back(run_stage("execute_compilation_job", "permutations", permutations, iterations,
+			[&]
+			{
+				fs::remove_all(output_dir, ec);
+				pool.invalidate_includes();
+			},
+			run_job));
+		stages.push_back(run_stage("execute_compilation_job_no_op", "permutations", permutations, iterations,
+			[&] { pool.invalidate_includes(); },
+			run_job));
+	}
+#endif
+
+	std::string json = "{\n  \"corpus\": " + sxc::benchmark::corpus_settings_json(corpus)
+		+ ",\n  \"permutations\": " + std::to_string(permutations)
+		+ ",\n  \"compiled_permutations\": " + std::to_string(tasks.size())
+		+ ",\n  \"source_bytes\": " + std::to_string(info.source_bytes)
+		+ ",\n  \"iterations\": " + std::to_string(iterations)
+		+ ",\n  \"stages\": [\n";
+	for (size_t s = 0; s < stages.size(); s++)
+	{
+		json += "    " + to_json(stages[s]) + (s + 1 < stages.size() ? ",\n" : "\n");
+	}
+	json += "  ]\n}\n";
+	fputs(json.c_str(), stdout);
+	if (json_path.has_value())
+	{
+		std::ofstream(json_path.value(), std::ios::binary) << json;
+	}
+
+	config_file.close();
+	fs::current_path(directory.parent_path());
+	if (!keep)
+	{
+		fs::remove_all(directory, ec);
+	}
+	return 0;
+}
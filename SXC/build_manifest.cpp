@@ -0,0 +1,222 @@
+#include "build_manifest.h"
+#include "compile_cache.h"
+#include "dependency_graph.h"
+
+#include <cstring>
+#include <fstream>
+
+#undef min
+#undef max
+#include <tsl/robin_set.h>
+
+using namespace qhenki::sxc;
+
+namespace
+{
+	constexpr uint32_t MANIFEST_MAGIC = 0x42435853; // "SXCB"
+	constexpr uint32_t MANIFEST_VERSION = 1;
+	constexpr uint64_t MISSING_SIZE = UINT64_MAX; // Recorded file did not exist
+	constexpr uint64_t DIRECTORY_SIZE = UINT64_MAX - 1; // Only the modification time is compared
+
+	struct FileStat
+	{
+		fs::file_time_type::rep mtime = 0;
+		uint64_t size = MISSING_SIZE;
+
+		bool operator==(const FileStat& other) const = default;
+	};
+
+	// A single status query where the platform caches attributes in the directory entry (Windows)
+	FileStat stat_file(const fs::path& path)
+	{
+		std::error_code ec;
+		const fs::directory_entry entry(path, ec);
+		if (ec || !entry.exists(ec))
+		{
+			return {};
+		}
+		FileStat stat;
+		stat.mtime = entry.last_write_time(ec).time_since_epoch().count();
+		stat.size = entry.is_directory(ec) ? DIRECTORY_SIZE : entry.file_size(ec);
+		return ec ? FileStat{} : stat;
+	}
+
+	template <typename T>
+	void append_pod(std::string& buffer, const T& value)
+	{
+		buffer.append(reinterpret_cast<const char*>(&value), sizeof(T));
+	}
+
+	void append_string(std::string& buffer, const std::string_view str)
+	{
+		append_pod(buffer, static_cast<uint32_t>(str.size()));
+		buffer.append(str);
+	}
+
+	struct Reader
+	{
+		const char* p;
+		const char* end;
+
+		template <typename T>
+		bool read(T* value)
+		{
+			if (static_cast<size_t>(end - p) < sizeof(T))
+			{
+				return false;
+			}
+			memcpy(value, p, sizeof(T));
+			p += sizeof(T);
+			return true;
+		}
+
+		bool read_string(std::string_view* str)
+		{
+			uint32_t length;
+			if (!read(&length) || static_cast<size_t>(end - p) < length)
+			{
+				return false;
+			}
+			*str = { p, length };
+			p += length;
+			return true;
+		}
+	};
+}
+
+qhenki::util::Hash128 BuildManifest::make_settings_key(const std::span<const std::string> args, const fs::path& config_path)
+{
+	std::string buffer;
+	for (const auto& arg : args)
+	{
+		append_string(buffer, arg);
+	}
+	append_string(buffer, fs::absolute(config_path).generic_string());
+
+	std::ifstream file(config_path, std::ios::binary);
+	buffer.append(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+	return util::HashHelper::hash128(buffer);
+}
+
+bool BuildManifest::is_up_to_date(const fs::path& path, const util::Hash128& settings_key, uint64_t* permutation_count)
+{
+	std::ifstream file(path, std::ios::binary);
+	if (!file)
+	{
+		return false;
+	}
+	const std::string contents((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	Reader reader{ contents.data(), contents.data() + contents.size() };
+
+	uint32_t magic, version, file_count;
+	util::Hash128 recorded_key;
+	if (!reader.read(&magic) || !reader.read(&version) || !reader.read(&recorded_key) || !reader.read(&file_count)
+		|| !reader.read(permutation_count) || magic != MANIFEST_MAGIC || version != MANIFEST_VERSION || recorded_key != settings_key)
+	{
+		return false;
+	}
+
+	for (uint32_t i = 0; i < file_count; i++)
+	{
+		std::string_view file_path;
+		FileStat recorded;
+		if (!reader.read_string(&file_path) || !reader.read(&recorded.mtime) || !reader.read(&recorded.size))
+		{
+			return false;
+		}
+		if (stat_file(fs::path(file_path)) != recorded)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+void BuildManifest::add_output(const fs::path& output_path, const fs::path& source_path, const util::Hash128& config_key)
+{
+	std::lock_guard lock(m_mutex);
+	m_outputs.push_back(
+	{
+		.path = DependencyGraph::normalize(output_path),
+		.source = DependencyGraph::normalize(source_path),
+		.config_key = config_key,
+	});
+}
+
+bool BuildManifest::save(const fs::path& path, const util::Hash128& settings_key, DependencyGraph* dependencies,
+	const std::span<const fs::path> extra_inputs, const uint64_t permutation_count) const
+{
+	std::lock_guard lock(m_mutex);
+
+	// Outputs, then every input and the directories includes are searched in
+	std::vector<std::string> files;
+	tsl::robin_set<std::string> seen;
+	auto add_file = [&](std::string file)
+	{
+		if (seen.insert(file).second)
+		{
+			files.push_back(std::move(file));
+		}
+	};
+	for (const auto& output : m_outputs)
+	{
+		add_file(output.path);
+	}
+	// Permutations of a source share its dependencies. Views stay valid, m_outputs is not modified under the lock
+	tsl::robin_set<std::string_view> sources;
+	for (const auto& output : m_outputs)
+	{
+		if (!sources.insert(output.source).second)
+		{
+			continue;
+		}
+		std::vector<std::string> dependency_files;
+		dependencies->collect_dependencies(output.source, &dependency_files);
+		for (auto& file : dependency_files)
+		{
+			auto directory = DependencyGraph::normalize(fs::path(file).parent_path());
+			add_file(std::move(file));
+			add_file(directory.empty() ? std::string(".") : std::move(directory));
+		}
+	}
+	for (const auto& include_path : dependencies->get_include_paths())
+	{
+		add_file(DependencyGraph::normalize(include_path));
+	}
+	for (const auto& input : extra_inputs)
+	{
+		add_file(DependencyGraph::normalize(input));
+	}
+
+	std::string buffer;
+	append_pod(buffer, MANIFEST_MAGIC);
+	append_pod(buffer, MANIFEST_VERSION);
+	append_pod(buffer, settings_key);
+	append_pod(buffer, static_cast<uint32_t>(files.size()));
+	append_pod(buffer, permutation_count);
+	for (const auto& file : files)
+	{
+		// Inputs are recorded as they were when the build read them. Stat'ing them now would record a header edited
+		// during the build next to outputs compiled from its old contents, and the next build would skip them
+		FileStat stat;
+		bool exists;
+		if (dependencies->get_searched_directory_time(file, &stat.mtime, &exists))
+		{
+			stat = exists ? FileStat{ stat.mtime, DIRECTORY_SIZE } : FileStat{};
+		}
+		else if (!dependencies->get_checked_file(file, &stat.mtime, &stat.size))
+		{
+			stat = stat_file(fs::path(file));
+		}
+		append_string(buffer, file);
+		append_pod(buffer, stat.mtime);
+		append_pod(buffer, stat.size);
+	}
+	append_pod(buffer, static_cast<uint32_t>(m_outputs.size()));
+	for (const auto& output : m_outputs)
+	{
+		append_string(buffer, output.path);
+		append_pod(buffer, output.config_key);
+	}
+	return write_file_atomic(path, buffer.data(), buffer.size());
+}
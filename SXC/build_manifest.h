@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <span>
+#include <string>
+#include <vector>
+
+#include <qhenkiX/helper/hash_helper.h>
+
+namespace qhenki::sxc
+{
+	namespace fs = std::filesystem;
+
+	class DependencyGraph;
+
+	/**
+	 * @brief Snapshot of a successful build, used to detect no-op builds before the config is parsed.
+	 *
+	 * Lists every output with its config key, and every file the build read or wrote with its modification
+	 * time and size: sources, transitive includes, their directories (so a new file shadowing an include is
+	 * noticed), the config, the compiler DLLs and the outputs themselves. If the command line and config
+	 * contents hash to the recorded settings key and no recorded file changed, the build can be skipped after
+	 * one stat per file, without creating compilers or expanding permutations.
+	 */
+	class BuildManifest
+	{
+		struct Output
+		{
+			std::string path;
+			std::string source;
+			util::Hash128 config_key;
+		};
+
+		mutable std::mutex m_mutex;
+		std::vector<Output> m_outputs;
+
+	public:
+		// Hash of the command line and the config contents, any change to either requires a full build
+		static util::Hash128 make_settings_key(std::span<const std::string> args, const fs::path& config_path);
+
+		/**
+		 * @brief Checks a manifest written by save against the file system.
+		 * @param path Manifest file.
+		 * @param settings_key Key of the current invocation.
+		 * @param permutation_count (out) Number of permutations of the recorded build.
+		 * @return Whether the manifest exists, matches the settings and no recorded file changed.
+		 */
+		static bool is_up_to_date(const fs::path& path, const util::Hash128& settings_key, uint64_t* permutation_count);
+
+		// Called for every output of the build, compiled or up-to-date. Thread-safe
+		void add_output(const fs::path& output_path, const fs::path& source_path, const util::Hash128& config_key);
+
+		/**
+		 * @brief Records every output and its transitive inputs and writes the manifest.
+		 * Inputs are recorded with the modification times the include graph saw when it checked them, so one edited
+		 * during the build is rebuilt by the next run. Other files are stat'ed now.
+		 * @param path Manifest file.
+		 * @param settings_key Key of the invocation that produced the outputs.
+		 * @param dependencies Include graph of the build.
+		 * @param extra_inputs Other files the outputs depend on, e.g. the config and the compiler DLLs.
+		 * @param permutation_count Reported as up-to-date by the next run if nothing changed.
+		 */
+		bool save(const fs::path& path, const util::Hash128& settings_key, DependencyGraph* dependencies,
+			std::span<const fs::path> extra_inputs, uint64_t permutation_count) const;
+	};
+}
@@ -0,0 +1,150 @@
+#include "build_trace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+
+#include <tsl/robin_map.h>
+
+using namespace qhenki::sxc;
+
+namespace
+{
+	// Small stable ids are easier to read in the trace viewer than OS thread ids
+	uint32_t get_thread_index()
+	{
+		static std::atomic_uint32_t next_index{ 0 };
+		thread_local const uint32_t index = next_index++;
+		return index;
+	}
+
+	void append_escaped(std::string* out, const std::string_view str)
+	{
+		for (const char c : str)
+		{
+			switch (c)
+			{
+			case '"': *out += "\\\""; break;
+			case '\\': *out += "\\\\"; break;
+			case '\n': *out += "\\n"; break;
+			case '\r': *out += "\\r"; break;
+			case '\t': *out += "\\t"; break;
+			default:
+				if (static_cast<unsigned char>(c) < 0x20)
+				{
+					char buffer[8];
+					snprintf(buffer, sizeof(buffer), "\\u%04x", c);
+					*out += buffer;
+				}
+				else
+				{
+					out->push_back(c);
+				}
+			}
+		}
+	}
+}
+
+int64_t BuildTrace::now_us() const
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - m_start).count();
+}
+
+void BuildTrace::add(const char* stage, std::string name, const int64_t start_us, const int64_t end_us)
+{
+	m_events.local().push_back(
+	{
+		.stage = stage,
+		.name = std::move(name),
+		.start_us = start_us,
+		.duration_us = end_us - start_us,
+		.thread = get_thread_index(),
+	});
+}
+
+std::vector<BuildTrace::Event> BuildTrace::collect_events() const
+{
+	std::vector<Event> events;
+	for (const auto& list : m_events)
+	{
+		events.insert(events.end(), list.begin(), list.end());
+	}
+	std::ranges::sort(events, [](const Event& a, const Event& b) { return a.start_us < b.start_us; });
+	return events;
+}
+
+bool BuildTrace::write_json(const fs::path& path) const
+{
+	const auto events = collect_events();
+
+	std::string json;
+	json.reserve(events.size() * 128 + 64);
+	json += "{\"traceEvents\":[\n";
+
+	uint32_t max_thread = 0;
+	char buffer[128];
+	for (const auto& e : events)
+	{
+		max_thread = std::max(max_thread, e.thread);
+		json += "{\"name\":\"";
+		append_escaped(&json, e.name.empty() ? std::string_view(e.stage) : std::string_view(e.name));
+		json += "\",\"cat\":\"";
+		json += e.stage;
+		snprintf(buffer, sizeof(buffer), "\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%lld,\"dur\":%lld},\n",
+			e.thread, static_cast<long long>(e.start_us), static_cast<long long>(e.duration_us));
+		json += buffer;
+	}
+	for (uint32_t t = 0; t <= max_thread && !events.empty(); t++)
+	{
+		snprintf(buffer, sizeof(buffer), "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"Thread %u\"}},\n", t, t);
+		json += buffer;
+	}
+	json += "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"SXC\"}}\n]}\n";
+
+	std::ofstream out(path, std::ios::binary);
+	out.write(json.data(), static_cast<std::streamsize>(json.size()));
+	return out.good();
+}
+
+void BuildTrace::print_summary(const char* stage, const size_t top_count) const
+{
+	const auto events = collect_events();
+
+	struct StageTotal
+	{
+		int64_t duration_us = 0;
+		size_t count = 0;
+	};
+	tsl::robin_map<std::string_view, StageTotal> totals;
+	std::vector<std::string_view> order;
+	for (const auto& e : events)
+	{
+		auto [it, inserted] = totals.try_emplace(e.stage);
+		if (inserted) order.push_back(e.stage);
+		it.value().duration_us += e.duration_us;
+		it.value().count++;
+	}
+
+	printf("========== Time per stage (summed over threads) ==========\n");
+	for (const auto s : order)
+	{
+		const auto& total = totals.at(s);
+		printf("%-16.*s %10.3f s  %8zu events\n", static_cast<int>(s.size()), s.data(), total.duration_us / 1e6, total.count);
+	}
+
+	std::vector<const Event*> slowest;
+	for (const auto& e : events)
+	{
+		if (std::string_view(e.stage) == stage) slowest.push_back(&e);
+	}
+	const auto count = std::min(top_count, slowest.size());
+	std::ranges::partial_sort(slowest, slowest.begin() + count,
+		[](const Event* a, const Event* b) { return a->duration_us > b->duration_us; });
+
+	printf("========== %zu slowest (%s) ==========\n", count, stage);
+	for (size_t i = 0; i < count; i++)
+	{
+		printf("%3zu. %10.1f ms  %s\n", i + 1, slowest[i]->duration_us / 1000.0, slowest[i]->name.c_str());
+	}
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include <oneapi/tbb/enumerable_thread_specific.h>
+
+namespace qhenki::sxc
+{
+	namespace fs = std::filesystem;
+
+	/**
+	 * @brief Records the duration of every build stage per thread and exports it as Chrome trace-event JSON.
+	 *
+	 * Each thread appends to its own event list, nothing is shared until the trace is written.
+	 * The output can be opened in chrome://tracing or https://ui.perfetto.dev.
+	 */
+	class BuildTrace
+	{
+	public:
+		struct Event
+		{
+			const char* stage; // Static string, e.g. "compile"
+			std::string name;
+			int64_t start_us; // Relative to trace creation
+			int64_t duration_us;
+			uint32_t thread;
+		};
+
+	private:
+		using Clock = std::chrono::steady_clock;
+		Clock::time_point m_start = Clock::now();
+		tbb::enumerable_thread_specific<std::vector<Event>> m_events;
+
+	public:
+		int64_t now_us() const;
+		void add(const char* stage, std::string name, int64_t start_us, int64_t end_us);
+
+		// Gathers all thread lists sorted by start time. Not thread-safe with add
+		std::vector<Event> collect_events() const;
+
+		bool write_json(const fs::path& path) const;
+
+		// Prints total time per stage and the slowest events of one stage
+		void print_summary(const char* stage, size_t top_count) const;
+	};
+
+	// Adds an event for its lifetime. Does nothing if trace is nullptr
+	class TraceScope
+	{
+		BuildTrace* m_trace;
+		const char* m_stage;
+		std::string m_name;
+		int64_t m_start_us = 0;
+
+	public:
+		TraceScope(BuildTrace* trace, const char* stage, std::string name)
+			: m_trace(trace), m_stage(stage), m_name(std::move(name))
+		{
+			if (m_trace) m_start_us = m_trace->now_us();
+		}
+		~TraceScope()
+		{
+			if (m_trace) m_trace->add(m_stage, std::move(m_name), m_start_us, m_trace->now_us());
+		}
+
+		TraceScope(const TraceScope&) = delete;
+		TraceScope& operator=(const TraceScope&) = delete;
+	};
+}
@@ -0,0 +1,224 @@
+#include "compile_cache.h"
+
+#include <atomic>
+#include <cassert>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+using namespace qhenki::sxc;
+
+namespace
+{
+	constexpr uint32_t CACHE_MAGIC = 0x43435853; // "SXCC"
+	constexpr uint32_t CACHE_VERSION = 1;
+
+	struct CacheEntryHeader
+	{
+		uint32_t magic;
+		uint32_t version;
+		uint64_t size;
+		uint64_t content_hash; // Detects truncated or corrupted entries
+	};
+
+	void append_field(std::string& buffer, const std::string_view field)
+	{
+		// Length prefix so that ("ab", "c") and ("a", "bc") do not produce the same key
+		const uint64_t length = field.size();
+		buffer.append(reinterpret_cast<const char*>(&length), sizeof(length));
+		buffer.append(field);
+	}
+
+	void append_settings(std::string& buffer, const CompilerInput& input)
+	{
+		append_field(buffer, input.get_path());
+		append_field(buffer, input.entry_point);
+		// A hit does not write a PDB, so only entries compiled with the same PDB directory may be reused
+		append_field(buffer, input.pdb_path);
+		buffer.push_back(static_cast<char>(input.shader_model));
+		buffer.push_back(static_cast<char>(input.shader_type));
+		buffer.push_back(static_cast<char>(input.optimization));
+		buffer.push_back(static_cast<char>(input.flags));
+		// Order is kept, a later define with the same name overrides an earlier one
+		const auto defines = input.get_defines();
+		const uint64_t define_count = defines.size();
+		buffer.append(reinterpret_cast<const char*>(&define_count), sizeof(define_count));
+		for (const auto& define : defines)
+		{
+			append_field(buffer, define);
+		}
+		const uint64_t include_count = input.includes.size();
+		buffer.append(reinterpret_cast<const char*>(&include_count), sizeof(include_count));
+		for (const auto& include : input.includes)
+		{
+			append_field(buffer, include);
+		}
+	}
+}
+
+bool qhenki::sxc::write_temp_file(const fs::path& path, const void* data, const size_t size, fs::path* temp_path)
+{
+	// Thread ids are only unique within a process and the cache may be shared between processes
+#ifdef _WIN32
+	static const auto process_id = _getpid();
+#else
+	static const auto process_id = getpid();
+#endif
+	static std::atomic_uint64_t counter{ 0 };
+	const auto unique = std::hash<std::thread::id>{}(std::this_thread::get_id()) ^ (counter++ << 32);
+
+	*temp_path = path;
+	*temp_path += ".tmp" + std::to_string(process_id) + "_" + std::to_string(unique);
+	std::ofstream file(*temp_path, std::ios::binary);
+	if (!file)
+	{
+		return false;
+	}
+	file.write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+	file.close(); // Buffered data may only fail to flush here
+	if (file.fail())
+	{
+		std::error_code ec;
+		fs::remove(*temp_path, ec);
+		return false;
+	}
+	return true;
+}
+
+bool qhenki::sxc::write_file_atomic(const fs::path& path, const void* data, const size_t size)
+{
+	fs::path temp_path;
+	if (!write_temp_file(path, data, size, &temp_path))
+	{
+		return false;
+	}
+
+	std::error_code ec;
+	fs::rename(temp_path, path, ec);
+	if (ec)
+	{
+		fs::remove(temp_path, ec);
+		return false;
+	}
+	return true;
+}
+
+CompileCache::CompileCache(fs::path directory) : m_directory(std::move(directory))
+{
+	std::error_code ec;
+	fs::create_directories(m_directory / "objects", ec);
+	fs::create_directories(m_directory / "outputs", ec);
+	if (ec)
+	{
+		throw std::runtime_error("Failed to create cache directory: " + m_directory.string());
+	}
+}
+
+fs::path CompileCache::get_object_path(const util::Hash128& key) const
+{
+	const auto hex = key.to_hex();
+	const std::string_view name(hex.data(), hex.size());
+	// Two character fan out keeps directories small
+	return m_directory / "objects" / name.substr(0, 2) / name;
+}
+
+fs::path CompileCache::get_output_record_path(const fs::path& output_path) const
+{
+	const auto absolute = fs::absolute(output_path).generic_string();
+	const auto hash = util::HashHelper::hash128(absolute);
+	const auto hex = hash.to_hex();
+	return m_directory / "outputs" / std::string_view(hex.data(), hex.size());
+}
+
+qhenki::util::Hash128 CompileCache::make_key(const CompilerInput& input, const std::string_view preprocessed,
+	const std::string_view compiler_version)
+{
+	thread_local std::string buffer;
+	buffer.clear();
+	buffer.reserve(preprocessed.size() + 256);
+	append_field(buffer, compiler_version);
+	append_settings(buffer, input);
+	append_field(buffer, preprocessed);
+	return util::HashHelper::hash128(buffer);
+}
+
+qhenki::util::Hash128 CompileCache::make_config_key(const CompilerInput* inputs, const size_t count,
+	const std::string_view compiler_version)
+{
+	assert(inputs || count == 0);
+	thread_local std::string buffer;
+	buffer.clear();
+	append_field(buffer, compiler_version);
+	for (size_t i = 0; i < count; i++)
+	{
+		append_settings(buffer, inputs[i]);
+	}
+	return util::HashHelper::hash128(buffer);
+}
+
+bool CompileCache::load(const util::Hash128& key, std::vector<uint8_t>* data) const
+{
+	assert(data);
+	std::ifstream file(get_object_path(key), std::ios::binary);
+	if (!file)
+	{
+		return false;
+	}
+
+	CacheEntryHeader header{};
+	if (!file.read(reinterpret_cast<char*>(&header), sizeof(header))
+		|| header.magic != CACHE_MAGIC || header.version != CACHE_VERSION)
+	{
+		return false;
+	}
+
+	data->resize(header.size);
+	if (!file.read(reinterpret_cast<char*>(data->data()), static_cast<std::streamsize>(header.size)))
+	{
+		return false;
+	}
+	return util::HashHelper::xxh64(data->data(), data->size()) == header.content_hash;
+}
+
+bool CompileCache::store(const util::Hash128& key, const void* data, const size_t size) const
+{
+	const auto path = get_object_path(key);
+	std::error_code ec;
+	fs::create_directories(path.parent_path(), ec);
+
+	const CacheEntryHeader header
+	{
+		.magic = CACHE_MAGIC,
+		.version = CACHE_VERSION,
+		.size = size,
+		.content_hash = util::HashHelper::xxh64(data, size),
+	};
+	std::vector<uint8_t> entry(sizeof(header) + size);
+	memcpy(entry.data(), &header, sizeof(header));
+	memcpy(entry.data() + sizeof(header), data, size);
+	return write_file_atomic(path, entry.data(), entry.size());
+}
+
+bool CompileCache::load_output_record(const fs::path& output_path, util::Hash128* config_key) const
+{
+	assert(config_key);
+	std::ifstream file(get_output_record_path(output_path), std::ios::binary);
+	if (!file)
+	{
+		return false;
+	}
+	return static_cast<bool>(file.read(reinterpret_cast<char*>(config_key), sizeof(*config_key)));
+}
+
+bool CompileCache::store_output_record(const fs::path& output_path, const util::Hash128& config_key) const
+{
+	return write_file_atomic(get_output_record_path(output_path), &config_key, sizeof(config_key));
+}
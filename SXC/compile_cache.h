@@ -0,0 +1,52 @@
+#pragma once
+
+#include <filesystem>
+#include <string_view>
+#include <vector>
+
+#include <qhenkiX/RHI/shader_compiler.h>
+#include <qhenkiX/helper/hash_helper.h>
+
+namespace qhenki::sxc
+{
+	namespace fs = std::filesystem;
+
+	/**
+	 * @brief Persistent content-addressed store of compiled shader blobs.
+	 *
+	 * Blobs are keyed by a hash of everything that can change the compiler output: the preprocessed source,
+	 * defines, entry point, shader model, optimization level, flags and compiler version. The PDB directory is part of
+	 * the key as well since a hit does not write a PDB.
+	 * Entries are written to a temporary file and renamed into place so the cache can be shared between
+	 * concurrent SXC processes (e.g. CI agents pointing at the same directory).
+	 */
+	class CompileCache
+	{
+		fs::path m_directory;
+
+		fs::path get_object_path(const util::Hash128& key) const;
+		fs::path get_output_record_path(const fs::path& output_path) const;
+
+	public:
+		explicit CompileCache(fs::path directory);
+
+		const fs::path& get_directory() const { return m_directory; }
+
+		static util::Hash128 make_key(const CompilerInput& input, std::string_view preprocessed, std::string_view compiler_version);
+		// Cheaper key without source contents, used to detect config changes for an output
+		static util::Hash128 make_config_key(const CompilerInput* inputs, size_t count, std::string_view compiler_version);
+
+		bool load(const util::Hash128& key, std::vector<uint8_t>* data) const;
+		bool store(const util::Hash128& key, const void* data, size_t size) const;
+
+		// Remembers which config key produced an output file
+		bool load_output_record(const fs::path& output_path, util::Hash128* config_key) const;
+		bool store_output_record(const fs::path& output_path, const util::Hash128& config_key) const;
+	};
+
+	// Writes to a uniquely named sibling file of path, which is removed again on failure
+	bool write_temp_file(const fs::path& path, const void* data, size_t size, fs::path* temp_path);
+
+	// Writes to a uniquely named sibling file then renames it over the destination
+	bool write_file_atomic(const fs::path& path, const void* data, size_t size);
+}
@@ -0,0 +1,109 @@
+#include "compile_stats.h"
+#include "compile_cache.h"
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <qhenkiX/helper/hash_helper.h>
+#include <qhenkiX/utility/shader_archive.h>
+
+using namespace qhenki::sxc;
+
+namespace
+{
+	constexpr uint32_t STATS_MAGIC = 0x53435853; // "SXCS"
+	constexpr uint32_t STATS_VERSION = 1;
+
+	struct StatsRecord
+	{
+		uint64_t key;
+		uint32_t microseconds;
+		uint32_t reserved;
+	};
+}
+
+uint64_t CompileStats::make_key(const CompilerInput& input)
+{
+	const auto path = input.get_path();
+	const uint8_t settings[] =
+	{
+		static_cast<uint8_t>(input.shader_model),
+		static_cast<uint8_t>(input.shader_type),
+	};
+	uint64_t key = util::ShaderArchive::make_key(input.get_defines());
+	key = util::HashHelper::xxh64(path.data(), path.size(), key);
+	key = util::HashHelper::xxh64(input.entry_point.data(), input.entry_point.size(), key);
+	return util::HashHelper::xxh64(settings, sizeof(settings), key);
+}
+
+bool CompileStats::load(const fs::path& path)
+{
+	std::ifstream in(path, std::ios::binary | std::ios::ate);
+	if (!in)
+	{
+		return false;
+	}
+	const auto file_size = static_cast<uint64_t>(in.tellg());
+	in.seekg(0, std::ios::beg);
+
+	uint32_t header[2];
+	uint64_t count;
+	if (!in.read(reinterpret_cast<char*>(header), sizeof(header)) || !in.read(reinterpret_cast<char*>(&count), sizeof(count))
+		|| header[0] != STATS_MAGIC || header[1] != STATS_VERSION)
+	{
+		return false;
+	}
+	// A corrupt count must not turn into a huge allocation
+	if (count != (file_size - sizeof(header) - sizeof(count)) / sizeof(StatsRecord))
+	{
+		return false;
+	}
+
+	std::vector<StatsRecord> records(count);
+	if (!in.read(reinterpret_cast<char*>(records.data()), static_cast<std::streamsize>(count * sizeof(StatsRecord))))
+	{
+		return false;
+	}
+
+	m_durations.clear();
+	m_durations.reserve(count);
+	for (const auto& r : records)
+	{
+		m_durations.insert_or_assign(r.key, r.microseconds);
+	}
+	return true;
+}
+
+bool CompileStats::save(const fs::path& path) const
+{
+	std::vector<StatsRecord> records;
+	records.reserve(m_durations.size());
+	for (const auto& [key, microseconds] : m_durations)
+	{
+		records.push_back({ key, microseconds, 0 });
+	}
+
+	const uint32_t header[2] = { STATS_MAGIC, STATS_VERSION };
+	const uint64_t count = records.size();
+	std::string buffer;
+	buffer.reserve(sizeof(header) + sizeof(count) + count * sizeof(StatsRecord));
+	buffer.append(reinterpret_cast<const char*>(header), sizeof(header));
+	buffer.append(reinterpret_cast<const char*>(&count), sizeof(count));
+	buffer.append(reinterpret_cast<const char*>(records.data()), count * sizeof(StatsRecord));
+	// Shared between concurrent SXC processes through the cache directory
+	return write_file_atomic(path, buffer.data(), buffer.size());
+}
+
+uint32_t CompileStats::get_duration(const uint64_t key) const
+{
+	const auto it = m_durations.find(key);
+	return it != m_durations.end() ? it->second : 0;
+}
+
+void CompileStats::record(const uint64_t key, const uint32_t microseconds)
+{
+	// Blend with the previous run to smooth out noise from machine load
+	const auto previous = get_duration(key);
+	m_durations.insert_or_assign(key, previous ? static_cast<uint32_t>((uint64_t{ previous } + microseconds) / 2) : microseconds);
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+
+#undef min
+#undef max
+#include <tsl/robin_map.h>
+
+#include <qhenkiX/RHI/shader_compiler.h>
+
+namespace qhenki::sxc
+{
+	namespace fs = std::filesystem;
+
+	/**
+	 * @brief Compile durations of individual permutations from previous runs.
+	 *
+	 * Used to schedule the most expensive permutations first. Not thread-safe, durations are gathered by the
+	 * job and recorded once all permutations finished.
+	 */
+	class CompileStats
+	{
+		tsl::robin_map<uint64_t, uint32_t> m_durations; // Microseconds
+
+	public:
+		// Identifies a permutation independent of source contents and compiler settings that rarely change its cost
+		static uint64_t make_key(const CompilerInput& input);
+
+		bool load(const fs::path& path);
+		bool save(const fs::path& path) const;
+
+		// Returns 0 if the permutation was never compiled
+		uint32_t get_duration(uint64_t key) const;
+		void record(uint64_t key, uint32_t microseconds);
+	};
+}
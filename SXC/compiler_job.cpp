@@ -1,48 +1,37 @@
 #include "compiler_job.h"
+#include "build_manifest.h"
+#include "build_trace.h"
+#include "compile_cache.h"
+#include "compile_stats.h"
+#include "compiler_pool.h"
+#include "config_parser.h"
+#include "define_pruning.h"
+#include "dependency_graph.h"
+#include "output_writer.h"
+#include "permutation_archive.h"
+#include "shard.h"
 
-#include <tbb/enumerable_thread_specific.h>
 #include <tbb/concurrent_vector.h>
-#include <tbb/concurrent_hash_map.h>
-#include <tbb/parallel_pipeline.h>
-#include <tbb/parallel_for_each.h>
-#include <tsl/robin_set.h>
+#include <tbb/parallel_for.h>
+#include <tbb/task_arena.h>
+#include <tbb/task_group.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <filesystem>
 #include <fstream>
-#include <regex>
+#include <mutex>
+#include <numeric>
 
 #include <magic_enum/magic_enum.hpp>
 
-#include <argparse/argparse.hpp>
-
-#include "graphics/d3d12/d3d12_shader_compiler.h"
 #include "qhenkiX/helper/d3d_helper.h"
 
-#include "qhenkiX/helper/file_helper.h"
+#include "qhenkiX/helper/mapped_file.h"
+#include "qhenkiX/utility/shader_reflection.h"
 
 using namespace qhenki::sxc;
 
-qhenki::gfx::ShaderType SXCJob::to_shader_type(const char* str)
-{
-	assert(strlen(str) == 2);
-
-	auto hash = [](const char* s)->uint32_t
-	{
-		return s[0] << 16 | s[1] << 8 | s[2];
-	};
-
-	switch (hash(str))
-	{
-		case hash("vs"):
-			return gfx::ShaderType::VERTEX_SHADER;
-		case hash("ps"):
-			return gfx::ShaderType::PIXEL_SHADER;
-		case hash("cs"):
-			return gfx::ShaderType::COMPUTE_SHADER;
-		default:
-			throw std::runtime_error("Unknown shader type: " + std::string(str));
-	}
-}
-
 const char* SXCJob::shader_type_to_str(gfx::ShaderType type)
 {
 	switch (type)
@@ -58,242 +47,65 @@ const char* SXCJob::shader_type_to_str(gfx::ShaderType type)
 	}
 }
 
-int SXCJob::parse_config(const CLIInput& input, tbb::concurrent_vector<boost::container::small_vector<CompilerInput, 1>>* compiler_inputs)
+int SXCJob::parse_config(const CLIInput& input, tbb::concurrent_vector<CompilerInputVector>* compiler_inputs)
 {
 	assert(compiler_inputs);
-	std::ifstream config_file(input.config_path);
-	if (!config_file.is_open()) 
+	util::MappedFile config_file;
+	if (!config_file.open(input.config_path.c_str()))
 	{
 		fprintf(stderr, "Failed to open config file: %s\n", input.config_path.c_str());
 		return -1;
 	}
 
-	std::vector<std::vector<std::string>> args;
-	std::string line;
-	while (std::getline(config_file, line)) 
+	std::vector<ConfigParser::Error> errors;
+	std::vector<ConfigParser::Error> warnings;
+	const std::string_view text(static_cast<const char*>(config_file.data()), config_file.size());
+	const bool parsed = ConfigParser::parse(text, input, compiler_inputs, &errors, &warnings);
+	for (const auto& warning : warnings)
 	{
-		args.emplace_back();
-		auto& arg = args.back();
-		arg.emplace_back("");
-
-		std::istringstream iss(line);
-		std::string token;
-		while (iss >> token) 
+		fprintf(stderr, "%s(%zu): warning: %s\n", input.config_path.c_str(), warning.line, warning.message.c_str());
+	}
+	if (!parsed)
+	{
+		for (const auto& error : errors)
 		{
-			arg.push_back(token);
+			fprintf(stderr, "%s(%zu): error: %s\n", input.config_path.c_str(), error.line, error.message.c_str());
 		}
+		return -1;
 	}
-
-	tbb::concurrent_vector<std::pair<int, std::string>> parse_errors;
-
-	tbb::parallel_for(static_cast<size_t>(0), args.size(), [&](size_t i)
-	{
-			CompilerInput compiler_input
-			{
-				.pdb_path = input.pdb_dir,
-				.includes = input.include_paths,
-				.shader_model = input.shader_model,
-				// shader type determined below
-				.flags = input.debug_flag ? CompilerInput::ShaderFlags::DEBUG : CompilerInput::ShaderFlags::NONE,
-				.optimization = input.optimization, // May be overridden by config
-			};
-
-			const auto& arg = args[i];
-			argparse::ArgumentParser program("config");
-			program.set_prefix_chars("-+/");
-			program.set_assign_chars("=:");
-			program.add_argument("-p", "--path")
-				.nargs(1)
-				.required();
-			program.add_argument("-out", "--output-dir")
-				.nargs(1);
-			program.add_argument("-e", "--entry-point")
-				.store_into(compiler_input.entry_point) // Store entry point directly
-				.nargs(1)
-				.required();
-			program.add_argument("-d", "--define")
-				.default_value(std::vector<std::string>{})
-				.append();
-			program.add_argument("-o", "--optimization")
-				.default_value("O3")
-				.choices("O0", "O1", "O2", "O3")
-				.nargs(1);
-			program.add_argument("-st", "--shader-type")
-				.required();
-
-			try
-			{
-				program.parse_args(arg);
-
-				compiler_input.shader_type = to_shader_type(program.get<std::string>("--shader-type").c_str());
-
-				// Could be {1,2,3} format
-				// Strings may get moved out so invalid after expand_defines routine
-				auto defines = program.get<std::vector<std::string>>("--define");
-
-				std::vector<boost::container::small_vector<std::string, 2>> parsed_defines;
-				parsed_defines.reserve(defines.size() + input.global_defines.size());
-				auto expand_defines = [&parsed_defines](auto self, std::string& d)
-				{
-						auto& current_defines_list = parsed_defines.back();
-
-						const auto opening = d.find('{');
-
-						if (opening == std::string::npos)
-						{
-							current_defines_list.push_back(std::move(d));
-							return;
-						}
-
-						const auto closing = d.find('}', opening);
-						if (closing == std::string::npos)
-						{
-							// The entire line will fail which could cause multiple compiles to be missed
-							throw std::runtime_error("Missing '}' in define: " + d);
-						}
-
-						size_t current = opening + 1;
-						while (true)
-						{
-							size_t comma = d.find(',', current);
-							if (comma == std::string::npos || comma > closing)
-								comma = closing;
-
-							// Precompute the size for the new string to minimize allocations
-							const size_t prefix_len = opening;
-							const size_t middle_len = comma - current;
-							const size_t suffix_len = d.size() - (closing + 1);
-							std::string new_config;
-							new_config.reserve(prefix_len + middle_len + suffix_len);
-
-							new_config.append(d, 0, prefix_len);
-							new_config.append(d, current, middle_len);
-							new_config.append(d, closing + 1, suffix_len);
-							// Continue expanding other {}
-							self(self, new_config);
-
-							current = comma + 1;
-							if (comma >= closing)
-								break;
-						}
-				};
-
-				for (auto& d : input.global_defines)
-				{
-					parsed_defines.emplace_back();
-					std::string copy = d;
-					expand_defines(expand_defines, copy);
-				}
-
-				for (auto& d : defines)
-				{
-					parsed_defines.emplace_back();
-					expand_defines(expand_defines, d);
-				}
-
-				// Make compiler input for all combinations of defines
-				CompilerInputVector inputs;
-				auto generate_combinations = [&parsed_defines, &inputs, &compiler_input, &program](auto self,
-					std::vector<std::string>& per_compile_defines)
-				{
-					if (per_compile_defines.size() == parsed_defines.size())
-					{
-						CompilerInput input_copy = compiler_input;
-						input_copy.path_and_defines = Owning
-						{
-							.path = program.get<std::string>("--path"),
-							.defines = per_compile_defines
-						};
-						inputs.push_back(std::move(input_copy));
-						return;
-					}
-					for (const auto& define : parsed_defines[per_compile_defines.size()])
-					{
-						// Recursively generate combinations
-						per_compile_defines.push_back(define);
-						self(self, per_compile_defines);
-						// Backtrack
-						per_compile_defines.pop_back();
-					}
-				};
-				
-				std::vector<std::string> per_compile_defines;
-				generate_combinations(generate_combinations, per_compile_defines);
-				
-				compiler_inputs->push_back(std::move(inputs));
-			}
-			catch (const std::exception& err)
-			{
-				parse_errors.emplace_back(i, std::string(err.what()));
-			}
-		}
-	);
-
-	for (const auto& error : parse_errors)
-	{
-		fprintf(stderr, "Failed to parse config line: %d\n\t%s\n", error.first, error.second.c_str());
-	}
-	return parse_errors.empty() ? 0 : -1;
+	return 0;
 }
 
-fs::file_time_type get_most_recent_time(const fs::path& file, tsl::robin_set<fs::path>& visited)
+fs::path get_reflection_path(const fs::path& output_path)
 {
-	if (!fs::exists(file))
-	{
-		printf("Include file not found: %s\n", file.string().c_str());
-		return fs::file_time_type::min();
-	}
+	fs::path path = output_path;
+	path += qhenki::util::SHADER_REFLECTION_EXTENSION;
+	return path;
+}
 
-	if (!visited.insert(file).second)
+bool needs_to_recompile_shader(const fs::path& input_path, const fs::path& output_path, const CompileCache* cache, 
+	const qhenki::util::Hash128& config_key, DependencyGraph* dependencies, const bool needs_reflection, BuildTrace* trace)
+{
+	if (!fs::exists(output_path) || (needs_reflection && !fs::exists(get_reflection_path(output_path))))
 	{
-		return fs::file_time_type::min(); // Already visited this file
+		return true;
 	}
 
-	std::ifstream in(file);
-	if (!in.is_open())
-		return fs::file_time_type::min();
-
-	fs::file_time_type latest = fs::last_write_time(file); // This can technically throw an exception
-
-	std::string line;
-	std::regex include_regex(R"(^\s*#\s*include\s*["<](.*)[">])");
-	while (std::getline(in, line))
+	// Changes to defines, optimization, shader model or compiler version do not touch any file times
+	if (cache)
 	{
-		std::smatch match;
-		if (std::regex_search(line, match, include_regex))
+		qhenki::util::Hash128 recorded_key;
+		if (!cache->load_output_record(output_path, &recorded_key) || recorded_key != config_key)
 		{
-			// Look in include paths
-			fs::path include_file = file.parent_path() / match[1].str();
-			// Detect circular includes
-			if (visited.find(include_file) != visited.end())
-			{
-				printf("Circular include detected: %s\n", include_file.string().c_str());
-			}
-			else
-			{
-				// Recursively get times of includes
-				auto inc_time = get_most_recent_time(include_file, visited);
-				if (inc_time > latest)
-				{
-					latest = inc_time;
-				}
-			}
+			return true;
 		}
 	}
-	return latest;
-}
 
-bool needs_to_recompile_shader(const fs::path& input_path, const fs::path& output_path)
-{
-	if (!fs::exists(output_path))
+	fs::file_time_type latest_input_time;
 	{
-		return true;
+		TraceScope scope(trace, "include scan", trace ? input_path.string() : std::string{});
+		latest_input_time = dependencies->get_most_recent_time(input_path);
 	}
-
-	// TODO: Need a hash based off defines or something. Otherwise, changes in config file do not trigger a recompilation.
-
-	tsl::robin_set<fs::path> visited;
-	const auto latest_input_time = get_most_recent_time(input_path, visited);
 	const auto output_time = fs::last_write_time(output_path);
 
 	if (latest_input_time > output_time)
@@ -302,6 +114,18 @@ bool needs_to_recompile_shader(const fs::path& input_path, const fs::path& outpu
 	return false;
 }
 
+// Archives written with a different --compress setting are rebuilt
+static bool archive_compression_matches(const fs::path& output_path, const bool compress)
+{
+	std::ifstream file(output_path, std::ios::binary);
+	qhenki::util::ShaderArchiveHeader header{};
+	if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)))
+	{
+		return false;
+	}
+	return static_cast<bool>(header.flags & qhenki::util::SHADER_ARCHIVE_FLAG_LZ4) == compress;
+}
+
 fs::path SXCJob::get_resolved_output_name(const OutputInfo& info, const fs::path& input_path, const std::string& output_dir, const size_t permutation_count)
 {
 	// Appends something like _vs_5_0_main.dxil
@@ -322,7 +146,7 @@ fs::path SXCJob::get_resolved_output_name(const OutputInfo& info, const fs::path
 
 	// TODO: flag for Vulkan/SPIRV
 
-	// TODO: If including multiple permutations, change file type to reflect that to differentiate between plain shaders
+	// Multiple permutations are packed into an archive, see qhenkiX/utility/shader_archive.h
 	if (info.sm > gfx::ShaderModel::SM_5_0)
 	{
 		filename += ".dxil";
@@ -339,183 +163,749 @@ fs::path SXCJob::get_resolved_output_name(const OutputInfo& info, const fs::path
 	return fs::path(output_dir) / filename;
 }
 
-ShaderResultCount qhenki::sxc::execute_compilation_job(tbb::concurrent_vector<CompilerInputVector>* inputs, const std::string& output_dir)
+namespace
 {
-	// Go through inputs and just return the same one
-	const auto collect_inputs = tbb::make_filter<void, CompilerInputVector*>(
-		tbb::filter_mode::serial_in_order,
-		[&](tbb::flow_control& fc) -> CompilerInputVector*
+	// All permutations of one config line. Written to a single output once its last permutation finished
+	struct ShaderGroup
+	{
+		fs::path output_path;
+		const CompilerInputVector* inputs = nullptr;
+		qhenki::util::Hash128 config_key;
+		std::vector<CompilerOutput> outputs; // Same order as inputs
+		std::vector<std::vector<uint8_t>> reflections; // Serialized util::ShaderReflectionData, empty if not reflected
+		// Permutation whose output is used for each input. Differs from the input index when the
+		// permutation only differs from an earlier one in defines the shader never references
+		std::vector<uint32_t> output_index;
+		std::vector<uint8_t> in_shard; // Per input, empty when not sharding
+		std::atomic_size_t remaining{ 0 }; // Permutations left to compile
+		std::atomic_uint64_t held_bytes{ 0 }; // Output bytes kept in memory until the group is written
+
+		// Outputs that did not fit the memory budget wait in a file next to the output, see hold_output
+		std::mutex spill_mutex;
+		std::ofstream spill;
+		fs::path spill_path;
+		uint64_t spill_size = 0;
+		std::vector<uint64_t> spill_offset; // Per input, NOT_SPILLED if in memory
+	};
+	constexpr uint64_t NOT_SPILLED = UINT64_MAX;
+
+	/**
+	 * Keeps a finished permutation of a multi-permutation group in memory while the job stays within its budget,
+	 * otherwise appends it to the group's spill file so memory does not grow with the number of permutations.
+	 */
+	void hold_output(ShaderGroup* group, const uint32_t i, std::atomic_uint64_t* held_bytes, const uint64_t budget)
+	{
+		auto& out = group->outputs[i];
+		const uint64_t size = out.shader_size;
+		if (held_bytes->fetch_add(size) + size <= budget)
 		{
-			static size_t index = 0;
-			if (inputs->empty() || index >= inputs->size()) 
+			group->held_bytes += size;
+			return;
+		}
+
+		std::lock_guard lock(group->spill_mutex);
+		if (group->spill_offset.empty())
+		{
+			group->spill_path = group->output_path;
+			group->spill_path += ".spill";
+			group->spill.open(group->spill_path, std::ios::binary | std::ios::trunc);
+			group->spill_offset.assign(group->outputs.size(), NOT_SPILLED);
+		}
+		group->spill.write(static_cast<const char*>(out.shader_data), static_cast<std::streamsize>(size));
+		if (!group->spill.good())
+		{
+			// Later spills of this group fail as well, those outputs stay in memory
+			group->held_bytes += size;
+			return;
+		}
+		*held_bytes -= size;
+		group->spill_offset[i] = group->spill_size;
+		group->spill_size += size;
+		out.shader_data = nullptr;
+		out.internal_state.reset();
+	}
+
+	// Maps the spill file and points the spilled outputs into it. The mapping is released with the outputs
+	void restore_spilled(ShaderGroup* group)
+	{
+		if (group->spill_offset.empty())
+		{
+			return;
+		}
+		group->spill.close();
+		auto mapped = mkS<qhenki::util::MappedFile>();
+		const bool readable = !group->spill.fail() && mapped->open(group->spill_path.c_str());
+		for (size_t i = 0; i < group->outputs.size(); i++)
+		{
+			if (group->spill_offset[i] == NOT_SPILLED)
 			{
-				fc.stop();
-				return nullptr;
+				continue;
 			}
-			const auto civ = &(*inputs)[index++];
-			if (civ->empty())
+			auto& out = group->outputs[i];
+			if (readable)
 			{
-				fc.stop();
-				return nullptr;
+				out.shader_data = static_cast<const uint8_t*>(mapped->data()) + group->spill_offset[i];
+				out.internal_state = mapped;
+			}
+			else
+			{
+				out.error_message = "Failed to read back output spilled to " + group->spill_path.string() + "\n";
 			}
-			return civ;
 		}
-	);
+	}
 
-	struct OutputPathAndCompilerInputVector
+	// Called once the outputs no longer reference the mapping
+	void remove_spill(ShaderGroup* group)
 	{
-		fs::path output_path;
-		CompilerInputVector* input_vector = nullptr;
-	};
-
-	std::atomic_uint64_t skipped_count{ 0 };
-	// Check if input needs to be compiled
-	const auto filter_shaders = tbb::make_filter<CompilerInputVector*, OutputPathAndCompilerInputVector>(
-		tbb::filter_mode::parallel,
-		[&output_dir, &skipped_count](CompilerInputVector* input) -> OutputPathAndCompilerInputVector
+		if (!group->spill_path.empty())
 		{
-			assert(input); // nullptr should have stopped pipeline from last filter
-			assert(!input->empty());
+			std::error_code ec;
+			fs::remove(group->spill_path, ec);
+		}
+	}
 
-			// Assumes that all inputs are the same shader!
+	/**
+	 * Points permutations that only differ in unreferenced defines at the first permutation of their kind.
+	 * @return Number of permutations that do not need compiling.
+	 */
+	uint32_t prune_permutations(ShaderGroup* group, DependencyGraph* dependencies, BuildTrace* trace)
+	{
+		const auto& inputs = *group->inputs;
+		TraceScope scope(trace, "define pruning", trace ? std::string(inputs.front().get_path()) : std::string{});
 
-			// Check if the shader needs to be compiled
-			// Since all inputs are the same shader just with different defines, we can cull entire groups
-			// This is done by returning nullptr, which is then ignored by the next filter
+		std::vector<std::string_view> names;
+		std::vector<std::string_view> values;
+		for (const auto& input : inputs)
+		{
+			for (const auto& define : input.get_defines())
+			{
+				const auto name = get_define_name(define);
+				if (std::ranges::find(names, name) == names.end())
+				{
+					names.push_back(name);
+				}
+				const auto value = get_define_value(define);
+				if (!value.empty() && std::ranges::find(values, value) == values.end())
+				{
+					values.push_back(value);
+				}
+			}
+		}
 
-			const auto& ci = input->at(0);
+		// A header that could not be found or is included through a macro may reference any define
+		std::vector<std::string> files;
+		std::vector<uint8_t> referenced;
+		bool complete;
+		dependencies->collect_dependencies(inputs.front().get_path(), &files, &complete);
+		if (!complete || !find_referenced_defines(files, names, values, &referenced))
+		{
+			return 0;
+		}
 
-			const OutputInfo info
+		tsl::robin_map<uint64_t, uint32_t> first_of_kind;
+		std::vector<std::string> effective_defines;
+		uint32_t pruned = 0;
+		for (uint32_t i = 0; i < inputs.size(); i++)
+		{
+			effective_defines.clear();
+			for (const auto& define : inputs[i].get_defines())
+			{
+				const auto it = std::ranges::find(names, get_define_name(define));
+				if (referenced[it - names.begin()])
+				{
+					effective_defines.push_back(define);
+				}
+			}
+			const auto [it, inserted] = first_of_kind.insert({ qhenki::util::ShaderArchive::make_key(effective_defines), i });
+			group->output_index[i] = it->second;
+			if (!inserted)
 			{
-				.sm = ci.shader_model,
-				.st = ci.shader_type,
-				.entry_point = ci.entry_point,
-			};
-			fs::path input_path = ci.get_path();
-			fs::path output_path = SXCJob::get_resolved_output_name(info, input_path, output_dir, input->size());
+				pruned++;
+			}
+		}
+		return pruned;
+	}
+
+	// e.g. "shader.hlsl main vs_6_0 A=1 B=0"
+	std::string describe_permutation(const CompilerInput& input, const std::string& target)
+	{
+		std::string name(input.get_path());
+		name += ' ';
+		name += input.entry_point;
+		name += ' ';
+		name += target;
+		for (const auto& define : input.get_defines())
+		{
+			name += ' ';
+			name += define;
+		}
+		return name;
+	}
 
-			if (needs_to_recompile_shader(input_path, output_path))
+	struct PermutationTask
+	{
+		ShaderGroup* group;
+		uint32_t index;
+		uint32_t expected_us; // From previous runs, or estimated
+		uint64_t stats_key;
+		uint32_t measured_us; // 0 unless the permutation was actually compiled
+	};
+
+	// Hands the permutations of this shard to the shard writer. The output itself is written by "SXC merge"
+	void write_shard_group(ShaderGroup* group, ShardWriter* writer, std::atomic_uint64_t* succeeded_count, std::atomic_uint64_t* failed_count,
+		BuildTrace* trace)
+	{
+		TraceScope scope(trace, "write", trace ? group->output_path.string() : std::string{});
+
+		restore_spilled(group);
+		std::vector<ShardEntry> entries;
+		for (uint32_t i = 0; i < group->outputs.size(); i++)
+		{
+			if (!group->in_shard[i])
 			{
-				return
-				{
-					.output_path = output_path,
-					.input_vector = input
-				};
+				continue;
+			}
+			const auto& co = group->outputs[group->output_index[i]];
+			if (!co.error_message.empty())
+			{
+				++*failed_count;
+				continue;
 			}
+			entries.push_back(
+			{
+				.key = qhenki::util::ShaderArchive::make_key((*group->inputs)[i].get_defines()),
+				.index = i,
+				.data = co.shader_data,
+				.size = co.shader_size,
+			});
+		}
+
+		const auto output_name = group->output_path.filename().string();
+		if (writer->add_group(output_name, static_cast<uint32_t>(group->inputs->size()), group->config_key, entries))
+		{
+			*succeeded_count += entries.size();
+		}
+		else
+		{
+			printf("Failed to write shard output: %s\n", output_name.c_str());
+			*failed_count += entries.size();
+		}
 
-			skipped_count += input->size();
+		std::vector<CompilerOutput>().swap(group->outputs);
+		remove_spill(group);
+	}
 
-			return {};
+	// Sidecar mirrors the output: a single record, or an archive of records under the same permutation keys
+	void add_reflection(const ShaderGroup* group, std::vector<OutputFile>* files)
+	{
+		auto path = get_reflection_path(group->output_path);
+		if (group->outputs.size() == 1)
+		{
+			const auto& record = group->reflections.front();
+			if (record.empty())
+			{
+				// A stale sidecar would describe an older shader, remove it so the runtime reflects instead
+				std::error_code ec;
+				fs::remove(path, ec);
+			}
+			else
+			{
+				files->push_back({ std::move(path), record });
+			}
+			return;
 		}
-	);
 
-	using CompilerOutputVector = oneapi::tbb::concurrent_vector<CompilerOutput>;
+		PermutationArchiveWriter archive;
+		archive.reserve(group->outputs.size());
+		for (size_t i = 0; i < group->outputs.size(); i++)
+		{
+			const auto& record = group->reflections[group->output_index[i]];
+			if (!record.empty())
+			{
+				archive.add((*group->inputs)[i].get_defines(), record.data(), record.size());
+			}
+		}
+		std::vector<uint8_t> archive_data;
+		std::string error;
+		if (archive.finalize(&archive_data, &error))
+		{
+			files->push_back({ std::move(path), std::move(archive_data) });
+		}
+		else
+		{
+			printf("Failed to write shader reflection: %s %s\n", path.string().c_str(), error.c_str());
+		}
+	}
 
-	struct PathAndOutputs
+	struct CompressionTotals
 	{
-		fs::path path;
-		CompilerOutputVector* output;
+		std::atomic_uint64_t uncompressed_bytes{ 0 };
+		std::atomic_uint64_t compressed_bytes{ 0 };
+		std::atomic_uint64_t decode_us{ 0 };
 	};
 
-	tbb::enumerable_thread_specific<gfx::D3D12ShaderCompiler> compilers;
-	// Compile shader
-	auto compile_shaders = tbb::make_filter<OutputPathAndCompilerInputVector, PathAndOutputs>(
-		tbb::filter_mode::parallel,
-		[&compilers](const OutputPathAndCompilerInputVector& out_and_vector) -> PathAndOutputs
+	// Decodes every permutation of a freshly built archive, which both validates it and measures the runtime load cost
+	bool verify_compressed_archive(const std::vector<uint8_t>& archive_data, CompressionTotals* totals)
+	{
+		qhenki::util::ShaderArchive archive;
+		if (!archive.open(archive_data.data(), archive_data.size()))
 		{
-			const auto& out_path = out_and_vector.output_path;
-			const auto input_vector = out_and_vector.input_vector;
+			return false;
+		}
+		thread_local std::vector<uint8_t> decoded;
+		const auto start = std::chrono::steady_clock::now();
+		for (const auto& entry : archive.get_entries())
+		{
+			if (!archive.read(entry, &decoded))
+			{
+				return false;
+			}
+		}
+		const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+		totals->decode_us += elapsed.count();
+		return true;
+	}
+
+	// Builds the output of a finished group and queues it on the writer. Blobs are released before this returns
+	void write_group(ShaderGroup* group, const CompileCache* cache, OutputWriter* writer, std::atomic_uint64_t* succeeded_count,
+		std::atomic_uint64_t* failed_count, CompressionTotals* compression, BuildTrace* trace)
+	{
+		TraceScope scope(trace, "assemble", trace ? group->output_path.string() : std::string{});
 
-			if (!input_vector)
+		restore_spilled(group);
+		bool all_compiled = true;
+		PermutationArchiveWriter archive;
+		const bool is_archive = group->outputs.size() > 1;
+		if (is_archive)
+		{
+			archive.reserve(group->outputs.size());
+			archive.set_compression(compression != nullptr);
+		}
+
+		std::vector<OutputFile> files;
+		for (size_t i = 0; i < group->outputs.size(); i++)
+		{
+			const auto& co = group->outputs[group->output_index[i]];
+			if (!co.error_message.empty())
+			{
+				++*failed_count;
+				all_compiled = false;
+			}
+			else
+			{
+				++*succeeded_count;
+
+				if (is_archive)
+				{
+					archive.add((*group->inputs)[i].get_defines(), co.shader_data, co.shader_size);
+				}
+				else
+				{
+					const auto data = static_cast<const uint8_t*>(co.shader_data);
+					files.push_back({ group->output_path, std::vector<uint8_t>(data, data + co.shader_size) });
+				}
+			}
+		}
+
+		// A partial archive would make the runtime silently miss permutations, so nothing is written on failure
+		const size_t count = group->outputs.size();
+		if (is_archive && all_compiled)
+		{
+			std::vector<uint8_t> archive_data;
+			std::string error;
+			bool built = archive.finalize(&archive_data, &error);
+			if (built && compression)
 			{
-				return
+				built = verify_compressed_archive(archive_data, compression);
+				if (built)
 				{
-					.path= "",
-					.output= nullptr
-				};
+					compression->uncompressed_bytes += archive.get_uncompressed_size();
+					compression->compressed_bytes += archive.get_compressed_size();
+				}
+				else
+				{
+					error = "Compressed archive failed to decode";
+				}
+			}
+			if (built)
+			{
+				files.push_back({ group->output_path, std::move(archive_data) });
+			}
+			else
+			{
+				printf("Failed to write shader archive: %s %s\n", group->output_path.string().c_str(), error.c_str());
+				*failed_count += count;
+				*succeeded_count -= count;
+				all_compiled = false;
 			}
+		}
 
-			auto& compiler = compilers.local();
+		if (all_compiled && !group->reflections.empty())
+		{
+			add_reflection(group, &files);
+		}
 
-			using allocator = oneapi::tbb::tbb_allocator<CompilerOutputVector>;
+		// Release the blobs now instead of at the end of the build
+		std::vector<CompilerOutput>().swap(group->outputs);
+		std::vector<std::vector<uint8_t>>().swap(group->reflections);
+		remove_spill(group);
 
-			allocator alloc;
-			auto output = alloc.allocate(1);
-			std::allocator_traits<allocator>::construct(alloc, output);
+		if (!all_compiled)
+		{
+			return;
+		}
 
-			if (input_vector->size() > 1)
+		// Only remember the config once the output is on disk, otherwise failures would be treated as up-to-date
+		writer->submit(std::move(files),
+			[cache, succeeded_count, failed_count, count, path = group->output_path, config_key = group->config_key](const bool written)
+		{
+			if (!written)
+			{
+				printf("Failed to write shader output: %s\n", path.string().c_str());
+				*failed_count += count;
+				*succeeded_count -= count;
+			}
+			else if (cache)
 			{
-				output->reserve(input_vector->size());
+				cache->store_output_record(path, config_key);
 			}
+		});
+	}
+}
+
+ShaderResultCount qhenki::sxc::execute_compilation_job(tbb::concurrent_vector<CompilerInputVector>* inputs, const JobSettings& settings)
+{
+	assert(settings.dependencies);
+	const auto& output_dir = settings.output_dir;
+	const auto cache = settings.cache;
+	const auto dependencies = settings.dependencies;
+	const auto stats = settings.stats;
+	const auto trace = settings.trace;
+	const auto shard = settings.shard;
+	assert(!shard || settings.shard_writer);
+	// Shards do not carry reflection, merged outputs are reflected at runtime
+	const bool write_reflection = settings.reflection && !shard;
+
+	std::optional<CompilerPool> local_compilers;
+	if (!settings.compilers)
+	{
+		local_compilers.emplace();
+	}
+	auto& compilers = settings.compilers ? *settings.compilers : local_compilers.value();
+	auto get_compiler_version = [&](const gfx::ShaderModel sm) -> const std::string&
+	{
+		return compilers.get_version(sm);
+	};
+
+	// Since all inputs of a line are the same shader just with different defines, entire groups are culled at once
+	std::atomic_uint64_t skipped_count{ 0 };
+	std::atomic_uint64_t pruned_count{ 0 };
+	std::vector<uPtr<ShaderGroup>> groups(inputs->size());
+	tbb::parallel_for(static_cast<size_t>(0), inputs->size(), [&](const size_t i)
+	{
+		const auto& input = (*inputs)[i];
+		if (input.empty())
+		{
+			return;
+		}
+		const auto& ci = input.front();
 
-			tbb::parallel_for(static_cast<size_t>(0), input_vector->size(), [&](size_t i)
+		const OutputInfo info
+		{
+			.sm = ci.shader_model,
+			.st = ci.shader_type,
+			.entry_point = ci.entry_point,
+		};
+		fs::path input_path = ci.get_path();
+		fs::path output_path = SXCJob::get_resolved_output_name(info, input_path, output_dir, input.size());
+		const auto config_key = CompileCache::make_config_key(input.data(), input.size(), get_compiler_version(ci.shader_model));
+		if (settings.manifest && !shard)
+		{
+			settings.manifest->add_output(output_path, input_path, config_key);
+			if (write_reflection)
 			{
-				auto& input = (*input_vector)[i];
-				output->emplace_back();
-				auto& out = output->back();
-				const auto success = compiler.compile(input, out);
+				settings.manifest->add_output(get_reflection_path(output_path), input_path, config_key);
+			}
+		}
 
-				const auto tm = gfx::D3DHelper::get_shader_model_char(input.shader_type, input.shader_model);
+		// A shard cannot tell whether the merged output is up-to-date, compiles hit the cache instead
+		bool needs_compile = true;
+		if (!shard)
+		{
+			TraceScope scope(trace, "up-to-date check", trace ? output_path.string() : std::string{});
+			needs_compile = needs_to_recompile_shader(input_path, output_path, cache, config_key, dependencies, settings.reflection, trace)
+				|| (input.size() > 1 && !archive_compression_matches(output_path, settings.compress));
+		}
+		if (!needs_compile)
+		{
+			skipped_count += input.size();
+			return;
+		}
 
-				if (success)
-				{
-					printf("Permutation #%zu: Compiling shader: %s %s\n", i, input.get_path().data(), tm.data());
-				}
-				else
+		auto group = mkU<ShaderGroup>();
+		group->output_path = std::move(output_path);
+		group->inputs = &input;
+		group->config_key = config_key;
+		group->outputs.resize(input.size());
+		if (write_reflection)
+		{
+			group->reflections.resize(input.size());
+		}
+		group->output_index.resize(input.size());
+		std::iota(group->output_index.begin(), group->output_index.end(), 0u);
+		uint32_t pruned = 0;
+		if (settings.prune_defines && input.size() > 1)
+		{
+			pruned = prune_permutations(group.get(), dependencies, trace);
+		}
+		size_t to_compile = input.size() - pruned;
+		if (shard)
+		{
+			// Pruned permutations follow the permutation they reuse, so it is compiled on the shard that needs it
+			group->in_shard.resize(input.size());
+			to_compile = 0;
+			pruned = 0;
+			for (uint32_t p = 0; p < input.size(); p++)
+			{
+				const auto representative = group->output_index[p];
+				group->in_shard[p] = shard->owns(input[representative]);
+				if (group->in_shard[p])
 				{
-					printf("Permutation #%zu: Compiling shader: %s %s\n%s", i, input.get_path().data(), tm.data(), out.error_message.data());
+					representative == p ? to_compile++ : pruned++;
 				}
+			}
+			if (to_compile == 0)
+			{
+				return;
+			}
+		}
+		pruned_count += pruned;
+		group->remaining = to_compile;
+		groups[i] = std::move(group);
+	});
+
+	// Flatten every permutation into one pool so a large group does not serialize the tail of the build
+	std::vector<PermutationTask> tasks;
+	uint64_t known_sum = 0, known_count = 0;
+	for (const auto& group : groups)
+	{
+		if (!group) continue;
+		for (uint32_t i = 0; i < group->inputs->size(); i++)
+		{
+			if (group->output_index[i] != i)
+			{
+				continue; // Reuses the output of another permutation
+			}
+			if (shard && !group->in_shard[i])
+			{
+				continue;
+			}
+			const auto stats_key = stats ? CompileStats::make_key((*group->inputs)[i]) : 0;
+			const auto expected_us = stats ? stats->get_duration(stats_key) : 0;
+			if (expected_us)
+			{
+				known_sum += expected_us;
+				known_count++;
+			}
+			tasks.push_back(
+			{
+				.group = group.get(),
+				.index = i,
+				.expected_us = expected_us,
+				.stats_key = stats_key,
+				.measured_us = 0,
 			});
+		}
+	}
 
-			return
+	// Permutations without history are assumed to cost as much as their siblings, or the average permutation
+	const uint32_t average_us = known_count ? static_cast<uint32_t>(known_sum / known_count) : 0;
+	for (size_t begin = 0; begin < tasks.size();)
+	{
+		size_t end = begin;
+		uint64_t group_sum = 0, group_count = 0;
+		while (end < tasks.size() && tasks[end].group == tasks[begin].group)
+		{
+			if (tasks[end].expected_us)
 			{
-				.path = out_path,
-				.output = output
-			};
+				group_sum += tasks[end].expected_us;
+				group_count++;
+			}
+			end++;
 		}
-	);
+		const uint32_t estimate = group_count ? static_cast<uint32_t>(group_sum / group_count) : average_us;
+		for (size_t t = begin; t < end; t++)
+		{
+			if (!tasks[t].expected_us) tasks[t].expected_us = estimate;
+		}
+		begin = end;
+	}
+
+	// Longest expected first. Without any history bigger groups go first as they are likely uber shaders
+	std::ranges::stable_sort(tasks, [](const PermutationTask& a, const PermutationTask& b)
+	{
+		if (a.expected_us != b.expected_us) return a.expected_us > b.expected_us;
+		return a.group->inputs->size() > b.group->inputs->size();
+	});
 
 	std::atomic_uint64_t succeeded_count{ 0 };
 	std::atomic_uint64_t failed_count{ 0 };
-	// Write out and collect results
-	auto collect_compile_results = tbb::make_filter<PathAndOutputs, void>(
-		tbb::filter_mode::parallel,
-		[&failed_count, &succeeded_count](const PathAndOutputs& pa) -> void
+	std::atomic_uint64_t held_bytes{ 0 };
+	std::atomic_uint64_t spilled_bytes{ 0 };
+	CompressionTotals compression;
+	// Declared after the counters its callbacks update so it is joined first
+	std::optional<OutputWriter> writer;
+	if (!shard)
+	{
+		writer.emplace(settings.output_budget, trace);
+	}
+
+	auto run_task = [&](PermutationTask& task)
+	{
+		const auto group = task.group;
+		const auto i = task.index;
+		auto& input = (*group->inputs)[i];
+		auto& out = group->outputs[i];
+		auto& compiler = compilers.local();
+
+		const auto tm = gfx::D3DHelper::get_shader_model_char(input.shader_type, input.shader_model);
+		const auto name = trace ? describe_permutation(input, tm) : std::string{};
+
+		const auto start = std::chrono::steady_clock::now();
+		bool cached = false;
+		std::optional<util::Hash128> key;
+		// A hit would not write the PDB, which is missing after a clean even though the key still matches
+		if (cache && input.pdb_path.empty())
 		{
-			if (pa.output)
+			TraceScope scope(trace, "cache lookup", name);
+			std::string preprocessed;
+			std::string preprocess_error;
+			// On failure fall through to compile, which reports the error properly
+			if (compiler.preprocess(input, preprocessed, preprocess_error))
 			{
-				for (const auto& co : *pa.output)
+				key = CompileCache::make_key(input, preprocessed, get_compiler_version(input.shader_model));
+				auto blob = mkS<std::vector<uint8_t>>();
+				if (cache->load(*key, blob.get()))
 				{
-					if (!co.error_message.empty())
-					{
-						++failed_count;
-					}
-					else
-					{
-						++succeeded_count;
-
-						// TODO: permutations of the same shader need to be written to the same file
-						// Needs to be a header with offsets
-
-						if (!util::FileHelper::write_file(pa.path.c_str(), co.shader_data, co.shader_size))
-						{
-							printf("Failed to write shader to file: %s\n", pa.path.string().c_str());
-							++failed_count;
-						}
-					}
+					out.shader_data = blob->data();
+					out.shader_size = blob->size();
+					out.internal_state = std::move(blob);
+					printf("Permutation #%u: Cached shader: %s %s\n", i, input.get_path().data(), tm.data());
+					cached = true;
 				}
-				oneapi::tbb::tbb_allocator<CompilerOutputVector>().deallocate(pa.output, 1);
 			}
 		}
-	);
 
-	constexpr auto max_tokens = 2;
-	parallel_pipeline(max_tokens, collect_inputs, filter_shaders, compile_shaders, collect_compile_results);
+		if (!cached)
+		{
+			bool success;
+			{
+				TraceScope scope(trace, "compile", name);
+				success = compiler.compile(input, out);
+			}
+			if (!success && out.error_message.empty())
+			{
+				out.error_message = "Unknown compiler error\n";
+			}
+			if (success && key.has_value() && out.error_message.empty() && !cache->store(*key, out.shader_data, out.shader_size))
+			{
+				printf("Failed to write shader to cache: %s\n", cache->get_directory().string().c_str());
+			}
+
+			if (success)
+			{
+				const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+				task.measured_us = static_cast<uint32_t>(std::max<int64_t>(1, elapsed.count()));
+				printf("Permutation #%u: Compiling shader: %s %s\n", i, input.get_path().data(), tm.data());
+			}
+			else
+			{
+				printf("Permutation #%u: Compiling shader: %s %s\n%s", i, input.get_path().data(), tm.data(), out.error_message.data());
+			}
+		}
+
+		if (!group->reflections.empty() && out.error_message.empty())
+		{
+			TraceScope scope(trace, "reflect", name);
+			qhenki::util::ShaderReflectionData reflection;
+			std::string reflect_error;
+			if (compiler.reflect(out.shader_data, out.shader_size, input.shader_model, &reflection, reflect_error))
+			{
+				reflection.serialize(&group->reflections[i]);
+			}
+			else
+			{
+				printf("Permutation #%u: No reflection for %s %s: %s\n", i, input.get_path().data(), tm.data(), reflect_error.c_str());
+			}
+		}
+
+		// Finished permutations wait for the rest of their group, within the budget in memory and otherwise on disk
+		if (group->outputs.size() > 1 && out.error_message.empty())
+		{
+			hold_output(group, i, &held_bytes, settings.output_budget);
+			if (!out.shader_data && out.shader_size)
+			{
+				spilled_bytes += out.shader_size;
+			}
+		}
+
+		// Last permutation of the group writes the output. fetch_sub orders the other threads' results before it
+		if (group->remaining.fetch_sub(1) == 1)
+		{
+			if (shard)
+			{
+				write_shard_group(group, settings.shard_writer, &succeeded_count, &failed_count, trace);
+			}
+			else
+			{
+				write_group(group, cache, &writer.value(), &succeeded_count, &failed_count,
+					settings.compress ? &compression : nullptr, trace);
+			}
+			held_bytes -= group->held_bytes;
+		}
+	};
+
+	// Every worker pulls the next most expensive permutation, keeping all cores busy until the pool is empty
+	std::atomic_size_t next_task{ 0 };
+	tbb::task_group workers;
+	const auto worker_count = tbb::this_task_arena::max_concurrency();
+	for (int w = 0; w < worker_count; w++)
+	{
+		workers.run([&]
+		{
+			for (size_t t = next_task++; t < tasks.size(); t = next_task++)
+			{
+				run_task(tasks[t]);
+			}
+		});
+	}
+	workers.wait();
+	if (writer.has_value())
+	{
+		TraceScope scope(trace, "flush", std::string{});
+		writer->flush();
+	}
+
+	if (stats)
+	{
+		for (const auto& task : tasks)
+		{
+			if (task.measured_us)
+			{
+				stats->record(task.stats_key, task.measured_us);
+			}
+		}
+	}
 
 	return
 	{
 		.succeeded_count = succeeded_count.load(),
 		.failed_count = failed_count.load(),
 		.skipped_count = skipped_count.load(),
+		.pruned_count = pruned_count.load(),
+		.archive_uncompressed_bytes = compression.uncompressed_bytes.load(),
+		.archive_compressed_bytes = compression.compressed_bytes.load(),
+		.archive_decode_us = compression.decode_us.load(),
+		.spilled_bytes = spilled_bytes.load(),
 	};
 }
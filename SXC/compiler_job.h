@@ -1,6 +1,6 @@
 #pragma once
 
-#include <basetsd.h>
+#include <cstdint>
 #include <filesystem>
 #include <optional>
 #include <string>
@@ -42,20 +42,14 @@ namespace qhenki::sxc
 		std::string_view entry_point;
 	};
 
-	using CompilerInputVector = boost::container::small_vector<CompilerInput, 1>;
+	// Permutations of one config line. Their paths and defines point into storage, which copies share
+	struct CompilerInputVector : boost::container::small_vector<CompilerInput, 1>
+	{
+		sPtr<const std::vector<std::string>> storage;
+	};
 
 	class SXCJob
 	{
-		struct ConfigLineInput
-		{
-			std::optional<std::string> output_dir; // Overrides CLIInput output directory
-			std::string entry_point;
-			std::optional<std::vector<std::string>> defines; // list of range of possible range of values {}
-			std::optional<CompilerInput::Optimization> optimization; // Overrides CLIInput optimization
-			gfx::ShaderType shader_type;
-		};
-
-		static gfx::ShaderType to_shader_type(const char* str);
 		static const char* shader_type_to_str(gfx::ShaderType type);
 
 	public:
@@ -66,10 +60,43 @@ namespace qhenki::sxc
 
 	struct ShaderResultCount
 	{
-		UINT64 succeeded_count;
-		UINT64 failed_count;
-		UINT64 skipped_count;
+		uint64_t succeeded_count;
+		uint64_t failed_count;
+		uint64_t skipped_count;
+		uint64_t pruned_count; // Permutations that reused the output of an equivalent permutation
+		uint64_t archive_uncompressed_bytes; // Archive blobs before compression, 0 without compression
+		uint64_t archive_compressed_bytes; // Archive blobs and dictionaries after compression
+		uint64_t archive_decode_us; // Time to decompress every written archive once
+		uint64_t spilled_bytes; // Permutation outputs moved to disk to stay within JobSettings::output_budget
+	};
+
+	class BuildManifest;
+	class BuildTrace;
+	class CompileCache;
+	class CompileStats;
+	class CompilerPool;
+	class DependencyGraph;
+	class ShardWriter;
+	struct ShardSpec;
+
+	struct JobSettings
+	{
+		std::string output_dir;
+		const CompileCache* cache = nullptr; // nullptr to always compile
+		DependencyGraph* dependencies = nullptr; // Shared by all threads, required
+		CompileStats* stats = nullptr; // Orders permutations by previous compile times and records new ones, optional
+		BuildTrace* trace = nullptr; // Records stage timings, optional
+		CompilerPool* compilers = nullptr; // Reused between builds if set, otherwise created for this job
+		BuildManifest* manifest = nullptr; // Receives every output for the no-op check of the next run, optional
+		bool prune_defines = true; // Compile permutations differing only in unreferenced defines once
+		bool reflection = true; // Write a .refl sidecar next to every output so the runtime does not reflect shaders
+		bool compress = false; // LZ4 compress permutation archives, single shader outputs stay raw bytecode
+		// Bytes of finished permutations kept in memory until their group is complete, and separately the bytes
+		// queued for writing. Finished permutations beyond it are spilled to disk, writes beyond it block
+		uint64_t output_budget = 256ull << 20;
+		const ShardSpec* shard = nullptr; // Compile only the permutations of this shard, requires shard_writer
+		ShardWriter* shard_writer = nullptr; // Receives the shard outputs instead of the output directory
 	};
 
-	ShaderResultCount execute_compilation_job(tbb::concurrent_vector<CompilerInputVector>* inputs, const std::string& output_dir);
+	ShaderResultCount execute_compilation_job(tbb::concurrent_vector<CompilerInputVector>* inputs, const JobSettings& settings);
 }
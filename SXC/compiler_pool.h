@@ -0,0 +1,38 @@
+#pragma once
+
+#include <string>
+
+#include <tbb/enumerable_thread_specific.h>
+
+#include "graphics/d3d12/d3d12_shader_compiler.h"
+#include "qhenkiX/utility/include_cache.h"
+
+namespace qhenki::sxc
+{
+	// One compiler per thread since IDxcCompiler3 is not thread safe. Kept alive between builds in watch mode
+	class CompilerPool
+	{
+		gfx::IncludeCache m_includes; // Shared by all compilers, each source and header is read once per build
+		tbb::enumerable_thread_specific<gfx::D3D12ShaderCompiler> m_compilers;
+		std::string m_fxc_version;
+		std::string m_dxc_version;
+
+	public:
+		CompilerPool() : m_compilers(&m_includes)
+		{
+			// Compiler versions are part of every cache key, query them once up front
+			m_fxc_version = m_compilers.local().get_version(gfx::ShaderModel::SM_5_0);
+			m_dxc_version = m_compilers.local().get_version(gfx::ShaderModel::SM_6_0);
+		}
+
+		gfx::D3D12ShaderCompiler& local() { return m_compilers.local(); }
+
+		// Files may have changed on disk, call between builds only
+		void invalidate_includes() { m_includes.clear(); }
+
+		const std::string& get_version(const gfx::ShaderModel sm) const
+		{
+			return sm < gfx::ShaderModel::SM_6_0 ? m_fxc_version : m_dxc_version;
+		}
+	};
+}
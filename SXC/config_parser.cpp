@@ -0,0 +1,378 @@
+#include "config_parser.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+#include <tbb/blocked_range.h>
+#include <tbb/concurrent_vector.h>
+#include <tbb/parallel_for.h>
+
+using namespace qhenki::sxc;
+
+namespace
+{
+	using DefineList = boost::container::small_vector<std::string, 2>;
+
+	enum class Option : uint8_t
+	{
+		PATH,
+		OUTPUT_DIR,
+		ENTRY_POINT,
+		DEFINE,
+		OPTIMIZATION,
+		SHADER_TYPE,
+		COUNT,
+	};
+
+	struct OptionName
+	{
+		std::string_view short_name;
+		std::string_view long_name;
+		Option option;
+	};
+
+	constexpr OptionName OPTIONS[] =
+	{
+		{ "-p", "--path", Option::PATH },
+		{ "-out", "--output-dir", Option::OUTPUT_DIR },
+		{ "-e", "--entry-point", Option::ENTRY_POINT },
+		{ "-d", "--define", Option::DEFINE },
+		{ "-o", "--optimization", Option::OPTIMIZATION },
+		{ "-st", "--shader-type", Option::SHADER_TYPE },
+	};
+
+	struct Line
+	{
+		const char* begin;
+		const char* end;
+		size_t number;
+	};
+
+	bool is_space(const char c)
+	{
+		return c == ' ' || c == '\t' || c == '\r';
+	}
+
+	class Tokenizer
+	{
+		const char* m_p;
+		const char* m_end;
+
+	public:
+		Tokenizer(const char* begin, const char* end) : m_p(begin), m_end(end) {}
+
+		bool next(std::string_view* token)
+		{
+			while (m_p < m_end && is_space(*m_p)) m_p++;
+			if (m_p == m_end)
+			{
+				return false;
+			}
+			const char* start = m_p;
+			while (m_p < m_end && !is_space(*m_p)) m_p++;
+			*token = std::string_view(start, m_p - start);
+			return true;
+		}
+	};
+
+	// Matches "-p", "--path" and the assigned forms "-p=value", "-p:value"
+	const OptionName* match_option(const std::string_view token, std::string_view* value, bool* has_value)
+	{
+		*has_value = false;
+		for (const auto& name : OPTIONS)
+		{
+			if (token == name.short_name || token == name.long_name)
+			{
+				return &name;
+			}
+		}
+		for (const auto& name : OPTIONS)
+		{
+			for (const auto candidate : { name.short_name, name.long_name })
+			{
+				if (token.size() > candidate.size() && token.starts_with(candidate)
+					&& (token[candidate.size()] == '=' || token[candidate.size()] == ':'))
+				{
+					*value = token.substr(candidate.size() + 1);
+					*has_value = true;
+					return &name;
+				}
+			}
+		}
+		return nullptr;
+	}
+
+	bool to_shader_type(const std::string_view str, qhenki::gfx::ShaderType* type)
+	{
+		if (str == "vs") *type = qhenki::gfx::ShaderType::VERTEX_SHADER;
+		else if (str == "ps") *type = qhenki::gfx::ShaderType::PIXEL_SHADER;
+		else if (str == "cs") *type = qhenki::gfx::ShaderType::COMPUTE_SHADER;
+		else return false;
+		return true;
+	}
+
+	bool to_optimization(const std::string_view str, CompilerInput::Optimization* optimization)
+	{
+		if (str.size() != 2 || str[0] != 'O' || str[1] < '0' || str[1] > '3')
+		{
+			return false;
+		}
+		*optimization = static_cast<CompilerInput::Optimization>(CompilerInput::O0 + (str[1] - '0'));
+		return true;
+	}
+
+	// Expands {a,b,c} lists, e.g. "A={0,1}" -> "A=0", "A=1". Multiple lists in one define expand recursively
+	bool expand_define(const std::string_view d, DefineList* out, std::string* error)
+	{
+		const auto opening = d.find('{');
+		if (opening == std::string_view::npos)
+		{
+			out->emplace_back(d);
+			return true;
+		}
+
+		const auto closing = d.find('}', opening);
+		if (closing == std::string_view::npos)
+		{
+			// The entire line will fail which could cause multiple compiles to be missed
+			*error = "Missing '}' in define: " + std::string(d);
+			return false;
+		}
+
+		size_t current = opening + 1;
+		while (true)
+		{
+			size_t comma = d.find(',', current);
+			if (comma == std::string_view::npos || comma > closing)
+				comma = closing;
+
+			std::string new_define;
+			new_define.reserve(opening + (comma - current) + (d.size() - closing - 1));
+			new_define.append(d.substr(0, opening));
+			new_define.append(d.substr(current, comma - current));
+			new_define.append(d.substr(closing + 1));
+			// Continue expanding other {}
+			if (!expand_define(new_define, out, error))
+			{
+				return false;
+			}
+
+			current = comma + 1;
+			if (comma >= closing)
+				break;
+		}
+		return true;
+	}
+
+	bool parse_line(const Line& line, const CLIInput& input, const std::vector<DefineList>& global_defines,
+		CompilerInputVector* inputs, std::string* error, std::string* warning)
+	{
+		std::string_view values[static_cast<size_t>(Option::COUNT)]{};
+		boost::container::small_vector<std::string_view, 8> defines;
+
+		Tokenizer tokenizer(line.begin, line.end);
+		std::string_view token;
+		while (tokenizer.next(&token))
+		{
+			std::string_view value;
+			bool has_value;
+			const auto name = match_option(token, &value, &has_value);
+			if (!name)
+			{
+				*error = "Unknown argument: " + std::string(token);
+				return false;
+			}
+			if ((!has_value && !tokenizer.next(&value)) || value.empty())
+			{
+				*error = "Missing value for " + std::string(name->long_name);
+				return false;
+			}
+
+			if (name->option == Option::DEFINE)
+			{
+				defines.push_back(value);
+				continue;
+			}
+			auto& slot = values[static_cast<size_t>(name->option)];
+			if (!slot.empty())
+			{
+				*error = "Duplicate argument: " + std::string(name->long_name);
+				return false;
+			}
+			slot = value;
+		}
+
+		for (const auto option : { Option::PATH, Option::ENTRY_POINT, Option::SHADER_TYPE })
+		{
+			if (values[static_cast<size_t>(option)].empty())
+			{
+				*error = std::string(OPTIONS[static_cast<size_t>(option)].long_name) + ": required.";
+				return false;
+			}
+		}
+
+		qhenki::gfx::ShaderType shader_type;
+		if (const auto type = values[static_cast<size_t>(Option::SHADER_TYPE)]; !to_shader_type(type, &shader_type))
+		{
+			*error = "Unknown shader type: " + std::string(type);
+			return false;
+		}
+		auto optimization = input.optimization; // May be overridden by config
+		if (const auto level = values[static_cast<size_t>(Option::OPTIMIZATION)]; !level.empty()
+			&& !to_optimization(level, &optimization))
+		{
+			*error = "Invalid optimization: " + std::string(level) + " (expected O0, O1, O2 or O3)";
+			return false;
+		}
+		// Outputs, the manifest and shards are all keyed by the global output directory. Accepted for older configs
+		if (!values[static_cast<size_t>(Option::OUTPUT_DIR)].empty())
+		{
+			*warning = "--output-dir is ignored per line, outputs go to the output directory set on the command line";
+		}
+
+		const CompilerInput compiler_input
+		{
+			.path_and_defines = NonOwning{}, // Set per combination below
+			.pdb_path = input.pdb_dir,
+			.entry_point = std::string(values[static_cast<size_t>(Option::ENTRY_POINT)]),
+			.includes = input.include_paths,
+			.shader_model = input.shader_model,
+			.shader_type = shader_type,
+			.flags = input.debug_flag ? CompilerInput::ShaderFlags::DEBUG : CompilerInput::ShaderFlags::NONE,
+			.optimization = optimization,
+		};
+
+		boost::container::small_vector<DefineList, 8> line_defines(defines.size());
+		for (size_t i = 0; i < defines.size(); i++)
+		{
+			if (!expand_define(defines[i], &line_defines[i], error))
+			{
+				return false;
+			}
+		}
+
+		// Make compiler input for all combinations of defines, global defines first
+		const size_t list_count = global_defines.size() + line_defines.size();
+		auto get_list = [&](const size_t i) -> const DefineList&
+		{
+			return i < global_defines.size() ? global_defines[i] : line_defines[i - global_defines.size()];
+		};
+
+		size_t combination_count = 1;
+		for (size_t i = 0; i < list_count; i++)
+		{
+			combination_count *= get_list(i).size();
+		}
+		inputs->reserve(combination_count);
+
+		// The path and the defines of every combination are stored once per line, inputs only point into the storage
+		auto storage = mkS<std::vector<std::string>>();
+		storage->reserve(1 + combination_count * list_count);
+		storage->emplace_back(values[static_cast<size_t>(Option::PATH)]);
+		boost::container::small_vector<size_t, 8> indices(list_count, 0);
+		for (size_t c = 0; c < combination_count; c++)
+		{
+			for (size_t i = 0; i < list_count; i++)
+			{
+				storage->push_back(get_list(i)[indices[i]]);
+			}
+
+			// Odometer increment, last list changes fastest
+			for (size_t i = list_count; i-- > 0;)
+			{
+				if (++indices[i] < get_list(i).size())
+				{
+					break;
+				}
+				indices[i] = 0;
+			}
+		}
+
+		const std::string& path = storage->front();
+		for (size_t c = 0; c < combination_count; c++)
+		{
+			inputs->push_back(compiler_input);
+			inputs->back().path_and_defines.emplace<NonOwning>(NonOwning{ path, std::span(storage->data() + 1 + c * list_count, list_count) });
+		}
+		inputs->storage = std::move(storage);
+		return true;
+	}
+}
+
+bool ConfigParser::parse(const std::string_view text, const CLIInput& input,
+	tbb::concurrent_vector<CompilerInputVector>* compiler_inputs, std::vector<Error>* errors, std::vector<Error>* warnings)
+{
+	assert(compiler_inputs);
+	assert(errors);
+
+	// Split into job lines first so the output order matches the file regardless of scheduling
+	std::vector<Line> lines;
+	const char* p = text.data();
+	const char* const end = text.data() + text.size();
+	size_t number = 1;
+	while (p < end)
+	{
+		auto line_end = static_cast<const char*>(memchr(p, '\n', end - p));
+		if (!line_end)
+		{
+			line_end = end;
+		}
+
+		const char* first = p;
+		while (first < line_end && is_space(*first)) first++;
+		if (first < line_end && *first != '#')
+		{
+			lines.push_back({ first, line_end, number });
+		}
+
+		p = line_end + 1;
+		number++;
+	}
+
+	std::vector<DefineList> global_defines(input.global_defines.size());
+	for (size_t i = 0; i < input.global_defines.size(); i++)
+	{
+		std::string error;
+		if (!expand_define(input.global_defines[i], &global_defines[i], &error))
+		{
+			errors->push_back({ 0, std::move(error) });
+			return false;
+		}
+	}
+
+	if (lines.empty())
+	{
+		return true;
+	}
+
+	const auto first_output = compiler_inputs->grow_by(lines.size());
+	tbb::concurrent_vector<Error> parse_errors;
+	tbb::concurrent_vector<Error> parse_warnings;
+	tbb::parallel_for(tbb::blocked_range<size_t>(0, lines.size()), [&](const tbb::blocked_range<size_t>& range)
+	{
+		for (size_t i = range.begin(); i != range.end(); i++)
+		{
+			std::string error;
+			std::string warning;
+			if (!parse_line(lines[i], input, global_defines, &first_output[i], &error, &warning))
+			{
+				parse_errors.push_back({ lines[i].number, std::move(error) });
+			}
+			else if (!warning.empty())
+			{
+				parse_warnings.push_back({ lines[i].number, std::move(warning) });
+			}
+		}
+	});
+
+	const auto by_line = [](const Error& a, const Error& b) { return a.line < b.line; };
+	if (warnings)
+	{
+		warnings->assign(parse_warnings.begin(), parse_warnings.end());
+		std::ranges::sort(*warnings, by_line);
+	}
+	errors->assign(parse_errors.begin(), parse_errors.end());
+	std::ranges::sort(*errors, by_line);
+	return errors->empty();
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "compiler_job.h"
+
+namespace qhenki::sxc
+{
+	/**
+	 * @brief Parses SXC config text into compiler inputs.
+	 *
+	 * Tokens are views into the config text. Each line stores its path and the defines of all its permutations in one
+	 * block (CompilerInputVector::storage), its CompilerInputs only point into it.
+	 * Accepts the same options as the config format documented in the README, including "-p=path" and
+	 * "-p:path" forms. Blank lines and lines starting with '#' are ignored.
+	 */
+	class ConfigParser
+	{
+	public:
+		struct Error
+		{
+			size_t line; // 1-based
+			std::string message;
+		};
+
+		/**
+		 * @brief Parses all lines of a config in parallel.
+		 * @param text Config contents, e.g. a mapped file. Must stay alive for the duration of the call.
+		 * @param input Global settings every line starts from.
+		 * @param compiler_inputs (out) One entry per job line, appended in file order.
+		 * @param errors (out) Errors sorted by line number.
+		 * @param warnings (out, optional) Ignored options sorted by line number, the lines still parse.
+		 * @return Whether every line parsed.
+		 */
+		static bool parse(std::string_view text, const CLIInput& input,
+			tbb::concurrent_vector<CompilerInputVector>* compiler_inputs, std::vector<Error>* errors,
+			std::vector<Error>* warnings = nullptr);
+	};
+}
@@ -0,0 +1,123 @@
+#include "define_pruning.h"
+
+#include <cassert>
+#include <cstring>
+
+#undef min
+#undef max
+#include <tsl/robin_map.h>
+
+#include <qhenkiX/helper/mapped_file.h>
+
+using namespace qhenki::sxc;
+
+namespace
+{
+	bool is_identifier_start(const char c)
+	{
+		return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+	}
+
+	bool is_identifier_char(const char c)
+	{
+		return is_identifier_start(c) || (c >= '0' && c <= '9');
+	}
+
+	// Marks the names that appear as an identifier in data. Returns the number of names that are still unreferenced
+	size_t mark_identifiers(const char* data, const size_t size, const tsl::robin_map<std::string_view, size_t>& lookup,
+		std::vector<uint8_t>* referenced, size_t remaining)
+	{
+		size_t i = 0;
+		while (i < size && remaining > 0)
+		{
+			if (!is_identifier_start(data[i]))
+			{
+				// Skip the rest of numbers like 0x1F so their tail is not read as an identifier
+				if (data[i] >= '0' && data[i] <= '9')
+				{
+					while (i < size && is_identifier_char(data[i])) i++;
+				}
+				else
+				{
+					i++;
+				}
+				continue;
+			}
+			const size_t start = i;
+			while (i < size && is_identifier_char(data[i])) i++;
+			if (const auto it = lookup.find(std::string_view(data + start, i - start)); it != lookup.end()
+				&& !(*referenced)[it->second])
+			{
+				(*referenced)[it->second] = 1;
+				remaining--;
+			}
+		}
+		return remaining;
+	}
+}
+
+std::string_view qhenki::sxc::get_define_name(const std::string_view define)
+{
+	const auto equals = define.find('=');
+	return equals == std::string_view::npos ? define : define.substr(0, equals);
+}
+
+std::string_view qhenki::sxc::get_define_value(const std::string_view define)
+{
+	const auto equals = define.find('=');
+	return equals == std::string_view::npos ? std::string_view() : define.substr(equals + 1);
+}
+
+bool qhenki::sxc::find_referenced_defines(const std::span<const std::string> files, const std::span<const std::string_view> names,
+	const std::span<const std::string_view> values, std::vector<uint8_t>* referenced)
+{
+	assert(referenced);
+	referenced->assign(names.size(), 0);
+
+	tsl::robin_map<std::string_view, size_t> lookup;
+	lookup.reserve(names.size());
+	for (size_t i = 0; i < names.size(); i++)
+	{
+		lookup.insert({ names[i], i });
+	}
+	size_t remaining = lookup.size();
+
+	// The compiler substitutes values into the source, e.g. -d A=B references B wherever A is used
+	for (const auto& value : values)
+	{
+		remaining = mark_identifiers(value.data(), value.size(), lookup, referenced, remaining);
+	}
+
+	for (const auto& file : files)
+	{
+		util::MappedFile mapped;
+		if (!mapped.open(file.c_str()))
+		{
+			return false;
+		}
+		const auto data = static_cast<const char*>(mapped.data());
+		const size_t size = mapped.size();
+
+		// A name could be assembled from pieces, in which case it cannot be found by scanning
+		for (const char* p = data; size > 0 && (p = static_cast<const char*>(memchr(p, '#', data + size - p))); p++)
+		{
+			if (p + 1 < data + size && p[1] == '#')
+			{
+				return false;
+			}
+		}
+
+		remaining = mark_identifiers(data, size, lookup, referenced, remaining);
+		if (remaining == 0)
+		{
+			break;
+		}
+	}
+
+	// Names listed more than once share the result of their first occurrence
+	for (size_t i = 0; i < names.size(); i++)
+	{
+		(*referenced)[i] = (*referenced)[lookup.at(names[i])];
+	}
+	return true;
+}
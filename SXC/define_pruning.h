@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace qhenki::sxc
+{
+	// Name part of a define, e.g. "A" for "A=1"
+	std::string_view get_define_name(std::string_view define);
+	// Value part of a define, e.g. "1" for "A=1", empty if it has none
+	std::string_view get_define_value(std::string_view define);
+
+	/**
+	 * @brief Finds which define names appear as an identifier in any of the files.
+	 *
+	 * A define whose name never appears in a shader or its includes cannot change the compiler output.
+	 * The scan is conservative: names in comments or inactive branches count as referenced.
+	 * @param files Source and all of its transitive includes, e.g. from DependencyGraph::collect_dependencies.
+	 * @param names Define names to look for.
+	 * @param values Define values. The compiler substitutes them into the source, so names in them count as referenced.
+	 * @param referenced (out) One entry per name, non-zero if the name was found.
+	 * @return False if a file could not be read or uses token pasting (##), nothing may be pruned then.
+	 */
+	bool find_referenced_defines(std::span<const std::string> files, std::span<const std::string_view> names,
+		std::span<const std::string_view> values, std::vector<uint8_t>* referenced);
+}
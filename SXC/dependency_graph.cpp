@@ -0,0 +1,490 @@
+#include "dependency_graph.h"
+#include "compile_cache.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <mutex>
+
+#include <tsl/robin_set.h>
+
+#include <qhenkiX/helper/hash_helper.h>
+
+using namespace qhenki::sxc;
+
+namespace
+{
+	constexpr uint32_t DEPENDENCY_MAGIC = 0x44435853; // "SXCD"
+	constexpr uint32_t DEPENDENCY_VERSION = 2;
+	constexpr auto MISSING_TIME = std::numeric_limits<fs::file_time_type::rep>::min(); // Directory did not exist
+
+	bool is_space(const char c)
+	{
+		return c == ' ' || c == '\t' || c == '\r';
+	}
+
+	// Calls callback(name, angled) for every #include directive, with an empty name if the file is named through a
+	// macro. Does not evaluate conditionals, so the result is a superset of the real dependencies which is fine for
+	// up-to-date checks
+	template <typename Callback>
+	void find_includes(const char* data, const size_t size, Callback&& callback)
+	{
+		const char* p = data;
+		const char* const end = data + size;
+		while (p < end)
+		{
+			auto line_end = static_cast<const char*>(memchr(p, '\n', end - p));
+			if (!line_end)
+			{
+				line_end = end;
+			}
+
+			const char* c = p;
+			while (c < line_end && is_space(*c)) c++;
+			if (c < line_end && *c == '#')
+			{
+				c++;
+				while (c < line_end && is_space(*c)) c++;
+				constexpr std::string_view directive = "include";
+				if (static_cast<size_t>(line_end - c) > directive.size() && memcmp(c, directive.data(), directive.size()) == 0)
+				{
+					c += directive.size();
+					const char* const after_directive = c;
+					while (c < line_end && is_space(*c)) c++;
+					if (c < line_end && (*c == '"' || *c == '<'))
+					{
+						const bool angled = *c == '<';
+						const char close = angled ? '>' : '"';
+						const char* name_start = ++c;
+						while (c < line_end && *c != close) c++;
+						if (c < line_end && c > name_start)
+						{
+							callback(std::string_view(name_start, c - name_start), angled);
+						}
+					}
+					else if (c > after_directive && c < line_end && (isalpha(static_cast<unsigned char>(*c)) || *c == '_'))
+					{
+						callback(std::string_view(), false); // #include MACRO
+					}
+				}
+			}
+			p = line_end + 1;
+		}
+	}
+
+	template <typename T>
+	void append_pod(std::string& buffer, const T& value)
+	{
+		buffer.append(reinterpret_cast<const char*>(&value), sizeof(T));
+	}
+
+	void append_string(std::string& buffer, const std::string& str)
+	{
+		append_pod(buffer, static_cast<uint32_t>(str.size()));
+		buffer.append(str);
+	}
+
+	bool read_string(std::ifstream& in, std::string* str)
+	{
+		uint32_t length;
+		if (!in.read(reinterpret_cast<char*>(&length), sizeof(length)))
+		{
+			return false;
+		}
+		str->resize(length);
+		return static_cast<bool>(in.read(str->data(), length));
+	}
+
+	template <typename T>
+	bool read_pod(std::ifstream& in, T* value)
+	{
+		return static_cast<bool>(in.read(reinterpret_cast<char*>(value), sizeof(T)));
+	}
+}
+
+DependencyGraph::DependencyGraph(const std::span<const std::string> include_paths)
+	: m_include_paths(include_paths.begin(), include_paths.end())
+{
+	std::string joined;
+	for (const auto& include : m_include_paths)
+	{
+		joined += include;
+		joined.push_back('\0');
+	}
+	m_include_paths_hash = util::HashHelper::xxh64(joined);
+}
+
+std::string DependencyGraph::normalize(const fs::path& path)
+{
+	return path.lexically_normal().generic_string();
+}
+
+bool DependencyGraph::resolve_include(const fs::path& parent_dir, const std::string_view name, const bool angled,
+	std::string* resolved, std::vector<SearchedDirectory>* searched)
+{
+	auto try_path = [&](const fs::path& candidate)
+	{
+		// Creating or deleting a file updates the time of its directory. Recorded before probing, so a file created
+		// in between is noticed on the next build
+		const auto parent = candidate.parent_path();
+		auto directory = parent.empty() ? std::string(".") : normalize(parent);
+		if (std::ranges::none_of(*searched, [&](const SearchedDirectory& d) { return d.path == directory; }))
+		{
+			const auto mtime = get_directory_time(directory);
+			searched->push_back({ std::move(directory), mtime });
+		}
+
+		std::error_code ec;
+		if (fs::is_regular_file(candidate, ec))
+		{
+			*resolved = normalize(candidate);
+			return true;
+		}
+		return false;
+	};
+
+	// Same search order as the compilers, quoted includes look next to the including file first
+	if (!angled && try_path(parent_dir / name))
+	{
+		return true;
+	}
+	for (const auto& include_path : m_include_paths)
+	{
+		if (try_path(fs::path(include_path) / name))
+		{
+			return true;
+		}
+	}
+	return angled && try_path(parent_dir / name);
+}
+
+fs::file_time_type::rep DependencyGraph::get_directory_time(const std::string& directory)
+{
+	{
+		std::shared_lock lock(m_mutex);
+		if (const auto it = m_directory_times.find(directory); it != m_directory_times.end() && it->second.second == m_generation)
+		{
+			return it->second.first;
+		}
+	}
+
+	std::error_code ec;
+	const auto time = fs::last_write_time(directory, ec);
+	const auto mtime = ec ? MISSING_TIME : time.time_since_epoch().count();
+
+	std::unique_lock lock(m_mutex);
+	m_directory_times.insert_or_assign(directory, std::pair(mtime, m_generation));
+	return mtime;
+}
+
+bool DependencyGraph::is_resolution_current(const Node& node)
+{
+	return std::ranges::all_of(node.searched, [this](const SearchedDirectory& directory)
+	{
+		return get_directory_time(directory.path) == directory.mtime;
+	});
+}
+
+void DependencyGraph::scan(const std::string& path, Node* node)
+{
+	assert(node);
+	node->includes.clear();
+	node->searched.clear();
+	node->has_unresolved = false;
+
+	std::ifstream file(path, std::ios::binary | std::ios::ate);
+	if (!file)
+	{
+		node->exists = false;
+		return;
+	}
+	const auto size = file.tellg();
+	file.seekg(0, std::ios::beg);
+	std::string contents(static_cast<size_t>(size), '\0');
+	if (!file.read(contents.data(), size))
+	{
+		node->exists = false;
+		return;
+	}
+
+	node->size = contents.size();
+	node->content_hash = util::HashHelper::xxh64(contents);
+
+	const auto parent_dir = fs::path(path).parent_path();
+	find_includes(contents.data(), contents.size(), [&](const std::string_view name, const bool angled)
+	{
+		if (name.empty())
+		{
+			printf("Include through a macro is not followed (included from %s)\n", path.c_str());
+			node->has_unresolved = true;
+			return;
+		}
+		std::string resolved;
+		if (resolve_include(parent_dir, name, angled, &resolved, &node->searched))
+		{
+			if (std::ranges::find(node->includes, resolved) == node->includes.end())
+			{
+				node->includes.push_back(std::move(resolved));
+			}
+		}
+		else
+		{
+			printf("Include file not found: %.*s (included from %s)\n", static_cast<int>(name.size()), name.data(), path.c_str());
+			node->has_unresolved = true;
+		}
+	});
+}
+
+DependencyGraph::Node DependencyGraph::refresh(const std::string& path)
+{
+	{
+		std::shared_lock lock(m_mutex);
+		if (const auto it = m_nodes.find(path); it != m_nodes.end() && it->second.checked_generation == m_generation)
+		{
+			return it->second;
+		}
+	}
+
+	// Stat and scan outside of the lock. Two threads may race to scan the same file, both produce the same result
+	Node node;
+	std::error_code ec;
+	const auto time = fs::last_write_time(path, ec);
+	if (!ec)
+	{
+		node.exists = true;
+		node.mtime = time.time_since_epoch().count();
+
+		bool reused = false;
+		{
+			std::shared_lock lock(m_mutex);
+			// A missing include may have been created since, so nodes with unresolved includes are always rescanned
+			if (const auto it = m_nodes.find(path); it != m_nodes.end() && it->second.exists
+				&& it->second.mtime == node.mtime && !it->second.has_unresolved)
+			{
+				node = it->second;
+				reused = true;
+			}
+		}
+		// Unchanged contents may still resolve to other files, e.g. a new header earlier in the search order
+		if (reused && !is_resolution_current(node))
+		{
+			reused = false;
+		}
+		if (!reused)
+		{
+			scan(path, &node);
+		}
+	}
+	node.checked_generation = m_generation;
+
+	std::unique_lock lock(m_mutex);
+	m_nodes.insert_or_assign(path, node);
+	return node;
+}
+
+void DependencyGraph::invalidate()
+{
+	std::unique_lock lock(m_mutex);
+	m_generation++;
+}
+
+fs::file_time_type DependencyGraph::get_most_recent_time(const fs::path& file)
+{
+	auto latest = fs::file_time_type::min();
+
+	std::vector<std::string> stack{ normalize(file) };
+	tsl::robin_set<std::string> visited;
+	while (!stack.empty())
+	{
+		auto path = std::move(stack.back());
+		stack.pop_back();
+		if (!visited.insert(path).second)
+		{
+			continue; // Diamond or circular include
+		}
+
+		const auto node = refresh(path);
+		if (!node.exists)
+		{
+			printf("Include file not found: %s\n", path.c_str());
+			continue;
+		}
+		const auto time = fs::file_time_type(fs::file_time_type::duration(node.mtime));
+		if (time > latest)
+		{
+			latest = time;
+		}
+		stack.insert(stack.end(), node.includes.begin(), node.includes.end());
+	}
+	return latest;
+}
+
+void DependencyGraph::collect_dependencies(const fs::path& file, std::vector<std::string>* files, bool* complete)
+{
+	assert(files);
+	files->clear();
+	if (complete)
+	{
+		*complete = true;
+	}
+
+	std::vector<std::string> stack{ normalize(file) };
+	tsl::robin_set<std::string> visited;
+	while (!stack.empty())
+	{
+		auto path = std::move(stack.back());
+		stack.pop_back();
+		if (!visited.insert(path).second)
+		{
+			continue;
+		}
+
+		const auto node = refresh(path);
+		if (!node.exists)
+		{
+			continue;
+		}
+		if (complete && node.has_unresolved)
+		{
+			*complete = false;
+		}
+		stack.insert(stack.end(), node.includes.rbegin(), node.includes.rend());
+		files->push_back(std::move(path));
+	}
+}
+
+uint64_t DependencyGraph::get_content_hash(const fs::path& file)
+{
+	const auto node = refresh(normalize(file));
+	return node.exists ? node.content_hash : 0;
+}
+
+bool DependencyGraph::get_checked_file(const std::string& path, fs::file_time_type::rep* mtime, uint64_t* size) const
+{
+	assert(mtime && size);
+	std::shared_lock lock(m_mutex);
+	const auto it = m_nodes.find(path);
+	if (it == m_nodes.end() || it->second.checked_generation != m_generation || !it->second.exists)
+	{
+		return false;
+	}
+	*mtime = it->second.mtime;
+	*size = it->second.size;
+	return true;
+}
+
+bool DependencyGraph::get_searched_directory_time(const std::string& path, fs::file_time_type::rep* mtime, bool* exists) const
+{
+	assert(mtime && exists);
+	std::shared_lock lock(m_mutex);
+	const auto it = m_directory_times.find(path);
+	if (it == m_directory_times.end() || it->second.second != m_generation)
+	{
+		return false;
+	}
+	*mtime = it->second.first;
+	*exists = it->second.first != MISSING_TIME;
+	return true;
+}
+
+bool DependencyGraph::load(const fs::path& path)
+{
+	std::ifstream in(path, std::ios::binary);
+	if (!in)
+	{
+		return false;
+	}
+
+	uint32_t magic, version;
+	uint64_t include_paths_hash, count;
+	if (!read_pod(in, &magic) || !read_pod(in, &version) || !read_pod(in, &include_paths_hash) || !read_pod(in, &count)
+		|| magic != DEPENDENCY_MAGIC || version != DEPENDENCY_VERSION || include_paths_hash != m_include_paths_hash)
+	{
+		return false;
+	}
+
+	tsl::robin_map<std::string, Node> nodes;
+	nodes.reserve(count);
+	for (uint64_t i = 0; i < count; i++)
+	{
+		std::string file;
+		Node node;
+		uint32_t include_count;
+		if (!read_string(in, &file) || !read_pod(in, &node.mtime) || !read_pod(in, &node.size)
+			|| !read_pod(in, &node.content_hash) || !read_pod(in, &include_count))
+		{
+			return false;
+		}
+		node.includes.resize(include_count);
+		for (auto& include : node.includes)
+		{
+			if (!read_string(in, &include))
+			{
+				return false;
+			}
+		}
+		uint32_t searched_count;
+		if (!read_pod(in, &searched_count))
+		{
+			return false;
+		}
+		node.searched.resize(searched_count);
+		for (auto& directory : node.searched)
+		{
+			if (!read_string(in, &directory.path) || !read_pod(in, &directory.mtime))
+			{
+				return false;
+			}
+		}
+		node.exists = true;
+		node.checked_generation = 0; // Must be validated again
+		nodes.insert_or_assign(std::move(file), std::move(node));
+	}
+
+	std::unique_lock lock(m_mutex);
+	m_nodes = std::move(nodes);
+	return true;
+}
+
+bool DependencyGraph::save(const fs::path& path) const
+{
+	std::shared_lock lock(m_mutex);
+
+	// Missing files and files with unresolved includes are not persisted, they are always rescanned anyway
+	uint64_t count = 0;
+	for (const auto& [file, node] : m_nodes)
+	{
+		if (node.exists && !node.has_unresolved) count++;
+	}
+
+	std::string buffer;
+	append_pod(buffer, DEPENDENCY_MAGIC);
+	append_pod(buffer, DEPENDENCY_VERSION);
+	append_pod(buffer, m_include_paths_hash);
+	append_pod(buffer, count);
+	for (const auto& [file, node] : m_nodes)
+	{
+		if (!node.exists || node.has_unresolved) continue;
+		append_string(buffer, file);
+		append_pod(buffer, node.mtime);
+		append_pod(buffer, node.size);
+		append_pod(buffer, node.content_hash);
+		append_pod(buffer, static_cast<uint32_t>(node.includes.size()));
+		for (const auto& include : node.includes)
+		{
+			append_string(buffer, include);
+		}
+		append_pod(buffer, static_cast<uint32_t>(node.searched.size()));
+		for (const auto& directory : node.searched)
+		{
+			append_string(buffer, directory.path);
+			append_pod(buffer, directory.mtime);
+		}
+	}
+	// Shared between concurrent SXC processes through the cache directory
+	return write_file_atomic(path, buffer.data(), buffer.size());
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <filesystem>
+#include <shared_mutex>
+#include <span>
+#include <string>
+#include <utility>
+#include <vector>
+
+#undef min
+#undef max
+#include <tsl/robin_map.h>
+
+namespace qhenki::sxc
+{
+	namespace fs = std::filesystem;
+
+	/**
+	 * @brief Include dependency database shared by all compile threads and persisted between runs.
+	 *
+	 * Each file is stat'ed at most once per build and only rescanned for #include directives when its
+	 * modification time or that of a directory searched for its includes changed, e.g. because a new header now
+	 * shadows a resolved include. Up-to-date checks are then a walk over cached nodes.
+	 * Includes are resolved relative to the including file first, then through the -i include paths.
+	 */
+	class DependencyGraph
+	{
+		struct SearchedDirectory
+		{
+			std::string path;
+			fs::file_time_type::rep mtime; // Of the directory when it was searched
+		};
+		struct Node
+		{
+			fs::file_time_type::rep mtime = 0;
+			uint64_t size = 0;
+			uint64_t content_hash = 0;
+			std::vector<std::string> includes; // Resolved, normalized paths
+			std::vector<SearchedDirectory> searched; // Every directory probed while resolving includes
+			uint32_t checked_generation = 0; // Equal to m_generation once validated this build
+			bool exists = false;
+			bool has_unresolved = false; // Some include could not be found or names its file through a macro
+		};
+
+		mutable std::shared_mutex m_mutex;
+		tsl::robin_map<std::string, Node> m_nodes;
+		// Modification times of searched directories, stat'ed at most once per build. Second is the generation
+		tsl::robin_map<std::string, std::pair<fs::file_time_type::rep, uint32_t>> m_directory_times;
+		std::vector<std::string> m_include_paths;
+		uint64_t m_include_paths_hash = 0;
+		uint32_t m_generation = 1;
+
+		void scan(const std::string& path, Node* node);
+		bool resolve_include(const fs::path& parent_dir, std::string_view name, bool angled, std::string* resolved,
+		                     std::vector<SearchedDirectory>* searched);
+		fs::file_time_type::rep get_directory_time(const std::string& directory);
+		// Whether no file was added to or removed from the directories searched for the includes of node
+		bool is_resolution_current(const Node& node);
+		// Returns a copy of the validated node, rescanning the file if needed
+		Node refresh(const std::string& path);
+
+	public:
+		explicit DependencyGraph(std::span<const std::string> include_paths);
+
+		static std::string normalize(const fs::path& path);
+
+		std::span<const std::string> get_include_paths() const { return m_include_paths; }
+
+		// Loads a graph saved by a previous run. Fails if the file is missing or was built with different include paths
+		bool load(const fs::path& path);
+		bool save(const fs::path& path) const;
+
+		// Forces every file to be stat'ed again, e.g. before another build in the same process
+		void invalidate();
+
+		// Latest modification time of a file and everything it transitively includes
+		fs::file_time_type get_most_recent_time(const fs::path& file);
+
+		/**
+		 * @brief Collects a file and all of its transitive includes.
+		 * @param file Root source file.
+		 * @param files (out) Normalized paths, root first. Missing files are skipped.
+		 * @param complete (out, optional) False if a file has an include that could not be found or followed, so files
+		 * may be missing dependencies.
+		 */
+		void collect_dependencies(const fs::path& file, std::vector<std::string>* files, bool* complete = nullptr);
+
+		// Hash of the file contents as of the last scan, 0 if the file does not exist
+		uint64_t get_content_hash(const fs::path& file);
+
+		// Modification time and size of a normalized path as of its check this build. False if it was not checked or is missing
+		bool get_checked_file(const std::string& path, fs::file_time_type::rep* mtime, uint64_t* size) const;
+		// Modification time of a normalized directory as of when includes were searched in it this build. False if it was not searched
+		bool get_searched_directory_time(const std::string& path, fs::file_time_type::rep* mtime, bool* exists) const;
+	};
+}
@@ -0,0 +1,271 @@
+#include "file_watcher.h"
+
+#include <cassert>
+#include <cstdio>
+
+#include "dependency_graph.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+using namespace qhenki::sxc;
+
+void FileWatcher::push_changed(const fs::path& directory, const fs::path& name)
+{
+	{
+		std::scoped_lock lock(m_mutex);
+		m_changed.insert(DependencyGraph::normalize(directory / name));
+	}
+	m_condition.notify_all();
+}
+
+bool FileWatcher::wait(const std::chrono::milliseconds settle, std::vector<std::string>* changed)
+{
+	assert(changed);
+	changed->clear();
+
+	std::unique_lock lock(m_mutex);
+	m_condition.wait(lock, [this] { return m_stopping || !m_changed.empty(); });
+	while (!m_stopping)
+	{
+		const auto count = m_changed.size();
+		m_condition.wait_for(lock, settle, [this, count] { return m_stopping || m_changed.size() != count; });
+		if (m_changed.size() == count)
+		{
+			break;
+		}
+	}
+	if (m_stopping)
+	{
+		return false;
+	}
+
+	changed->assign(m_changed.begin(), m_changed.end());
+	m_changed.clear();
+	return true;
+}
+
+#ifdef _WIN32
+FileWatcher::FileWatcher()
+{
+	m_stop_event = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+}
+
+bool FileWatcher::add_directory(const fs::path& directory)
+{
+	const auto key = DependencyGraph::normalize(directory.empty() ? fs::path(".") : directory);
+	if (!m_watched.insert(key).second)
+	{
+		return true;
+	}
+
+	const HANDLE handle = CreateFileW(fs::path(key).c_str(), FILE_LIST_DIRECTORY,
+		FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING,
+		FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, nullptr);
+	if (handle == INVALID_HANDLE_VALUE)
+	{
+		printf("Failed to watch directory: %s\n", key.c_str());
+		m_watched.erase(key);
+		return false;
+	}
+
+	auto dir = mkU<Directory>();
+	dir->path = key;
+	dir->handle = handle;
+	dir->thread = std::thread([this, d = dir.get()]
+	{
+		// DWORD aligned as required by ReadDirectoryChangesW
+		alignas(DWORD) uint8_t buffer[16 * 1024];
+		OVERLAPPED overlapped{};
+		overlapped.hEvent = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+		const HANDLE events[] = { overlapped.hEvent, m_stop_event };
+		while (true)
+		{
+			ResetEvent(overlapped.hEvent);
+			if (!ReadDirectoryChangesW(d->handle, buffer, sizeof(buffer), FALSE,
+				FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_SIZE, nullptr, &overlapped, nullptr))
+			{
+				break;
+			}
+
+			DWORD bytes;
+			if (WaitForMultipleObjects(2, events, FALSE, INFINITE) != WAIT_OBJECT_0)
+			{
+				// Stopped, the buffer must stay alive until the cancelled read completes
+				CancelIoEx(d->handle, &overlapped);
+				GetOverlappedResult(d->handle, &overlapped, &bytes, TRUE);
+				break;
+			}
+			if (!GetOverlappedResult(d->handle, &overlapped, &bytes, FALSE))
+			{
+				break;
+			}
+			if (bytes == 0)
+			{
+				continue; // Buffer overflowed, changes were dropped
+			}
+
+			auto info = reinterpret_cast<const FILE_NOTIFY_INFORMATION*>(buffer);
+			while (true)
+			{
+				if (info->Action != FILE_ACTION_REMOVED && info->Action != FILE_ACTION_RENAMED_OLD_NAME)
+				{
+					push_changed(d->path, std::wstring(info->FileName, info->FileNameLength / sizeof(WCHAR)));
+				}
+				if (info->NextEntryOffset == 0)
+				{
+					break;
+				}
+				info = reinterpret_cast<const FILE_NOTIFY_INFORMATION*>(reinterpret_cast<const uint8_t*>(info) + info->NextEntryOffset);
+			}
+		}
+		CloseHandle(overlapped.hEvent);
+	});
+	m_directories.push_back(std::move(dir));
+	return true;
+}
+
+void FileWatcher::stop()
+{
+	{
+		std::scoped_lock lock(m_mutex);
+		if (m_stopping)
+		{
+			return;
+		}
+		m_stopping = true;
+	}
+	m_condition.notify_all();
+
+	SetEvent(m_stop_event);
+	for (auto& dir : m_directories)
+	{
+		if (dir->thread.joinable())
+		{
+			dir->thread.join();
+		}
+		CloseHandle(dir->handle);
+	}
+	m_directories.clear();
+	CloseHandle(m_stop_event);
+	m_stop_event = nullptr;
+}
+#else
+FileWatcher::FileWatcher()
+{
+	m_inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (m_inotify < 0)
+	{
+		printf("Failed to initialize inotify\n");
+		return;
+	}
+	m_thread = std::thread([this] { read_inotify(); });
+}
+
+bool FileWatcher::add_directory(const fs::path& directory)
+{
+	const auto key = DependencyGraph::normalize(directory.empty() ? fs::path(".") : directory);
+	if (m_inotify < 0 || !m_watched.insert(key).second)
+	{
+		return m_inotify >= 0;
+	}
+
+	// Editors that save by renaming a temporary file report IN_MOVED_TO instead of IN_CLOSE_WRITE.
+	// Names of a directory already watched, e.g. "." and its absolute path, return the same watch descriptor
+	const int watch = inotify_add_watch(m_inotify, key.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+	if (watch < 0)
+	{
+		printf("Failed to watch directory: %s\n", key.c_str());
+		m_watched.erase(key);
+		return false;
+	}
+
+	auto dir = mkU<Directory>();
+	dir->path = key;
+	dir->watch = watch;
+	std::scoped_lock lock(m_mutex);
+	m_directories.push_back(std::move(dir));
+	return true;
+}
+
+void FileWatcher::read_inotify()
+{
+	alignas(inotify_event) char buffer[16 * 1024];
+	while (true)
+	{
+		{
+			std::scoped_lock lock(m_mutex);
+			if (m_stopping) return;
+		}
+
+		pollfd fd{ m_inotify, POLLIN, 0 };
+		// Wake up periodically to notice stop
+		if (poll(&fd, 1, 100) <= 0)
+		{
+			continue;
+		}
+
+		const auto length = read(m_inotify, buffer, sizeof(buffer));
+		for (ssize_t offset = 0; offset < length;)
+		{
+			const auto event = reinterpret_cast<const inotify_event*>(buffer + offset);
+			offset += sizeof(inotify_event) + event->len;
+			if (event->len == 0)
+			{
+				continue;
+			}
+
+			// Reported under every name the directory was added with, so it matches paths however they were spelled
+			std::vector<fs::path> directories;
+			{
+				std::scoped_lock lock(m_mutex);
+				for (const auto& dir : m_directories)
+				{
+					if (dir->watch == event->wd)
+					{
+						directories.push_back(dir->path);
+					}
+				}
+			}
+			for (const auto& directory : directories)
+			{
+				push_changed(directory, event->name);
+			}
+		}
+	}
+}
+
+void FileWatcher::stop()
+{
+	{
+		std::scoped_lock lock(m_mutex);
+		if (m_stopping)
+		{
+			return;
+		}
+		m_stopping = true;
+	}
+	m_condition.notify_all();
+
+	if (m_thread.joinable())
+	{
+		m_thread.join();
+	}
+	if (m_inotify >= 0)
+	{
+		close(m_inotify);
+		m_inotify = -1;
+	}
+	m_directories.clear();
+}
+#endif
+
+FileWatcher::~FileWatcher()
+{
+	stop();
+}
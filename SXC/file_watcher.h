@@ -0,0 +1,78 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#undef min
+#undef max
+#include <tsl/robin_set.h>
+
+#include <smartpointer.h>
+
+namespace qhenki::sxc
+{
+	namespace fs = std::filesystem;
+
+	/**
+	 * @brief Reports files modified in a set of watched directories.
+	 *
+	 * Uses ReadDirectoryChangesW on Windows (one thread per directory) and inotify elsewhere.
+	 * Changed paths are reported as directory / file name normalized like DependencyGraph::normalize, once for every
+	 * name the directory was added with, e.g. both "a.hlsl" and "/abs/a.hlsl" if "." and "/abs" were added.
+	 */
+	class FileWatcher
+	{
+		struct Directory
+		{
+			fs::path path;
+#ifdef _WIN32
+			void* handle = nullptr; // HANDLE
+			std::thread thread;
+#else
+			int watch = -1;
+#endif
+		};
+
+		std::mutex m_mutex;
+		std::condition_variable m_condition;
+		tsl::robin_set<std::string> m_changed;
+		std::vector<uPtr<Directory>> m_directories;
+		tsl::robin_set<std::string> m_watched;
+		bool m_stopping = false;
+#ifdef _WIN32
+		void* m_stop_event = nullptr; // HANDLE
+#else
+		int m_inotify = -1;
+		std::thread m_thread;
+		void read_inotify();
+#endif
+
+		void push_changed(const fs::path& directory, const fs::path& name);
+
+	public:
+		FileWatcher();
+		~FileWatcher();
+
+		FileWatcher(const FileWatcher&) = delete;
+		FileWatcher& operator=(const FileWatcher&) = delete;
+
+		// Watches files directly inside a directory. Adding a directory twice is a no-op
+		bool add_directory(const fs::path& directory);
+
+		/**
+		 * @brief Blocks until a file changed, then keeps collecting until nothing changed for settle time.
+		 * Editors often save in several steps (truncate, write, rename), those are reported as one change.
+		 * @param settle Quiet period that ends the batch.
+		 * @param changed (out) Normalized paths of changed files.
+		 * @return False if the watcher was stopped.
+		 */
+		bool wait(std::chrono::milliseconds settle, std::vector<std::string>* changed);
+
+		void stop();
+	};
+}
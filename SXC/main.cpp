@@ -2,11 +2,82 @@
 #include <qhenkiX/RHI/shader_compiler.h>
 #include <magic_enum/magic_enum.hpp>
 #include <filesystem>
+#include "build_manifest.h"
+#include "build_trace.h"
 #include "compiler_job.h"
+#include "compile_cache.h"
+#include "compile_stats.h"
+#include "compiler_pool.h"
+#include "dependency_graph.h"
+#include "shard.h"
+#include "watch_mode.h"
 #include "graphics/d3d12/d3d12_shader_compiler.h"
 
+// SXC merge -out <dir> <shard>... combines the outputs of a sharded build
+int run_merge(int argc, char* argv[])
+{
+	argparse::ArgumentParser program("SXC merge", "0.1.0");
+	program.add_description("Combines the outputs of all shards of a build (--shard) into the final outputs.");
+	program.set_prefix_chars("-+/");
+	program.set_assign_chars("=:");
+
+	program.add_argument("shards")
+		.nargs(argparse::nargs_pattern::at_least_one)
+		.help("shard output directories or manifest files");
+
+	program.add_argument("-out", "--output")
+		.nargs(1)
+		.help("output directory")
+		.required();
+
+	program.add_argument("-cache", "--cache-dir")
+		.nargs(1)
+		.default_value(".sxc_cache")
+		.help("compile cache directory, merged outputs are recorded as up-to-date");
+
+	program.add_argument("-nc", "--no-cache")
+		.flag()
+		.help("do not record merged outputs in the cache");
+
+	program.add_argument("-z", "--compress")
+		.flag()
+		.help("LZ4 compress permutation archives");
+
+	try
+	{
+		program.parse_args(argc, argv);
+
+		const auto shard_names = program.get<std::vector<std::string>>("shards");
+		const std::vector<std::filesystem::path> shards(shard_names.begin(), shard_names.end());
+
+		std::optional<qhenki::sxc::CompileCache> cache;
+		if (!program.get<bool>("--no-cache"))
+		{
+			cache.emplace(program.get<std::string>("--cache-dir"));
+		}
+
+		const auto start = std::chrono::steady_clock::now();
+		const bool success = qhenki::sxc::merge_shards(shards, program.get<std::string>("--output"),
+			cache.has_value() ? &cache.value() : nullptr, program.get<bool>("--compress"));
+		const auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+		printf("========== Merge %s and took %.3f seconds ==========\n", success ? "completed" : "failed", ms / 1000.0);
+		return success ? 0 : 1;
+	}
+	catch (const std::exception& err)
+	{
+		fprintf(stderr, "%s\n", err.what());
+		fprintf(stderr, "%s", program.help().str().c_str());
+		return 1;
+	}
+}
+
 int main(int argc, char* argv[])
 {
+	if (argc > 1 && std::string_view(argv[1]) == "merge")
+	{
+		return run_merge(argc - 1, argv + 1);
+	}
+
 	argparse::ArgumentParser program("SXC", "0.1.0");
 	program.add_description("FXC/DXC batch shader compiler.");
 	program.set_prefix_chars("-+/");
@@ -37,6 +108,51 @@ int main(int argc, char* argv[])
 			.nargs(1)
 			.default_value("O3")
 			.help("default optimization level for shaders");
+
+		program.add_argument("-cache", "--cache-dir")
+			.nargs(1)
+			.default_value(".sxc_cache")
+			.help("compile cache directory, can be shared between builds and machines");
+
+		program.add_argument("-nc", "--no-cache")
+			.flag()
+			.help("always invoke the compiler");
+
+		program.add_argument("-np", "--no-prune")
+			.flag()
+			.help("compile every permutation even if it only differs in defines the shader does not reference");
+
+		program.add_argument("-nr", "--no-reflection")
+			.flag()
+			.help("do not write .refl reflection sidecars next to the outputs");
+
+		program.add_argument("-z", "--compress")
+			.flag()
+			.help("LZ4 compress permutation archives, permutations are decompressed individually on load");
+
+		program.add_argument("-w", "--watch")
+			.flag()
+			.help("keep running and rebuild shaders affected by file changes");
+
+		program.add_argument("--trace")
+			.nargs(1)
+			.help("write per stage timings as Chrome trace-event JSON");
+
+		program.add_argument("--trace-top")
+			.nargs(1)
+			.default_value(size_t{ 10 })
+			.scan<'u', size_t>()
+			.help("number of slowest permutations to print with --trace");
+
+		program.add_argument("--shard")
+			.nargs(1)
+			.help("compile only shard i of N [i/N] into the output directory, combine the shards with \"SXC merge\"");
+
+		program.add_argument("--memory-budget")
+			.nargs(1)
+			.default_value(256)
+			.scan<'i', int>()
+			.help("MiB of compiled output held in memory and queued for writing, the rest is spilled to disk");
 	}
 
 	std::string config_file_path;
@@ -68,6 +184,7 @@ int main(int argc, char* argv[])
 	try
 	{
 		program.parse_args(argc, argv);
+		const std::vector<std::string> args(argv + 1, argv + argc);
 
 		// Verify config file path
 		if (!std::filesystem::exists(config_file_path))
@@ -75,7 +192,8 @@ int main(int argc, char* argv[])
 			throw std::runtime_error("Config file does not exist: " + program.get<std::string>("--config-path"));
 		}
 
-		// Set working directory to config file location
+		// Set working directory to config file location. The config path itself must stay valid afterwards
+		config_file_path = std::filesystem::absolute(config_file_path).string();
 		const auto config_dir = std::filesystem::path(config_file_path).parent_path();
 		if (!config_dir.empty())
 		{
@@ -141,10 +259,58 @@ int main(int argc, char* argv[])
 			.debug_flag = program.get<bool>("--debug-flag")
 		};
 
+		qhenki::sxc::ShardSpec shard;
+		const auto shard_str = program.present<std::string>("--shard");
+		if (shard_str.has_value())
+		{
+			if (!qhenki::sxc::parse_shard_spec(shard_str.value(), &shard))
+			{
+				throw std::runtime_error("Invalid shard, expected i/N with 1 <= i <= N: " + shard_str.value());
+			}
+			if (program.get<bool>("--watch"))
+			{
+				throw std::runtime_error("--shard cannot be combined with --watch");
+			}
+		}
+
 		const auto start = std::chrono::steady_clock::now();
+
+		// If nothing changed since the last successful build, exit before parsing the config or creating compilers
+		const bool use_manifest = !program.get<bool>("--no-cache") && !shard_str.has_value() && !program.get<bool>("--watch");
+		std::filesystem::path manifest_path;
+		qhenki::util::Hash128 settings_key;
+		if (use_manifest)
+		{
+			manifest_path = std::filesystem::path(program.get<std::string>("--cache-dir")) / "manifest.bin";
+			settings_key = qhenki::sxc::BuildManifest::make_settings_key(args, input.config_path);
+			uint64_t permutation_count;
+			if (qhenki::sxc::BuildManifest::is_up_to_date(manifest_path, settings_key, &permutation_count))
+			{
+				const auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+				printf("========== Build: 0 succeeded, 0 failed, %llu up-to-date ==========\n",
+					static_cast<unsigned long long>(permutation_count));
+				printf("========== Build completed and took %.3f seconds ==========\n", ms / 1000.0);
+				return 0;
+			}
+			// An interrupted build must not leave the previous manifest behind
+			std::error_code ec;
+			std::filesystem::remove(manifest_path, ec);
+		}
+
+		const auto trace_path = program.present<std::string>("--trace");
+		std::optional<qhenki::sxc::BuildTrace> trace;
+		if (trace_path.has_value())
+		{
+			trace.emplace();
+		}
+		const auto trace_ptr = trace.has_value() ? &trace.value() : nullptr;
 		
 		tbb::concurrent_vector<qhenki::sxc::CompilerInputVector> inputs;
-		const auto num_lines = qhenki::sxc::SXCJob::parse_config(input, &inputs);
+		int num_lines;
+		{
+			qhenki::sxc::TraceScope scope(trace_ptr, "config parse", input.config_path);
+			num_lines = qhenki::sxc::SXCJob::parse_config(input, &inputs);
+		}
 		if (num_lines < 0)
 		{
 			fprintf(stderr, "Failed to parse config file: %s\n", input.config_path.c_str());
@@ -156,19 +322,141 @@ int main(int argc, char* argv[])
 		qhenki::gfx::D3D12ShaderCompiler::get_dll_path(buffer1.data(), buffer2.data(), buffer_length);
 		printf("Using shader compiler DLLs:\nFXC: %s\nDXC: %s\n", buffer1.data(), buffer2.data());
 
-		const auto result_count = qhenki::sxc::execute_compilation_job(&inputs, input.output_dir);
+		std::optional<qhenki::sxc::CompileCache> cache;
+		if (!program.get<bool>("--no-cache"))
+		{
+			cache.emplace(program.get<std::string>("--cache-dir"));
+		}
+
+		// Include graph is persisted next to the cache so unchanged headers are not rescanned
+		qhenki::sxc::DependencyGraph dependencies(input.include_paths);
+		std::filesystem::path dependency_path;
+		if (cache.has_value())
+		{
+			dependency_path = cache->get_directory() / "dependencies.bin";
+			dependencies.load(dependency_path);
+		}
+
+		// Compile times of previous runs, used to schedule the slowest permutations first
+		qhenki::sxc::CompileStats stats;
+		std::filesystem::path stats_path;
+		if (cache.has_value())
+		{
+			stats_path = cache->get_directory() / "stats.bin";
+			stats.load(stats_path);
+		}
+
+		qhenki::sxc::CompilerPool compilers;
+		qhenki::sxc::BuildManifest manifest;
+
+		qhenki::sxc::ShardWriter shard_writer;
+		if (shard_str.has_value() && !shard_writer.open(input.output_dir, shard))
+		{
+			fprintf(stderr, "Failed to create shard output in: %s\n", input.output_dir.c_str());
+			return 1;
+		}
+
+		qhenki::sxc::JobSettings settings
+		{
+			.output_dir = input.output_dir,
+			.cache = cache.has_value() ? &cache.value() : nullptr,
+			.dependencies = &dependencies,
+			.stats = cache.has_value() ? &stats : nullptr,
+			.trace = trace_ptr,
+			.compilers = &compilers,
+			.manifest = use_manifest ? &manifest : nullptr,
+			.prune_defines = !program.get<bool>("--no-prune"),
+			.reflection = !program.get<bool>("--no-reflection"),
+			.compress = program.get<bool>("--compress"),
+			.output_budget = static_cast<uint64_t>(std::max(1, program.get<int>("--memory-budget"))) << 20,
+			.shard = shard_str.has_value() ? &shard : nullptr,
+			.shard_writer = shard_str.has_value() ? &shard_writer : nullptr,
+		};
+		auto result_count = qhenki::sxc::execute_compilation_job(&inputs, settings);
+		if (shard_str.has_value() && !shard_writer.finalize())
+		{
+			fprintf(stderr, "Failed to write shard manifest in: %s\n", input.output_dir.c_str());
+			result_count.failed_count += result_count.succeeded_count;
+			result_count.succeeded_count = 0;
+		}
+
+		auto save_build_state = [&]
+		{
+			if (!dependency_path.empty() && !dependencies.save(dependency_path))
+			{
+				fprintf(stderr, "Failed to save include dependencies: %s\n", dependency_path.string().c_str());
+			}
+			if (!stats_path.empty() && !stats.save(stats_path))
+			{
+				fprintf(stderr, "Failed to save compile stats: %s\n", stats_path.string().c_str());
+			}
+		};
+		save_build_state();
+
+		// The config key is taken again, a config edited during the build would otherwise be recorded as built
+		if (use_manifest && result_count.failed_count == 0
+			&& qhenki::sxc::BuildManifest::make_settings_key(args, input.config_path) == settings_key)
+		{
+			std::vector<std::filesystem::path> extra_inputs{ input.config_path };
+			for (const auto dll : { buffer1.data(), buffer2.data() })
+			{
+				if (dll[0] != '\0')
+				{
+					extra_inputs.emplace_back(dll);
+				}
+			}
+			const auto permutation_count = result_count.succeeded_count + result_count.skipped_count;
+			if (!manifest.save(manifest_path, settings_key, &dependencies, extra_inputs, permutation_count))
+			{
+				fprintf(stderr, "Failed to save build manifest: %s\n", manifest_path.string().c_str());
+			}
+		}
 
 		const auto end = std::chrono::steady_clock::now();
 
 		printf("========== Build: %llu succeeded, %llu failed, %llu up-to-date ==========\n",
 			   result_count.succeeded_count, result_count.failed_count, result_count.skipped_count);
+		if (result_count.pruned_count > 0)
+		{
+			printf("========== %llu permutations reused the output of an equivalent permutation ==========\n", result_count.pruned_count);
+		}
+		if (result_count.spilled_bytes > 0)
+		{
+			printf("========== %.2f MB of output exceeded the memory budget and was spilled to disk ==========\n",
+				result_count.spilled_bytes / 1e6);
+		}
+		if (result_count.archive_compressed_bytes > 0)
+		{
+			// Decode throughput is measured on the uncompressed size, i.e. bytecode produced per second
+			const double ratio = static_cast<double>(result_count.archive_uncompressed_bytes) / result_count.archive_compressed_bytes;
+			const double decode_mbps = result_count.archive_decode_us > 0
+				? result_count.archive_uncompressed_bytes / static_cast<double>(result_count.archive_decode_us) : 0.0;
+			printf("========== Archives compressed %.2f MB -> %.2f MB (%.2fx), decode %.0f MB/s ==========\n",
+				result_count.archive_uncompressed_bytes / 1e6, result_count.archive_compressed_bytes / 1e6, ratio, decode_mbps);
+		}
 
 		// Print duration in seconds with milliseconds
 		auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
 		double seconds = ms / 1000.0;
 
+		if (trace.has_value())
+		{
+			trace->print_summary("compile", program.get<size_t>("--trace-top"));
+			if (!trace->write_json(trace_path.value()))
+			{
+				fprintf(stderr, "Failed to write trace: %s\n", trace_path.value().c_str());
+			}
+		}
+
 		printf("========== Build completed and took %.3f seconds ==========\n", seconds);
 
+		if (program.get<bool>("--watch"))
+		{
+			// Rebuilds are not traced, the trace covers the initial build only
+			settings.trace = nullptr;
+			return qhenki::sxc::run_watch_mode(input, settings, &inputs, save_build_state);
+		}
+
 		return 0;
 	}
 	catch (const std::exception& err)
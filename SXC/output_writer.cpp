@@ -0,0 +1,139 @@
+#include "output_writer.h"
+#include "build_trace.h"
+#include "compile_cache.h"
+
+#include <algorithm>
+#include <cassert>
+
+using namespace qhenki::sxc;
+
+OutputWriter::OutputWriter(const uint64_t budget, BuildTrace* trace) : m_budget(budget), m_trace(trace)
+{
+	m_thread = std::thread(&OutputWriter::run, this);
+}
+
+OutputWriter::~OutputWriter()
+{
+	{
+		std::lock_guard lock(m_mutex);
+		m_stopping = true;
+	}
+	m_condition.notify_all();
+	m_thread.join();
+}
+
+void OutputWriter::submit(std::vector<OutputFile> files, std::function<void(bool)> on_written)
+{
+	uint64_t size = 0;
+	for (const auto& file : files)
+	{
+		size += file.data.size();
+	}
+
+	std::unique_lock lock(m_mutex);
+	assert(!m_stopping);
+	m_condition.wait(lock, [&] { return m_in_flight == 0 || m_in_flight + size <= m_budget; });
+	m_in_flight += size;
+	m_peak_in_flight = std::max(m_peak_in_flight, m_in_flight);
+	m_queue.push_back(
+	{
+		.files = std::move(files),
+		.on_written = std::move(on_written),
+		.size = size,
+	});
+	lock.unlock();
+	m_condition.notify_all();
+}
+
+void OutputWriter::flush()
+{
+	std::unique_lock lock(m_mutex);
+	m_condition.wait(lock, [this] { return m_queue.empty() && !m_writing; });
+}
+
+void OutputWriter::run()
+{
+	std::vector<Job> batch;
+	while (true)
+	{
+		{
+			std::unique_lock lock(m_mutex);
+			m_condition.wait(lock, [this] { return !m_queue.empty() || m_stopping; });
+			if (m_queue.empty())
+			{
+				return;
+			}
+			batch.swap(m_queue);
+			m_writing = true;
+			m_batch_count++;
+		}
+
+		write_batch(&batch);
+		batch.clear();
+
+		{
+			std::lock_guard lock(m_mutex);
+			m_writing = false;
+		}
+		m_condition.notify_all();
+	}
+}
+
+void OutputWriter::write_batch(std::vector<Job>* batch)
+{
+	size_t file_count = 0;
+	for (const auto& job : *batch)
+	{
+		file_count += job.files.size();
+	}
+	TraceScope scope(m_trace, "write", m_trace ? std::to_string(file_count) + " files" : std::string{});
+
+	// Data is released right after its temporary file is written so blocked submitters can continue early
+	std::vector<std::vector<fs::path>> temp_paths(batch->size());
+	std::vector<uint8_t> staged(batch->size(), 1);
+	for (size_t j = 0; j < batch->size(); j++)
+	{
+		auto& job = (*batch)[j];
+		for (auto& file : job.files)
+		{
+			fs::path temp_path;
+			if (staged[j] && write_temp_file(file.path, file.data.data(), file.data.size(), &temp_path))
+			{
+				temp_paths[j].push_back(std::move(temp_path));
+			}
+			else
+			{
+				staged[j] = 0;
+			}
+			std::vector<uint8_t>().swap(file.data);
+		}
+		{
+			std::lock_guard lock(m_mutex);
+			m_in_flight -= job.size;
+		}
+		m_condition.notify_all();
+	}
+
+	for (size_t j = 0; j < batch->size(); j++)
+	{
+		auto& job = (*batch)[j];
+		bool written = staged[j];
+		std::error_code ec;
+		for (size_t f = 0; f < temp_paths[j].size(); f++)
+		{
+			if (written)
+			{
+				fs::rename(temp_paths[j][f], job.files[f].path, ec);
+				written = !ec;
+			}
+			if (!written)
+			{
+				fs::remove(temp_paths[j][f], ec);
+			}
+		}
+		if (job.on_written)
+		{
+			job.on_written(written);
+		}
+	}
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace qhenki::sxc
+{
+	namespace fs = std::filesystem;
+
+	class BuildTrace;
+
+	struct OutputFile
+	{
+		fs::path path;
+		std::vector<uint8_t> data;
+	};
+
+	/**
+	 * @brief Writes build outputs on a background thread so compile threads never wait on the disk.
+	 *
+	 * Submitted bytes are bounded by a budget: submit blocks while the queue holds more than that, so memory
+	 * stays flat however many outputs a build produces. The writer drains everything queued at once and writes
+	 * the batch in two passes, all temporary files first and then all renames. The files of one submission are
+	 * only renamed into place if all of them were written, and a crash leaves at most stray temporary files.
+	 */
+	class OutputWriter
+	{
+		struct Job
+		{
+			std::vector<OutputFile> files;
+			std::function<void(bool)> on_written;
+			uint64_t size;
+		};
+
+		std::mutex m_mutex;
+		std::condition_variable m_condition;
+		std::vector<Job> m_queue;
+		uint64_t m_budget;
+		BuildTrace* m_trace;
+		uint64_t m_in_flight = 0; // Bytes submitted but not yet written
+		uint64_t m_peak_in_flight = 0;
+		uint64_t m_batch_count = 0;
+		bool m_writing = false;
+		bool m_stopping = false;
+		std::thread m_thread;
+
+		void run();
+		void write_batch(std::vector<Job>* batch);
+
+	public:
+		// Each batch is recorded as a "write" event on trace, if not nullptr
+		explicit OutputWriter(uint64_t budget, BuildTrace* trace = nullptr);
+		~OutputWriter();
+
+		OutputWriter(const OutputWriter&) = delete;
+		OutputWriter& operator=(const OutputWriter&) = delete;
+
+		/**
+		 * @brief Queues files that are renamed into place together. Blocks while the budget is exceeded,
+		 * a submission larger than the whole budget waits for an empty queue.
+		 * @param files Files to write, the data is released as soon as it is on disk.
+		 * @param on_written Optional, called on the writer thread with whether every file was written.
+		 */
+		void submit(std::vector<OutputFile> files, std::function<void(bool)> on_written = {});
+
+		// Blocks until every submitted file is written and its callback returned
+		void flush();
+
+		// Valid after flush
+		uint64_t get_peak_in_flight() const { return m_peak_in_flight; }
+		uint64_t get_batch_count() const { return m_batch_count; }
+	};
+}
@@ -0,0 +1,305 @@
+#include "permutation_archive.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+#undef min
+#undef max
+#include <tsl/robin_map.h>
+
+using namespace qhenki::sxc;
+using namespace qhenki::util;
+
+static uint64_t align_up(const uint64_t value, const uint64_t alignment)
+{
+	return (value + alignment - 1) & ~(alignment - 1);
+}
+
+namespace
+{
+	constexpr size_t DICTIONARY_SAMPLE_COUNT = 256;
+	constexpr size_t DICTIONARY_SEGMENT_SIZE = 32;
+	constexpr size_t DICTIONARY_SEGMENT_STEP = 8;
+	constexpr size_t DICTIONARY_MIN_SIZE = 256; // Smaller dictionaries are not worth storing
+
+	/*
+	 * Collects byte ranges that recur across blobs, e.g. container headers, root signatures and shared code.
+	 * Segments are counted once per blob that contains them. Segments found in at least two blobs are scored
+	 * by that count in the blob they were first seen in, and the best scoring runs fill the dictionary.
+	 */
+	std::vector<uint8_t> train_dictionary(const std::span<const std::span<const uint8_t>> blobs)
+	{
+		const size_t stride = std::max<size_t>(1, blobs.size() / DICTIONARY_SAMPLE_COUNT);
+		std::vector<std::span<const uint8_t>> samples;
+		for (size_t i = 0; i < blobs.size() && samples.size() < DICTIONARY_SAMPLE_COUNT; i += stride)
+		{
+			samples.push_back(blobs[i]);
+		}
+		if (samples.size() < 2)
+		{
+			return {};
+		}
+
+		struct Segment
+		{
+			uint32_t count;
+			uint32_t last_sample;
+			uint32_t sample;
+			uint32_t offset;
+		};
+		tsl::robin_map<uint64_t, Segment> segments;
+		for (uint32_t s = 0; s < samples.size(); s++)
+		{
+			const auto& sample = samples[s];
+			for (size_t offset = 0; offset + DICTIONARY_SEGMENT_SIZE <= sample.size(); offset += DICTIONARY_SEGMENT_STEP)
+			{
+				const auto hash = HashHelper::xxh64(sample.data() + offset, DICTIONARY_SEGMENT_SIZE, 0);
+				const auto [it, inserted] = segments.try_emplace(hash, Segment{ 1, s, s, static_cast<uint32_t>(offset) });
+				if (!inserted && it->second.last_sample != s)
+				{
+					it.value().count++;
+					it.value().last_sample = s;
+				}
+			}
+		}
+
+		std::vector<std::vector<uint32_t>> coverage(samples.size());
+		for (const auto& [hash, segment] : segments)
+		{
+			if (segment.count < 2)
+			{
+				continue;
+			}
+			auto& scores = coverage[segment.sample];
+			scores.resize(samples[segment.sample].size(), 0);
+			for (size_t i = segment.offset; i < segment.offset + DICTIONARY_SEGMENT_SIZE; i++)
+			{
+				scores[i] = std::max(scores[i], segment.count);
+			}
+		}
+
+		struct Run
+		{
+			uint64_t score;
+			uint32_t sample;
+			uint32_t offset;
+			uint32_t size;
+		};
+		std::vector<Run> runs;
+		for (uint32_t s = 0; s < coverage.size(); s++)
+		{
+			const auto& scores = coverage[s];
+			for (size_t i = 0; i < scores.size();)
+			{
+				if (!scores[i])
+				{
+					i++;
+					continue;
+				}
+				Run run{ 0, s, static_cast<uint32_t>(i), 0 };
+				for (; i < scores.size() && scores[i]; i++)
+				{
+					run.score += scores[i];
+					run.size++;
+				}
+				runs.push_back(run);
+			}
+		}
+		std::ranges::sort(runs, [](const Run& a, const Run& b)
+		{
+			if (a.score != b.score) return a.score > b.score;
+			if (a.sample != b.sample) return a.sample < b.sample;
+			return a.offset < b.offset;
+		});
+
+		// Best runs go last, closest to the data
+		std::vector<const Run*> selected;
+		size_t size = 0;
+		for (const auto& run : runs)
+		{
+			if (size + run.size > CompressionHelper::LZ4_MAX_DICTIONARY_SIZE)
+			{
+				continue;
+			}
+			selected.push_back(&run);
+			size += run.size;
+		}
+		if (size < DICTIONARY_MIN_SIZE)
+		{
+			return {};
+		}
+		std::vector<uint8_t> dictionary;
+		dictionary.reserve(size);
+		for (auto it = selected.rbegin(); it != selected.rend(); ++it)
+		{
+			const auto data = samples[(*it)->sample].data() + (*it)->offset;
+			dictionary.insert(dictionary.end(), data, data + (*it)->size);
+		}
+		return dictionary;
+	}
+}
+
+void PermutationArchiveWriter::add(const std::span<const std::string> defines, const void* data, const size_t size)
+{
+	add(ShaderArchive::make_key(defines), data, size);
+}
+
+void PermutationArchiveWriter::add(const uint64_t key, const void* data, const size_t size)
+{
+	assert(data || size == 0);
+	m_permutations.push_back(
+	{
+		.key = key,
+		.data = data,
+		.size = size,
+	});
+}
+
+bool PermutationArchiveWriter::finalize(std::vector<uint8_t>* out, std::string* error)
+{
+	assert(out);
+	assert(error);
+	m_deduplicated_count = 0;
+
+	std::ranges::sort(m_permutations, [](const Permutation& a, const Permutation& b) { return a.key < b.key; });
+	if (const auto it = std::ranges::adjacent_find(m_permutations,
+		[](const Permutation& a, const Permutation& b) { return a.key == b.key; }); it != m_permutations.end())
+	{
+		// Either a hash collision or the same define set was listed twice
+		*error = "Duplicate permutation key in archive";
+		return false;
+	}
+
+	// Identical bytecode is stored once, e.g. permutations that only differ in defines the shader ignores
+	tsl::robin_map<uint64_t, size_t> blob_by_hash; // Content hash -> first permutation with that blob
+	std::vector<size_t> blob_of(m_permutations.size()); // Permutation whose blob is stored for this one
+	std::vector<std::span<const uint8_t>> unique_blobs;
+	for (size_t i = 0; i < m_permutations.size(); i++)
+	{
+		const auto& p = m_permutations[i];
+		if (p.size > UINT32_MAX)
+		{
+			*error = "Permutation blob too large for archive";
+			return false;
+		}
+
+		blob_of[i] = i;
+		const auto hash = HashHelper::xxh64(p.data, p.size, p.size);
+		if (const auto it = blob_by_hash.find(hash); it != blob_by_hash.end())
+		{
+			const auto& other = m_permutations[it->second];
+			if (other.size == p.size && (other.data == p.data || memcmp(other.data, p.data, p.size) == 0))
+			{
+				blob_of[i] = it->second;
+				m_deduplicated_count++;
+				continue;
+			}
+		}
+		else
+		{
+			blob_by_hash.insert({ hash, i });
+		}
+		unique_blobs.push_back({ static_cast<const uint8_t*>(p.data), p.size });
+	}
+
+	// Blobs that do not shrink are stored as is
+	std::vector<uint8_t> dictionary;
+	std::vector<std::vector<uint8_t>> compressed(m_compress ? m_permutations.size() : 0);
+	if (m_compress)
+	{
+		dictionary = train_dictionary(unique_blobs);
+		for (size_t i = 0; i < m_permutations.size(); i++)
+		{
+			const auto& p = m_permutations[i];
+			if (blob_of[i] != i || p.size == 0)
+			{
+				continue;
+			}
+			auto& blob = compressed[i];
+			blob.resize(CompressionHelper::lz4_compress_bound(p.size));
+			const auto size = CompressionHelper::lz4_compress(p.data, p.size, blob.data(), blob.size(), dictionary);
+			if (size == 0 || size >= p.size)
+			{
+				blob.clear();
+				continue;
+			}
+			blob.resize(size);
+		}
+	}
+
+	const uint64_t entry_offset = sizeof(ShaderArchiveHeader) + (m_compress ? sizeof(ShaderArchiveDictionary) : 0);
+	const uint64_t dictionary_offset = align_up(entry_offset + m_permutations.size() * sizeof(ShaderArchiveEntry), SHADER_ARCHIVE_ALIGNMENT);
+	uint64_t blob_offset = align_up(dictionary_offset + dictionary.size(), SHADER_ARCHIVE_ALIGNMENT);
+	m_uncompressed_size = 0;
+	m_compressed_size = dictionary.size();
+
+	std::vector<ShaderArchiveEntry> entries;
+	entries.reserve(m_permutations.size());
+	for (size_t i = 0; i < m_permutations.size(); i++)
+	{
+		const auto& p = m_permutations[i];
+		if (blob_of[i] != i)
+		{
+			auto entry = entries[blob_of[i]];
+			entry.key = p.key;
+			entries.push_back(entry);
+			continue;
+		}
+
+		const bool is_compressed = m_compress && !compressed[i].empty();
+		const size_t stored_size = is_compressed ? compressed[i].size() : p.size;
+		entries.push_back(
+		{
+			.key = p.key,
+			.offset = blob_offset,
+			.size = static_cast<uint32_t>(stored_size),
+			.uncompressed_size = is_compressed ? static_cast<uint32_t>(p.size) : 0,
+		});
+		blob_offset = align_up(blob_offset + stored_size, SHADER_ARCHIVE_ALIGNMENT);
+		m_uncompressed_size += p.size;
+		m_compressed_size += stored_size;
+	}
+
+	const ShaderArchiveHeader header
+	{
+		.magic = SHADER_ARCHIVE_MAGIC,
+		.version = SHADER_ARCHIVE_VERSION,
+		.flags = m_compress ? SHADER_ARCHIVE_FLAG_LZ4 : uint16_t{ 0 },
+		.entry_count = static_cast<uint32_t>(entries.size()),
+		.entry_offset = static_cast<uint32_t>(entry_offset),
+		.file_size = blob_offset,
+	};
+
+	// Zero fill so padding is deterministic
+	out->assign(blob_offset, 0);
+	memcpy(out->data(), &header, sizeof(header));
+	if (m_compress)
+	{
+		const ShaderArchiveDictionary dictionary_desc
+		{
+			.offset = dictionary_offset,
+			.size = static_cast<uint32_t>(dictionary.size()),
+			.reserved = 0,
+		};
+		memcpy(out->data() + sizeof(header), &dictionary_desc, sizeof(dictionary_desc));
+		if (!dictionary.empty())
+		{
+			memcpy(out->data() + dictionary_offset, dictionary.data(), dictionary.size());
+		}
+	}
+	memcpy(out->data() + entry_offset, entries.data(), entries.size() * sizeof(ShaderArchiveEntry));
+	for (size_t i = 0; i < entries.size(); i++)
+	{
+		if (blob_of[i] != i)
+		{
+			continue;
+		}
+		const void* data = entries[i].uncompressed_size ? compressed[i].data() : m_permutations[i].data;
+		if (entries[i].size > 0)
+		{
+			memcpy(out->data() + entries[i].offset, data, entries[i].size);
+		}
+	}
+	return true;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <string>
+#include <vector>
+
+#include <qhenkiX/utility/shader_archive.h>
+
+namespace qhenki::sxc
+{
+	// Builds a permutation archive in memory, see qhenkiX/utility/shader_archive.h for the layout
+	class PermutationArchiveWriter
+	{
+		struct Permutation
+		{
+			uint64_t key;
+			const void* data;
+			size_t size;
+		};
+		std::vector<Permutation> m_permutations;
+		size_t m_deduplicated_count = 0;
+		bool m_compress = false;
+		uint64_t m_uncompressed_size = 0;
+		uint64_t m_compressed_size = 0;
+
+	public:
+		void reserve(size_t count) { m_permutations.reserve(count); }
+
+		// LZ4 compresses every blob against a dictionary trained on the blobs of this archive
+		void set_compression(bool compress) { m_compress = compress; }
+
+		// Data must stay alive until finalize
+		void add(std::span<const std::string> defines, const void* data, size_t size);
+		void add(uint64_t key, const void* data, size_t size);
+
+		/**
+		 * @brief Sorts the permutations and serializes the archive. Identical blobs are stored once.
+		 * @param out (out) Archive bytes.
+		 * @param error (out) Reason for failure, e.g. two define sets hashing to the same key.
+		 * @return Whether the archive was built.
+		 */
+		bool finalize(std::vector<uint8_t>* out, std::string* error);
+
+		// Permutations that share the blob of another permutation, valid after finalize
+		size_t get_deduplicated_count() const { return m_deduplicated_count; }
+
+		// Bytes of the unique blobs before and after compression including the dictionary, valid after finalize
+		uint64_t get_uncompressed_size() const { return m_uncompressed_size; }
+		uint64_t get_compressed_size() const { return m_compressed_size; }
+	};
+}
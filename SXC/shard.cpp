@@ -0,0 +1,405 @@
+#include "shard.h"
+
+#include <algorithm>
+#include <cassert>
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+
+#undef min
+#undef max
+#include <tsl/robin_map.h>
+
+#include <qhenkiX/helper/mapped_file.h>
+#include <qhenkiX/utility/shader_reflection.h>
+
+#include "compile_cache.h"
+#include "compile_stats.h"
+#include "permutation_archive.h"
+
+using namespace qhenki::sxc;
+
+namespace
+{
+	constexpr uint32_t MANIFEST_MAGIC = 0x4D435853; // "SXCM"
+	constexpr uint32_t MANIFEST_VERSION = 1;
+	constexpr std::string_view MANIFEST_EXTENSION = ".sxcm";
+
+	struct ManifestHeader
+	{
+		uint32_t magic;
+		uint32_t version;
+		uint32_t shard_index;
+		uint32_t shard_count;
+		uint32_t group_count;
+		uint32_t reserved;
+	};
+
+	void write_string(std::string* out, const std::string_view str)
+	{
+		const uint32_t length = static_cast<uint32_t>(str.size());
+		out->append(reinterpret_cast<const char*>(&length), sizeof(length));
+		out->append(str);
+	}
+
+	template <typename T>
+	void write_pod(std::string* out, const T& value)
+	{
+		out->append(reinterpret_cast<const char*>(&value), sizeof(T));
+	}
+
+	// Bounds checked reader over a mapped manifest
+	class Reader
+	{
+		const uint8_t* m_p;
+		const uint8_t* m_end;
+
+	public:
+		Reader(const void* data, const size_t size)
+			: m_p(static_cast<const uint8_t*>(data)), m_end(static_cast<const uint8_t*>(data) + size) {}
+
+		bool read(void* out, const size_t size)
+		{
+			if (static_cast<size_t>(m_end - m_p) < size)
+			{
+				return false;
+			}
+			memcpy(out, m_p, size);
+			m_p += size;
+			return true;
+		}
+
+		template <typename T>
+		bool read_pod(T* value)
+		{
+			return read(value, sizeof(T));
+		}
+
+		bool read_string(std::string* str)
+		{
+			uint32_t length;
+			if (!read_pod(&length) || static_cast<size_t>(m_end - m_p) < length)
+			{
+				return false;
+			}
+			str->assign(reinterpret_cast<const char*>(m_p), length);
+			m_p += length;
+			return true;
+		}
+	};
+
+	struct MergePermutation
+	{
+		uint64_t key;
+		uint32_t index;
+		const void* data;
+		size_t size;
+	};
+
+	struct MergeGroup
+	{
+		uint32_t permutation_count;
+		qhenki::util::Hash128 config_key;
+		std::vector<MergePermutation> permutations;
+	};
+
+	struct Shard
+	{
+		ManifestHeader header;
+		qhenki::util::MappedFile blobs;
+	};
+}
+
+bool ShardSpec::owns(const CompilerInput& input) const
+{
+	// Same identity as the compile stats: path, entry point, target and defines. Independent of config order
+	return CompileStats::make_key(input) % count == index;
+}
+
+bool qhenki::sxc::parse_shard_spec(const std::string_view text, ShardSpec* spec)
+{
+	assert(spec);
+	const auto slash = text.find('/');
+	if (slash == std::string_view::npos)
+	{
+		return false;
+	}
+	uint32_t index, count;
+	const auto index_end = text.data() + slash;
+	const auto count_end = text.data() + text.size();
+	if (std::from_chars(text.data(), index_end, index).ptr != index_end
+		|| std::from_chars(index_end + 1, count_end, count).ptr != count_end
+		|| count == 0 || index == 0 || index > count)
+	{
+		return false;
+	}
+	spec->index = index - 1;
+	spec->count = count;
+	return true;
+}
+
+bool ShardWriter::open(const fs::path& directory, const ShardSpec& spec)
+{
+	m_spec = spec;
+	char name[64];
+	snprintf(name, sizeof(name), "shard_%u_of_%u", spec.index + 1, spec.count);
+
+	std::error_code ec;
+	fs::create_directories(directory, ec);
+	m_manifest_path = directory / (std::string(name) + std::string(MANIFEST_EXTENSION));
+	m_blob_path = directory / (std::string(name) + ".sxcb");
+	m_blobs.open(m_blob_path, std::ios::binary | std::ios::trunc);
+	return m_blobs.is_open();
+}
+
+bool ShardWriter::add_group(const std::string_view output_name, const uint32_t permutation_count, const util::Hash128& config_key,
+	const std::span<const ShardEntry> entries)
+{
+	Group group
+	{
+		.name = std::string(output_name),
+		.permutation_count = permutation_count,
+		.config_key = config_key,
+		.records = {},
+	};
+	group.records.reserve(entries.size());
+
+	std::scoped_lock lock(m_mutex);
+	for (const auto& entry : entries)
+	{
+		if (entry.size > UINT32_MAX)
+		{
+			return false;
+		}
+		group.records.push_back(
+		{
+			.key = entry.key,
+			.offset = m_blob_size,
+			.size = static_cast<uint32_t>(entry.size),
+			.index = entry.index,
+		});
+		m_blobs.write(static_cast<const char*>(entry.data), static_cast<std::streamsize>(entry.size));
+		m_blob_size += entry.size;
+	}
+	m_groups.push_back(std::move(group));
+	return m_blobs.good();
+}
+
+bool ShardWriter::finalize()
+{
+	std::scoped_lock lock(m_mutex);
+	m_blobs.close();
+	if (m_blobs.fail())
+	{
+		return false;
+	}
+
+	// Sorted so manifests of identical builds are identical
+	std::ranges::sort(m_groups, [](const Group& a, const Group& b) { return a.name < b.name; });
+
+	std::string manifest;
+	write_pod(&manifest, ManifestHeader
+	{
+		.magic = MANIFEST_MAGIC,
+		.version = MANIFEST_VERSION,
+		.shard_index = m_spec.index,
+		.shard_count = m_spec.count,
+		.group_count = static_cast<uint32_t>(m_groups.size()),
+		.reserved = 0,
+	});
+	write_string(&manifest, m_blob_path.filename().string());
+	for (const auto& group : m_groups)
+	{
+		write_string(&manifest, group.name);
+		write_pod(&manifest, group.permutation_count);
+		write_pod(&manifest, group.config_key);
+		write_pod(&manifest, static_cast<uint32_t>(group.records.size()));
+		manifest.append(reinterpret_cast<const char*>(group.records.data()), group.records.size() * sizeof(Record));
+	}
+	return write_file_atomic(m_manifest_path, manifest.data(), manifest.size());
+}
+
+bool qhenki::sxc::merge_shards(const std::span<const fs::path> shard_paths, const fs::path& output_dir, const CompileCache* cache,
+	const bool compress)
+{
+	std::vector<fs::path> manifests;
+	for (const auto& path : shard_paths)
+	{
+		std::error_code ec;
+		if (fs::is_directory(path, ec))
+		{
+			for (const auto& entry : fs::directory_iterator(path, ec))
+			{
+				if (entry.path().extension() == MANIFEST_EXTENSION)
+				{
+					manifests.push_back(entry.path());
+				}
+			}
+		}
+		else
+		{
+			manifests.push_back(path);
+		}
+	}
+	if (manifests.empty())
+	{
+		fprintf(stderr, "No shard manifests found\n");
+		return false;
+	}
+
+	// Shards stay mapped until all outputs are written since permutations point into their blob files
+	std::vector<Shard> shards(manifests.size());
+	tsl::robin_map<std::string, MergeGroup> groups;
+	bool success = true;
+	for (size_t s = 0; s < manifests.size(); s++)
+	{
+		const auto manifest_path = manifests[s].string();
+		util::MappedFile manifest;
+		if (!manifest.open(manifest_path.c_str()))
+		{
+			fprintf(stderr, "Failed to open shard manifest: %s\n", manifest_path.c_str());
+			return false;
+		}
+
+		Reader reader(manifest.data(), manifest.size());
+		auto& header = shards[s].header;
+		std::string blob_name;
+		if (!reader.read_pod(&header) || header.magic != MANIFEST_MAGIC || header.version != MANIFEST_VERSION
+			|| !reader.read_string(&blob_name))
+		{
+			fprintf(stderr, "Invalid shard manifest: %s\n", manifest_path.c_str());
+			return false;
+		}
+		const auto blob_path = (manifests[s].parent_path() / blob_name).string();
+		if (!shards[s].blobs.open(blob_path.c_str()))
+		{
+			fprintf(stderr, "Failed to open shard blobs: %s\n", blob_path.c_str());
+			return false;
+		}
+		const auto blob_data = static_cast<const uint8_t*>(shards[s].blobs.data());
+		const auto blob_size = shards[s].blobs.size();
+
+		for (uint32_t g = 0; g < header.group_count; g++)
+		{
+			std::string name;
+			uint32_t permutation_count, record_count;
+			util::Hash128 config_key;
+			if (!reader.read_string(&name) || !reader.read_pod(&permutation_count) || !reader.read_pod(&config_key)
+				|| !reader.read_pod(&record_count))
+			{
+				fprintf(stderr, "Truncated shard manifest: %s\n", manifest_path.c_str());
+				return false;
+			}
+
+			auto [it, inserted] = groups.try_emplace(name, MergeGroup{ permutation_count, config_key, {} });
+			auto& group = it.value();
+			if (group.permutation_count != permutation_count || group.config_key != config_key)
+			{
+				fprintf(stderr, "Shards were built from different configs: %s\n", name.c_str());
+				success = false;
+			}
+
+			for (uint32_t r = 0; r < record_count; r++)
+			{
+				uint64_t key, offset;
+				uint32_t size, index;
+				if (!reader.read_pod(&key) || !reader.read_pod(&offset) || !reader.read_pod(&size) || !reader.read_pod(&index))
+				{
+					fprintf(stderr, "Truncated shard manifest: %s\n", manifest_path.c_str());
+					return false;
+				}
+				if (offset + size > blob_size)
+				{
+					fprintf(stderr, "Shard blob file is truncated: %s\n", blob_path.c_str());
+					return false;
+				}
+				group.permutations.push_back({ key, index, blob_data + offset, size });
+			}
+		}
+	}
+
+	// Every shard of the build must be present exactly once
+	const auto shard_count = shards.front().header.shard_count;
+	std::vector<uint8_t> present(shard_count, 0);
+	for (const auto& shard : shards)
+	{
+		if (shard.header.shard_count != shard_count || shard.header.shard_index >= shard_count || present[shard.header.shard_index]++)
+		{
+			fprintf(stderr, "Shard manifests do not belong to one build of %u shards\n", shard_count);
+			return false;
+		}
+	}
+	for (uint32_t i = 0; i < shard_count; i++)
+	{
+		if (!present[i])
+		{
+			fprintf(stderr, "Missing shard %u/%u\n", i + 1, shard_count);
+			return false;
+		}
+	}
+
+	std::error_code ec;
+	fs::create_directories(output_dir, ec);
+	for (auto it = groups.begin(); it != groups.end(); ++it)
+	{
+		const auto output_path = output_dir / it->first;
+		auto& group = it.value();
+		auto& permutations = group.permutations;
+		std::ranges::sort(permutations, [](const MergePermutation& a, const MergePermutation& b) { return a.index < b.index; });
+		const bool has_duplicates = std::ranges::adjacent_find(permutations,
+			[](const MergePermutation& a, const MergePermutation& b) { return a.index == b.index; }) != permutations.end();
+		if (permutations.size() != group.permutation_count || has_duplicates)
+		{
+			// A permutation failed to compile on one of the shards
+			fprintf(stderr, "Incomplete output %s: %zu of %u permutations\n", output_path.string().c_str(),
+				permutations.size(), group.permutation_count);
+			success = false;
+			continue;
+		}
+
+		bool written;
+		if (group.permutation_count == 1)
+		{
+			written = write_file_atomic(output_path, permutations.front().data, permutations.front().size);
+		}
+		else
+		{
+			PermutationArchiveWriter archive;
+			archive.reserve(permutations.size());
+			archive.set_compression(compress);
+			for (const auto& p : permutations)
+			{
+				archive.add(p.key, p.data, p.size);
+			}
+			std::vector<uint8_t> archive_data;
+			std::string error;
+			written = archive.finalize(&archive_data, &error)
+				&& write_file_atomic(output_path, archive_data.data(), archive_data.size());
+			if (!error.empty())
+			{
+				fprintf(stderr, "%s: %s\n", output_path.string().c_str(), error.c_str());
+			}
+		}
+
+		if (!written)
+		{
+			fprintf(stderr, "Failed to write merged output: %s\n", output_path.string().c_str());
+			success = false;
+			continue;
+		}
+
+		// Shards carry no reflection. A sidecar of an earlier unsharded build would describe an older shader,
+		// remove it so the runtime reflects the merged bytecode instead
+		auto reflection_path = output_path;
+		reflection_path += util::SHADER_REFLECTION_EXTENSION;
+		fs::remove(reflection_path, ec);
+
+		if (cache)
+		{
+			cache->store_output_record(output_path, group.config_key);
+		}
+	}
+
+	printf("========== Merged %zu shards into %zu outputs ==========\n", shards.size(), groups.size());
+	return success;
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <qhenkiX/RHI/shader_compiler.h>
+#include <qhenkiX/helper/hash_helper.h>
+
+namespace qhenki::sxc
+{
+	namespace fs = std::filesystem;
+
+	class CompileCache;
+
+	struct ShardSpec
+	{
+		uint32_t index = 0; // 0-based
+		uint32_t count = 1;
+
+		bool owns(const CompilerInput& input) const;
+	};
+
+	// Parses "i/N" with 1 <= i <= N, the convention used by CI systems
+	bool parse_shard_spec(std::string_view text, ShardSpec* spec);
+
+	struct ShardEntry
+	{
+		uint64_t key; // ShaderArchive::make_key of the permutation defines
+		uint32_t index; // Permutation index in its config line
+		const void* data;
+		size_t size;
+	};
+
+	/**
+	 * @brief Output of one shard: a blob file and a manifest describing which permutations of which output it holds.
+	 *
+	 * Groups are added from any thread as they finish. Blobs are appended to the blob file immediately,
+	 * the manifest is written by finalize. "SXC merge" combines the manifests of all shards into the final outputs.
+	 */
+	class ShardWriter
+	{
+		struct Record
+		{
+			uint64_t key;
+			uint64_t offset; // In the blob file
+			uint32_t size;
+			uint32_t index;
+		};
+		static_assert(sizeof(Record) == 24);
+
+		struct Group
+		{
+			std::string name; // Output file name
+			uint32_t permutation_count; // Over all shards
+			util::Hash128 config_key;
+			std::vector<Record> records;
+		};
+
+		std::mutex m_mutex;
+		std::ofstream m_blobs;
+		uint64_t m_blob_size = 0;
+		std::vector<Group> m_groups;
+		fs::path m_manifest_path;
+		fs::path m_blob_path;
+		ShardSpec m_spec;
+
+	public:
+		bool open(const fs::path& directory, const ShardSpec& spec);
+
+		/**
+		 * @brief Appends the permutations of one output that belong to this shard.
+		 * @param output_name File name of the final output.
+		 * @param permutation_count Number of permutations of the output over all shards.
+		 * @param config_key Config key of the output, must match across shards.
+		 * @param entries Successfully compiled permutations of this shard.
+		 */
+		bool add_group(std::string_view output_name, uint32_t permutation_count, const util::Hash128& config_key,
+			std::span<const ShardEntry> entries);
+
+		bool finalize();
+	};
+
+	/**
+	 * @brief Combines the shard outputs of one build into the final output directory.
+	 * @param shard_paths Shard output directories or manifest files. All shards of the build must be present.
+	 * @param output_dir Directory the outputs are written to.
+	 * @param cache Optional, records the config key of every output so later unsharded builds see them as up-to-date.
+	 * @param compress LZ4 compress the merged permutation archives, see PermutationArchiveWriter::set_compression.
+	 * @return Whether every output was complete and written.
+	 */
+	bool merge_shards(std::span<const fs::path> shard_paths, const fs::path& output_dir, const CompileCache* cache, bool compress);
+}
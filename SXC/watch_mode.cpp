@@ -0,0 +1,143 @@
+#include "watch_mode.h"
+
+#include <cassert>
+#include <chrono>
+#include <cstdio>
+
+#undef min
+#undef max
+#include <tsl/robin_map.h>
+#include <tsl/robin_set.h>
+
+#include "compiler_pool.h"
+#include "dependency_graph.h"
+#include "file_watcher.h"
+
+using namespace qhenki::sxc;
+
+namespace
+{
+	// Long enough to merge the separate writes of one save, short enough to feel immediate
+	constexpr std::chrono::milliseconds SETTLE_TIME{ 30 };
+
+	void watch_reachable(FileWatcher* watcher, DependencyGraph* dependencies,
+		const tbb::concurrent_vector<CompilerInputVector>& inputs)
+	{
+		tsl::robin_set<std::string> sources;
+		std::vector<std::string> files;
+		for (const auto& civ : inputs)
+		{
+			if (civ.empty() || !sources.insert(std::string(civ.front().get_path())).second)
+			{
+				continue;
+			}
+			dependencies->collect_dependencies(civ.front().get_path(), &files);
+			for (const auto& file : files)
+			{
+				watcher->add_directory(fs::path(file).parent_path());
+			}
+		}
+	}
+}
+
+int qhenki::sxc::run_watch_mode(const CLIInput& input, const JobSettings& settings,
+	tbb::concurrent_vector<CompilerInputVector>* inputs, const std::function<void()>& on_build_finished)
+{
+	assert(settings.dependencies);
+	const auto dependencies = settings.dependencies;
+
+	const auto config_path = fs::absolute(input.config_path);
+	const auto config_key = DependencyGraph::normalize(config_path);
+
+	FileWatcher watcher;
+	if (!watcher.add_directory(config_path.parent_path()))
+	{
+		return 1;
+	}
+	watch_reachable(&watcher, dependencies, *inputs);
+	printf("========== Watching for changes, press Ctrl+C to stop ==========\n");
+
+	std::vector<std::string> changed;
+	std::vector<std::string> files;
+	while (watcher.wait(SETTLE_TIME, &changed))
+	{
+		const auto start = std::chrono::steady_clock::now();
+		const tsl::robin_set<std::string> changed_set(changed.begin(), changed.end());
+
+		const bool config_changed = changed_set.contains(config_key);
+		if (config_changed)
+		{
+			tbb::concurrent_vector<CompilerInputVector> new_inputs;
+			if (SXCJob::parse_config(input, &new_inputs) < 0)
+			{
+				fprintf(stderr, "Failed to parse config file, keeping the previous one: %s\n", input.config_path.c_str());
+				continue;
+			}
+			inputs->swap(new_inputs);
+		}
+
+		// Stat every known file again, unchanged ones are not rescanned
+		dependencies->invalidate();
+		if (settings.compilers)
+		{
+			settings.compilers->invalidate_includes();
+		}
+
+		tbb::concurrent_vector<CompilerInputVector> affected;
+		if (!config_changed)
+		{
+			tsl::robin_map<std::string, bool> source_affected;
+			for (const auto& civ : *inputs)
+			{
+				if (civ.empty())
+				{
+					continue;
+				}
+				const std::string source(civ.front().get_path());
+				auto it = source_affected.find(source);
+				if (it == source_affected.end())
+				{
+					dependencies->collect_dependencies(source, &files);
+					bool any = false;
+					for (const auto& file : files)
+					{
+						if (changed_set.contains(file))
+						{
+							any = true;
+							break;
+						}
+					}
+					it = source_affected.insert({ source, any }).first;
+				}
+				if (it->second)
+				{
+					// CompilerInput is copy constructible but not assignable
+					CompilerInputVector copy;
+					copy.storage = civ.storage;
+					copy.reserve(civ.size());
+					for (const auto& ci : civ)
+					{
+						copy.push_back(ci);
+					}
+					affected.emplace_back(std::move(copy));
+				}
+			}
+			if (affected.empty())
+			{
+				continue; // Unrelated file in a watched directory
+			}
+		}
+
+		const auto result_count = execute_compilation_job(config_changed ? inputs : &affected, settings);
+		on_build_finished();
+
+		const auto ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		printf("========== Rebuild: %llu succeeded, %llu failed, %llu up-to-date in %.1f ms ==========\n",
+			static_cast<unsigned long long>(result_count.succeeded_count), static_cast<unsigned long long>(result_count.failed_count),
+			static_cast<unsigned long long>(result_count.skipped_count), ms);
+
+		// New includes may live in directories that are not watched yet
+		watch_reachable(&watcher, dependencies, *inputs);
+	}
+	return 0;
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <functional>
+
+#include "compiler_job.h"
+
+namespace qhenki::sxc
+{
+	/**
+	 * @brief Watches the config and every reachable source file and rebuilds affected outputs on change.
+	 *
+	 * Compilers, the include graph and the parsed config stay in memory between rebuilds. Only config lines
+	 * whose transitive inputs changed are checked again, all lines if the config itself changed.
+	 * @param input Same settings as the initial build.
+	 * @param settings Job settings of the initial build. Compilers should be set so they stay warm.
+	 * @param inputs Parsed config, replaced when the config changes.
+	 * @param on_build_finished Called after every rebuild, e.g. to persist the include graph.
+	 * @return Exit code once watching fails.
+	 */
+	int run_watch_mode(const CLIInput& input, const JobSettings& settings,
+		tbb::concurrent_vector<CompilerInputVector>* inputs, const std::function<void()>& on_build_finished);
+}